@@ -188,28 +188,6 @@ int main(int argc, char** argv) {
     SetConsoleCtrlHandler(static_cast<PHANDLER_ROUTINE>(console_ctrl_handler), true);
 #endif
     // prompt user immediately after the starting prompt has been loaded
-    auto fix_word = [](std::string& word) {
-        auto ret = word;
-        if (word == "<n>" || word == "<n><n>")
-            word = "\n";
-        if (word == "<|tab|>")
-            word = "\t";
-        int pos = word.find("<|blank_");
-        if (pos != -1) {
-            int space_num = atoi(word.substr(8, word.size() - 10).c_str());
-            word = std::string(space_num, ' ');
-        }
-        pos = word.find("▁");
-        if (pos != -1) {
-            word.replace(pos, pos + 3, " ");
-        }
-        // Fix utf-8 garbled characters
-        if (word.length() == 6 && word[0] == '<' && word[word.length() - 1] == '>' &&
-            word[1] == '0' && word[2] == 'x') {
-            int num = std::stoi(word.substr(3, 2), nullptr, 16);
-            word = static_cast<char>(num);
-        }
-    };
     bool is_interacting = true;
     std::string user_input, output;
     
@@ -219,16 +197,14 @@ int main(int argc, char** argv) {
     while (model->get_remain_token() > 0) {
         if (!user_input.empty()) {
             int token;
-            output = model->decode(user_input, token);
-            fix_word(output);
+            output = inferllm::token_to_text(model->decode(user_input, token));
             user_input.clear();
             is_interacting = false;
         }
         //! continue to decod to get the next token
         if (!is_interacting) {
             int token;
-            auto o = model->decode_iter(token);
-            fix_word(o);
+            auto o = inferllm::token_to_text(model->decode_iter(token));
             output += o;
             token_id++;
             printf("%s", output.c_str());
@@ -38,6 +38,8 @@ struct app_params {
     std::string device = "CPU";      // configure the compute device type
     std::string mtype = "llama";    // the model type name, llama
     int32_t version = 1;            // the model version
+    bool kv_head_major = false;     // store the kv cache head by head
+    int32_t numa = 1;               // the numa nodes the threads are split to
 };
 
 void app_print_usage(int argc, char** argv, const app_params& params) {
@@ -82,6 +84,13 @@ void app_print_usage(int argc, char** argv, const app_params& params) {
             "  -g type               configure the compute device type, default CPU, "
             "can be CPU and GPU now.\n");
     fprintf(stderr, "  --version N           the llama model version, default 1.\n");
+    fprintf(stderr,
+            "  --kv_head_major       store the kv cache head by head, faster attention "
+            "of long context\n");
+    fprintf(stderr,
+            "  --numa N              split the threads and the weights to N numa "
+            "nodes (default: %d)\n",
+            params.numa);
     fprintf(stderr, "\n");
 }
 
@@ -116,6 +125,10 @@ bool app_params_parse(int argc, char** argv, app_params& params) {
             params.version = std::stoi(argv[++i]);
         }else if (arg == "--mmap") {
             params.use_mmap = true;
+        } else if (arg == "--kv_head_major") {
+            params.kv_head_major = true;
+        } else if (arg == "--numa") {
+            params.numa = std::stoi(argv[++i]);
         } else if (arg == "-h" || arg == "--help") {
             app_print_usage(argc, argv, params);
             exit(0);
@@ -160,6 +173,8 @@ int main(int argc, char** argv) {
     config.nr_thread = params.n_threads;
     config.enable_mmap = params.use_mmap;
     config.nr_ctx = params.n_ctx;
+    config.kv_head_major = params.kv_head_major;
+    config.nr_numa_node = params.numa;
 
     if(params.version == 1){
         params.mtype = "llama";
@@ -0,0 +1,631 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define SERVER_SUPPORTED 1
+#endif
+
+#include "model.h"
+#include "server.h"
+
+//! a local HTTP server with the OpenAI compatible completions and chat
+//! completions endpoints, the requests are queued to the engine thread of the
+//! model and the answers are returned at once or streamed by SSE
+
+struct server_params {
+    int32_t seed = -1;  // RNG seed
+    int32_t n_threads = std::min(4, (int32_t)std::thread::hardware_concurrency());
+    int32_t n_predict = 128;     // default new tokens to predict
+    int32_t repeat_last_n = 64;  // last n tokens to penalize
+    int32_t n_ctx = 2048;        // context size
+
+    // sampling parameters
+    int32_t top_k = 40;
+    float top_p = 0.95f;
+    float temp = 0.10f;
+    float repeat_penalty = 1.10f;
+
+    std::string model;  // model path
+
+    bool use_mmap = false;          // use mmap to load model
+    std::string dtype = "float32";  // configure the compute dtype
+    std::string device = "CPU";     // configure the compute device type
+    std::string mtype = "llama";    // the model type name, llama
+
+    std::string host = "127.0.0.1";  // the address to listen
+    int32_t port = 8080;             // the port to listen
+    int32_t max_queue = 16;          // the max number of requests in flight
+    int32_t max_conn = 64;           // the max number of connections served
+    int32_t prefill_chunk = 128;     // the tokens of a prompt chunk per step
+    bool kv_head_major = false;      // store the kv cache head by head
+    int32_t numa = 1;                // the numa nodes the threads are split to
+    int32_t pipeline_stages = 1;     // the processes the layers are split to
+    int32_t pipeline_stage = 0;      // the stage of this process
+    std::string pipeline_recv;       // the address this stage receives from
+    std::string pipeline_send;       // the address of the next stage
+    int32_t micro_batch = 1;         // the micro batches of the pipeline
+    std::string weight_segment;      // the shared memory of the weights
+    int32_t workers = 1;             // the processes forked to serve
+};
+
+void server_print_usage(int argc, char** argv, const server_params& params) {
+    // clang-format off
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h, --help            show this help message and exit\n");
+    fprintf(stderr, "  -s SEED, --seed SEED  RNG seed (default: -1)\n");
+    fprintf(stderr, "  -t N, --threads N     number of threads to use during computation (default: %d)\n", params.n_threads);
+    fprintf(stderr, "  -n N, --n_predict N   default number of tokens to predict (default: %d)\n", params.n_predict);
+    fprintf(stderr, "  --top_k N             top-k sampling (default: %d)\n", params.top_k);
+    fprintf(stderr, "  --top_p N             top-p sampling (default: %.1f)\n", params.top_p);
+    fprintf(stderr, "  --repeat_last_n N     last n tokens to consider for penalize (default: %d)\n", params.repeat_last_n);
+    fprintf(stderr, "  --repeat_penalty N    penalize repeat sequence of tokens (default: %.1f)\n", params.repeat_penalty);
+    fprintf(stderr, "  -c N, --ctx_size N    size of the prompt context (default: %d)\n", params.n_ctx);
+    fprintf(stderr, "  --temp N              temperature (default: %.1f)\n", params.temp);
+    fprintf(stderr, "  -m FNAME, --model FNAME\n");
+    fprintf(stderr, "                        model path (default: %s)\n", params.model.c_str());
+    fprintf(stderr, "  --mmap                enable mmap when read weights, default = false\n");
+    fprintf(stderr, "  -d type               configure the compute type, default float32, can be float32 and flot16 now.\n");
+    fprintf(stderr, "  -g type               configure the compute device type, default CPU, can be CPU and GPU now.\n");
+    fprintf(stderr, "  --type type           the model type name, default llama.\n");
+    fprintf(stderr, "  --host ADDR           the address to listen (default: %s)\n", params.host.c_str());
+    fprintf(stderr, "  --port N              the port to listen (default: %d)\n", params.port);
+    fprintf(stderr, "  --max_queue N         the max number of requests in flight (default: %d)\n", params.max_queue);
+    fprintf(stderr, "  --max_conn N          the max number of connections served, the others wait to be accepted (default: %d)\n", params.max_conn);
+    fprintf(stderr, "  --prefill_chunk N     the prompt tokens prefilled per step, 0 is the whole prompt (default: %d)\n", params.prefill_chunk);
+    fprintf(stderr, "  --kv_head_major       store the kv cache head by head, faster attention of long context\n");
+    fprintf(stderr, "  --numa N              split the threads and the weights to N numa nodes (default: %d)\n", params.numa);
+    fprintf(stderr, "  --pipeline N K        split the layers to N processes, this one is stage K, the others than 0 only compute\n");
+    fprintf(stderr, "  --pipeline_recv ADDR  the address the stage receives from, shm:NAME or tcp:HOST:PORT\n");
+    fprintf(stderr, "  --pipeline_send ADDR  the address of the next stage, the next one of the last stage is stage 0\n");
+    fprintf(stderr, "  --micro_batch N       the micro batches the stages of the pipeline compute at the same time (default: %d)\n", params.micro_batch);
+    fprintf(stderr, "  --weight_segment NAME share the prepared weights with the servers of the same NAME on the host\n");
+    fprintf(stderr, "  --workers N           fork N processes sharing the loaded model to serve the port (default: %d)\n", params.workers);
+    fprintf(stderr, "\n");
+    // clang-format on
+}
+
+bool server_params_parse(int argc, char** argv, server_params& params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-s" || arg == "--seed") {
+            params.seed = std::stoi(argv[++i]);
+        } else if (arg == "-t" || arg == "--threads") {
+            params.n_threads = std::stoi(argv[++i]);
+        } else if (arg == "-n" || arg == "--n_predict") {
+            params.n_predict = std::stoi(argv[++i]);
+        } else if (arg == "--top_k") {
+            params.top_k = std::stoi(argv[++i]);
+        } else if (arg == "-c" || arg == "--ctx_size") {
+            params.n_ctx = std::stoi(argv[++i]);
+        } else if (arg == "-d" || arg == "--dtype") {
+            params.dtype = argv[++i];
+        } else if (arg == "-g") {
+            params.device = argv[++i];
+        } else if (arg == "--top_p") {
+            params.top_p = std::stof(argv[++i]);
+        } else if (arg == "--temp") {
+            params.temp = std::stof(argv[++i]);
+        } else if (arg == "--repeat_last_n") {
+            params.repeat_last_n = std::stoi(argv[++i]);
+        } else if (arg == "--repeat_penalty") {
+            params.repeat_penalty = std::stof(argv[++i]);
+        } else if (arg == "-m" || arg == "--model") {
+            params.model = argv[++i];
+        } else if (arg == "--type") {
+            params.mtype = argv[++i];
+        } else if (arg == "--mmap") {
+            params.use_mmap = true;
+        } else if (arg == "--host") {
+            params.host = argv[++i];
+        } else if (arg == "--port") {
+            params.port = std::stoi(argv[++i]);
+        } else if (arg == "--max_queue") {
+            params.max_queue = std::stoi(argv[++i]);
+        } else if (arg == "--max_conn") {
+            params.max_conn = std::stoi(argv[++i]);
+        } else if (arg == "--prefill_chunk") {
+            params.prefill_chunk = std::stoi(argv[++i]);
+        } else if (arg == "--kv_head_major") {
+            params.kv_head_major = true;
+        } else if (arg == "--numa") {
+            params.numa = std::stoi(argv[++i]);
+        } else if (arg == "--pipeline") {
+            params.pipeline_stages = std::stoi(argv[++i]);
+            params.pipeline_stage = std::stoi(argv[++i]);
+        } else if (arg == "--pipeline_recv") {
+            params.pipeline_recv = argv[++i];
+        } else if (arg == "--pipeline_send") {
+            params.pipeline_send = argv[++i];
+        } else if (arg == "--micro_batch") {
+            params.micro_batch = std::stoi(argv[++i]);
+        } else if (arg == "--weight_segment") {
+            params.weight_segment = argv[++i];
+        } else if (arg == "--workers") {
+            params.workers = std::stoi(argv[++i]);
+        } else if (arg == "-h" || arg == "--help") {
+            server_print_usage(argc, argv, params);
+            exit(0);
+        } else {
+            fprintf(stderr, "unknown argument: %s\n", arg.c_str());
+            server_print_usage(argc, argv, params);
+            exit(1);
+        }
+    }
+    return true;
+}
+
+using Clock = std::chrono::steady_clock;
+
+//! the state of one generation request, written by the engine thread and read
+//! by the connection thread
+struct Generation {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::string> pieces;
+    bool finished = false;
+    //! the reason why the request is rejected by the model
+    std::string error;
+    int32_t nr_token = 0;
+    Clock::time_point submit_time;
+    Clock::time_point first_time;
+    Clock::time_point end_time;
+
+    //! time to first token in ms
+    double ttft() const {
+        return std::chrono::duration<double, std::milli>(first_time - submit_time)
+                .count();
+    }
+
+    //! the speed of decoding after the first token
+    double token_per_second() const {
+        double seconds = std::chrono::duration<double>(end_time - first_time).count();
+        return nr_token > 1 && seconds > 0 ? (nr_token - 1) / seconds : 0;
+    }
+};
+
+#if SERVER_SUPPORTED
+
+class Server {
+public:
+    Server(std::shared_ptr<inferllm::Model> model, const server_params& params)
+            : m_model(model), m_params(params) {}
+
+    int run();
+
+private:
+    bool read_request(int fd, HttpRequest& request);
+    bool send_all(int fd, const std::string& data);
+    void send_response(int fd, int status, const std::string& body);
+    void handle(int fd);
+    void handle_generate(int fd, const JsonValue& body, bool chat);
+    std::string build_chat_prompt(const JsonValue& messages);
+
+    std::shared_ptr<inferllm::Model> m_model;
+    server_params m_params;
+    std::atomic<int32_t> m_in_flight{0};
+    //! the connections being served, a connection thread exits when it closes
+    std::mutex m_connection_mutex;
+    std::condition_variable m_connection_cv;
+    int32_t m_nr_connection = 0;
+    std::atomic<uint64_t> m_nr_request{0};
+};
+
+int Server::run() {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_params.port);
+    if (inet_pton(AF_INET, m_params.host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid host address: %s\n", m_params.host.c_str());
+        return 1;
+    }
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        perror("bind");
+        return 1;
+    }
+    fprintf(stderr, "server listening on http://%s:%d\n", m_params.host.c_str(),
+            m_params.port);
+    //! the workers share the prepared model and accept on the socket, this
+    //! process forks a new one when a worker exits, but once a second at most,
+    //! so the workers which exit at start don't make it fork in a loop
+    auto last_fork = std::chrono::steady_clock::now();
+    for (int32_t nr_worker = 0, nr_fork = 0; m_params.workers > 1;) {
+        if (nr_worker < m_params.workers) {
+            if (nr_fork >= m_params.workers) {
+                std::this_thread::sleep_until(last_fork + std::chrono::seconds(1));
+            }
+            last_fork = std::chrono::steady_clock::now();
+            int32_t pid = m_model->fork_worker();
+            if (pid == 0) {
+                break;
+            } else if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+            nr_worker++;
+            nr_fork++;
+        } else if (wait(nullptr) > 0) {
+            nr_worker--;
+        } else if (errno == ECHILD) {
+            //! the workers are reaped by others, such as SIGCHLD is ignored
+            nr_worker = 0;
+        } else if (errno != EINTR) {
+            perror("wait");
+            return 1;
+        }
+    }
+    while (true) {
+        //! the connections over the limit wait in the listen backlog
+        {
+            std::unique_lock<std::mutex> lock(m_connection_mutex);
+            m_connection_cv.wait(
+                    lock, [this]() { return m_nr_connection < m_params.max_conn; });
+        }
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            //! out of the file descriptors or the memory, wait for the served
+            //! connections to close them instead of failing in a busy loop
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+                errno == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+        //! the client which doesn't send the whole request in time is dropped
+        timeval timeout = {30, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        {
+            std::lock_guard<std::mutex> lock(m_connection_mutex);
+            m_nr_connection++;
+        }
+        //! every connection has its own thread, the generation is serialized by
+        //! the engine thread of the model
+        std::thread([this, fd]() {
+            handle(fd);
+            close(fd);
+            std::lock_guard<std::mutex> lock(m_connection_mutex);
+            m_nr_connection--;
+            m_connection_cv.notify_one();
+        }).detach();
+    }
+    return 0;
+}
+
+bool Server::read_request(int fd, HttpRequest& request) {
+    constexpr size_t MAX_REQUEST = 1 << 20;
+    std::string data;
+    char buf[4096];
+    size_t header_end = std::string::npos;
+    while (header_end == std::string::npos) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0 || data.size() > MAX_REQUEST) {
+            return false;
+        }
+        data.append(buf, n);
+        header_end = data.find("\r\n\r\n");
+    }
+    size_t content_length = 0;
+    std::string error;
+    if (!parse_http_head(data.substr(0, header_end), request, content_length, error)) {
+        send_response(fd, 400, "{\"error\":{\"message\":" + json_escape(error) + "}}");
+        return false;
+    }
+    if (content_length > MAX_REQUEST) {
+        return false;
+    }
+    request.body = data.substr(header_end + 4);
+    while (request.body.size() < content_length) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return false;
+        }
+        request.body.append(buf, n);
+    }
+    request.body.resize(content_length);
+    return true;
+}
+
+bool Server::send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+void Server::send_response(int fd, int status, const std::string& body) {
+    const char* reason = status == 200   ? "OK"
+                         : status == 400 ? "Bad Request"
+                         : status == 404 ? "Not Found"
+                         : status == 503 ? "Service Unavailable"
+                                         : "Error";
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + reason +
+                           "\r\nContent-Type: application/json\r\nContent-Length: " +
+                           std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body;
+    send_all(fd, response);
+}
+
+void Server::handle(int fd) {
+    HttpRequest request;
+    if (!read_request(fd, request)) {
+        return;
+    }
+    if (request.method == "GET" && request.path == "/health") {
+        send_response(fd, 200, "{\"status\":\"ok\"}");
+        return;
+    }
+    if (request.method == "GET" && request.path == "/v1/models") {
+        send_response(
+                fd, 200,
+                "{\"object\":\"list\",\"data\":[{\"id\":" + json_escape(m_params.mtype) +
+                        ",\"object\":\"model\",\"owned_by\":\"inferllm\"}]}");
+        return;
+    }
+    bool completion = request.path == "/v1/completions";
+    bool chat = request.path == "/v1/chat/completions";
+    if (request.method != "POST" || (!completion && !chat)) {
+        send_response(fd, 404, "{\"error\":{\"message\":\"not found\"}}");
+        return;
+    }
+    JsonValue body;
+    if (!JsonParser(request.body).parse(body) ||
+        body.type != JsonValue::Type::Object) {
+        send_response(fd, 400, "{\"error\":{\"message\":\"invalid json body\"}}");
+        return;
+    }
+    handle_generate(fd, body, chat);
+}
+
+std::string Server::build_chat_prompt(const JsonValue& messages) {
+    std::string user = "User: ", assistant = "Assistant: ";
+    if (m_params.mtype == "baichuan") {
+        user = "USER:";
+        assistant = "ASSISTANT:";
+    }
+    std::string prompt;
+    for (auto& message : messages.array) {
+        auto role = message.get("role");
+        auto content = message.get("content");
+        if (!role || !content) {
+            continue;
+        }
+        if (role->str == "assistant") {
+            prompt += assistant + content->str + "\n";
+        } else if (role->str == "system") {
+            prompt += content->str + "\n";
+        } else {
+            prompt += user + content->str + "\n";
+        }
+    }
+    return prompt + assistant;
+}
+
+void Server::handle_generate(int fd, const JsonValue& body, bool chat) {
+    std::string prompt;
+    if (chat) {
+        auto messages = body.get("messages");
+        if (messages && messages->type == JsonValue::Type::Array) {
+            prompt = build_chat_prompt(*messages);
+        }
+    } else if (auto p = body.get("prompt")) {
+        prompt = p->str;
+    }
+    if (prompt.empty()) {
+        send_response(fd, 400, "{\"error\":{\"message\":\"empty prompt\"}}");
+        return;
+    }
+    int32_t max_token = m_params.n_predict;
+    if (auto n = body.get("max_tokens")) {
+        //! checked as the double, the cast of a huge one is undefined
+        if (n->type != JsonValue::Type::Number || !(n->number >= 1) ||
+            n->number > m_params.n_ctx) {
+            send_response(
+                    fd, 400,
+                    "{\"error\":{\"message\":\"max_tokens should be in [1, " +
+                            std::to_string(m_params.n_ctx) + "]\"}}");
+            return;
+        }
+        max_token = static_cast<int32_t>(n->number);
+    }
+    auto stream_value = body.get("stream");
+    bool stream = stream_value && stream_value->boolean;
+
+    if (m_in_flight.fetch_add(1) >= m_params.max_queue) {
+        m_in_flight--;
+        send_response(fd, 503, "{\"error\":{\"message\":\"too many requests\"}}");
+        return;
+    }
+    uint64_t index = m_nr_request++;
+    std::string id = (chat ? "chatcmpl-" : "cmpl-") + std::to_string(index);
+    std::string object = chat ? "chat.completion" : "text_completion";
+
+    auto generation = std::make_shared<Generation>();
+    generation->submit_time = Clock::now();
+    uint64_t request_id = m_model->submit(
+            prompt, max_token,
+            [generation](int32_t token, const std::string& text, bool finished) {
+                std::unique_lock<std::mutex> lock(generation->mutex);
+                auto now = Clock::now();
+                if (finished) {
+                    generation->finished = true;
+                    generation->end_time = now;
+                    if (token == inferllm::REJECTED_TOKEN) {
+                        generation->error = text;
+                    }
+                } else {
+                    if (generation->nr_token++ == 0) {
+                        generation->first_time = now;
+                    }
+                    generation->pieces.push_back(inferllm::token_to_text(text));
+                }
+                generation->cv.notify_one();
+            });
+
+    auto choice = [&](const std::string& text, bool delta) {
+        if (!chat) {
+            return "{\"index\":0,\"text\":" + json_escape(text);
+        }
+        return std::string("{\"index\":0,") + (delta ? "\"delta\"" : "\"message\"") +
+               ":{\"role\":\"assistant\",\"content\":" + json_escape(text) + "}";
+    };
+    auto head = "{\"id\":\"" + id + "\",\"object\":\"" + object +
+                (stream ? ".chunk" : "") + "\",\"model\":" +
+                json_escape(m_params.mtype) + ",";
+
+    bool connected = true;
+    bool started = false;
+    std::string answer;
+    while (true) {
+        std::deque<std::string> pieces;
+        bool finished;
+        std::string error;
+        {
+            std::unique_lock<std::mutex> lock(generation->mutex);
+            generation->cv.wait(lock, [&]() {
+                return generation->finished || !generation->pieces.empty();
+            });
+            pieces.swap(generation->pieces);
+            finished = generation->finished;
+            error = generation->error;
+        }
+        //! the status is sent after the model accepts the request
+        if (!error.empty()) {
+            m_in_flight--;
+            send_response(
+                    fd, 400, "{\"error\":{\"message\":" + json_escape(error) + "}}");
+            return;
+        }
+        if (!started && stream) {
+            connected = send_all(
+                    fd,
+                    "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                    "Cache-Control: no-cache\r\nConnection: close\r\n\r\n");
+        }
+        started = true;
+        for (auto& piece : pieces) {
+            answer += piece;
+            if (stream && connected) {
+                connected = send_all(
+                        fd, sse_event(
+                                    head + "\"choices\":[" + choice(piece, true) +
+                                    ",\"finish_reason\":null}]}"));
+                //! the client is gone, stop the generation
+                if (!connected) {
+                    m_model->cancel(request_id);
+                }
+            }
+        }
+        if (finished) {
+            break;
+        }
+    }
+    m_in_flight--;
+
+    int32_t nr_token = generation->nr_token;
+    std::string finish_reason = nr_token >= max_token ? "length" : "stop";
+    char timing[256];
+    snprintf(
+            timing, sizeof(timing),
+            "\"usage\":{\"completion_tokens\":%d},"
+            "\"timings\":{\"ttft_ms\":%.3f,\"tokens_per_second\":%.3f}",
+            nr_token, generation->ttft(), generation->token_per_second());
+    fprintf(stderr, "%s: %d tokens, ttft %.3f ms, %.3f tokens/s\n", id.c_str(),
+            nr_token, generation->ttft(), generation->token_per_second());
+    if (stream) {
+        if (connected) {
+            send_all(
+                    fd, sse_event(
+                                head + "\"choices\":[" + choice("", true) +
+                                ",\"finish_reason\":\"" + finish_reason + "\"}]," +
+                                timing + "}") +
+                                sse_event("[DONE]"));
+        }
+        return;
+    }
+    send_response(
+            fd, 200,
+            head + "\"choices\":[" + choice(answer, false) + ",\"finish_reason\":\"" +
+                    finish_reason + "\"}]," + timing + "}");
+}
+
+#endif
+
+int main(int argc, char** argv) {
+#if SERVER_SUPPORTED
+    server_params params;
+    if (server_params_parse(argc, argv, params) == false) {
+        return 1;
+    }
+    if (params.seed < 0) {
+        params.seed = time(NULL);
+    }
+    fprintf(stderr, "%s: seed = %d\n", __func__, params.seed);
+
+    inferllm::ModelConfig config;
+    config.compt_type = params.dtype;
+    config.device_type = params.device;
+    config.nr_thread = params.n_threads;
+    config.enable_mmap = params.use_mmap;
+    config.nr_ctx = params.n_ctx;
+    config.prefill_chunk = params.prefill_chunk;
+    config.kv_head_major = params.kv_head_major;
+    config.nr_numa_node = params.numa;
+    config.nr_pipeline_stage = params.pipeline_stages;
+    config.pipeline_stage = params.pipeline_stage;
+    config.pipeline_recv = params.pipeline_recv;
+    config.pipeline_send = params.pipeline_send;
+    config.pipeline_micro_batch = params.micro_batch;
+    config.weight_segment = params.weight_segment;
+
+    std::shared_ptr<inferllm::Model> model =
+            std::make_shared<inferllm::Model>(config, params.mtype);
+    model->load(params.model);
+    //! the later stages compute the layers of the requests of stage 0
+    if (params.pipeline_stage > 0) {
+        model->serve_pipeline();
+        return 0;
+    }
+    model->init(
+            params.top_k, params.top_p, params.temp, params.repeat_penalty,
+            params.repeat_last_n, params.seed, 2);
+
+    Server server(model, params);
+    return server.run();
+#else
+    fprintf(stderr, "the server is only supported on unix like system now.\n");
+    return 1;
+#endif
+}
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+//! the parsing and the framing of the HTTP server, they don't touch the socket
+
+//! a minimal JSON value, only used to read the request body
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0;
+    std::string str;
+    std::vector<JsonValue> array;
+    std::map<std::string, JsonValue> object;
+
+    const JsonValue* get(const std::string& key) const {
+        auto it = object.find(key);
+        return it == object.end() ? nullptr : &it->second;
+    }
+};
+
+class JsonParser {
+public:
+    JsonParser(const std::string& text) : m_text(text) {}
+
+    bool parse(JsonValue& value) {
+        if (!parse_value(value)) {
+            return false;
+        }
+        skip_space();
+        return m_pos == m_text.size();
+    }
+
+private:
+    void skip_space() {
+        while (m_pos < m_text.size() && isspace((unsigned char)m_text[m_pos])) {
+            m_pos++;
+        }
+    }
+
+    bool consume(const char* literal) {
+        size_t len = strlen(literal);
+        if (m_text.compare(m_pos, len, literal) != 0) {
+            return false;
+        }
+        m_pos += len;
+        return true;
+    }
+
+    bool parse_value(JsonValue& value) {
+        skip_space();
+        if (m_pos >= m_text.size()) {
+            return false;
+        }
+        char c = m_text[m_pos];
+        if (c == '{') {
+            value.type = JsonValue::Type::Object;
+            m_pos++;
+            skip_space();
+            if (m_pos < m_text.size() && m_text[m_pos] == '}') {
+                m_pos++;
+                return true;
+            }
+            while (true) {
+                skip_space();
+                std::string key;
+                if (!parse_string(key)) {
+                    return false;
+                }
+                skip_space();
+                if (!consume(":") || !parse_value(value.object[key])) {
+                    return false;
+                }
+                skip_space();
+                if (consume("}")) {
+                    return true;
+                }
+                if (!consume(",")) {
+                    return false;
+                }
+            }
+        } else if (c == '[') {
+            value.type = JsonValue::Type::Array;
+            m_pos++;
+            skip_space();
+            if (consume("]")) {
+                return true;
+            }
+            while (true) {
+                value.array.emplace_back();
+                if (!parse_value(value.array.back())) {
+                    return false;
+                }
+                skip_space();
+                if (consume("]")) {
+                    return true;
+                }
+                if (!consume(",")) {
+                    return false;
+                }
+            }
+        } else if (c == '"') {
+            value.type = JsonValue::Type::String;
+            return parse_string(value.str);
+        } else if (consume("true")) {
+            value.type = JsonValue::Type::Bool;
+            value.boolean = true;
+            return true;
+        } else if (consume("false")) {
+            value.type = JsonValue::Type::Bool;
+            return true;
+        } else if (consume("null")) {
+            return true;
+        }
+        char* end = nullptr;
+        value.number = strtod(m_text.c_str() + m_pos, &end);
+        if (end == m_text.c_str() + m_pos) {
+            return false;
+        }
+        value.type = JsonValue::Type::Number;
+        m_pos = end - m_text.c_str();
+        return true;
+    }
+
+    bool parse_string(std::string& str) {
+        if (!consume("\"")) {
+            return false;
+        }
+        while (m_pos < m_text.size()) {
+            char c = m_text[m_pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                str += c;
+                continue;
+            }
+            if (m_pos >= m_text.size()) {
+                return false;
+            }
+            c = m_text[m_pos++];
+            switch (c) {
+                case 'n':
+                    str += '\n';
+                    break;
+                case 't':
+                    str += '\t';
+                    break;
+                case 'r':
+                    str += '\r';
+                    break;
+                case 'b':
+                    str += '\b';
+                    break;
+                case 'f':
+                    str += '\f';
+                    break;
+                case 'u': {
+                    if (m_pos + 4 > m_text.size()) {
+                        return false;
+                    }
+                    for (size_t i = m_pos; i < m_pos + 4; i++) {
+                        if (!isxdigit(static_cast<unsigned char>(m_text[i]))) {
+                            return false;
+                        }
+                    }
+                    uint32_t code =
+                            strtoul(m_text.substr(m_pos, 4).c_str(), nullptr, 16);
+                    m_pos += 4;
+                    //! encode the code point to utf-8, surrogate pairs are not
+                    //! combined
+                    if (code < 0x80) {
+                        str += static_cast<char>(code);
+                    } else if (code < 0x800) {
+                        str += static_cast<char>(0xC0 | (code >> 6));
+                        str += static_cast<char>(0x80 | (code & 0x3F));
+                    } else {
+                        str += static_cast<char>(0xE0 | (code >> 12));
+                        str += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                        str += static_cast<char>(0x80 | (code & 0x3F));
+                    }
+                    break;
+                }
+                default:
+                    str += c;
+            }
+        }
+        return false;
+    }
+
+    const std::string& m_text;
+    size_t m_pos = 0;
+};
+
+inline std::string json_escape(const std::string& str) {
+    std::string ret = "\"";
+    for (char c : str) {
+        switch (c) {
+            case '"':
+                ret += "\\\"";
+                break;
+            case '\\':
+                ret += "\\\\";
+                break;
+            case '\n':
+                ret += "\\n";
+                break;
+            case '\r':
+                ret += "\\r";
+                break;
+            case '\t':
+                ret += "\\t";
+                break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+                    ret += buf;
+                } else {
+                    ret += c;
+                }
+        }
+    }
+    return ret + "\"";
+}
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::string body;
+};
+
+//! parse the request line and the header fields before the empty line, the
+//! error is set when it is malformed
+inline bool parse_http_head(
+        const std::string& head, HttpRequest& request, size_t& content_length,
+        std::string& error) {
+    content_length = 0;
+    size_t line_end = head.find("\r\n");
+    std::string line = head.substr(0, line_end);
+    size_t sp0 = line.find(' ');
+    size_t sp1 = sp0 == std::string::npos ? sp0 : line.find(' ', sp0 + 1);
+    if (sp1 == std::string::npos) {
+        error = "invalid request line";
+        return false;
+    }
+    request.method = line.substr(0, sp0);
+    request.path = line.substr(sp0 + 1, sp1 - sp0 - 1);
+
+    for (size_t pos = line_end; pos != std::string::npos && pos < head.size();) {
+        size_t next = head.find("\r\n", pos + 2);
+        std::string field = head.substr(pos + 2, next - pos - 2);
+        size_t colon = field.find(':');
+        if (colon != std::string::npos) {
+            std::string key = field.substr(0, colon);
+            for (auto& c : key) {
+                c = tolower(c);
+            }
+            if (key == "content-length") {
+                //! the value is untrusted, a malformed one is a bad request
+                std::string value = field.substr(colon + 1);
+                const char* begin = value.c_str();
+                while (*begin == ' ' || *begin == '\t') {
+                    begin++;
+                }
+                char* end = nullptr;
+                errno = 0;
+                content_length = strtoul(begin, &end, 10);
+                while (end && (*end == ' ' || *end == '\t')) {
+                    end++;
+                }
+                if (!isdigit(static_cast<unsigned char>(*begin)) || *end != 0 ||
+                    errno == ERANGE) {
+                    error = "invalid content length";
+                    return false;
+                }
+            }
+        }
+        pos = next;
+    }
+    return true;
+}
+
+//! the event of the streamed response, the data is the JSON of one line, the
+//! line breaks of the generated text are escaped in it
+inline std::string sse_event(const std::string& data) {
+    return "data: " + data + "\n\n";
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #if defined(_WIN32)
 #define API __declspec(dllexport)
@@ -20,10 +23,92 @@ struct ModelConfig {
     uint32_t nr_ctx;
     int32_t device_id;
     bool enable_mmap;
+    //! the prompt is executed chunk by chunk of this number of tokens, which
+    //! bounds the workspace and lets the async engine interleave the decode of
+    //! other requests, 0 means the whole prompt in one execution
+    uint32_t prefill_chunk = 0;
+    //! allocate the workspace of the longest input at init, which is the
+    //! prefill chunk or the whole context, so no execution allocates it later
+    bool preallocate_workspace = false;
+    //! store the kv cache as {head, nr_ctx, head_dim}, so the attention of a head
+    //! reads contiguous rows, the model without the kernels of the layout keeps
+    //! the kv cache of rows
+    bool kv_head_major = false;
+    //! split the threads to this number of numa nodes, the rows of every weight
+    //! and the heads of the kv cache are moved to the node of the threads which
+    //! compute them, so every socket reads its local shard, 1 is no split. The
+    //! weights mapped with enable_mmap stay on the pages of the file and are not
+    //! moved. The speedup is not measured on a multi-socket host yet
+    uint32_t nr_numa_node = 1;
+    //! split the layers of the model to nr_pipeline_stage processes, every
+    //! process loads the model as its pipeline_stage, stage 0 generates and the
+    //! others call serve_pipeline, 1 is no pipeline
+    uint32_t nr_pipeline_stage = 1;
+    uint32_t pipeline_stage = 0;
+    //! the address the stage receives from and the address of the next stage,
+    //! the next one of the last stage is stage 0, the address is "shm:NAME" on
+    //! one host, "tcp:HOST:PORT" between hosts or "loopback:NAME" in one process
+    std::string pipeline_recv;
+    std::string pipeline_send;
+    //! the batch of sequences or the prompt is split to this number of micro
+    //! batches, so the stages compute different micro batches at the same time
+    uint32_t pipeline_micro_batch = 1;
+    //! the name of the shared memory which holds the prepared weights, the
+    //! first process prepares its weights into it and the later processes with
+    //! the same name and model map them read only, empty is the private weights
+    std::string weight_segment;
 };
 
+//! one of the n-best generated texts and its log-probability
+struct Candidate {
+    std::string text;
+    float logprob;
+};
+
+//! the callback of the async generation, it is called on the engine thread with
+//! every generated token and its text, the last call is finished with the token
+//! -1 and no text, or with the token REJECTED_TOKEN and the reason as the text
+//! when the request can't generate, such as its prompt exceeds the context
+constexpr int32_t REJECTED_TOKEN = -2;
+using TokenCallback =
+        std::function<void(int32_t token, const std::string& text, bool finished)>;
+
 class ModelImp;
 
+//! the single producer single consumer queue of the async generated text, the
+//! engine thread pushes the text and the user polls it without lock
+class API TokenStream {
+public:
+    TokenStream(size_t capacity) : m_ring(capacity) {}
+
+    uint64_t id() const { return m_id; }
+
+    //! pop the next text without blocking, return false if there is no text now
+    bool pop(std::string& text);
+
+    //! whether the generation is finished and all the text is popped
+    bool finished() const;
+
+    //! the reason why the request is rejected, it is empty if the request is
+    //! not rejected, read it after finished
+    const std::string& error() const { return m_error; }
+
+private:
+    friend class ModelImp;
+    void push(const std::string& text);
+    void finish(const std::string& error) {
+        m_error = error;
+        m_finished.store(true, std::memory_order_release);
+    }
+
+    uint64_t m_id = 0;
+    std::string m_error;
+    std::vector<std::string> m_ring;
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+    std::atomic<bool> m_finished{false};
+};
+
 class API Model {
 public:
     //! create a model by the model_name, the model_name must be registered
@@ -52,10 +137,86 @@ public:
     //! decode the answer one by one
     std::string decode_iter(int& token);
 
+    //! score the text from an empty context, return the log-probability of every
+    //! token conditioned on the tokens before it, all the positions of a chunk are
+    //! computed in one pass and long text is split by chunk_size, the context is
+    //! reset after scoring
+    std::vector<float> score(const std::string& text, uint32_t chunk_size = 512);
+
+    //! extract the embedding of every text from an empty context without the LM
+    //! head, layer < 0 means the final normed hidden state, otherwise the output
+    //! of the given layer, pooling is "mean" or "last" over the tokens, the
+    //! context is reset after extraction
+    std::vector<std::vector<float>> embedding(
+            const std::vector<std::string>& texts, const std::string& pooling = "mean",
+            int32_t layer = -1, uint32_t chunk_size = 512);
+
+    //! generate the nr_beam best continuations of the prompt by beam search from
+    //! an empty context, the beams share the kv cache of the prompt and decode
+    //! in one batch, the context is reset after generation
+    std::vector<Candidate> beam_search(
+            const std::string& prompt, uint32_t nr_beam, uint32_t max_token);
+
+    //! sample nr_sample continuations of the prompt in parallel like
+    //! beam_search, every candidate is sampled with the init parameters
+    std::vector<Candidate> sample_n(
+            const std::string& prompt, uint32_t nr_sample, uint32_t max_token);
+
+    //! submit a generation request which runs on the engine thread, the text
+    //! of every token is passed to the callback, the prompt continues the current
+    //! context if reset_context is false, return the id of the request. The
+    //! requests from an empty context are decoded together and their prompts
+    //! are prefilled by chunks of prefill_chunk between the decode steps
+    uint64_t submit(
+            const std::string& prompt, uint32_t max_token, TokenCallback callback,
+            bool reset_context = true);
+
+    //! submit a generation request like submit, the text is pushed to the
+    //! returned stream
+    std::shared_ptr<TokenStream> submit_stream(
+            const std::string& prompt, uint32_t max_token, bool reset_context = true);
+
+    //! cancel the request, it stops before the next token
+    void cancel(uint64_t id);
+
+    //! block until all the submitted requests are finished
+    void wait_all();
+
+    //! constrain the generated tokens by a grammar, type is "regex" with the
+    //! pattern matching the whole generated text, or "json" for any well-formed
+    //! JSON object with an empty pattern, a JSON schema is not supported, so the
+    //! keys and the value types are not checked, write a regex for an object of
+    //! fixed keys, the end token is only sampled when the text is complete, an
+    //! empty type removes the constraint, call it after load and init, it is
+    //! safe while the async requests run, they keep the constraint of their
+    //! submission
+    void set_constraint(const std::string& type, const std::string& pattern = "");
+
     std::string decode_summary() const;
 
+    //! serve the pipeline as the stage of the config until stage 0 is destructed,
+    //! for the stages except stage 0, call it after load
+    void serve_pipeline();
+
+    //! remove the shared weights of the name, the processes using them keep them
+    //! until they exit, the next process with the name prepares them again
+    static void remove_weight_segment(const std::string& name);
+
+    //! fork a worker process which shares the loaded model with this one copy on
+    //! write, return 0 in the worker and the pid of the worker in this process
+    //! like fork, -1 if it fails. All the weights are read and preprocessed
+    //! before the first fork, the threads of this process are stopped before
+    //! every fork and each process creates its threads at its next execution,
+    //! so call it after load and init and before submit
+    int32_t fork_worker();
+
 private:
     std::shared_ptr<ModelImp> m_model_imp;
 };
 
+//! the text of a generated token, the special tokens of the vocabs, like "<n>",
+//! "<|tab|>" and "<|blank_N|>", the "▁" of sentencepiece and the byte tokens
+//! "<0xXX>" are converted to the characters
+API std::string token_to_text(const std::string& token);
+
 }  // namespace inferllm
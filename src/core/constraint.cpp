@@ -0,0 +1,610 @@
+#include "constraint.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+using namespace inferllm;
+
+Regex::Regex(const std::string& pattern) : m_pattern(pattern) {
+    Frag frag = parse_alternate();
+    INFER_ASSERT(m_pos == m_pattern.size(), "unbalanced parenthesis in the regex.");
+    Node match;
+    match.match = true;
+    patch(frag.outs, new_node(match));
+
+    std::vector<bool> visited(m_nodes.size(), false);
+    std::vector<int> set;
+    closure(frag.start, visited, set);
+    m_start_state = get_dfa_state(set);
+}
+
+int Regex::new_node(Node node) {
+    m_nodes.push_back(node);
+    return m_nodes.size() - 1;
+}
+
+void Regex::patch(const std::vector<int>& outs, int target) {
+    for (int slot : outs) {
+        if (slot % 2 == 0) {
+            m_nodes[slot / 2].out = target;
+        } else {
+            m_nodes[slot / 2].out1 = target;
+        }
+    }
+}
+
+Regex::Frag Regex::empty() {
+    Node node;
+    node.epsilon = true;
+    int id = new_node(node);
+    return {id, {id * 2}};
+}
+
+Regex::Frag Regex::concat(Frag a, Frag b) {
+    patch(a.outs, b.start);
+    return {a.start, b.outs};
+}
+
+Regex::Frag Regex::alternate(Frag a, Frag b) {
+    Node node;
+    node.epsilon = true;
+    node.out = a.start;
+    node.out1 = b.start;
+    a.outs.insert(a.outs.end(), b.outs.begin(), b.outs.end());
+    return {new_node(node), a.outs};
+}
+
+Regex::Frag Regex::star(Frag a) {
+    Node node;
+    node.epsilon = true;
+    node.out = a.start;
+    int id = new_node(node);
+    patch(a.outs, id);
+    return {id, {id * 2 + 1}};
+}
+
+Regex::Frag Regex::optional(Frag a) {
+    Node node;
+    node.epsilon = true;
+    node.out = a.start;
+    int id = new_node(node);
+    a.outs.push_back(id * 2 + 1);
+    return {id, a.outs};
+}
+
+Regex::Frag Regex::parse_alternate() {
+    Frag frag = parse_concat();
+    while (m_pos < m_pattern.size() && m_pattern[m_pos] == '|') {
+        m_pos++;
+        frag = alternate(frag, parse_concat());
+    }
+    return frag;
+}
+
+Regex::Frag Regex::parse_concat() {
+    Frag frag = empty();
+    while (m_pos < m_pattern.size() && m_pattern[m_pos] != '|' &&
+           m_pattern[m_pos] != ')') {
+        frag = concat(frag, parse_repeat());
+    }
+    return frag;
+}
+
+Regex::Frag Regex::parse_repeat() {
+    size_t atom_pos = m_pos;
+    Frag frag = parse_atom();
+    bool repeated = false;
+    while (m_pos < m_pattern.size()) {
+        char c = m_pattern[m_pos];
+        if (c == '*') {
+            frag = star(frag);
+        } else if (c == '+') {
+            //! the loop back to the atom, without copying the atom
+            Node node;
+            node.epsilon = true;
+            node.out = frag.start;
+            int id = new_node(node);
+            patch(frag.outs, id);
+            frag = {frag.start, {id * 2 + 1}};
+        } else if (c == '?') {
+            frag = optional(frag);
+        } else if (c == '{') {
+            INFER_ASSERT(!repeated, "the counted repeat should follow an atom.");
+            m_pos++;
+            int min = parse_number();
+            int max = min;
+            bool unbounded = false;
+            if (m_pos < m_pattern.size() && m_pattern[m_pos] == ',') {
+                m_pos++;
+                if (m_pos < m_pattern.size() && m_pattern[m_pos] == '}') {
+                    unbounded = true;
+                } else {
+                    max = parse_number();
+                }
+            }
+            INFER_ASSERT(
+                    m_pos < m_pattern.size() && m_pattern[m_pos] == '}' && min <= max,
+                    "invalid counted repeat in the regex.");
+            size_t end_pos = m_pos;
+            //! the atom is parsed again to get a copy of its nodes
+            auto copy_atom = [&]() {
+                m_pos = atom_pos;
+                return parse_atom();
+            };
+            Frag result = empty();
+            for (int i = 0; i < min; i++) {
+                result = concat(result, i == 0 ? frag : copy_atom());
+            }
+            if (unbounded) {
+                result = concat(result, star(min == 0 ? frag : copy_atom()));
+            }
+            for (int i = min; !unbounded && i < max; i++) {
+                result = concat(result, optional(i == 0 ? frag : copy_atom()));
+            }
+            frag = result;
+            m_pos = end_pos;
+        } else {
+            break;
+        }
+        repeated = true;
+        m_pos++;
+    }
+    return frag;
+}
+
+Regex::Frag Regex::parse_atom() {
+    INFER_ASSERT(m_pos < m_pattern.size(), "unexpected end of the regex.");
+    char c = m_pattern[m_pos];
+    INFER_ASSERT(
+            c != '*' && c != '+' && c != '?' && c != '{',
+            "nothing to repeat in the regex.");
+    if (c == '(') {
+        m_pos++;
+        if (m_pattern.compare(m_pos, 2, "?:") == 0) {
+            m_pos += 2;
+        }
+        Frag frag = parse_alternate();
+        INFER_ASSERT(
+                m_pos < m_pattern.size() && m_pattern[m_pos] == ')',
+                "unbalanced parenthesis in the regex.");
+        m_pos++;
+        return frag;
+    }
+    Node node;
+    if (c == '[') {
+        node.chars = parse_class();
+    } else if (c == '\\') {
+        node.chars = parse_escape();
+    } else if (c == '.') {
+        node.chars.set();
+        node.chars.reset('\n');
+        m_pos++;
+    } else {
+        node.chars.set(static_cast<unsigned char>(c));
+        m_pos++;
+    }
+    int id = new_node(node);
+    return {id, {id * 2}};
+}
+
+std::bitset<256> Regex::parse_escape() {
+    m_pos++;
+    INFER_ASSERT(m_pos < m_pattern.size(), "unexpected end of the regex.");
+    char c = m_pattern[m_pos++];
+    std::bitset<256> chars;
+    switch (c) {
+        case 'd':
+        case 'D':
+            for (char i = '0'; i <= '9'; i++)
+                chars.set(i);
+            break;
+        case 'w':
+        case 'W':
+            for (int i = 0; i < 128; i++) {
+                if (isalnum(i) || i == '_')
+                    chars.set(i);
+            }
+            break;
+        case 's':
+        case 'S':
+            for (char i : std::string(" \t\n\r\f\v"))
+                chars.set(i);
+            break;
+        case 'n':
+            chars.set('\n');
+            break;
+        case 't':
+            chars.set('\t');
+            break;
+        case 'r':
+            chars.set('\r');
+            break;
+        default:
+            chars.set(static_cast<unsigned char>(c));
+    }
+    if (c == 'D' || c == 'W' || c == 'S') {
+        chars.flip();
+    }
+    return chars;
+}
+
+std::bitset<256> Regex::parse_class() {
+    m_pos++;
+    bool negate = m_pos < m_pattern.size() && m_pattern[m_pos] == '^';
+    if (negate) {
+        m_pos++;
+    }
+    std::bitset<256> chars;
+    bool first = true;
+    while (m_pos < m_pattern.size() && (first || m_pattern[m_pos] != ']')) {
+        first = false;
+        if (m_pattern[m_pos] == '\\') {
+            chars |= parse_escape();
+            continue;
+        }
+        unsigned char begin = m_pattern[m_pos++];
+        unsigned char end = begin;
+        if (m_pos + 1 < m_pattern.size() && m_pattern[m_pos] == '-' &&
+            m_pattern[m_pos + 1] != ']') {
+            end = m_pattern[m_pos + 1];
+            m_pos += 2;
+        }
+        for (int i = begin; i <= end; i++) {
+            chars.set(i);
+        }
+    }
+    INFER_ASSERT(m_pos < m_pattern.size(), "unbalanced bracket in the regex.");
+    m_pos++;
+    if (negate) {
+        chars.flip();
+    }
+    return chars;
+}
+
+int Regex::parse_number() {
+    int number = 0;
+    size_t begin = m_pos;
+    while (m_pos < m_pattern.size() && isdigit(m_pattern[m_pos])) {
+        number = number * 10 + (m_pattern[m_pos++] - '0');
+    }
+    INFER_ASSERT(m_pos > begin, "expect a number in the counted repeat.");
+    return number;
+}
+
+void Regex::closure(int node, std::vector<bool>& visited, std::vector<int>& set) {
+    if (node < 0 || visited[node]) {
+        return;
+    }
+    visited[node] = true;
+    if (m_nodes[node].epsilon) {
+        closure(m_nodes[node].out, visited, set);
+        closure(m_nodes[node].out1, visited, set);
+    } else {
+        set.push_back(node);
+    }
+}
+
+int Regex::get_dfa_state(std::vector<int> set) {
+    std::sort(set.begin(), set.end());
+    auto it = m_dfa_ids.find(set);
+    if (it != m_dfa_ids.end()) {
+        return it->second;
+    }
+    int id = m_dfa_sets.size();
+    bool accept = false;
+    for (int node : set) {
+        accept |= m_nodes[node].match;
+    }
+    std::array<int, 256> trans;
+    trans.fill(-2);
+    m_dfa_ids[set] = id;
+    m_dfa_sets.push_back(set);
+    m_dfa_trans.push_back(trans);
+    m_dfa_accept.push_back(accept);
+    return id;
+}
+
+int Regex::step(int state, unsigned char c) {
+    if (m_dfa_trans[state][c] != -2) {
+        return m_dfa_trans[state][c];
+    }
+    std::vector<bool> visited(m_nodes.size(), false);
+    std::vector<int> set;
+    for (int node : m_dfa_sets[state]) {
+        if (!m_nodes[node].match && m_nodes[node].chars.test(c)) {
+            closure(m_nodes[node].out, visited, set);
+        }
+    }
+    int next = set.empty() ? -1 : get_dfa_state(set);
+    m_dfa_trans[state][c] = next;
+    return next;
+}
+
+bool RegexMatcher::advance(char c) {
+    if (m_state < 0) {
+        return false;
+    }
+    m_state = m_regex->step(m_state, static_cast<unsigned char>(c));
+    return m_state >= 0;
+}
+
+std::string JsonMatcher::key() const {
+    return std::to_string(static_cast<int>(m_mode)) + (m_in_key ? "k" : "v") +
+           m_stack + ":" + m_remain;
+}
+
+bool JsonMatcher::value_begin(char c) {
+    if (c == '{') {
+        m_stack.push_back('{');
+        m_mode = Mode::KeyOrEnd;
+    } else if (c == '[') {
+        m_stack.push_back('[');
+        m_mode = Mode::ValueOrEnd;
+    } else if (c == '"') {
+        m_in_key = false;
+        m_mode = Mode::String;
+    } else if (c == '-') {
+        m_mode = Mode::NumSign;
+    } else if (c == '0') {
+        m_mode = Mode::NumZero;
+    } else if (c >= '1' && c <= '9') {
+        m_mode = Mode::NumInt;
+    } else if (c == 't' || c == 'f' || c == 'n') {
+        m_remain = c == 't' ? "rue" : (c == 'f' ? "alse" : "ull");
+        m_mode = Mode::Literal;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool JsonMatcher::value_end() {
+    m_mode = m_stack.empty() ? Mode::Done : Mode::AfterValue;
+    return true;
+}
+
+bool JsonMatcher::number_end(char c) {
+    value_end();
+    return advance(c);
+}
+
+bool JsonMatcher::advance(char c) {
+    bool space = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    bool digit = c >= '0' && c <= '9';
+    switch (m_mode) {
+        case Mode::Root:
+            if (c == '{') {
+                return value_begin(c);
+            }
+            return space;
+        case Mode::Value:
+            return space || value_begin(c);
+        case Mode::ValueOrEnd:
+            if (c == ']') {
+                m_stack.pop_back();
+                return value_end();
+            }
+            return space || value_begin(c);
+        case Mode::KeyOrEnd:
+        case Mode::Key:
+            if (c == '"') {
+                m_in_key = true;
+                m_mode = Mode::String;
+                return true;
+            }
+            if (c == '}' && m_mode == Mode::KeyOrEnd) {
+                m_stack.pop_back();
+                return value_end();
+            }
+            return space;
+        case Mode::Colon:
+            if (c == ':') {
+                m_mode = Mode::Value;
+                return true;
+            }
+            return space;
+        case Mode::AfterValue:
+            if (c == ',') {
+                m_mode = m_stack.back() == '{' ? Mode::Key : Mode::Value;
+                return true;
+            }
+            if ((c == '}' && m_stack.back() == '{') ||
+                (c == ']' && m_stack.back() == '[')) {
+                m_stack.pop_back();
+                return value_end();
+            }
+            return space;
+        case Mode::String:
+            if (c == '"') {
+                if (m_in_key) {
+                    m_in_key = false;
+                    m_mode = Mode::Colon;
+                    return true;
+                }
+                return value_end();
+            }
+            if (c == '\\') {
+                m_mode = Mode::Escape;
+                return true;
+            }
+            return static_cast<unsigned char>(c) >= 0x20;
+        case Mode::Escape:
+            if (c == 'u') {
+                m_remain = "0000";
+                m_mode = Mode::Hex;
+                return true;
+            }
+            m_mode = Mode::String;
+            return std::string("\"\\/bfnrt").find(c) != std::string::npos;
+        case Mode::Hex:
+            if (!isxdigit(static_cast<unsigned char>(c))) {
+                return false;
+            }
+            m_remain.pop_back();
+            if (m_remain.empty()) {
+                m_mode = Mode::String;
+            }
+            return true;
+        case Mode::Literal:
+            if (c != m_remain[0]) {
+                return false;
+            }
+            m_remain.erase(0, 1);
+            return m_remain.empty() ? value_end() : true;
+        case Mode::NumSign:
+            if (c == '0' || !digit) {
+                m_mode = Mode::NumZero;
+                return c == '0';
+            }
+            m_mode = Mode::NumInt;
+            return true;
+        case Mode::NumZero:
+        case Mode::NumInt:
+        case Mode::NumFrac:
+            if (digit && m_mode != Mode::NumZero) {
+                return true;
+            }
+            if (c == '.' && m_mode != Mode::NumFrac) {
+                m_mode = Mode::NumDot;
+                return true;
+            }
+            if (c == 'e' || c == 'E') {
+                m_mode = Mode::NumExp;
+                return true;
+            }
+            return number_end(c);
+        case Mode::NumDot:
+            m_mode = Mode::NumFrac;
+            return digit;
+        case Mode::NumExp:
+            if (c == '+' || c == '-') {
+                m_mode = Mode::NumExpSign;
+                return true;
+            }
+            m_mode = Mode::NumExpInt;
+            return digit;
+        case Mode::NumExpSign:
+            m_mode = Mode::NumExpInt;
+            return digit;
+        case Mode::NumExpInt:
+            return digit || number_end(c);
+        case Mode::Done:
+            return false;
+    }
+    return false;
+}
+
+TokenConstraint::TokenConstraint(std::unique_ptr<Matcher> matcher, const Vocab& vocab)
+        : m_start(matcher->clone()),
+          m_matcher(std::move(matcher)),
+          m_vocab(vocab),
+          m_tables(std::make_shared<Tables>()) {
+    build_trie(vocab);
+}
+
+std::unique_ptr<TokenConstraint> TokenConstraint::clone() const {
+    return std::unique_ptr<TokenConstraint>(new TokenConstraint(*this));
+}
+
+TokenConstraint::TokenConstraint(const TokenConstraint& other)
+        : m_start(other.m_start->clone()),
+          m_matcher(other.m_matcher->clone()),
+          m_vocab(other.m_vocab),
+          m_tables(other.m_tables) {}
+
+void TokenConstraint::build_trie(const Vocab& vocab) {
+    auto& trie = m_tables->trie;
+    std::map<std::pair<int, char>, int> edges;
+    trie.resize(1);
+    for (size_t id = 0; id < vocab.id_to_token.size(); id++) {
+        auto& token = vocab.id_to_token[id].tok;
+        //! the empty token never advances the grammar, it is always masked
+        if (token.empty()) {
+            continue;
+        }
+        int node = 0;
+        for (char c : token) {
+            auto it = edges.find({node, c});
+            if (it == edges.end()) {
+                int child = trie.size();
+                trie.emplace_back();
+                trie[node].children.push_back({c, child});
+                it = edges.insert({{node, c}, child}).first;
+            }
+            node = it->second;
+        }
+        trie[node].tokens.push_back(id);
+    }
+}
+
+void TokenConstraint::fill_mask(
+        int node, const Matcher& matcher, std::vector<bool>& mask) {
+    auto& trie = m_tables->trie;
+    for (auto& child : trie[node].children) {
+        auto next = matcher.clone();
+        if (!next->advance(child.first)) {
+            continue;
+        }
+        for (auto token : trie[child.second].tokens) {
+            mask[token] = true;
+        }
+        fill_mask(child.second, *next, mask);
+    }
+}
+
+const std::vector<bool>& TokenConstraint::get_mask() {
+    auto& cache = m_tables->mask_cache;
+    auto key = m_matcher->key();
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    if (cache.size() >= MAX_CACHE) {
+        cache.clear();
+    }
+    std::vector<bool> mask(m_vocab.id_to_token.size(), false);
+    fill_mask(0, *m_matcher, mask);
+    return cache.emplace(key, std::move(mask)).first->second;
+}
+
+void TokenConstraint::apply(float* logits, Vocab::Id end_token) {
+    auto& mask = get_mask();
+    float end_logit = logits[end_token];
+    bool any = false;
+    for (size_t i = 0; i < mask.size(); i++) {
+        if (mask[i]) {
+            any = true;
+        } else {
+            logits[i] = -INFINITY;
+        }
+    }
+    //! the end token is also allowed when the grammar can not go on, otherwise
+    //! no token is valid
+    logits[end_token] = m_matcher->accepted() || !any ? end_logit : -INFINITY;
+}
+
+void TokenConstraint::accept(Vocab::Id token) {
+    bool valid = true;
+    for (char c : m_vocab.id_to_token[token].tok) {
+        valid = valid && m_matcher->advance(c);
+    }
+    INFER_ASSERT(valid, "the sampled token breaks the grammar.");
+}
+
+std::unique_ptr<TokenConstraint> inferllm::make_constraint(
+        const std::string& type, const std::string& pattern, const Vocab& vocab) {
+    std::unique_ptr<Matcher> matcher;
+    if (type == "regex") {
+        matcher = make_unique<RegexMatcher>(std::make_shared<Regex>(pattern));
+    } else if (type == "json") {
+        INFER_ASSERT(
+                pattern.empty(),
+                "the json constraint doesn't take a schema, use a regex for the "
+                "fixed keys.");
+        matcher = make_unique<JsonMatcher>();
+    } else {
+        INFER_ASSERT(0, "Unsupported constraint type, should be regex or json.");
+    }
+    return make_unique<TokenConstraint>(std::move(matcher), vocab);
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+namespace inferllm {
+
+//! the byte level state machine of the constrained decoding, the generated text
+//! is fed byte by byte and the bytes out of the grammar are rejected
+class Matcher {
+public:
+    virtual ~Matcher() = default;
+
+    virtual std::unique_ptr<Matcher> clone() const = 0;
+
+    //! consume one byte, return false if the byte breaks the grammar, the state
+    //! is undefined after a rejected byte
+    virtual bool advance(char c) = 0;
+
+    //! whether the consumed bytes form a complete sentence of the grammar
+    virtual bool accepted() const = 0;
+
+    //! the states with the same key accept the same strings, it is the key of
+    //! the token mask cache
+    virtual std::string key() const = 0;
+};
+
+//! the compiled regex, it is a thompson NFA and the DFA states are built lazily
+//! when they are reached, support literal, escape (\d \w \s), '.', char class,
+//! group, '|', '*', '+', '?' and {n}, {n,}, {n,m}, the regex matches the whole
+//! generated text
+class Regex {
+public:
+    explicit Regex(const std::string& pattern);
+
+    int start() const { return m_start_state; }
+
+    //! the DFA state after consuming c, -1 means the state is dead
+    int step(int state, unsigned char c);
+
+    bool accepted(int state) const { return m_dfa_accept[state]; }
+
+private:
+    struct Node {
+        //! the bytes to next node, empty for epsilon node
+        std::bitset<256> chars;
+        bool epsilon = false;
+        bool match = false;
+        int out = -1;
+        int out1 = -1;
+    };
+    //! the slots to patch, node id * 2 + (0 for out, 1 for out1)
+    struct Frag {
+        int start;
+        std::vector<int> outs;
+    };
+
+    int new_node(Node node);
+    void patch(const std::vector<int>& outs, int target);
+    Frag empty();
+    Frag concat(Frag a, Frag b);
+    Frag alternate(Frag a, Frag b);
+    Frag star(Frag a);
+    Frag optional(Frag a);
+
+    Frag parse_alternate();
+    Frag parse_concat();
+    Frag parse_repeat();
+    Frag parse_atom();
+    std::bitset<256> parse_escape();
+    std::bitset<256> parse_class();
+    int parse_number();
+
+    void closure(int node, std::vector<bool>& visited, std::vector<int>& set);
+    int get_dfa_state(std::vector<int> set);
+
+    std::string m_pattern;
+    size_t m_pos = 0;
+    std::vector<Node> m_nodes;
+    int m_start_state;
+
+    std::map<std::vector<int>, int> m_dfa_ids;
+    std::vector<std::vector<int>> m_dfa_sets;
+    //! -2 means the transition is not built yet
+    std::vector<std::array<int, 256>> m_dfa_trans;
+    std::vector<bool> m_dfa_accept;
+};
+
+class RegexMatcher : public Matcher {
+public:
+    RegexMatcher(std::shared_ptr<Regex> regex)
+            : m_regex(regex), m_state(regex->start()) {}
+
+    std::unique_ptr<Matcher> clone() const override {
+        return make_unique<RegexMatcher>(*this);
+    }
+    bool advance(char c) override;
+    bool accepted() const override { return m_regex->accepted(m_state); }
+    std::string key() const override { return std::to_string(m_state); }
+
+private:
+    std::shared_ptr<Regex> m_regex;
+    int m_state;
+};
+
+//! the pushdown state machine of a JSON object, the root value must be an
+//! object and nothing is allowed after the root object is closed
+class JsonMatcher : public Matcher {
+public:
+    std::unique_ptr<Matcher> clone() const override {
+        return make_unique<JsonMatcher>(*this);
+    }
+    bool advance(char c) override;
+    bool accepted() const override { return m_mode == Mode::Done; }
+    std::string key() const override;
+
+private:
+    enum class Mode {
+        Root,
+        Value,
+        KeyOrEnd,
+        Key,
+        Colon,
+        ValueOrEnd,
+        AfterValue,
+        String,
+        Escape,
+        Hex,
+        Literal,
+        NumSign,
+        NumZero,
+        NumInt,
+        NumDot,
+        NumFrac,
+        NumExp,
+        NumExpSign,
+        NumExpInt,
+        Done
+    };
+    bool value_begin(char c);
+    bool value_end();
+    bool number_end(char c);
+
+    Mode m_mode = Mode::Root;
+    //! the open containers, '{' or '['
+    std::string m_stack;
+    bool m_in_key = false;
+    //! the remaining bytes of true/false/null or the remaining hex digits
+    std::string m_remain;
+};
+
+//! mask the tokens which break the grammar before sampling, the mask of every
+//! grammar state is computed once by walking the prefix tree of the vocab and
+//! cached by the state key
+class TokenConstraint {
+public:
+    TokenConstraint(std::unique_ptr<Matcher> matcher, const Vocab& vocab);
+
+    //! the constraint of the same grammar state, it shares the prefix tree and
+    //! the mask cache, so it is used on the thread of this one, such as a beam
+    //! or a request of the engine
+    std::unique_ptr<TokenConstraint> clone() const;
+
+    //! restart the grammar from the empty text, such as for a new prompt
+    void reset() { m_matcher = m_start->clone(); }
+
+    //! set the logits of the tokens out of the grammar to -inf, the end token
+    //! is only allowed when the generated text is a complete sentence
+    void apply(float* logits, Vocab::Id end_token);
+
+    //! advance the grammar with the sampled token
+    void accept(Vocab::Id token);
+
+private:
+    struct TrieNode {
+        std::vector<std::pair<char, int>> children;
+        std::vector<Vocab::Id> tokens;
+    };
+    //! the prefix tree of the vocab and the masks of the visited states
+    struct Tables {
+        std::vector<TrieNode> trie;
+        std::unordered_map<std::string, std::vector<bool>> mask_cache;
+    };
+    //! the copy shares the tables
+    TokenConstraint(const TokenConstraint& other);
+
+    void build_trie(const Vocab& vocab);
+    void fill_mask(int node, const Matcher& matcher, std::vector<bool>& mask);
+    const std::vector<bool>& get_mask();
+
+    //! the cache is dropped when it is full, a mask is a bit per token
+    static constexpr size_t MAX_CACHE = 1024;
+
+    std::unique_ptr<Matcher> m_start;
+    std::unique_ptr<Matcher> m_matcher;
+    const Vocab& m_vocab;
+    std::shared_ptr<Tables> m_tables;
+};
+
+//! create the constraint by type, "regex" or "json", pattern is the regex and
+//! it is empty for json
+std::unique_ptr<TokenConstraint> make_constraint(
+        const std::string& type, const std::string& pattern, const Vocab& vocab);
+
+}  // namespace inferllm
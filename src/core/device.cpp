@@ -1,5 +1,6 @@
 
 #include "device.h"
+#include "numa.h"
 #include "tensor.h"
 
 #ifndef __APPLE__
@@ -35,14 +36,16 @@ void* CPUDevice::allocate(size_t len) {
 #ifdef ENABLE_ASAN
     return aligned_alloc(len);
 #else
+    //! the empty buckets are kept, so the memory freed back to them later does
+    //! not allocate the node of the map again
     auto it = m_free_memory.lower_bound(len);
+    while (it != m_free_memory.end() && it->second.empty()) {
+        it++;
+    }
     void* ptr = nullptr;
-    if (it != m_free_memory.end() && it->second.size() > 0) {
+    if (it != m_free_memory.end()) {
         ptr = it->second.back();
         it->second.pop_back();
-        if (it->second.size() < 1) {
-            m_free_memory.erase(it);
-        }
     } else {
         ptr = aligned_alloc(len);
         m_alloc_memory[ptr] = len;
@@ -72,6 +75,25 @@ void CPUDevice::free_device(void* ptr) {
 #endif
 }
 
+void CPUDevice::distribute(void* ptr, size_t len, size_t nr_part) {
+    uint32_t nr_group = m_thread_pool->nr_groups();
+    if (nr_group < 2 || nr_part == 0) {
+        return;
+    }
+    //! the parts of a group are the sub tasks of its threads, the shared memory
+    //! gathers the outputs of the groups, so no part is copied to other nodes
+    size_t part = len / nr_part;
+    for (uint32_t group = 0; group < nr_group; group++) {
+        size_t begin = m_thread_pool->group_task_begin(group, nr_part);
+        size_t end = m_thread_pool->group_task_begin(group + 1, nr_part);
+        if (end > begin) {
+            bind_memory_to_node(
+                    static_cast<char*>(ptr) + begin * part, (end - begin) * part,
+                    m_thread_pool->group_node(group));
+        }
+    }
+}
+
 CPUDevice::~CPUDevice() {
 #ifndef ENABLE_ASAN
     for (auto it : m_free_memory) {
@@ -46,6 +46,10 @@ public:
 
     virtual void deactive() {}
 
+    //! stop the threads of the device before the process forks, the processes
+    //! create their threads again at the next execution
+    virtual void stop_threads() {}
+
     virtual void host2device_copy(
             void* device, const void* host, size_t size, bool async = false) = 0;
 
@@ -62,6 +66,11 @@ public:
     //! memory
     virtual bool unified_memory() { return true; }
 
+    //! the memory of len bytes is nr_part equal parts computed in order by the sub
+    //! tasks, like the rows of a weight or the heads of the kv cache, move every
+    //! part to the memory of the threads which compute it
+    virtual void distribute(void* /*ptr*/, size_t /*len*/, size_t /*nr_part*/) {}
+
 protected:
     std::unique_ptr<Kernel> m_kernel;
     std::map<void*, size_t> m_alloc_memory;
@@ -70,8 +79,9 @@ protected:
 
 class CPUDevice : public Device {
 public:
-    CPUDevice(KernelType type, uint32_t nr_thread) : Device() {
-        m_thread_pool = make_unique<ThreadPool>(nr_thread);
+    //! the threads and the weights are split to nr_group numa nodes
+    CPUDevice(KernelType type, uint32_t nr_thread, uint32_t nr_group = 1) : Device() {
+        m_thread_pool = make_unique<ThreadPool>(nr_thread, nr_group);
         m_kernel = make_unique<Kernel>(type, m_thread_pool.get());
     }
 
@@ -83,6 +93,8 @@ public:
 
     void deactive() override { m_thread_pool->deactive(); }
 
+    void stop_threads() override { m_thread_pool->stop(); }
+
     void host2device_copy(
             void* device, const void* host, size_t size, bool async = false) override {
         memcpy(device, host, size);
@@ -100,6 +112,8 @@ public:
 
     void sync() override {}
 
+    void distribute(void* ptr, size_t len, size_t nr_part) override;
+
     ~CPUDevice();
 
 private:
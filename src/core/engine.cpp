@@ -0,0 +1,273 @@
+#include <algorithm>
+
+#include "engine.h"
+#include "model_imp.h"
+
+using namespace inferllm;
+
+AsyncEngine::AsyncEngine(ModelImp* model) : m_model(model) {
+    m_thread = std::thread(&AsyncEngine::run, this);
+}
+
+AsyncEngine::~AsyncEngine() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+        for (auto& request : m_requests) {
+            request.second->cancelled = true;
+        }
+    }
+    m_request_cv.notify_all();
+    m_thread.join();
+}
+
+uint64_t AsyncEngine::submit(
+        const std::string& prompt, uint32_t max_token, TokenCallback callback,
+        bool reset_context) {
+    INFER_ASSERT(!prompt.empty(), "the prompt of the request is empty.");
+    auto request = std::make_shared<Request>();
+    request->prompt = prompt;
+    request->max_token = max_token;
+    request->reset_context = reset_context;
+    request->callback = callback;
+    //! the constraint set when the request is submitted
+    request->constraint = m_model->new_constraint();
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        request->id = m_next_id++;
+        m_queue.push_back(request);
+        m_requests[request->id] = request;
+    }
+    m_request_cv.notify_one();
+    return request->id;
+}
+
+void AsyncEngine::cancel(uint64_t id) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_requests.find(id);
+    if (it != m_requests.end()) {
+        it->second->cancelled = true;
+    }
+}
+
+void AsyncEngine::wait_all() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finish_cv.wait(lock, [this]() { return m_requests.empty(); });
+}
+
+void AsyncEngine::run() {
+    bool batched = m_model->m_graph->support_batch();
+    while (true) {
+        std::shared_ptr<Request> serial;
+        std::vector<std::shared_ptr<Request>> admitted;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_request_cv.wait(lock, [this]() {
+                return m_stop || !m_queue.empty() || !m_active.empty();
+            });
+            if (m_queue.empty() && m_active.empty()) {
+                return;
+            }
+            while (!m_queue.empty()) {
+                auto request = m_queue.front();
+                if (batched && request->reset_context) {
+                    admitted.push_back(request);
+                    m_queue.pop_front();
+                    continue;
+                }
+                //! the serial request waits until the interleaved ones are
+                //! finished, and the later requests wait behind it
+                if (m_active.empty() && admitted.empty()) {
+                    serial = request;
+                    m_queue.pop_front();
+                }
+                break;
+            }
+        }
+        if (serial) {
+            generate(*serial);
+            finish(serial);
+            continue;
+        }
+        for (auto& request : admitted) {
+            if (start(*request)) {
+                m_active.push_back(request);
+            } else {
+                finish(request);
+            }
+        }
+        if (!m_active.empty()) {
+            step();
+        }
+    }
+}
+
+void AsyncEngine::generate(Request& request) {
+    int32_t end_token = m_model->end_token();
+    uint32_t nr_token = 0;
+    if (!request.cancelled && request.max_token > 0) {
+        if (request.reset_context) {
+            m_model->reset_token();
+        }
+        //! only checked, the decode tokenizes the prompt again
+        if (!tokenize(request, m_model->get_remain_token())) {
+            return;
+        }
+        int token;
+        std::string text = m_model->decode(request.prompt, token);
+        while (token != end_token) {
+            request.callback(token, text, false);
+            if (++nr_token >= request.max_token || request.cancelled ||
+                m_model->get_remain_token() == 0) {
+                break;
+            }
+            text = m_model->decode_iter(token);
+        }
+    }
+}
+
+bool AsyncEngine::start(Request& request) {
+    if (request.cancelled || request.max_token == 0) {
+        return false;
+    }
+    auto graph = m_model->m_graph;
+    if (!tokenize(request, graph->get_nr_ctx())) {
+        return false;
+    }
+    if (m_free_seqs.empty()) {
+        request.seq = m_nr_seq++;
+    } else {
+        request.seq = m_free_seqs.back();
+        m_free_seqs.pop_back();
+    }
+    graph->reset_seq(request.seq);
+    request.last_queue.assign(m_model->m_repeat_last_n, 0);
+    for (auto token : request.tokens) {
+        request.last_queue.push_back(token);
+        request.last_queue.pop_front();
+    }
+    return true;
+}
+
+bool AsyncEngine::tokenize(Request& request, uint32_t nr_remain) {
+    //! tokenized like the decode of the serial request
+    request.tokens = m_model->tokenize(request.prompt, false);
+    m_model->m_graph->post_tokenize(request.tokens);
+    if (request.tokens.size() >= nr_remain) {
+        request.error = "the prompt of " + std::to_string(request.tokens.size()) +
+                        " tokens exceeds the remain context of " +
+                        std::to_string(nr_remain) + " tokens";
+        return false;
+    }
+    return true;
+}
+
+void AsyncEngine::step() {
+    auto graph = m_model->m_graph;
+    for (size_t i = 0; i < m_active.size();) {
+        if (m_active[i]->cancelled) {
+            auto request = m_active[i];
+            m_active.erase(m_active.begin() + i);
+            finish(request);
+        } else {
+            i++;
+        }
+    }
+    if (m_active.empty()) {
+        return;
+    }
+    //! every generating request decodes one token, and the prompts are
+    //! prefilled in the order of submission within the chunk budget
+    std::vector<int32_t> tokens;
+    std::vector<uint32_t> seqs;
+    std::vector<std::pair<Request*, uint32_t>> runs;
+    for (auto& request : m_active) {
+        if (request->nr_prefilled == request->tokens.size()) {
+            tokens.push_back(request->last_token);
+            seqs.push_back(request->seq);
+            runs.push_back({request.get(), 1});
+        }
+    }
+    size_t budget = m_model->m_config.prefill_chunk;
+    if (budget == 0) {
+        budget = graph->get_nr_ctx();
+    }
+    for (auto& request : m_active) {
+        size_t remain = request->tokens.size() - request->nr_prefilled;
+        if (remain == 0 || budget == 0) {
+            continue;
+        }
+        uint32_t len = std::min(remain, budget);
+        auto begin = request->tokens.begin() + request->nr_prefilled;
+        tokens.insert(tokens.end(), begin, begin + len);
+        seqs.insert(seqs.end(), len, request->seq);
+        runs.push_back({request.get(), len});
+        budget -= len;
+    }
+    size_t nr_vocab = graph->get_nr_vocab();
+    m_logits.resize(runs.size() * nr_vocab);
+    graph->execute_batch(tokens, seqs, m_logits);
+
+    std::vector<Request*> finished;
+    for (size_t i = 0; i < runs.size(); i++) {
+        auto request = runs[i].first;
+        if (request->nr_prefilled < request->tokens.size()) {
+            request->nr_prefilled += runs[i].second;
+            if (request->nr_prefilled < request->tokens.size()) {
+                continue;
+            }
+        }
+        float* logits = m_logits.data() + i * nr_vocab;
+        if (request->constraint) {
+            request->constraint->apply(logits, m_model->end_token());
+        }
+        auto token = llama_sample_top_p_top_k(
+                *m_model->m_vocab, logits, request->last_queue,
+                m_model->m_repeat_penalty, m_model->m_top_k, m_model->m_top_p,
+                m_model->m_temp, m_model->m_rng);
+        if (request->constraint && token != m_model->end_token()) {
+            request->constraint->accept(token);
+        }
+        request->last_queue.push_back(token);
+        request->last_queue.pop_front();
+        if (token == m_model->end_token()) {
+            finished.push_back(request);
+            continue;
+        }
+        request->callback(token, m_model->m_vocab->id_to_token[token].tok, false);
+        request->last_token = token;
+        request->nr_token++;
+        //! the next decode token needs a free row of the context
+        if (request->nr_token >= request->max_token || request->cancelled ||
+            request->tokens.size() + request->nr_token >= graph->get_nr_ctx()) {
+            finished.push_back(request);
+        }
+    }
+    for (auto request : finished) {
+        auto it = std::find_if(
+                m_active.begin(), m_active.end(),
+                [request](const std::shared_ptr<Request>& r) {
+                    return r.get() == request;
+                });
+        auto holder = *it;
+        m_active.erase(it);
+        finish(holder);
+    }
+}
+
+void AsyncEngine::finish(std::shared_ptr<Request> request) {
+    if (request->seq != 0) {
+        m_free_seqs.push_back(request->seq);
+    }
+    //! the last call carries no token and text, or the reason of the rejection
+    if (request->error.empty()) {
+        request->callback(-1, "", true);
+    } else {
+        request->callback(REJECTED_TOKEN, request->error, true);
+    }
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_requests.erase(request->id);
+    }
+    m_finish_cv.notify_all();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "constraint.h"
+#include "model.h"
+
+namespace inferllm {
+
+class ModelImp;
+
+//! the engine runs the generation requests on its own thread, the requests
+//! share the model, so the synchronous decode of the model should not be called
+//! when there is any request running.
+//!
+//! when the graph supports the batched execution, every request starting from
+//! an empty context owns a sequence of the kv cache, and every step executes one
+//! batch which contains a decode token of every generating request and the
+//! prompt chunks of the prefilling requests, so a long prompt does not block the
+//! decode of the others. The request continuing the context of the model, or
+//! the graph without the batched execution, runs alone from start to end
+class AsyncEngine {
+public:
+    AsyncEngine(ModelImp* model);
+
+    ~AsyncEngine();
+
+    uint64_t submit(
+            const std::string& prompt, uint32_t max_token, TokenCallback callback,
+            bool reset_context);
+
+    //! the cancelled request stops before its next token, and it is finished
+    //! without generation if it is still in the queue
+    void cancel(uint64_t id);
+
+    //! block until all the submitted requests are finished
+    void wait_all();
+
+private:
+    struct Request {
+        uint64_t id;
+        std::string prompt;
+        uint32_t max_token;
+        bool reset_context;
+        TokenCallback callback;
+        std::atomic<bool> cancelled{false};
+        //! the reason why the request is rejected, empty if it is not
+        std::string error;
+
+        //! the state of the interleaved generation
+        uint32_t seq = 0;
+        std::vector<int32_t> tokens;
+        size_t nr_prefilled = 0;
+        uint32_t nr_token = 0;
+        int32_t last_token = 0;
+        std::list<int32_t> last_queue;
+        //! the grammar state of the generated tokens, null without constraint,
+        //! it is created on the submitting thread
+        std::unique_ptr<TokenConstraint> constraint;
+    };
+
+    void run();
+    //! run the request alone in the context of the model
+    void generate(Request& request);
+    //! tokenize the prompt and give the request an empty sequence, return
+    //! false if the request can not generate
+    bool start(Request& request);
+    //! tokenize the prompt of the request, it is rejected if the prompt and
+    //! one generated token exceed the remain context
+    bool tokenize(Request& request, uint32_t nr_remain);
+    //! execute one batch of the active requests
+    void step();
+    void finish(std::shared_ptr<Request> request);
+
+    ModelImp* m_model;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    //! notified when a request is submitted or the engine is stopped
+    std::condition_variable m_request_cv;
+    //! notified when a request is finished
+    std::condition_variable m_finish_cv;
+    std::deque<std::shared_ptr<Request>> m_queue;
+    //! the queued and the running requests, used by cancel
+    std::unordered_map<uint64_t, std::shared_ptr<Request>> m_requests;
+    uint64_t m_next_id = 0;
+    bool m_stop = false;
+
+    //! the interleaved requests, only accessed by the engine thread
+    std::vector<std::shared_ptr<Request>> m_active;
+    //! the sequence 0 is the context of the model, the others are allocated to
+    //! the interleaved requests and reused after they are finished
+    std::vector<uint32_t> m_free_seqs;
+    uint32_t m_nr_seq = 1;
+    std::vector<float> m_logits;
+};
+
+}  // namespace inferllm
@@ -0,0 +1,231 @@
+#include "gguf.h"
+
+#include "utils.h"
+
+using namespace inferllm;
+
+namespace {
+//! the types of the metadata values
+enum GgufType : uint32_t {
+    GGUF_UINT8 = 0,
+    GGUF_INT8,
+    GGUF_UINT16,
+    GGUF_INT16,
+    GGUF_UINT32,
+    GGUF_INT32,
+    GGUF_FLOAT32,
+    GGUF_BOOL,
+    GGUF_STRING,
+    GGUF_ARRAY,
+    GGUF_UINT64,
+    GGUF_INT64,
+    GGUF_FLOAT64,
+};
+
+//! the types of the ggml tensors which have InferLLM dtypes
+enum GgmlType : uint32_t {
+    GGML_F32 = 0,
+    GGML_F16 = 1,
+    GGML_Q4_0 = 2,
+    GGML_Q8_0 = 8,
+    GGML_Q6_K = 14,
+};
+
+template <typename T>
+T read_pod(InputFile* fin) {
+    T value;
+    fin->read_raw(&value, sizeof(value));
+    return value;
+}
+
+//! the count of a header field is bounded by the bytes left in the file, every
+//! item takes at least min_size bytes, so a broken count fails before it
+//! allocates
+void check_count(InputFile* fin, uint64_t nr, size_t min_size) {
+    size_t left = fin->size() - fin->tell();
+    INFER_ASSERT(
+            nr <= left / min_size, "the count in the gguf header exceeds the file.");
+}
+}  // namespace
+
+constexpr uint32_t GgufReader::MAGIC;
+constexpr uint32_t GgufReader::DEFAULT_ALIGNMENT;
+
+GgufReader::GgufReader(std::shared_ptr<InputFile> fin) : m_file(fin) {
+    m_version = read_pod<uint32_t>(fin.get());
+    INFER_ASSERT(
+            m_version == 2 || m_version == 3,
+            "only the gguf version 2 and 3 are supported.");
+    uint64_t nr_tensor = read_pod<uint64_t>(fin.get());
+    uint64_t nr_kv = read_pod<uint64_t>(fin.get());
+    //! the key of a value has at least the length and the type has 4 bytes, a
+    //! tensor info has the length of the name, the nr_dim, the type and the offset
+    check_count(fin.get(), nr_kv, sizeof(uint64_t) + sizeof(uint32_t));
+    check_count(fin.get(), nr_tensor, 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t));
+    for (uint64_t i = 0; i < nr_kv; i++) {
+        auto key = read_string();
+        auto type = read_pod<uint32_t>(fin.get());
+        m_values[key] = read_value(type);
+    }
+    for (uint64_t i = 0; i < nr_tensor; i++) {
+        TensorInfo info;
+        info.name = read_string();
+        auto nr_dim = read_pod<uint32_t>(fin.get());
+        INFER_ASSERT(nr_dim <= 4, "the gguf tensor has more than 4 dims.");
+        for (uint32_t d = 0; d < nr_dim; d++) {
+            info.dims.push_back(read_pod<uint64_t>(fin.get()));
+        }
+        info.type = read_pod<uint32_t>(fin.get());
+        info.offset = read_pod<uint64_t>(fin.get());
+        m_tensors.push_back(info);
+    }
+    //! the data starts at the alignment after the header, the offsets of the
+    //! tensors are relative to it and aligned too
+    size_t alignment = get_int("general.alignment", DEFAULT_ALIGNMENT);
+    INFER_ASSERT(alignment > 0, "the alignment of the gguf file is zero.");
+    size_t data_offset = (fin->tell() + alignment - 1) / alignment * alignment;
+    for (auto& info : m_tensors) {
+        info.offset += data_offset;
+    }
+}
+
+std::string GgufReader::read_string() {
+    auto len = read_pod<uint64_t>(m_file.get());
+    check_count(m_file.get(), len, 1);
+    std::string str(len, 0);
+    m_file->read_raw(&str[0], len);
+    return str;
+}
+
+void GgufReader::read_scalar(uint32_t type, int64_t& integer, double& number) {
+    auto fin = m_file.get();
+    switch (type) {
+        case GGUF_UINT8:
+        case GGUF_BOOL:
+            integer = read_pod<uint8_t>(fin);
+            break;
+        case GGUF_INT8:
+            integer = read_pod<int8_t>(fin);
+            break;
+        case GGUF_UINT16:
+            integer = read_pod<uint16_t>(fin);
+            break;
+        case GGUF_INT16:
+            integer = read_pod<int16_t>(fin);
+            break;
+        case GGUF_UINT32:
+            integer = read_pod<uint32_t>(fin);
+            break;
+        case GGUF_INT32:
+            integer = read_pod<int32_t>(fin);
+            break;
+        case GGUF_UINT64:
+            integer = static_cast<int64_t>(read_pod<uint64_t>(fin));
+            break;
+        case GGUF_INT64:
+            integer = read_pod<int64_t>(fin);
+            break;
+        case GGUF_FLOAT32:
+            number = read_pod<float>(fin);
+            integer = static_cast<int64_t>(number);
+            return;
+        case GGUF_FLOAT64:
+            number = read_pod<double>(fin);
+            integer = static_cast<int64_t>(number);
+            return;
+        default:
+            INFER_ASSERT(0, "unknown type of the gguf metadata.");
+    }
+    number = static_cast<double>(integer);
+}
+
+GgufReader::Value GgufReader::read_value(uint32_t type) {
+    Value value;
+    value.type = type;
+    if (type == GGUF_STRING) {
+        value.str = read_string();
+    } else if (type == GGUF_ARRAY) {
+        auto elem_type = read_pod<uint32_t>(m_file.get());
+        auto nr = read_pod<uint64_t>(m_file.get());
+        check_count(m_file.get(), nr, elem_type == GGUF_STRING ? sizeof(uint64_t) : 1);
+        for (uint64_t i = 0; i < nr; i++) {
+            if (elem_type == GGUF_STRING) {
+                value.strs.push_back(read_string());
+            } else if (elem_type == GGUF_ARRAY) {
+                read_value(elem_type);
+            } else {
+                int64_t integer = 0;
+                double number = 0;
+                read_scalar(elem_type, integer, number);
+                value.integers.push_back(integer);
+                value.numbers.push_back(number);
+            }
+        }
+    } else {
+        read_scalar(type, value.integer, value.number);
+    }
+    return value;
+}
+
+int64_t GgufReader::get_int(const std::string& key, int64_t value) const {
+    auto it = m_values.find(key);
+    return it == m_values.end() ? value : it->second.integer;
+}
+
+float GgufReader::get_float(const std::string& key, float value) const {
+    auto it = m_values.find(key);
+    return it == m_values.end() ? value : static_cast<float>(it->second.number);
+}
+
+std::string GgufReader::get_string(
+        const std::string& key, const std::string& value) const {
+    auto it = m_values.find(key);
+    return it == m_values.end() ? value : it->second.str;
+}
+
+std::vector<std::string> GgufReader::get_strings(const std::string& key) const {
+    auto it = m_values.find(key);
+    return it == m_values.end() ? std::vector<std::string>() : it->second.strs;
+}
+
+std::vector<float> GgufReader::get_floats(const std::string& key) const {
+    auto it = m_values.find(key);
+    if (it == m_values.end()) {
+        return {};
+    }
+    return std::vector<float>(it->second.numbers.begin(), it->second.numbers.end());
+}
+
+std::vector<int64_t> GgufReader::get_ints(const std::string& key) const {
+    auto it = m_values.find(key);
+    return it == m_values.end() ? std::vector<int64_t>() : it->second.integers;
+}
+
+bool GgufReader::convert_type(uint32_t type, DType& dtype, FileLayout& layout) {
+    layout = FileLayout::Native;
+    switch (type) {
+        case GGML_F32:
+            dtype = DType::Float32;
+            return true;
+        case GGML_F16:
+            dtype = DType::Float32;
+            layout = FileLayout::Half;
+            return true;
+        //! the blocks have the half scale instead of the float one of InferLLM
+        case GGML_Q4_0:
+            dtype = DType::Int4;
+            layout = FileLayout::GgmlBlock;
+            return true;
+        case GGML_Q8_0:
+            dtype = DType::Int8;
+            layout = FileLayout::GgmlBlock;
+            return true;
+        //! llama-quantize keeps the output of the Q4_0 files in Q6_K
+        case GGML_Q6_K:
+            dtype = DType::Int8;
+            layout = FileLayout::GgmlQ6K;
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "file.h"
+#include "tensor.h"
+
+namespace inferllm {
+
+//! the reader of the gguf model file, the header has the metadata of keys and
+//! values and the infos of the tensors, it is followed by the aligned data of the
+//! tensors, so the tensors read the file or map it directly
+class GgufReader {
+public:
+    //! "GGUF" of the first 4 bytes in little endian
+    static constexpr uint32_t MAGIC = 0x46554747;
+    static constexpr uint32_t DEFAULT_ALIGNMENT = 32;
+
+    struct TensorInfo {
+        std::string name;
+        //! the dims of ggml, the first one is the contiguous one
+        std::vector<uint64_t> dims;
+        uint32_t type;
+        //! the offset in the file
+        size_t offset;
+
+        size_t nr_number() const {
+            size_t nr = 1;
+            for (auto dim : dims) {
+                nr *= dim;
+            }
+            return nr;
+        }
+    };
+
+    //! read the header of the file, the magic is already read
+    GgufReader(std::shared_ptr<InputFile> fin);
+
+    bool has(const std::string& key) const { return m_values.count(key) > 0; }
+
+    //! the metadata of the integer, float or string types, the default is
+    //! returned if the key is missing
+    int64_t get_int(const std::string& key, int64_t value) const;
+    float get_float(const std::string& key, float value) const;
+    std::string get_string(const std::string& key, const std::string& value) const;
+    //! the metadata of the arrays, they are empty if the key is missing
+    std::vector<std::string> get_strings(const std::string& key) const;
+    std::vector<float> get_floats(const std::string& key) const;
+    std::vector<int64_t> get_ints(const std::string& key) const;
+
+    const std::vector<TensorInfo>& tensors() const { return m_tensors; }
+
+    //! the dtype and the file layout of the tensor of the ggml type, the quant
+    //! types except Q4_0, Q8_0 and Q6_K have no InferLLM dtype, return false for
+    //! them
+    static bool convert_type(uint32_t type, DType& dtype, FileLayout& layout);
+
+private:
+    //! the scalar or the array of scalars, the arrays of arrays are skipped
+    struct Value {
+        uint32_t type;
+        //! the integers and the floats are widened
+        int64_t integer = 0;
+        double number = 0;
+        std::string str;
+        std::vector<int64_t> integers;
+        std::vector<double> numbers;
+        std::vector<std::string> strs;
+    };
+
+    Value read_value(uint32_t type);
+    //! read the integer or float of the type to the value
+    void read_scalar(uint32_t type, int64_t& integer, double& number);
+    std::string read_string();
+
+    std::shared_ptr<InputFile> m_file;
+    uint32_t m_version;
+    std::map<std::string, Value> m_values;
+    std::vector<TensorInfo> m_tensors;
+};
+
+}  // namespace inferllm
@@ -1,11 +1,16 @@
 
 #include <sys/time.h>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 #include <regex>
+#include <unordered_set>
 #include <vector>
 
 #include "graph.h"
+#include "pass.h"
 
 using namespace inferllm;
 
@@ -15,25 +20,6 @@ void OprModuleBase::deduce_output_shape() {
     }
 }
 
-void OprModuleBase::execute(WorkSpace* workspace, uint32_t nr_past, bool) {
-    for (auto opr : m_oprs) {
-        opr->pre_execute();
-#ifdef INFER_PROFILE
-        struct timeval start, end;
-        gettimeofday(&start, NULL);
-#endif
-        opr->execute(workspace, nr_past);
-
-#ifdef INFER_PROFILE
-        gettimeofday(&end, NULL);
-        long seconds = end.tv_sec - start.tv_sec;
-        float micros = (seconds * 1000) + (float)(end.tv_usec - start.tv_usec) / 1000;
-        printf("Op %s spent time %f ms\n", opr->name().c_str(), micros);
-#endif
-        opr->end_execute();
-    }
-}
-
 size_t OprModuleBase::get_workspace_in_byte() {
     size_t max_workspace = 0;
     for (auto opr : m_oprs) {
@@ -65,12 +51,12 @@ LlamaFFNModule::LlamaFFNModule(
     //! matmul1
     auto matmul_out1 = add_opr<MatMul>(
             device, name + ".ffn.w1", OpIOs{input}, std::vector<size_t>{nff, embd})[0];
-    //! silu activation
-    auto silu_out = add_opr<Elemwise>(
-            device, name + ".silu", OpIOs{matmul_out1}, ElemMode::Silu)[0];
+    //! silu activation fused into the matmul
+    std::static_pointer_cast<MatMul>(oprs().back())->set_activation(ElemMode::Silu);
     //! elemwise mul
     auto mul_out = add_opr<Elemwise>(
-            device, name + ".elemwise", OpIOs{silu_out, matmul_out0}, ElemMode::Mul)[0];
+            device, name + ".elemwise", OpIOs{matmul_out1, matmul_out0},
+            ElemMode::Mul)[0];
     //! matmul2
     auto matmul_out2 = add_opr<MatMul>(
             device, name + ".ffn.w2", OpIOs{mul_out},
@@ -110,11 +96,6 @@ SparseFFNModule::SparseFFNModule(
 
 }
 
-void SparseFFNModule::execute(WorkSpace* workspace, uint32_t nr_past, bool is_prefill) 
-{
-   
-}
-
 GlmFFNModule::GlmFFNModule(
         Graph* graph, std::shared_ptr<Tensor> input, uint32_t embd, uint32_t mult,
         UserConfig model_config, Device* device, const std::string& name)
@@ -123,12 +104,11 @@ GlmFFNModule::GlmFFNModule(
     auto matmul_out1 = add_opr<MatMul>(
             device, name + ".ffn.matmul1", OpIOs{input},
             std::vector<size_t>{mult, embd}, true)[0];
-    //! gelu activation
-    auto gelu_out = add_opr<Elemwise>(
-            device, name + ".gelu", OpIOs{matmul_out1}, ElemMode::Gelu)[0];
+    //! gelu activation fused into the matmul
+    std::static_pointer_cast<MatMul>(oprs().back())->set_activation(ElemMode::Gelu);
     //! matmul2
     auto matmul_out2 = add_opr<MatMul>(
-            device, name + ".ffn.matmul2", OpIOs{gelu_out},
+            device, name + ".ffn.matmul2", OpIOs{matmul_out1},
             std::vector<size_t>{embd, mult}, true)[0];
     set_output(matmul_out2);
 }
@@ -166,17 +146,6 @@ HeadModule::HeadModule(
     set_output(matmul_out);
 }
 
-void HeadModule::execute(WorkSpace* workspace, uint32_t nr_past, bool is_prefill) {
-    //! prefill is no need to execute
-    if (!is_prefill) {
-        for (auto opr : oprs()) {
-            opr->pre_execute();
-            opr->execute(workspace, nr_past);
-            opr->end_execute();
-        }
-    }
-}
-
 EmbdModule::EmbdModule(
         Graph* graph, std::shared_ptr<Tensor> input, uint32_t embd, uint32_t vocab,
         UserConfig model_config, Device* device, const std::string& name)
@@ -190,6 +159,15 @@ EmbdModule::EmbdModule(
 //! Graph
 ///////////////////////////////////////////////////////////////////////////
 
+std::shared_ptr<Tensor> Graph::add_residual(
+        std::shared_ptr<Tensor> matmul_out, std::shared_ptr<Tensor> residual,
+        float scale) {
+    auto matmul = dynamic_cast<MatMul*>(matmul_out->owner_op());
+    INFER_ASSERT(matmul, "the residual can only be fused into the matmul.");
+    matmul->set_residual(residual, scale);
+    return matmul_out;
+}
+
 size_t Graph::get_workspace_in_byte() {
     size_t max_workspace = 0;
     for (size_t i = 0; i < m_modules.size(); i++) {
@@ -201,30 +179,23 @@ size_t Graph::get_workspace_in_byte() {
 }
 
 void Graph::execute(
-        std::vector<int32_t> in_token, std::vector<float>& logist, uint32_t nr_past,
-        bool prefill) {
-    if (m_input->dims() == 0 || !same_input_shape(in_token)) {
-        m_input->set_shape({in_token.size()}, DType::Int32);
-        size_t len = get_workspace_in_byte();
-        if(m_workspace->ptr() == nullptr) {
-            auto data = m_device->allocate(len);
-            m_workspace->set_memory(data, len);
-        } else if (m_workspace->ptr() && len > m_workspace->length()) {
-            m_device->free_device(m_workspace->ptr());
-            auto data = m_device->allocate(len);
-            m_workspace->set_memory(data, len);
-        }
+        const std::vector<int32_t>& in_token, std::vector<float>& logist,
+        uint32_t nr_past, bool prefill) {
+    if (m_pipeline) {
+        m_pipeline->execute(in_token, {}, logist, nr_past, prefill);
+        return;
     }
-
-    m_input->resume_user_count();
-    m_input->prepare_data();
-    m_device->host2device_copy(
-            m_input->ptr(), in_token.data(), in_token.size() * sizeof(int32_t), true);
+    prepare_input(in_token);
     INFER_ASSERT(
             m_output->length() == logist.size(),
             "output length is not match with logist size");
-    for (size_t i = 0; i < m_modules.size(); i++) {
-        m_modules[i]->execute(m_workspace.get(), nr_past, prefill);
+    for (auto& step : m_plan) {
+        if (!prefill || step.in_prefill) {
+            execute_step(step, nr_past);
+        }
+    }
+    if (prefill) {
+        release_prefill_skipped();
     }
     if (!prefill) {
         m_device->device2host_copy(
@@ -233,10 +204,493 @@ void Graph::execute(
     m_device->sync();
     m_output->recall_data();
 }
+
+void Graph::build_plan() {
+    m_plan.clear();
+    std::vector<OpBase*> oprs;
+    std::vector<bool> in_prefill;
+    for (auto& module : m_modules) {
+        for (auto& opr : module->oprs()) {
+            oprs.push_back(opr.get());
+            in_prefill.push_back(module->execute_in_prefill());
+        }
+    }
+    size_t begin = 0, end = 0;
+    stage_bounds(oprs, begin, end);
+    std::unordered_set<OpBase*> stage(oprs.begin() + begin, oprs.begin() + end);
+    auto boundary = first_stage() ? nullptr : m_layer_outputs[m_layer_begin - 1];
+    for (size_t i = begin; i < end; i++) {
+        //! only the hidden state of the layer before the stage comes from outside
+        for (auto& input : oprs[i]->inputs()) {
+            auto owner = input->owner_op();
+            INFER_ASSERT(
+                    !owner || stage.count(owner) || input == boundary,
+                    "the graph can't be split at the layer of the stage.");
+        }
+        m_plan.push_back({oprs[i], in_prefill[i]});
+    }
+}
+
+void Graph::stage_bounds(
+        const std::vector<OpBase*>& oprs, size_t& begin, size_t& end) {
+    auto producer = [&oprs](const std::shared_ptr<Tensor>& tensor) {
+        for (size_t i = 0; i < oprs.size(); i++) {
+            if (oprs[i]->outputs()[0] == tensor) {
+                return i;
+            }
+        }
+        INFER_ASSERT(0, "the layer output is not produced by the graph.");
+        return oprs.size();
+    };
+    begin = first_stage() ? 0 : producer(m_layer_outputs[m_layer_begin - 1]) + 1;
+    end = last_stage() ? oprs.size() : producer(m_layer_outputs[m_layer_end - 1]) + 1;
+}
+
+std::vector<OpBase*> Graph::stage_oprs() {
+    std::vector<OpBase*> oprs;
+    for (auto& module : m_modules) {
+        for (auto& opr : module->oprs()) {
+            oprs.push_back(opr.get());
+        }
+    }
+    size_t begin = 0, end = 0;
+    stage_bounds(oprs, begin, end);
+    return std::vector<OpBase*>(oprs.begin() + begin, oprs.begin() + end);
+}
+
+void Graph::set_layer_range(uint32_t begin, uint32_t end) {
+    INFER_ASSERT(
+            begin < end && end <= m_layer_outputs.size(),
+            "the layer range of the stage is invalid.");
+    INFER_ASSERT(m_plan.empty(), "the layer range is set before the execution.");
+    m_layer_begin = begin;
+    m_layer_end = end;
+}
+
+namespace {
+//! drop the users of the tensor whose readers are not executed, so its memory
+//! is recalled and allocated with the right shape next time
+void release_users(const std::shared_ptr<Tensor>& tensor) {
+    while (!tensor->shared() && tensor->get_curr_user_count() > 0) {
+        tensor->decrease_curr_user_count();
+    }
+}
+
+//! the rows 0, 1, ..., len - 1 of the head
+std::vector<uint32_t> iota_rows(size_t len) {
+    std::vector<uint32_t> rows(len);
+    std::iota(rows.begin(), rows.end(), 0);
+    return rows;
+}
+}  // namespace
+
+void Graph::release_prefill_skipped() {
+    //! the views before their bases
+    for (size_t i = m_plan.size(); i-- > 0;) {
+        if (m_plan[i].in_prefill) {
+            continue;
+        }
+        for (auto& input : m_plan[i].opr->inputs()) {
+            release_users(input);
+        }
+    }
+}
+
+void Graph::execute_stage(
+        const std::vector<int32_t>& in_token, const std::vector<uint32_t>& seqs,
+        std::vector<float>& data, uint32_t nr_past, bool prefill) {
+    if (!seqs.empty()) {
+        begin_batch(seqs);
+    }
+    prepare_input(in_token);
+    if (!first_stage()) {
+        auto hidden = m_layer_outputs[m_layer_begin - 1];
+        hidden->resume_user_count();
+        hidden->prepare_data();
+        INFER_ASSERT(
+                hidden->length() == data.size(),
+                "the hidden state of the stage is mismatch.");
+        m_device->host2device_copy(
+                hidden->ptr(), data.data(), data.size() * sizeof(float), true);
+        hidden->set_quantized_ready(false);
+        //! the embedding is in the first stage
+        release_users(m_input);
+    }
+    for (auto& step : m_plan) {
+        if (!prefill || step.in_prefill) {
+            execute_step(step, nr_past);
+        }
+    }
+    if (prefill) {
+        release_prefill_skipped();
+    }
+    if (last_stage()) {
+        data.resize(prefill ? 0 : m_output->length());
+        if (!prefill) {
+            m_device->device2host_copy(
+                    data.data(), m_output->ptr(), data.size() * sizeof(float), true);
+        }
+        m_device->sync();
+        m_output->recall_data();
+    } else {
+        auto hidden = m_layer_outputs[m_layer_end - 1];
+        data.resize(hidden->length());
+        m_device->device2host_copy(
+                data.data(), hidden->ptr(), data.size() * sizeof(float), true);
+        m_device->sync();
+        release_users(hidden);
+    }
+    if (!seqs.empty()) {
+        end_batch();
+    }
+}
+
+void Graph::set_pipeline(std::unique_ptr<PipelineStage> pipeline) {
+    m_pipeline = std::move(pipeline);
+}
+
+void Graph::share_weights(const std::string& name) {
+    INFER_ASSERT(
+            m_device->unified_memory(), "the weight segment is in the host memory.");
+    INFER_ASSERT(m_plan.empty(), "the weights are shared before the execution.");
+    std::vector<std::shared_ptr<Tensor>> weights;
+    std::unordered_set<Tensor*> visited;
+    for (auto opr : stage_oprs()) {
+        for (auto& weight : opr->weights()) {
+            if (visited.insert(weight.get()).second) {
+                weights.push_back(weight);
+            }
+        }
+    }
+    std::sort(
+            weights.begin(), weights.end(),
+            [](const std::shared_ptr<Tensor>& a, const std::shared_ptr<Tensor>& b) {
+                return a->name() < b->name();
+            });
+    size_t data_size = 0;
+    for (auto& weight : weights) {
+        data_size += WeightSegment::aligned(weight->length_in_byte());
+    }
+    m_weight_segment =
+            WeightSegment::create_or_attach(name, weights.size(), data_size);
+    auto& segment = m_weight_segment;
+    size_t offset = 0;
+    for (uint32_t id = 0; id < weights.size(); id++) {
+        auto& weight = weights[id];
+        auto& entry = segment->entry(id);
+        size_t length = weight->length_in_byte();
+        if (segment->creator()) {
+            INFER_ASSERT(
+                    weight->name().size() < sizeof(entry.name),
+                    "the weight name is too long for the weight segment.");
+            strcpy(entry.name, weight->name().c_str());
+            entry.offset = offset;
+            entry.length = length;
+            entry.dtype = static_cast<uint32_t>(weight->dtype());
+            offset += WeightSegment::aligned(length);
+            //! the weight is read and reordered by its op as the private one
+            weight->prepare_data();
+            entry.preprocessed = weight->preprocessed();
+            entry.dims = weight->dims();
+            for (uint32_t i = 0; i < entry.dims; i++) {
+                entry.shape[i] = weight->shape()[i];
+            }
+            void* data = segment->data(id);
+            if (entry.dims == 2) {
+                m_device->distribute(data, length, entry.shape[0]);
+            }
+            memcpy(data, weight->ptr(), length);
+            weight->set_segment_data(data);
+            continue;
+        }
+        INFER_ASSERT(
+                weight->name() == entry.name && entry.length == length &&
+                        entry.dtype == static_cast<uint32_t>(weight->dtype()),
+                "the weight segment is of another model, remove it first.");
+        //! the reordered layout depends on the kernel of the process
+        auto opr = weight->owner_op();
+        INFER_ASSERT(
+                static_cast<bool>(entry.preprocessed) ==
+                        opr->need_preprocess_weight(weight.get()),
+                "the weight segment is prepared for another kernel.");
+        if (entry.preprocessed) {
+            weight->set_shape(
+                    std::vector<size_t>(entry.shape, entry.shape + entry.dims));
+            opr->set_weight_preprocessed(weight.get());
+        }
+        weight->set_segment_data(segment->data(id));
+    }
+    if (segment->creator()) {
+        segment->publish();
+    }
+}
+
+void Graph::add_passes(PassManager& manager) {
+    manager.add_pass<EliminateReshapePass>()
+            .add_pass<FoldNormWeightPass>()
+            .add_pass<GroupSiblingPass>()
+            .add_pass<ShareQuantizedInputPass>();
+}
+
+void Graph::execute_step(const PlanStep& step, uint32_t nr_past) {
+    OpBase* opr = step.opr;
+    opr->pre_execute();
+    //! the outputs are written, so their quantized companions are stale
+    for (auto& output : opr->outputs()) {
+        output->set_quantized_ready(false);
+    }
+#ifdef INFER_PROFILE
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+#endif
+    opr->execute(m_workspace.get(), nr_past);
+#ifdef INFER_PROFILE
+    gettimeofday(&end, NULL);
+    long seconds = end.tv_sec - start.tv_sec;
+    float micros = (seconds * 1000) + (float)(end.tv_usec - start.tv_usec) / 1000;
+    printf("Op %s spent time %f ms\n", opr->name().c_str(), micros);
+#endif
+    opr->end_execute();
+}
+
+void Graph::prepare_plan() {
+    //! the graph is rewritten once the dtypes of the weights are loaded
+    if (m_plan.empty()) {
+        PassManager manager;
+        add_passes(manager);
+        manager.run(this);
+        build_plan();
+    }
+}
+
+void Graph::prepare_weights() {
+    prepare_plan();
+    for (auto& step : m_plan) {
+        for (auto& weight : step.opr->weights()) {
+            weight->prepare_data();
+        }
+    }
+}
+
+void Graph::prepare_input(const std::vector<int32_t>& in_token) {
+    prepare_plan();
+    if (m_input->dims() == 0 || !same_input_shape(in_token) || m_shape_dirty) {
+        m_shape_dirty = false;
+        size_t len = 0;
+        if (m_custom_plan) {
+            m_input->set_shape({in_token.size()}, DType::Int32);
+            len = get_workspace_in_byte();
+        } else {
+            len = plan_workspace(in_token.size(), m_all_logits);
+            m_input->set_shape({in_token.size()}, DType::Int32);
+            deduce_output_shape();
+        }
+        reserve_workspace(len);
+    }
+
+    m_input->resume_user_count();
+    m_input->prepare_data();
+    m_device->host2device_copy(
+            m_input->ptr(), in_token.data(), in_token.size() * sizeof(int32_t), true);
+}
+size_t Graph::plan_workspace(size_t len, bool all_logits) {
+    //! the workspace only grows with the input length, so the one planned with
+    //! the upper bound of the bucket serves all the lengths in the bucket
+    size_t bucket = 1;
+    while (bucket < len) {
+        bucket <<= 1;
+    }
+    //! no input is longer than the context, so the last bucket ends at it
+    bucket = std::max<size_t>(len, std::min<size_t>(bucket, get_nr_ctx()));
+    auto& plan = all_logits ? m_all_logits_plan : m_workspace_plan;
+    auto it = plan.find(bucket);
+    if (it != plan.end()) {
+        return it->second;
+    }
+    auto head = static_cast<MatMulLast*>(m_output->owner_op());
+    if (all_logits) {
+        head->set_rows(iota_rows(bucket));
+    }
+    m_input->set_shape({bucket}, DType::Int32);
+    size_t size = get_workspace_in_byte();
+    if (all_logits) {
+        head->set_rows(iota_rows(len));
+    }
+    plan[bucket] = size;
+    return size;
+}
+
+void Graph::reserve_workspace(size_t len) {
+    if (m_workspace->ptr() == nullptr) {
+        auto data = m_device->allocate(len);
+        m_workspace->set_memory(data, len);
+    } else if (m_workspace->ptr() && len > m_workspace->length()) {
+        m_device->free_device(m_workspace->ptr());
+        auto data = m_device->allocate(len);
+        m_workspace->set_memory(data, len);
+    }
+}
+
+void Graph::preallocate_workspace(uint32_t max_len) {
+    reserve_workspace(plan_workspace(max_len));
+    //! the input shape is the one of the bucket now
+    m_shape_dirty = true;
+}
+
+void Graph::deduce_output_shape() {
+    for (auto module : m_modules) {
+        module->deduce_output_shape();
+    }
+}
+
+void Graph::execute_all_logits(
+        const std::vector<int32_t>& in_token, std::vector<float>& logist,
+        uint32_t nr_past) {
+    INFER_ASSERT(!m_pipeline, "the pipeline only supports the generation.");
+    //! the output of the graph is the output of the MatMulLast in head module
+    auto head = dynamic_cast<MatMulLast*>(m_output->owner_op());
+    INFER_ASSERT(head, "the graph output is not produced by MatMulLast.");
+    //! the workspace of every row of the head is planned by the bucket of the
+    //! length like the one of the last row, only the shapes are deduced again
+    head->set_rows(iota_rows(in_token.size()));
+    m_shape_dirty = true;
+    m_all_logits = true;
+    execute(in_token, logist, nr_past, false);
+    head->set_rows({});
+    m_shape_dirty = true;
+    m_all_logits = false;
+}
+
+void Graph::execute_hidden(
+        const std::vector<int32_t>& in_token, std::vector<float>& hidden,
+        uint32_t nr_past, int32_t layer) {
+    INFER_ASSERT(!m_pipeline, "the pipeline only supports the generation.");
+    INFER_ASSERT(
+            layer < static_cast<int32_t>(m_layer_outputs.size()),
+            "the layer to extract hidden state is out of range.");
+    //! the final hidden state is the normed input of the MatMulLast
+    std::shared_ptr<Tensor> target = layer < 0 ? m_output->owner_op()->inputs()[0]
+                                               : m_layer_outputs[layer];
+    prepare_input(in_token);
+    INFER_ASSERT(
+            target->length() == hidden.size(),
+            "hidden state length is not match with hidden size");
+    //! execute the plan until the operator which produces the target, the
+    //! consumers of the target are skipped
+    size_t end = 0;
+    while (end < m_plan.size()) {
+        execute_step(m_plan[end], nr_past);
+        if (m_plan[end++].opr->outputs()[0] == target) {
+            break;
+        }
+    }
+    m_device->device2host_copy(
+            hidden.data(), target->ptr(), hidden.size() * sizeof(float), true);
+    m_device->sync();
+    //! the skipped readers never release the tensors written before the cut, so
+    //! release them, the views before their bases, to allocate them with the
+    //! shape of the next execution
+    for (size_t i = end; i-- > 0;) {
+        for (auto& output : m_plan[i].opr->outputs()) {
+            release_users(output);
+        }
+        for (auto& input : m_plan[i].opr->inputs()) {
+            release_users(input);
+        }
+    }
+}
+
+std::vector<AttentionBase*> Graph::attention_oprs() {
+    std::vector<AttentionBase*> attentions;
+    for (auto module : m_modules) {
+        for (auto opr : module->oprs()) {
+            if (auto attention = dynamic_cast<AttentionBase*>(opr.get())) {
+                attentions.push_back(attention);
+            }
+        }
+    }
+    return attentions;
+}
+
+bool Graph::support_batch() {
+    for (auto attention : attention_oprs()) {
+        if (!dynamic_cast<LlamaAttention*>(attention)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Graph::execute_batch(
+        const std::vector<int32_t>& in_token, const std::vector<uint32_t>& seqs,
+        std::vector<float>& logist) {
+    INFER_ASSERT(
+            in_token.size() == seqs.size(),
+            "every token of the batch should belong to a sequence.");
+    INFER_ASSERT(support_batch(), "batched decode only support the llama attention.");
+    if (m_pipeline) {
+        m_pipeline->execute(in_token, seqs, logist, 0, false);
+        return;
+    }
+    begin_batch(seqs);
+    execute(in_token, logist, 0, false);
+    end_batch();
+}
+
+void Graph::begin_batch(const std::vector<uint32_t>& seqs) {
+    for (auto attention : attention_oprs()) {
+        attention->set_batch_seqs(seqs);
+    }
+    //! only the last row of every sequence outputs the logits
+    std::vector<uint32_t> rows;
+    for (size_t i = 0; i < seqs.size(); i++) {
+        if (i + 1 == seqs.size() || seqs[i + 1] != seqs[i]) {
+            rows.push_back(i);
+        }
+    }
+    auto head = dynamic_cast<MatMulLast*>(m_output->owner_op());
+    INFER_ASSERT(head, "the graph output is not produced by MatMulLast.");
+    head->set_rows(rows);
+    //! the workspace of attention is changed with the batch
+    m_shape_dirty = true;
+    m_custom_plan = true;
+}
+
+void Graph::end_batch() {
+    auto head = static_cast<MatMulLast*>(m_output->owner_op());
+    head->set_rows({});
+    for (auto attention : attention_oprs()) {
+        attention->set_batch_seqs({});
+    }
+    m_shape_dirty = true;
+    m_custom_plan = false;
+}
+
+void Graph::fork_seq(uint32_t src, uint32_t dst) {
+    for (auto attention : attention_oprs()) {
+        attention->fork_seq(src, dst);
+    }
+    if (m_pipeline && first_stage()) {
+        m_pipeline->fork_seq(src, dst);
+    }
+}
+
+void Graph::reset_seq(uint32_t seq) {
+    for (auto attention : attention_oprs()) {
+        attention->reset_seq(seq);
+    }
+    if (m_pipeline && first_stage()) {
+        m_pipeline->reset_seq(seq);
+    }
+}
+
 void Graph::reset_ctx() {
     for (size_t i = 0; i < m_modules.size(); i++) {
         m_modules[i]->reset_ctx();
     }
+    if (m_pipeline && first_stage()) {
+        m_pipeline->reset_ctx();
+    }
 }
 
 void Graph::collect_weights() {
@@ -300,7 +754,7 @@ Graph::~Graph() {
     }
 }
 
-bool Graph::same_input_shape(std::vector<int32_t> in_token) {
+bool Graph::same_input_shape(const std::vector<int32_t>& in_token) {
     INFER_ASSERT(m_input->dims() == 1, "input tensor should be one dim.");
     return m_input->shape()[0] == in_token.size();
 }
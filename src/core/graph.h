@@ -3,7 +3,9 @@
 #include <unordered_map>
 #include "kvstorage.h"
 #include "op.h"
+#include "pipeline.h"
 #include "tensor.h"
+#include "weight_segment.h"
 #include "kern/kernel_define.h"
 
 namespace inferllm {
@@ -20,13 +22,17 @@ struct LlmParams {
     int32_t n_rot;
     int32_t ftype;
     int32_t n_ctx;  // this is provided as user input?
+    //! the hidden size of the feed forward, 0 is derived from n_mult
+    int32_t n_ff = 0;
 };
 
 struct UserConfig {
     DType compt_type;
+    bool kv_head_major = false;
 };
 
 class Graph;
+class PassManager;
 
 class OprModuleBase {
 public:
@@ -39,9 +45,6 @@ public:
     size_t get_workspace_in_byte();
     void deduce_output_shape();
 
-    virtual void execute(
-            WorkSpace* workspace, uint32_t nr_past, bool is_prefill = false);
-
     template <typename Op, typename... Args>
     std::vector<std::shared_ptr<Tensor>> add_opr(Args&&... args) {
         auto opr = std::make_shared<Op>(std::forward<Args>(args)...);
@@ -71,6 +74,10 @@ public:
 
     virtual void reset_ctx() {}
 
+    //! whether the operators run when prefill, the graph flattens the operators
+    //! of all the modules to its execution plan with it
+    virtual bool execute_in_prefill() const { return true; }
+
     std::vector<std::shared_ptr<OpBase>>& oprs() { return m_oprs; }
 
 private:
@@ -101,6 +108,9 @@ public:
         m_attention_op = std::make_shared<Attention>(
                 device, name, OpIOs{input}, embd, n_rot, n_ctx, head, layer_id,
                 model_config.compt_type, fused_weights, bias, rotary_mode);
+        if (model_config.kv_head_major) {
+            m_attention_op->set_kv_head_major();
+        }
         oprs().push_back(m_attention_op);
         auto v_out = m_attention_op->outputs()[0];
         //! matmul proj
@@ -149,7 +159,6 @@ class SparseFFNModule : public OprModuleBase {
 public:
     SparseFFNModule(Graph* graph, std::shared_ptr<Tensor> input, std::shared_ptr<Tensor> predictor_out, 
             uint32_t embd, uint32_t mult, UserConfig model_config, Device* device, const std::string& name);
-    void execute(WorkSpace* workspace, uint32_t nr_past, bool is_prefill = false) override;
 private:
     uint32_t m_embd;
     Graph* m_graph;
@@ -184,8 +193,8 @@ public:
             UserConfig model_config, Device* device, const std::string& name,
             bool bias = false, float eps = 1e-5);
 
-    void execute(
-            WorkSpace* workspace, uint32_t nr_past, bool is_prefill = false) override;
+    //! the logits of prefill are not used
+    bool execute_in_prefill() const override { return false; }
 
 private:
     uint32_t m_embd;
@@ -239,8 +248,77 @@ public:
     virtual ~Graph();
 
     void execute(
-            std::vector<int32_t> in_token, std::vector<float>& logist, uint32_t nr_past,
-            bool prefill = false);
+            const std::vector<int32_t>& in_token, std::vector<float>& logist,
+            uint32_t nr_past, bool prefill = false);
+
+    //! execute the graph and output the logits of every input token, the logist
+    //! layout is {in_token.size(), n_vocab}, used to score a sequence
+    void execute_all_logits(
+            const std::vector<int32_t>& in_token, std::vector<float>& logist,
+            uint32_t nr_past);
+
+    //! execute the graph until the hidden state of the given layer is produced,
+    //! the LM head is skipped, layer < 0 means the final normed hidden state,
+    //! the hidden layout is {in_token.size(), n_embd}
+    void execute_hidden(
+            const std::vector<int32_t>& in_token, std::vector<float>& hidden,
+            uint32_t nr_past, int32_t layer = -1);
+
+    //! execute the tokens of several sequences in one execution, token i belongs
+    //! to the sequence seqs[i] and the tokens of a sequence are consecutive, such
+    //! as one decode token of a sequence or a chunk of its prompt, row j of the
+    //! logist is the logits of the last token of the j-th sequence
+    void execute_batch(
+            const std::vector<int32_t>& in_token, const std::vector<uint32_t>& seqs,
+            std::vector<float>& logist);
+
+    //! only the llama attention support the batched execution
+    bool support_batch();
+
+    //! execute only the layers [begin, end) as a stage of the pipeline, the stage
+    //! after the first one reads the hidden state of the layer begin - 1 instead
+    //! of the embedding of the tokens, the stage before the last one outputs the
+    //! hidden state of the layer end - 1 instead of the logits, the weights of
+    //! the other layers are never read
+    void set_layer_range(uint32_t begin, uint32_t end);
+    bool first_stage() const { return m_layer_begin == 0; }
+    bool last_stage() const { return m_layer_end >= m_layer_outputs.size(); }
+
+    //! the operators of the layer range in execution order
+    std::vector<OpBase*> stage_oprs();
+
+    //! execute the layer range with the tokens, which deduce the shapes of every
+    //! stage, the seqs are the sequences of the batched tokens like execute_batch,
+    //! data is the input hidden state, it is replaced by the output hidden state
+    //! or the logits of the last stage
+    void execute_stage(
+            const std::vector<int32_t>& in_token, const std::vector<uint32_t>& seqs,
+            std::vector<float>& data, uint32_t nr_past, bool prefill = false);
+
+    //! the pipeline which the graph is a stage of, the execution and the kv cache
+    //! of the first stage are passed through the pipeline
+    void set_pipeline(std::unique_ptr<PipelineStage> pipeline);
+    PipelineStage* pipeline() { return m_pipeline.get(); }
+
+    //! put the weights of the stage in the shared weight segment of the name, the
+    //! first process prepares them into it and the later ones map them, the
+    //! weights in the segment are read only, so the norm is not folded into them
+    void share_weights(const std::string& name);
+
+    //! rewrite the graph and read all the weights of the plan, which are read at
+    //! the first execution otherwise, such as before the process forks workers
+    void prepare_weights();
+
+    //! whether the prompt can be executed chunk by chunk, the graph which
+    //! deduces the positions from the whole prompt does not support
+    virtual bool support_chunked_prefill() { return true; }
+
+    //! let the sequence dst share the kv cache of the sequence src, the shared
+    //! cache is copied when one of the sequences appends to it
+    void fork_seq(uint32_t src, uint32_t dst);
+
+    //! drop the kv cache of the sequence, it restarts from an empty context
+    void reset_seq(uint32_t seq);
 
     Device* device() { return m_device; }
 
@@ -250,6 +328,13 @@ public:
 
     size_t get_workspace_in_byte();
 
+    //! deduce the output shape of all the modules with the current input shape
+    void deduce_output_shape();
+
+    //! allocate the workspace of the input with max_len tokens ahead, so the
+    //! later executions with no more tokens do not allocate
+    void preallocate_workspace(uint32_t max_len);
+
     template <typename OpModule, typename... Args>
     std::shared_ptr<Tensor> add_module(Args&&... args) {
         auto module = std::make_shared<OpModule>(std::forward<Args>(args)...);
@@ -266,6 +351,12 @@ public:
         return module;
     }
 
+    //! add residual * scale to the output of a matmul inside the matmul, instead
+    //! of an elemwise add op, the output of the matmul is returned
+    std::shared_ptr<Tensor> add_residual(
+            std::shared_ptr<Tensor> matmul_out, std::shared_ptr<Tensor> residual,
+            float scale = 1.0f);
+
     void reset_ctx();
 
     void collect_weights();
@@ -278,7 +369,7 @@ public:
 
     static DType convert_dtype(int32_t type);
 
-    bool same_input_shape(std::vector<int32_t> in_token);
+    bool same_input_shape(const std::vector<int32_t>& in_token);
 
     virtual void load(
             std::shared_ptr<InputFile> fin, LlmParams& param,
@@ -288,25 +379,84 @@ public:
 
     virtual void set_weights_alias(){};
 
+    //! the passes which rewrite the graph before its first execution, the model
+    //! can override it to add its own passes
+    virtual void add_passes(PassManager& manager);
+
     virtual void post_tokenize(std::vector<Vocab::Id>& input) {}
 
     uint32_t get_nr_ctx() { return m_param.n_ctx; }
     uint32_t get_nr_vocab() { return m_param.n_vocab; }
+    uint32_t get_nr_embd() { return m_param.n_embd; }
+    uint32_t get_nr_layer() { return m_layer_outputs.size(); }
 
     std::shared_ptr<Tensor> m_input;
     std::shared_ptr<Tensor> m_output;
     std::unordered_map<std::string, std::shared_ptr<Tensor>> m_weights_map;
     std::unordered_map<std::string, std::string> m_weights_name_aliases;
     std::vector<std::shared_ptr<OprModuleBase>> m_modules;
+    //! the output hidden state of every transformer layer
+    std::vector<std::shared_ptr<Tensor>> m_layer_outputs;
 
     LlmParams m_param;
 
 private:
+    //! one operator of the flat execution plan
+    struct PlanStep {
+        OpBase* opr;
+        bool in_prefill;
+    };
+
+    //! flatten the operators of all the modules in execution order, the plan is
+    //! built once and the executions walk it without the module dispatch
+    void build_plan();
+    void execute_step(const PlanStep& step, uint32_t nr_past);
+    //! the steps skipped in prefill never read their inputs, release them to
+    //! allocate them with the shape of the next execution
+    void release_prefill_skipped();
+
+    void prepare_input(const std::vector<int32_t>& in_token);
+    //! run the passes and build the plan if it is not built
+    void prepare_plan();
+
+    //! the range of the layer range in the operators of all the modules
+    void stage_bounds(const std::vector<OpBase*>& oprs, size_t& begin, size_t& end);
+
+    //! set the sequences of the batched tokens and the rows of their logits
+    void begin_batch(const std::vector<uint32_t>& seqs);
+    void end_batch();
+
+    //! the workspace size of the input length, it is planned once for every
+    //! power of two bucket of the length and cached, all_logits plans the head
+    //! which computes the logits of every row
+    size_t plan_workspace(size_t len, bool all_logits = false);
+
+    //! grow the workspace memory to len bytes
+    void reserve_workspace(size_t len);
+
+    std::vector<AttentionBase*> attention_oprs();
+
     std::string m_name;
     UserConfig m_model_config;
     Device* m_device = nullptr;
 
     std::shared_ptr<Tensor> m_embeddings;
     std::unique_ptr<WorkSpace> m_workspace;
+    //! whether the output shape is changed since the last workspace deduce
+    bool m_shape_dirty = false;
+    //! the head rows or the batch of the execution is not the plain one, so its
+    //! workspace is deduced directly instead of from the plan
+    bool m_custom_plan = false;
+    //! the head computes the logits of every input row
+    bool m_all_logits = false;
+    //! the bucket of the input length -> the workspace size
+    std::unordered_map<size_t, size_t> m_workspace_plan;
+    std::unordered_map<size_t, size_t> m_all_logits_plan;
+    std::vector<PlanStep> m_plan;
+
+    uint32_t m_layer_begin = 0;
+    uint32_t m_layer_end = UINT32_MAX;
+    std::unique_ptr<PipelineStage> m_pipeline;
+    std::unique_ptr<WeightSegment> m_weight_segment;
 };
 }  // namespace inferllm
@@ -6,9 +6,14 @@ namespace inferllm {
 
 //! the kv storage is used to store the key and value, init with a part of memory, when
 //! memory is not enough, it will allocate a new memory and copy the data to the new
+//!
+//! the shape is {nr_ctx, embd}, and the rows are stored one by one by default, when
+//! the head is given, the storage is head major {head, nr_ctx, embd / head}, so the
+//! rows of a head are contiguous for the attention of the head
 class KvStorage : public Tensor {
 public:
-    KvStorage(std::vector<size_t> shape, DType dtype, Device* device);
+    KvStorage(
+            std::vector<size_t> shape, DType dtype, Device* device, uint32_t head = 0);
 
     ~KvStorage() {
         auto data = ptr();
@@ -20,7 +25,7 @@ public:
                 "The Kvstorage is not ready, please call prepare_data ahead.");
         m_curr_data = static_cast<char*>(ptr()) +
                       static_cast<size_t>(
-                              (stride()[0] * m_store_id * dtype_in_byte(dtype())));
+                              (row_stride() * m_store_id * dtype_in_byte(dtype())));
         return m_curr_data;
     }
 
@@ -33,12 +38,28 @@ public:
         m_store_id += id;
         m_curr_data = static_cast<char*>(ptr()) +
                       static_cast<size_t>(
-                              (stride()[0] * m_store_id * dtype_in_byte(dtype())));
+                              (row_stride() * m_store_id * dtype_in_byte(dtype())));
         return m_store_id;
     }
 
     size_t current_index() const { return m_store_id; }
 
+    bool head_major() const { return m_head > 0; }
+
+    //! the number of elements between two adjacent rows of a head
+    size_t row_stride() const { return stride()[m_head > 0 ? 1 : 0]; }
+
+    //! the number of elements between the first rows of two adjacent heads, only
+    //! for the head major storage, it changes when the storage grows
+    size_t head_stride() const {
+        INFER_ASSERT(m_head > 0, "the kv storage is not head major.");
+        return stride()[0];
+    }
+
+    //! copy the stored key or value to a new storage, used when the storage is
+    //! shared by several sequences and one of them appends to it
+    std::shared_ptr<KvStorage> clone();
+
     // reset the current index to 0, and set the current data to the first
     void reset_id() {
         m_store_id = 0;
@@ -46,6 +67,13 @@ public:
     }
 
 private:
+    //! the copy of other which owns data, the copied memory of other
+    KvStorage(KvStorage& other, void* data);
+
+    //! move the memory of every head to the threads which compute its attention
+    void distribute(void* data, size_t len);
+
+    uint32_t m_head;
     size_t m_store_id;
     size_t m_total_id;
     uint32_t m_curr_id;
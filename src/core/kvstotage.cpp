@@ -28,49 +28,97 @@ private:
 
 std::shared_ptr<KvStorageConfig> KvStorageConfig::instance = nullptr;
 
-KvStorage::KvStorage(std::vector<size_t> shape, DType dtype, Device* device)
+KvStorage::KvStorage(
+        std::vector<size_t> shape, DType dtype, Device* device, uint32_t head)
         : Tensor(device, "kvstorage") {
+    m_head = head;
     m_store_id = 0;
     m_total_id = shape[0];
     m_kv_id = KvStorageConfig::get_instance()->increase_count();
     m_curr_id = KvStorageConfig::get_instance()->get_start_index();
     //! only allocate the memory of length m_curr_id * embd
     shape[0] = m_curr_id;
+    if (m_head > 0) {
+        INFER_ASSERT(shape[1] % m_head == 0, "the embd of kv is not match the head.");
+        shape = {m_head, m_curr_id, shape[1] / m_head};
+    }
     set_shape(shape, dtype);
     size_t len = length_in_byte();
     //! no need use memory pool
     auto data = device->aligned_alloc(len);
+    distribute(data, len);
     set_shared_memory(data, len);
 }
 
+void KvStorage::distribute(void* data, size_t len) {
+    //! the heads are the sub tasks of the attention
+    if (m_head > 0) {
+        device()->distribute(data, len, m_head);
+    }
+}
+
 void KvStorage::set_shared_memory(void* data, size_t size) {
     Tensor::set_shared_memory(data, size);
     m_curr_data =
             static_cast<char*>(ptr()) +
-            static_cast<size_t>((stride()[0] * m_store_id * dtype_in_byte(dtype())));
+            static_cast<size_t>((row_stride() * m_store_id * dtype_in_byte(dtype())));
 }
 
 TensorState KvStorage::prepare_data_with_length(uint32_t len) {
     Tensor::prepare_data();
     //! if memory is not enough, allocate a new memory and copy the data to the new
     if (m_store_id + len >= m_curr_id) {
-        auto shape = this->shape();
-        shape[0] = m_curr_id + KvStorageConfig::KV_STEP;
+        //! grow by steps until the appended rows fit
+        uint32_t curr_id = m_curr_id + KvStorageConfig::KV_STEP;
+        while (m_store_id + len >= curr_id) {
+            curr_id += KvStorageConfig::KV_STEP;
+        }
+        std::vector<size_t> shape = this->shape();
+        shape[m_head > 0 ? 1 : 0] = curr_id;
         size_t old_len = length_in_byte();
         void* old_ptr = ptr();
 
         set_shape(shape, dtype());
         size_t len = length_in_byte();
         auto data = device()->aligned_alloc(len);
-        device()->device2device_copy(data, old_ptr, old_len);
+        //! the rows of every head are copied to the start of its new rows
+        size_t nr_part = m_head > 0 ? m_head : 1;
+        for (size_t i = 0; i < nr_part; i++) {
+            device()->device2device_copy(
+                    static_cast<char*>(data) + i * len / nr_part,
+                    static_cast<char*>(old_ptr) + i * old_len / nr_part,
+                    old_len / nr_part);
+        }
 
         device()->aligned_free(old_ptr);
+        distribute(data, len);
 
         set_shared_memory(data, len);
-        m_curr_id += KvStorageConfig::KV_STEP;
+        m_curr_id = curr_id;
     }
     m_curr_data =
             static_cast<char*>(ptr()) +
-            static_cast<size_t>((stride()[0] * m_store_id * dtype_in_byte(dtype())));
+            static_cast<size_t>((row_stride() * m_store_id * dtype_in_byte(dtype())));
     return TensorState::Own;
 }
+
+KvStorage::KvStorage(KvStorage& other, void* data)
+        : Tensor(other.device(), "kvstorage"),
+          m_head(other.m_head),
+          m_store_id(other.m_store_id),
+          m_total_id(other.m_total_id),
+          m_curr_id(other.m_curr_id),
+          m_kv_id(other.m_kv_id) {
+    //! the same capacity and the same stored rows as other
+    set_shape(other.shape(), other.dtype());
+    size_t len = length_in_byte();
+    distribute(data, len);
+    set_shared_memory(data, len);
+}
+
+std::shared_ptr<KvStorage> KvStorage::clone() {
+    size_t len = length_in_byte();
+    auto data = device()->aligned_alloc(len);
+    device()->device2device_copy(data, ptr(), len);
+    return std::shared_ptr<KvStorage>(new KvStorage(*this, data));
+}
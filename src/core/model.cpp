@@ -1,5 +1,8 @@
+#include <cstdlib>
+
 #include "model.h"
 #include "model_imp.h"
+#include "weight_segment.h"
 
 using namespace inferllm;
 
@@ -43,6 +46,111 @@ std::string Model::decode_iter(int& token) {
     return m_model_imp->decode_iter(token);
 }
 
+std::vector<float> Model::score(const std::string& text, uint32_t chunk_size) {
+    return m_model_imp->score(text, chunk_size);
+}
+
+std::vector<std::vector<float>> Model::embedding(
+        const std::vector<std::string>& texts, const std::string& pooling,
+        int32_t layer, uint32_t chunk_size) {
+    return m_model_imp->embedding(texts, pooling, layer, chunk_size);
+}
+
+std::vector<Candidate> Model::beam_search(
+        const std::string& prompt, uint32_t nr_beam, uint32_t max_token) {
+    return m_model_imp->beam_search(prompt, nr_beam, max_token);
+}
+
+std::vector<Candidate> Model::sample_n(
+        const std::string& prompt, uint32_t nr_sample, uint32_t max_token) {
+    return m_model_imp->sample_n(prompt, nr_sample, max_token);
+}
+
+uint64_t Model::submit(
+        const std::string& prompt, uint32_t max_token, TokenCallback callback,
+        bool reset_context) {
+    return m_model_imp->submit(prompt, max_token, callback, reset_context);
+}
+
+std::shared_ptr<TokenStream> Model::submit_stream(
+        const std::string& prompt, uint32_t max_token, bool reset_context) {
+    return m_model_imp->submit_stream(prompt, max_token, reset_context);
+}
+
+void Model::cancel(uint64_t id) {
+    m_model_imp->cancel(id);
+}
+
+void Model::wait_all() {
+    m_model_imp->wait_all();
+}
+
+bool TokenStream::pop(std::string& text) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    text = std::move(m_ring[head % m_ring.size()]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool TokenStream::finished() const {
+    return m_finished.load(std::memory_order_acquire) &&
+           m_head.load(std::memory_order_relaxed) ==
+                   m_tail.load(std::memory_order_acquire);
+}
+
+void TokenStream::push(const std::string& text) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    INFER_ASSERT(
+            tail - m_head.load(std::memory_order_acquire) < m_ring.size(),
+            "the token stream is full.");
+    m_ring[tail % m_ring.size()] = text;
+    m_tail.store(tail + 1, std::memory_order_release);
+}
+
+void Model::set_constraint(const std::string& type, const std::string& pattern) {
+    m_model_imp->set_constraint(type, pattern);
+}
+
+void Model::serve_pipeline() {
+    m_model_imp->serve_pipeline();
+}
+
+void Model::remove_weight_segment(const std::string& name) {
+    WeightSegment::remove(name);
+}
+
+int32_t Model::fork_worker() {
+    return m_model_imp->fork_worker();
+}
+
 std::string Model::decode_summary() const {
     return m_model_imp->decode_summary();
 }
+
+std::string inferllm::token_to_text(const std::string& token) {
+    if (token == "<n>" || token == "<n><n>") {
+        return "\n";
+    }
+    if (token == "<|tab|>") {
+        return "\t";
+    }
+    const std::string blank = "<|blank_";
+    if (token.compare(0, blank.size(), blank) == 0) {
+        return std::string(atoi(token.c_str() + blank.size()), ' ');
+    }
+    //! the byte of a utf-8 character which is not in the vocab
+    if (token.size() == 6 && token.compare(0, 3, "<0x") == 0 && token[5] == '>') {
+        char byte = static_cast<char>(strtol(token.c_str() + 3, nullptr, 16));
+        return std::string(1, byte);
+    }
+    const std::string space = "▁";
+    std::string text = token;
+    for (size_t pos = text.find(space); pos != std::string::npos;
+         pos = text.find(space, pos + 1)) {
+        text.replace(pos, space.size(), " ");
+    }
+    return text;
+}
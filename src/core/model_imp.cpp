@@ -1,6 +1,11 @@
 #include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <numeric>
 #include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
 
 #include "file.h"
 #include "graph.h"
@@ -17,9 +22,43 @@ void ModelImp::load(const std::string& model_path) {
     m_param.n_ctx = m_config.nr_ctx;
     m_graph->load(fin, m_param, m_vocab);
     m_logist.resize(m_param.n_vocab);
+    if (m_config.nr_pipeline_stage > 1) {
+        //! every stage listens before it connects, so they start in any order
+        auto recv = Transport::listen(m_config.pipeline_recv);
+        auto send = Transport::connect(m_config.pipeline_send);
+        m_graph->set_pipeline(make_unique<PipelineStage>(
+                m_graph.get(), m_config.pipeline_stage, m_config.nr_pipeline_stage,
+                std::move(recv), std::move(send), m_config.pipeline_micro_batch));
+    }
+    //! after the layer range is set, so the segment holds the weights of the stage
+    if (!m_config.weight_segment.empty()) {
+        m_graph->share_weights(m_config.weight_segment);
+    }
+}
+
+void ModelImp::serve_pipeline() {
+    INFER_ASSERT(m_graph->pipeline(), "the model is not a stage of the pipeline.");
+    m_graph->pipeline()->serve();
+}
+
+int32_t ModelImp::fork_worker() {
+#if defined(__unix__) || defined(__APPLE__)
+    //! the threads of the engine and the pipeline do not exist in the worker
+    INFER_ASSERT(!engine(false), "fork the workers before submitting the requests.");
+    INFER_ASSERT(!m_graph->pipeline(), "the stage of the pipeline can't be forked.");
+    m_graph->prepare_weights();
+    m_device->stop_threads();
+    return fork();
+#else
+    INFER_ASSERT(0, "fork is not supported on this platform.");
+    return -1;
+#endif
 }
 
 void ModelImp::prefill(const std::string& promote) {
+    if (m_constraint) {
+        m_constraint->reset();
+    }
     auto tokens = tokenize(promote, true);
     m_graph->post_tokenize(tokens);
     for (auto token : tokens) {
@@ -27,14 +66,32 @@ void ModelImp::prefill(const std::string& promote) {
         m_last_queue.pop_front();
     }
     //auto start = m_timer.get_time();
-    m_graph->execute(tokens, m_logist, m_past, true);
+    execute_prompt(tokens, true);
     //auto end = m_timer.get_time();
     //m_time_cost += end - start;
-    m_past = tokens.size();
+}
+
+void ModelImp::execute_prompt(const std::vector<Vocab::Id>& tokens, bool prefill) {
+    uint32_t chunk_size = m_config.prefill_chunk;
+    if (chunk_size == 0 || !m_graph->support_chunked_prefill()) {
+        chunk_size = tokens.size();
+    }
+    //! the chunks before the last one only fill the kv cache, so the LM head
+    //! is skipped
+    for (size_t start = 0; start < tokens.size(); start += chunk_size) {
+        size_t end = std::min<size_t>(start + chunk_size, tokens.size());
+        std::vector<int32_t> chunk(tokens.begin() + start, tokens.begin() + end);
+        m_graph->execute(chunk, m_logist, m_past, prefill || end < tokens.size());
+        m_past += chunk.size();
+    }
 }
 
 //! decode the user input sentence
 std::string ModelImp::decode(const std::string& user_input, int& token) {
+    //! the answer of the new input is constrained from the empty text
+    if (m_constraint) {
+        m_constraint->reset();
+    }
     auto tokens = tokenize(user_input, false);
     m_graph->post_tokenize(tokens);
     for (auto token : tokens) {
@@ -42,11 +99,10 @@ std::string ModelImp::decode(const std::string& user_input, int& token) {
         m_last_queue.pop_front();
     }
     //auto start = m_timer.get_time();
-    m_graph->execute(tokens, m_logist, m_past, false);
+    execute_prompt(tokens, false);
     //auto end = m_timer.get_time();
     //m_time_cost += end - start;
     sample_and_update();
-    m_past += tokens.size();
     token = m_pre_token;
     return m_vocab->id_to_token[m_pre_token].tok;
 }
@@ -54,7 +110,8 @@ std::string ModelImp::decode(const std::string& user_input, int& token) {
 //! decode the user input sentence
 std::string ModelImp::decode_iter(int& token) {
     auto start = m_timer.get_time();
-    m_graph->execute({m_pre_token}, m_logist, m_past);
+    m_iter_token[0] = m_pre_token;
+    m_graph->execute(m_iter_token, m_logist, m_past);
     auto end = m_timer.get_time();
     m_time_cost += end - start;
     sample_and_update();
@@ -63,11 +120,330 @@ std::string ModelImp::decode_iter(int& token) {
     return m_vocab->id_to_token[m_pre_token].tok;
 }
 
+std::vector<float> ModelImp::score(const std::string& text, uint32_t chunk_size) {
+    auto tokens = tokenize(text, true);
+    m_graph->post_tokenize(tokens);
+    return score(tokens, chunk_size);
+}
+
+std::vector<float> ModelImp::score(
+        const std::vector<Vocab::Id>& tokens, uint32_t chunk_size) {
+    INFER_ASSERT(chunk_size > 0, "the chunk size of score should not be zero.");
+    INFER_ASSERT(
+            tokens.size() <= m_graph->get_nr_ctx(),
+            "the text to score is longer than the context.");
+    //! the text is scored from an empty context
+    reset_token();
+
+    size_t nr_vocab = m_graph->get_nr_vocab();
+    std::vector<float> logprobs;
+    std::vector<float> logits;
+    for (size_t start = 0; start < tokens.size(); start += chunk_size) {
+        size_t end = std::min(start + chunk_size, tokens.size());
+        std::vector<int32_t> chunk(tokens.begin() + start, tokens.begin() + end);
+        logits.resize(chunk.size() * nr_vocab);
+        m_graph->execute_all_logits(chunk, logits, m_past);
+        m_past += chunk.size();
+        //! the logits of row i is the prediction of the token i + 1
+        for (size_t i = 0; i < chunk.size() && start + i + 1 < tokens.size(); i++) {
+            const float* row = logits.data() + i * nr_vocab;
+            float max = *std::max_element(row, row + nr_vocab);
+            double sum = 0;
+            for (size_t j = 0; j < nr_vocab; j++) {
+                sum += exp(row[j] - max);
+            }
+            logprobs.push_back(row[tokens[start + i + 1]] - max - log(sum));
+        }
+    }
+    //! the scored text is not the context of the next generation
+    reset_token();
+    return logprobs;
+}
+
+std::vector<std::vector<float>> ModelImp::embedding(
+        const std::vector<std::string>& texts, const std::string& pooling,
+        int32_t layer, uint32_t chunk_size) {
+    INFER_ASSERT(
+            pooling == "mean" || pooling == "last",
+            "the pooling of embedding should be mean or last.");
+    INFER_ASSERT(chunk_size > 0, "the chunk size of embedding should not be zero.");
+    size_t nr_embd = m_graph->get_nr_embd();
+    std::vector<std::vector<float>> embeddings;
+    std::vector<float> hidden;
+    for (auto& text : texts) {
+        auto tokens = tokenize(text, true);
+        m_graph->post_tokenize(tokens);
+        INFER_ASSERT(
+                tokens.size() > 0 && tokens.size() <= m_graph->get_nr_ctx(),
+                "the text to embed is empty or longer than the context.");
+        reset_token();
+        std::vector<float> embd(nr_embd, 0);
+        for (size_t start = 0; start < tokens.size(); start += chunk_size) {
+            size_t end = std::min(start + chunk_size, tokens.size());
+            std::vector<int32_t> chunk(tokens.begin() + start, tokens.begin() + end);
+            hidden.resize(chunk.size() * nr_embd);
+            m_graph->execute_hidden(chunk, hidden, m_past, layer);
+            m_past += chunk.size();
+            if (pooling == "last") {
+                if (end == tokens.size()) {
+                    const float* row = hidden.data() + (chunk.size() - 1) * nr_embd;
+                    embd.assign(row, row + nr_embd);
+                }
+                continue;
+            }
+            for (size_t i = 0; i < chunk.size(); i++) {
+                for (size_t j = 0; j < nr_embd; j++) {
+                    embd[j] += hidden[i * nr_embd + j];
+                }
+            }
+        }
+        if (pooling == "mean") {
+            for (auto& v : embd) {
+                v /= tokens.size();
+            }
+        }
+        embeddings.push_back(embd);
+    }
+    //! the layers after the extracted one are not executed, so the kv cache is
+    //! not consistent any more
+    reset_token();
+    return embeddings;
+}
+
+namespace {
+//! the log-probability of every token of the logits
+void log_softmax(const float* logits, size_t len, std::vector<float>& logprobs) {
+    float max = *std::max_element(logits, logits + len);
+    double sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += exp(logits[i] - max);
+    }
+    float log_sum = max + log(sum);
+    logprobs.resize(len);
+    for (size_t i = 0; i < len; i++) {
+        logprobs[i] = logits[i] - log_sum;
+    }
+}
+}  // namespace
+
+std::unique_ptr<TokenConstraint> ModelImp::new_constraint() const {
+    std::lock_guard<std::mutex> lock(m_constraint_mutex);
+    if (!m_constraint) {
+        return nullptr;
+    }
+    auto constraint = m_constraint->clone();
+    constraint->reset();
+    return constraint;
+}
+
+std::vector<Vocab::Id> ModelImp::prefill_prompt(
+        const std::string& prompt, uint32_t max_token) {
+    auto tokens = tokenize(prompt, true);
+    m_graph->post_tokenize(tokens);
+    INFER_ASSERT(
+            tokens.size() + max_token <= m_graph->get_nr_ctx(),
+            "the prompt and the generated tokens are longer than the context.");
+    reset_token();
+    execute_prompt(tokens, false);
+    return tokens;
+}
+
+void ModelImp::decode_beams(const std::vector<Beam>& beams, std::vector<float>& logits) {
+    std::vector<int32_t> tokens;
+    std::vector<uint32_t> seqs;
+    for (auto& beam : beams) {
+        tokens.push_back(beam.tokens.back());
+        seqs.push_back(beam.seq);
+    }
+    logits.resize(beams.size() * m_graph->get_nr_vocab());
+    m_graph->execute_batch(tokens, seqs, logits);
+}
+
+Candidate ModelImp::to_candidate(const Beam& beam) {
+    Candidate candidate;
+    candidate.logprob = beam.logprob;
+    for (auto token : beam.tokens) {
+        if (token != m_end_token) {
+            candidate.text += m_vocab->id_to_token[token].tok;
+        }
+    }
+    return candidate;
+}
+
+std::vector<Candidate> ModelImp::beam_search(
+        const std::string& prompt, uint32_t nr_beam, uint32_t max_token) {
+    INFER_ASSERT(nr_beam > 0, "the beam number should not be zero.");
+    prefill_prompt(prompt, max_token);
+    size_t nr_vocab = m_graph->get_nr_vocab();
+    uint32_t nr_top = std::min<size_t>(nr_beam, nr_vocab);
+
+    std::vector<Beam> beams(1);
+    beams[0].seq = 0;
+    beams[0].logprob = 0;
+    beams[0].constraint = new_constraint();
+    std::vector<float> logits = m_logist;
+    std::vector<Candidate> candidates;
+    std::vector<float> logprobs;
+    std::vector<int32_t> index(nr_vocab);
+    for (uint32_t step = 0; step < max_token; step++) {
+        //! the best nr_beam tokens of every beam
+        struct Expand {
+            float logprob;
+            size_t beam;
+            Vocab::Id token;
+        };
+        std::vector<Expand> expands;
+        for (size_t b = 0; b < beams.size(); b++) {
+            float* row = logits.data() + b * nr_vocab;
+            if (beams[b].constraint) {
+                beams[b].constraint->apply(row, m_end_token);
+            }
+            log_softmax(row, nr_vocab, logprobs);
+            std::iota(index.begin(), index.end(), 0);
+            std::partial_sort(
+                    index.begin(), index.begin() + nr_top, index.end(),
+                    [&](int32_t x, int32_t y) { return logprobs[x] > logprobs[y]; });
+            //! the masked tokens are never expanded
+            for (uint32_t i = 0; i < nr_top && !std::isinf(logprobs[index[i]]); i++) {
+                expands.push_back(
+                        {beams[b].logprob + logprobs[index[i]], b, index[i]});
+            }
+        }
+        std::sort(expands.begin(), expands.end(), [](const Expand& x, const Expand& y) {
+            return x.logprob > y.logprob;
+        });
+
+        //! the first child of a beam keeps the sequence of the beam, the others
+        //! fork from it to the sequences of the dropped beams or the new ones
+        std::vector<Beam> next;
+        std::vector<bool> owned(beams.size(), false);
+        std::vector<size_t> forks;
+        for (auto& expand : expands) {
+            if (next.size() + candidates.size() >= nr_beam) {
+                break;
+            }
+            Beam beam = beams[expand.beam];
+            beam.tokens.push_back(expand.token);
+            beam.logprob = expand.logprob;
+            if (expand.token == m_end_token) {
+                candidates.push_back(to_candidate(beam));
+                continue;
+            }
+            if (beam.constraint) {
+                beam.constraint = beam.constraint->clone();
+                beam.constraint->accept(expand.token);
+            }
+            if (owned[expand.beam]) {
+                forks.push_back(next.size());
+            }
+            owned[expand.beam] = true;
+            next.push_back(beam);
+        }
+        std::vector<uint32_t> free_seqs;
+        uint32_t nr_seq = 0;
+        for (size_t b = 0; b < beams.size(); b++) {
+            nr_seq = std::max(nr_seq, beams[b].seq + 1);
+            if (!owned[b]) {
+                free_seqs.push_back(beams[b].seq);
+            }
+        }
+        for (auto id : forks) {
+            uint32_t seq = nr_seq++;
+            if (!free_seqs.empty()) {
+                seq = free_seqs.back();
+                free_seqs.pop_back();
+            }
+            m_graph->fork_seq(next[id].seq, seq);
+            next[id].seq = seq;
+        }
+        beams.swap(next);
+        if (beams.empty() || step + 1 == max_token) {
+            break;
+        }
+        decode_beams(beams, logits);
+    }
+    for (auto& beam : beams) {
+        candidates.push_back(to_candidate(beam));
+    }
+    std::sort(
+            candidates.begin(), candidates.end(),
+            [](const Candidate& x, const Candidate& y) { return x.logprob > y.logprob; });
+    candidates.resize(std::min<size_t>(candidates.size(), nr_beam));
+    //! drop the kv cache of all the beams
+    reset_token();
+    return candidates;
+}
+
+std::vector<Candidate> ModelImp::sample_n(
+        const std::string& prompt, uint32_t nr_sample, uint32_t max_token) {
+    INFER_ASSERT(nr_sample > 0, "the sample number should not be zero.");
+    auto prompt_tokens = prefill_prompt(prompt, max_token);
+    size_t nr_vocab = m_graph->get_nr_vocab();
+
+    //! all the samples share the kv cache of the prompt
+    std::vector<Beam> beams(nr_sample);
+    std::vector<float> logits;
+    for (uint32_t i = 0; i < nr_sample; i++) {
+        beams[i].seq = i;
+        beams[i].logprob = 0;
+        beams[i].last_queue = m_last_queue;
+        beams[i].constraint = new_constraint();
+        for (auto token : prompt_tokens) {
+            beams[i].last_queue.push_back(token);
+            beams[i].last_queue.pop_front();
+        }
+        if (i > 0) {
+            m_graph->fork_seq(0, i);
+        }
+        logits.insert(logits.end(), m_logist.begin(), m_logist.end());
+    }
+    std::vector<Candidate> candidates;
+    std::vector<float> logprobs;
+    for (uint32_t step = 0; step < max_token && !beams.empty(); step++) {
+        std::vector<Beam> next;
+        for (size_t b = 0; b < beams.size(); b++) {
+            float* row = logits.data() + b * nr_vocab;
+            auto& beam = beams[b];
+            if (beam.constraint) {
+                beam.constraint->apply(row, m_end_token);
+            }
+            log_softmax(row, nr_vocab, logprobs);
+            auto token = llama_sample_top_p_top_k(
+                    *m_vocab, row, beam.last_queue, m_repeat_penalty, m_top_k,
+                    m_top_p, m_temp, m_rng);
+            if (beam.constraint && token != m_end_token) {
+                beam.constraint->accept(token);
+            }
+            beam.last_queue.push_back(token);
+            beam.last_queue.pop_front();
+            beam.tokens.push_back(token);
+            beam.logprob += logprobs[token];
+            if (token == m_end_token || step + 1 == max_token) {
+                candidates.push_back(to_candidate(beam));
+            } else {
+                next.push_back(beam);
+            }
+        }
+        beams.swap(next);
+        if (!beams.empty()) {
+            decode_beams(beams, logits);
+        }
+    }
+    reset_token();
+    return candidates;
+}
+
 int32_t ModelImp::sample_and_update() {
+    if (m_constraint) {
+        m_constraint->apply(m_logist.data(), m_end_token);
+    }
     // sample the next token
    auto token = llama_sample_top_p_top_k(
            *m_vocab, m_logist.data(), m_last_queue, m_repeat_penalty, m_top_k, m_top_p,
            m_temp, m_rng);
+    if (m_constraint && token != m_end_token) {
+        m_constraint->accept(token);
+    }
     // update the last queue
     m_last_queue.push_back(token);
     m_last_queue.pop_front();
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
+#include "constraint.h"
 #include "device.h"
+#include "engine.h"
 #include "graph.h"
 #include "kern/kernel_define.h"
 #include "model.h"
@@ -41,12 +45,20 @@ public:
         uint32_t nr_thread = config.nr_thread;
         std::string device_type = config.device_type;
         if (device_type == "CPU" || device_type == "cpu") {
+            if (config.nr_numa_node > 1 && config.enable_mmap) {
+                INFER_LOG(
+                        "the mapped weights are not moved to the numa nodes, load "
+                        "them without mmap to split them.\n");
+            }
 #if INFER_X86
-            m_device = make_unique<CPUDevice>(KernelType::X86, nr_thread);
+            m_device = make_unique<CPUDevice>(
+                    KernelType::X86, nr_thread, config.nr_numa_node);
 #elif INFER_ARM
-            m_device = make_unique<CPUDevice>(KernelType::Arm, nr_thread);
+            m_device = make_unique<CPUDevice>(
+                    KernelType::Arm, nr_thread, config.nr_numa_node);
 #else
-            m_device = make_unique<CPUDevice>(KernelType::Naive, nr_thread);
+            m_device = make_unique<CPUDevice>(
+                    KernelType::Naive, nr_thread, config.nr_numa_node);
 #endif
         } else if (
                 device_type == "GPU" || device_type == "CUDA" || device_type == "gpu") {
@@ -60,6 +72,7 @@ public:
 
         UserConfig user_config;
         user_config.compt_type = dtype_from_str(config.compt_type);
+        user_config.kv_head_major = config.kv_head_major;
         m_graph = Graph::make_graph(user_config, m_device.get(), name);
         m_past = 0;
     }
@@ -80,6 +93,13 @@ public:
             m_last_queue.push_back(0);
         }
         m_rng = std::mt19937(seed);
+        if (m_config.preallocate_workspace) {
+            uint32_t max_len = m_config.prefill_chunk;
+            if (max_len == 0 || !m_graph->support_chunked_prefill()) {
+                max_len = m_graph->get_nr_ctx();
+            }
+            m_graph->preallocate_workspace(max_len);
+        }
     }
 
     //! prefill the model with inference with the given promote
@@ -90,20 +110,131 @@ public:
 
     std::string decode_iter(int& token);
 
+    //! score the text, return the log-probability of every token after the
+    //! first one, the long text is computed chunk by chunk
+    std::vector<float> score(const std::string& text, uint32_t chunk_size);
+    std::vector<float> score(const std::vector<Vocab::Id>& tokens, uint32_t chunk_size);
+
+    //! the logits of the last token executed by decode or decode_iter
+    const std::vector<float>& logits() const { return m_logist; }
+
+    //! extract the pooled hidden state of every text, the LM head is skipped
+    std::vector<std::vector<float>> embedding(
+            const std::vector<std::string>& texts, const std::string& pooling,
+            int32_t layer, uint32_t chunk_size);
+
+    //! the n-best generation, the candidates decode in one batch
+    std::vector<Candidate> beam_search(
+            const std::string& prompt, uint32_t nr_beam, uint32_t max_token);
+    std::vector<Candidate> sample_n(
+            const std::string& prompt, uint32_t nr_sample, uint32_t max_token);
+
+    //! the async generation runs on the engine thread, it is created when the
+    //! first request is submitted
+    uint64_t submit(
+            const std::string& prompt, uint32_t max_token, TokenCallback callback,
+            bool reset_context) {
+        return engine(true)->submit(prompt, max_token, callback, reset_context);
+    }
+
+    std::shared_ptr<TokenStream> submit_stream(
+            const std::string& prompt, uint32_t max_token, bool reset_context) {
+        auto stream = std::make_shared<TokenStream>(std::max(max_token, 1u));
+        stream->m_id = submit(
+                prompt, max_token,
+                [stream](int32_t token, const std::string& text, bool finished) {
+                    if (finished) {
+                        stream->finish(token == REJECTED_TOKEN ? text : "");
+                    } else {
+                        stream->push(text);
+                    }
+                },
+                reset_context);
+        return stream;
+    }
+
+    void cancel(uint64_t id) {
+        if (auto engine = this->engine(false)) {
+            engine->cancel(id);
+        }
+    }
+
+    void wait_all() {
+        if (auto engine = this->engine(false)) {
+            engine->wait_all();
+        }
+    }
+
+    int32_t end_token() const { return m_end_token; }
+
+    //! constrain the sampled tokens by a regex or json grammar, the empty type
+    //! removes the constraint
+    void set_constraint(const std::string& type, const std::string& pattern) {
+        std::unique_ptr<TokenConstraint> constraint;
+        if (!type.empty()) {
+            constraint = make_constraint(type, pattern, *m_vocab);
+        }
+        //! the engine thread clones it for the new requests
+        std::lock_guard<std::mutex> lock(m_constraint_mutex);
+        m_constraint = std::move(constraint);
+    }
+
     uint32_t get_remain_token() { return m_graph->get_nr_ctx() - m_past; }
 
     void reset_token() {
         m_past = 0;
         m_graph->reset_ctx();
+        if (m_constraint) {
+            m_constraint->reset();
+        }
     }
 
     int32_t sample_and_update();
 
     std::string decode_summary() const;
 
+    void serve_pipeline();
+
+    int32_t fork_worker();
+
 private:
+    //! the engine tokenizes and samples the interleaved requests itself
+    friend class AsyncEngine;
+
     std::vector<Vocab::Id> tokenize(const std::string& text, bool bos);
 
+    //! the engine, it is created if create is true and there is no one, the
+    //! requests are submitted from several threads, such as by the server
+    AsyncEngine* engine(bool create) {
+        std::lock_guard<std::mutex> lock(m_engine_mutex);
+        if (!m_engine && create) {
+            m_engine = make_unique<AsyncEngine>(this);
+        }
+        return m_engine.get();
+    }
+
+    //! execute the prompt from m_past chunk by chunk, the logits of the last
+    //! token is output when not prefill
+    void execute_prompt(const std::vector<Vocab::Id>& tokens, bool prefill);
+
+    //! a generating candidate of the n-best generation
+    struct Beam {
+        uint32_t seq;
+        std::vector<Vocab::Id> tokens;
+        float logprob;
+        std::list<int32_t> last_queue;
+        //! the grammar state of the tokens of the beam
+        std::shared_ptr<TokenConstraint> constraint;
+    };
+    //! the constraint of a new generation, it is null without the constraint
+    std::unique_ptr<TokenConstraint> new_constraint() const;
+    //! run the prompt from an empty context in the sequence 0
+    std::vector<Vocab::Id> prefill_prompt(
+            const std::string& prompt, uint32_t max_token);
+    //! decode the last token of every beam in one batch
+    void decode_beams(const std::vector<Beam>& beams, std::vector<float>& logits);
+    Candidate to_candidate(const Beam& beam);
+
     uint32_t m_past = 0;
 
     uint32_t m_top_k;
@@ -114,6 +245,8 @@ private:
     int32_t m_end_token;
 
     int32_t m_pre_token;
+    //! the input of decode_iter, kept to not allocate it every token
+    std::vector<int32_t> m_iter_token = std::vector<int32_t>(1);
 
     std::string m_name;
     LlmParams m_param;
@@ -124,10 +257,16 @@ private:
     std::shared_ptr<Vocab> m_vocab;
     std::list<int32_t> m_last_queue;
     std::vector<float> m_logist;
+    std::unique_ptr<TokenConstraint> m_constraint;
+    mutable std::mutex m_constraint_mutex;
 
     std::mt19937 m_rng;
     Timer m_timer;
     double m_time_cost = 0;
+    std::mutex m_engine_mutex;
+    //! it is the last member, so the engine thread stops before the model is
+    //! destructed
+    std::unique_ptr<AsyncEngine> m_engine;
 };
 
 }  // namespace inferllm
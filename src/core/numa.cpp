@@ -0,0 +1,128 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+#include "utils.h"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace inferllm;
+
+std::vector<uint32_t> inferllm::parse_cpu_list(const std::string& list) {
+    std::vector<uint32_t> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string range = list.substr(pos, end - pos);
+        pos = end + 1;
+        //! strip the newline of the sysfs file
+        range.erase(
+                std::remove_if(
+                        range.begin(), range.end(),
+                        [](char c) { return c == '\n' || c == ' '; }),
+                range.end());
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        uint32_t first = std::strtoul(range.c_str(), nullptr, 10);
+        uint32_t last = first;
+        if (dash != std::string::npos) {
+            last = std::strtoul(range.c_str() + dash + 1, nullptr, 10);
+        }
+        INFER_ASSERT(first <= last, "the cpu range is invalid.");
+        for (uint32_t cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+namespace {
+std::vector<NumaNode> read_numa_nodes() {
+    std::vector<NumaNode> nodes;
+#if defined(__linux__)
+    const std::string root = "/sys/devices/system/node/";
+    DIR* dir = opendir(root.c_str());
+    if (!dir) {
+        return nodes;
+    }
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+            name.find_first_not_of("0123456789", 4) != std::string::npos) {
+            continue;
+        }
+        std::ifstream file(root + name + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list)) {
+            continue;
+        }
+        NumaNode node;
+        node.id = std::strtoul(name.c_str() + 4, nullptr, 10);
+        node.cpus = parse_cpu_list(list);
+        if (!node.cpus.empty()) {
+            nodes.push_back(node);
+        }
+    }
+    closedir(dir);
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) {
+        return a.id < b.id;
+    });
+#endif
+    return nodes;
+}
+}  // namespace
+
+const std::vector<NumaNode>& inferllm::numa_nodes() {
+    static std::vector<NumaNode> nodes = read_numa_nodes();
+    return nodes;
+}
+
+bool inferllm::bind_thread_to_cpus(const std::vector<uint32_t>& cpus) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    //! pid 0 is the calling thread
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+bool inferllm::bind_memory_to_node(void* ptr, size_t len, uint32_t node) {
+#if defined(__linux__) && defined(__NR_mbind)
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + page - 1) / page * page;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + len) / page * page;
+    if (end <= begin) {
+        return true;
+    }
+    constexpr size_t BITS = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> mask(node / BITS + 1, 0);
+    mask[node / BITS] |= 1UL << (node % BITS);
+    //! the written pages are moved, the others are allocated on the node
+    long ret =
+            syscall(__NR_mbind, begin, end - begin, MPOL_BIND, mask.data(),
+                    mask.size() * BITS + 1, MPOL_MF_MOVE);
+    return ret == 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace inferllm {
+
+//! a numa node of the system with its cpus, the nodes of only memory are skipped
+struct NumaNode {
+    uint32_t id;
+    std::vector<uint32_t> cpus;
+};
+
+//! parse the cpu list of sysfs, like "0-3,8-11"
+std::vector<uint32_t> parse_cpu_list(const std::string& list);
+
+//! the numa nodes with cpus of the system in the order of the id, it is empty when
+//! the system has no numa information
+const std::vector<NumaNode>& numa_nodes();
+
+//! pin the calling thread to the cpus, return false if it is not supported
+bool bind_thread_to_cpus(const std::vector<uint32_t>& cpus);
+
+//! move the pages fully inside the memory to the node, the pages shared with the
+//! memory around keep their node, return false if it is not supported
+bool bind_memory_to_node(void* ptr, size_t len, uint32_t node);
+
+}  // namespace inferllm
@@ -1,4 +1,5 @@
 #include "op.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -6,6 +7,23 @@
 #include "kern/naive/naive.h"
 using namespace inferllm;
 
+void OpBase::prepare_quantized_input() {
+    auto input = inputs()[0];
+    if (input->quantized_ready()) {
+        return;
+    }
+    auto quantized = m_quantized_input;
+    if (quantized->get_curr_user_count() == 0) {
+        quantized->resume_user_count();
+        quantized->prepare_data();
+    }
+    uint32_t K = input->shape()[input->dims() - 1];
+    uint32_t M = input->length() / K;
+    get_kernel()->operator()<KernelID::QuantizeQ8Float>(
+            input->ptr<float>(), quantized->ptr(), M, K);
+    input->set_quantized_ready(true);
+}
+
 void LayerNorm::execute(WorkSpace* workspace, uint32_t nr_past) {
     std::shared_ptr<Tensor> weight = nullptr, bias = nullptr;
     int weight_idx = 0;
@@ -34,6 +52,16 @@ void LayerNorm::execute(WorkSpace* workspace, uint32_t nr_past) {
         if (m_bias) {
             bias_ptr = bias->ptr<float>();
         }
+        if (kernel->m_kernel_type != KernelType::GPU) {
+            //! the weight, the bias and the quantization are applied to the row
+            //! when it is normed
+            void* q8_dst = outputs().size() > 1 ? outputs()[1]->ptr() : nullptr;
+            kernel->operator()<KernelID::FusedNormFloat>(
+                    src, dst, weight_ptr, bias_ptr, q8_dst, seq_len, embd, m_norm_eps,
+                    m_rms);
+            output->set_quantized_ready(q8_dst != nullptr);
+            return;
+        }
         if (m_rms) {
             kernel->operator()<KernelID::RmsNormFloat>(
                     src, dst, seq_len, embd, m_norm_eps);
@@ -99,13 +127,21 @@ void SoftMax::execute(WorkSpace*, uint32_t) {
     }
 }
 
+void Reshape::execute(WorkSpace*, uint32_t) {
+    if (m_view) {
+        return;
+    }
+    device()->device2device_copy(
+            outputs()[0]->ptr(), inputs()[0]->ptr(), inputs()[0]->length_in_byte());
+}
+
 void Elemwise::execute(WorkSpace*, uint32_t) {
     auto output = outputs()[0];
     auto kernel = get_kernel();
     if (output->dtype() == DType::Float32) {
         if (m_scale == -INFINITY) {
             InData<float> in_datas;
-            for (auto input : inputs()) {
+            for (auto& input : inputs()) {
                 in_datas.push_back(input->ptr<float>());
             }
             float* dst = output->ptr<float>();
@@ -118,7 +154,7 @@ void Elemwise::execute(WorkSpace*, uint32_t) {
                     inputs()[0]->ptr<float>(), dst, len, m_scale);
 
             InData<float> in_datas;
-            for (auto input : inputs()) {
+            for (auto& input : inputs()) {
                 in_datas.push_back(input->ptr<float>());
             }
             in_datas[0] = dst;
@@ -160,7 +196,6 @@ void MatMul::execute(WorkSpace* workspace, uint32_t) {
     auto weight_dtype = weights()[0]->dtype();
     void* p_workspace = workspace->ptr();
     uint32_t p_workspace_size = workspace->length();
-    auto kernel = get_kernel();
     if (src_dtype == DType::Float32) {
         float* dst = outputs()[0]->ptr<float>();
         const float* bias = nullptr;
@@ -168,31 +203,87 @@ void MatMul::execute(WorkSpace* workspace, uint32_t) {
             bias = weights()[1]->ptr<float>();
         }
         const float* src = inputs()[0]->ptr<float>();
+        uint32_t pack = weight_dtype == DType::Int4 && m_weight_packed ? PACK_SIZE : 1;
+        MatmulEpilogue epilogue;
+        epilogue.dst = dst;
+        epilogue.M = M;
+        epilogue.N = N * pack;
+        epilogue.pack = pack;
+        epilogue.activate = m_activate;
+        epilogue.act_mode = m_act_mode;
+        epilogue.residual = m_residual ? m_residual->ptr<float>() : nullptr;
+        epilogue.residual_scale = m_residual_scale;
+        if (quantized_input()) {
+            prepare_quantized_input();
+            execute_quantized(dst, bias, M, N, K, epilogue);
+            return;
+        }
         switch (weight_dtype) {
             case DType::Int4:
                 if (!m_weight_packed) {
-                    kernel->operator()<KernelID::MatmulInt4Float>(
-                            dst, weights()[0]->ptr(), bias, src, M, N, K, p_workspace,
-                            p_workspace_size);
-                } else {
-                    kernel->operator()<KernelID::MatmulInt4FloatPacked>(
-                            dst, weights()[0]->ptr(), bias, src, M, N * PACK_SIZE, K,
+                    compute<KernelID::MatmulInt4Float>(
+                            epilogue, dst, weights()[0]->ptr(), bias, src, M, N, K,
                             p_workspace, p_workspace_size);
+                } else {
+                    compute<KernelID::MatmulInt4FloatPacked>(
+                            epilogue, dst, weights()[0]->ptr(), bias, src, M,
+                            N * PACK_SIZE, K, p_workspace, p_workspace_size);
                 }
                 break;
             case DType::Int8:
-                kernel->operator()<KernelID::MatmulInt8Float>(
-                        dst, weights()[0]->ptr(), bias, src, M, N, K, p_workspace,
-                        p_workspace_size);
+                compute<KernelID::MatmulInt8Float>(
+                        epilogue, dst, weights()[0]->ptr(), bias, src, M, N, K,
+                        p_workspace, p_workspace_size);
                 break;
             case DType::Float32:
-                kernel->operator()<KernelID::MatmulFloatFloat>(
-                        dst, weights()[0]->ptr<float>(), bias, src, M, N, K,
+                compute<KernelID::MatmulFloatFloat>(
+                        epilogue, dst, weights()[0]->ptr<float>(), bias, src, M, N, K,
                         p_workspace, p_workspace_size);
                 break;
             default:
                 INFER_ASSERT(0, "not support");
         }
+        if (has_epilogue() && !fuse_epilogue()) {
+            execute_epilogue(epilogue, workspace);
+        }
+    }
+}
+
+void MatMul::execute_quantized(
+        float* dst, const float* bias, uint32_t M, uint32_t N, uint32_t K,
+        const MatmulEpilogue& epilogue) {
+    const void* weight = weights()[0]->ptr();
+    const void* q8_src = quantized_input()->ptr();
+    if (weights()[0]->dtype() == DType::Int8) {
+        compute<KernelID::MatmulInt8Q8Float>(
+                epilogue, dst, weight, bias, q8_src, M, N, K);
+    } else if (!m_weight_packed) {
+        compute<KernelID::MatmulInt4Q8Float>(
+                epilogue, dst, weight, bias, q8_src, M, N, K);
+    } else {
+        compute<KernelID::MatmulInt4Q8FloatPacked>(
+                epilogue, dst, weight, bias, q8_src, M, N * PACK_SIZE, K);
+    }
+}
+
+void MatMul::execute_epilogue(const MatmulEpilogue& epilogue, WorkSpace* workspace) {
+    auto kernel = get_kernel();
+    size_t len = epilogue.M * epilogue.N;
+    float* dst = epilogue.dst;
+    if (epilogue.activate) {
+        kernel->operator()<KernelID::ElemwiseFloat>(
+                InData<float>{dst}, dst, len, epilogue.act_mode);
+    }
+    if (epilogue.residual) {
+        float* residual = m_residual->ptr<float>();
+        if (epilogue.residual_scale != 1.0f) {
+            float* scaled = static_cast<float*>(workspace->ptr());
+            kernel->operator()<KernelID::ElemwiseFloatScale>(
+                    residual, scaled, len, epilogue.residual_scale);
+            residual = scaled;
+        }
+        kernel->operator()<KernelID::ElemwiseFloat>(
+                InData<float>{dst, residual}, dst, len, ElemMode::Add);
     }
 }
 
@@ -203,9 +294,19 @@ size_t MatMul::get_workspace_in_byte() {
     auto src_dtype = inputs()[0]->dtype();
     auto kernel = get_kernel();
     auto weight_dtype = weights()[0]->dtype();
+    //! the input is quantized by the producer
+    if (quantized_input()) {
+        return 0;
+    }
     if (src_dtype == DType::Float32) {
-        return kernel->get_workspace<KernelID::MatmulInt4Float>(
+        size_t workspace = kernel->get_workspace<KernelID::MatmulInt4Float>(
                 kernel->nr_thread(), M, N, K);
+        //! the scaled residual of the unfused epilogue
+        if (m_residual && m_residual_scale != 1.0f && !fuse_epilogue()) {
+            size_t scaled = outputs()[0]->length() * sizeof(float);
+            workspace = std::max(workspace, scaled);
+        }
+        return workspace;
     }
     return 0;
 }
@@ -230,9 +331,9 @@ std::vector<size_t> MatMul::preprocess_weight(Tensor* tensor, void* src, void* d
 void MatMulLast::execute(WorkSpace* workspace, uint32_t) {
     auto N = weights()[0]->shape()[0];
     auto K = weights()[0]->shape()[1];
-    //! only compute the last token
-    auto M = 1;
     auto row = inputs()[0]->shape()[0];
+    //! only compute the last token
+    uint32_t M = m_rows.empty() ? 1 : m_rows.size();
     auto src_dtype = inputs()[0]->dtype();
     auto weight_dtype = weights()[0]->dtype();
     void* p_workspace = workspace->ptr();
@@ -244,7 +345,19 @@ void MatMulLast::execute(WorkSpace* workspace, uint32_t) {
         if (m_bias) {
             bias = weights()[1]->ptr<float>();
         }
-        const float* src = inputs()[0]->ptr<float>() + (row - 1) * K;
+        const float* src = inputs()[0]->ptr<float>() + (row - M) * K;
+        if (!m_rows.empty() && !all_rows()) {
+            //! gather the selected rows to the head of the workspace
+            float* gather = static_cast<float*>(p_workspace);
+            for (uint32_t i = 0; i < M; i++) {
+                device()->device2device_copy(
+                        gather + i * K, inputs()[0]->ptr<float>() + m_rows[i] * K,
+                        K * sizeof(float));
+            }
+            src = gather;
+            p_workspace = gather + M * K;
+            p_workspace_size -= M * K * sizeof(float);
+        }
         switch (weight_dtype) {
             case DType::Int4:
                 if (!m_weight_packed) {
@@ -273,15 +386,28 @@ void MatMulLast::execute(WorkSpace* workspace, uint32_t) {
     }
 }
 
+bool MatMulLast::all_rows() {
+    if (m_rows.size() != inputs()[0]->shape()[0]) {
+        return false;
+    }
+    for (uint32_t i = 0; i < m_rows.size(); i++) {
+        if (m_rows[i] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
 size_t MatMulLast::get_workspace_in_byte() {
-    uint32_t M = 1;
+    uint32_t M = m_rows.empty() ? 1 : m_rows.size();
     uint32_t K = inputs()[0]->shape()[1];
     uint32_t N = weights()[0]->shape()[0];
     auto src_dtype = inputs()[0]->dtype();
     auto kernel = get_kernel();
     if (src_dtype == DType::Float32) {
-        return kernel->get_workspace<KernelID::MatmulInt4Float>(
-                kernel->nr_thread(), M, N, K);
+        size_t gather = m_rows.empty() || all_rows() ? 0 : M * K * sizeof(float);
+        return gather + kernel->get_workspace<KernelID::MatmulInt4Float>(
+                                kernel->nr_thread(), M, N, K);
     }
     return 0;
 }
@@ -323,11 +449,96 @@ size_t AttentionBase::get_workspace_in_byte() {
         //! out q
         total += seqlen * m_embd * sizeof(float);
         //! qk out
-        total += m_head * seqlen * m_ctx * sizeof(float);
+        total += qk_workspace_in_byte(seqlen);
+        //! k and v out of the batch, they are copied to every sequence, and the
+        //! k and v rows which are stored to the head major kv cache
+        if (!m_batch_seqs.empty() || m_kstorage->head_major()) {
+            total += 2 * seqlen * m_embd * sizeof(float);
+        }
     }
     return total;
 }
 
+size_t AttentionBase::qk_workspace_in_byte(uint32_t seqlen) {
+    size_t decode = get_kernel()->get_workspace<KernelID::FlashDecodeFloat>(
+            m_embd, m_head, m_ctx);
+    return std::max(m_head * seqlen * m_ctx * sizeof(float), decode);
+}
+
+void AttentionBase::fork_seq(uint32_t src, uint32_t dst) {
+    if (m_seq_kstorage.empty()) {
+        m_seq_kstorage.push_back(m_kstorage);
+        m_seq_vstorage.push_back(m_vstorage);
+    }
+    INFER_ASSERT(
+            src < m_seq_kstorage.size() && m_seq_kstorage[src],
+            "the sequence to fork is not exist.");
+    if (dst >= m_seq_kstorage.size()) {
+        m_seq_kstorage.resize(dst + 1);
+        m_seq_vstorage.resize(dst + 1);
+    }
+    m_seq_kstorage[dst] = m_seq_kstorage[src];
+    m_seq_vstorage[dst] = m_seq_vstorage[src];
+}
+
+void AttentionBase::select_seq(uint32_t seq, bool write) {
+    if (m_seq_kstorage.empty()) {
+        INFER_ASSERT(seq == 0, "the sequence is not forked.");
+        return;
+    }
+    INFER_ASSERT(
+            seq < m_seq_kstorage.size() && m_seq_kstorage[seq],
+            "the sequence is not forked.");
+    auto& kstorage = m_seq_kstorage[seq];
+    auto& vstorage = m_seq_vstorage[seq];
+    if (write && std::count(m_seq_kstorage.begin(), m_seq_kstorage.end(), kstorage) > 1) {
+        kstorage = kstorage->clone();
+        vstorage = vstorage->clone();
+    }
+    m_kstorage = kstorage;
+    m_vstorage = vstorage;
+}
+
+void AttentionBase::reset_seq(uint32_t seq) {
+    if (m_seq_kstorage.empty()) {
+        m_seq_kstorage.push_back(m_kstorage);
+        m_seq_vstorage.push_back(m_vstorage);
+    }
+    if (seq >= m_seq_kstorage.size()) {
+        m_seq_kstorage.resize(seq + 1);
+        m_seq_vstorage.resize(seq + 1);
+    }
+    auto& kstorage = m_seq_kstorage[seq];
+    auto& vstorage = m_seq_vstorage[seq];
+    if (kstorage && std::count(m_seq_kstorage.begin(), m_seq_kstorage.end(), kstorage) == 1) {
+        kstorage->reset_id();
+        vstorage->reset_id();
+        return;
+    }
+    //! the shared or the new sequence gets its own empty storage
+    uint32_t head = m_kstorage->head_major() ? m_head : 0;
+    kstorage = std::make_shared<KvStorage>(
+            std::vector<size_t>{m_ctx, m_embd}, m_kstorage->dtype(), device(), head);
+    vstorage = std::make_shared<KvStorage>(
+            std::vector<size_t>{m_ctx, m_embd}, m_vstorage->dtype(), device(), head);
+}
+
+void AttentionBase::set_batch_seqs(const std::vector<uint32_t>& seqs) {
+    //! the members keep their memory, so the decode steps don't allocate
+    m_batch_seqs.assign(seqs.begin(), seqs.end());
+    m_batch_runs.clear();
+    for (auto seq : m_batch_seqs) {
+        if (!m_batch_runs.empty() && m_batch_runs.back().first == seq) {
+            m_batch_runs.back().second++;
+            continue;
+        }
+        for (auto& run : m_batch_runs) {
+            INFER_ASSERT(run.first != seq, "the rows of a sequence are not consecutive.");
+        }
+        m_batch_runs.push_back({seq, 1});
+    }
+}
+
 std::vector<size_t> AttentionBase::preprocess_weight(
         Tensor* tensor, void* src, void* dst) {
     INFER_ASSERT(tensor->dtype() == DType::Int4, "only support optimized int4 kernel");
@@ -346,8 +557,10 @@ std::vector<size_t> AttentionBase::preprocess_weight(
 }
 
 void LlamaAttention::execute(WorkSpace* workspace, uint32_t nr_past) {
+    bool batched = !m_batch_seqs.empty();
+    bool head_major = m_kstorage->head_major();
     INFER_ASSERT(
-            nr_past == m_kstorage->current_index(),
+            batched || nr_past == m_kstorage->current_index(),
             "The index in kv storage is not the same as input\n");
     auto w_dtype = weights()[0]->dtype();
     auto out = outputs()[0];
@@ -355,7 +568,6 @@ void LlamaAttention::execute(WorkSpace* workspace, uint32_t nr_past) {
     auto in_dtype = input->dtype();
     uint32_t seqlen = input->shape()[0];
     uint32_t embd = input->shape()[1];
-    uint32_t head = m_head;
     auto kernel = get_kernel();
 
     void *p_wq = nullptr, *p_wk = nullptr, *p_wv = nullptr;
@@ -408,16 +620,45 @@ void LlamaAttention::execute(WorkSpace* workspace, uint32_t nr_past) {
     void* q_out = static_cast<void*>(static_cast<char*>(p_work) + matmul_size);
     void* qk_out = static_cast<void*>(
             static_cast<char*>(q_out) + seqlen * m_embd * sizeof(float));
+    float* k_out = reinterpret_cast<float*>(
+            static_cast<char*>(qk_out) + qk_workspace_in_byte(seqlen));
+    float* v_out = k_out + seqlen * m_embd;
 
     if (in_dtype == DType::Float32) {
         //! compute k, q, v
         const float* pdata = input->ptr<float>();
-        float* p_outk = static_cast<float*>(m_kstorage->get_current_data());
-        float* p_outv = static_cast<float*>(m_vstorage->get_current_data());
+        //! the k and v of a batch are computed together and copied to every
+        //! sequence, and the head major kv cache is stored in attention
+        bool to_cache = !batched && !head_major;
+        float* p_outk = to_cache ? static_cast<float*>(m_kstorage->get_current_data())
+                                 : k_out;
+        float* p_outv = to_cache ? static_cast<float*>(m_vstorage->get_current_data())
+                                 : v_out;
         float* p_outq = static_cast<float*>(q_out);
+        //! the Q8_0 blocks of the input shared with the other readers, q, k and v
+        //! read the same blocks
+        const void* q8_data = nullptr;
+        if (quantized_input()) {
+            prepare_quantized_input();
+            q8_data = quantized_input()->ptr();
+        }
         switch (w_dtype) {
             case DType::Int4:
-                if (!m_packed_weight) {
+                if (q8_data && !m_packed_weight) {
+                    kernel->operator()<KernelID::MatmulInt4Q8Float>(
+                            p_outq, p_wq, p_bq, q8_data, seqlen, embd, embd);
+                    kernel->operator()<KernelID::MatmulInt4Q8Float>(
+                            p_outk, p_wk, p_bk, q8_data, seqlen, embd, embd);
+                    kernel->operator()<KernelID::MatmulInt4Q8Float>(
+                            p_outv, p_wv, p_bv, q8_data, seqlen, embd, embd);
+                } else if (q8_data) {
+                    kernel->operator()<KernelID::MatmulInt4Q8FloatPacked>(
+                            p_outq, p_wq, p_bq, q8_data, seqlen, embd, embd);
+                    kernel->operator()<KernelID::MatmulInt4Q8FloatPacked>(
+                            p_outk, p_wk, p_bk, q8_data, seqlen, embd, embd);
+                    kernel->operator()<KernelID::MatmulInt4Q8FloatPacked>(
+                            p_outv, p_wv, p_bv, q8_data, seqlen, embd, embd);
+                } else if (!m_packed_weight) {
                     kernel->operator()<KernelID::MatmulInt4Float>(
                             p_outq, p_wq, p_bq, pdata, seqlen, embd, embd, p_work,
                             size);
@@ -440,6 +681,15 @@ void LlamaAttention::execute(WorkSpace* workspace, uint32_t nr_past) {
                 }
                 break;
             case DType::Int8:
+                if (q8_data) {
+                    kernel->operator()<KernelID::MatmulInt8Q8Float>(
+                            p_outq, p_wq, p_bq, q8_data, seqlen, embd, embd);
+                    kernel->operator()<KernelID::MatmulInt8Q8Float>(
+                            p_outk, p_wk, p_bk, q8_data, seqlen, embd, embd);
+                    kernel->operator()<KernelID::MatmulInt8Q8Float>(
+                            p_outv, p_wv, p_bv, q8_data, seqlen, embd, embd);
+                    break;
+                }
                 kernel->operator()<KernelID::MatmulInt8Float>(
                         p_outq, p_wq, p_bq, pdata, seqlen, embd, embd, p_work, size);
                 kernel->operator()<KernelID::MatmulInt8Float>(
@@ -461,41 +711,112 @@ void LlamaAttention::execute(WorkSpace* workspace, uint32_t nr_past) {
             default:
                 INFER_ASSERT(0, "not support");
         }
-        //! rope Q
+        float* out = outputs()[0]->ptr<float>();
+        if (!batched) {
+            attention(p_outq, p_outk, p_outv, out, (float*)qk_out, seqlen, nr_past);
+            return;
+        }
+        //! the rows of a sequence attend to its own kv cache, a run of several
+        //! rows is a chunk of the prompt which is masked causally
+        uint32_t row = 0;
+        for (auto& run : batch_runs()) {
+            select_seq(run.first, false);
+            float* k = p_outk + row * embd;
+            float* v = p_outv + row * embd;
+            if (!head_major) {
+                size_t len = run.second * embd * sizeof(float);
+                k = static_cast<float*>(m_kstorage->get_current_data());
+                v = static_cast<float*>(m_vstorage->get_current_data());
+                device()->device2device_copy(k, p_outk + row * embd, len);
+                device()->device2device_copy(v, p_outv + row * embd, len);
+            }
+            attention(
+                    p_outq + row * embd, k, v, out + row * embd, (float*)qk_out,
+                    run.second, m_kstorage->current_index());
+            row += run.second;
+        }
+        select_seq(0, false);
+    }
+}
 
-        float* p_totalk = static_cast<float*>(m_kstorage->ptr());
-        if (m_rotary_mode == RotMode::ModelRotHalf) {
-            kernel->operator()<KernelID::RopeFloat>(
-                    p_outq, p_outq, nr_past, m_rot, m_rotary_mode, seqlen, head,
-                    embd / head);
-            //! rope K
+void LlamaAttention::attention(
+        float* q, float* k, float* v, float* out, float* qk, uint32_t seqlen,
+        uint32_t nr_past) {
+    auto kernel = get_kernel();
+    uint32_t embd = m_embd;
+    uint32_t head = m_head;
+    bool head_major = m_kstorage->head_major();
+    //! rope Q
+    float* p_totalk = static_cast<float*>(m_kstorage->ptr());
+    if (m_rotary_mode == RotMode::ModelRotHalf) {
+        kernel->operator()<KernelID::RopeFloat>(
+                q, q, nr_past, m_rot, m_rotary_mode, seqlen, head, embd / head);
+        //! rope K
+        kernel->operator()<KernelID::RopeFloat>(
+                k, k, nr_past, m_rot, m_rotary_mode, seqlen, head, embd / head);
+    } else {
+        kernel->operator()<KernelID::RopeFloat>(
+                q, q, nr_past, m_rot, RotMode::Mode0, seqlen, head, embd / head);
+        //! rope K, the mode 1 of the rows from nr_past is the mode 0 of the new
+        //! rows
+        if (head_major) {
             kernel->operator()<KernelID::RopeFloat>(
-                    p_outk, p_outk, nr_past, m_rot, m_rotary_mode, seqlen, head,
-                    embd / head);
+                    k, k, nr_past, m_rot, RotMode::Mode0, seqlen, head, embd / head);
         } else {
-            kernel->operator()<KernelID::RopeFloat>(
-                    p_outq, p_outq, nr_past, m_rot, RotMode::Mode0, seqlen, head,
-                    embd / head);
-            //! rope K
             kernel->operator()<KernelID::RopeFloat>(
                     p_totalk, p_totalk, nr_past, m_rot, RotMode::Mode1,
                     seqlen + nr_past, head, embd / head);
         }
-        //! Q*k with transpose
+    }
+    float scale = 1.0f / sqrt(float(embd) / head);
+    float* p_totalv = static_cast<float*>(m_vstorage->ptr());
+    //! the capacity of the k and v storage may be different, so is the head
+    //! stride of them
+    uint32_t k_head_stride = embd / head;
+    uint32_t v_head_stride = embd / head;
+    uint32_t kv_row_stride = embd;
+    if (head_major) {
+        k_head_stride = m_kstorage->head_stride();
+        v_head_stride = m_vstorage->head_stride();
+        kv_row_stride = m_kstorage->row_stride();
+        kernel->operator()<KernelID::KvStoreFloat>(
+                static_cast<float*>(m_kstorage->get_current_data()), k, seqlen, embd,
+                head, k_head_stride, kv_row_stride);
+        kernel->operator()<KernelID::KvStoreFloat>(
+                static_cast<float*>(m_vstorage->get_current_data()), v, seqlen, embd,
+                head, v_head_stride, kv_row_stride);
+    }
+    //! a decode row sees all the kv cache, so it is split along the kv rows
+    if (seqlen == 1 && kernel->m_kernel_type != KernelType::GPU) {
+        kernel->operator()<KernelID::FlashDecodeFloat>(
+                out, q, p_totalk, p_totalv, scale, embd, head, nr_past + 1,
+                k_head_stride, v_head_stride, kv_row_stride, static_cast<void*>(qk),
+                qk_workspace_in_byte(seqlen));
+        return;
+    }
+    //! Q*k with transpose
+    if (head_major) {
+        kernel->operator()<KernelID::MatmulWithKvStrideFloat>(
+                qk, p_totalk, q, seqlen, embd, head, nr_past, k_head_stride,
+                kv_row_stride);
+    } else {
         kernel->operator()<KernelID::MatmulWithHeadStrideFloat>(
-                (float*)qk_out, p_totalk, p_outq, seqlen, embd, head, nr_past);
-        //! scale and diag
-        float scale = 1.0f / sqrt(float(embd) / head);
-        kernel->operator()<KernelID::ScaleDiagMaskFloat>(
-                (float*)qk_out, (float*)qk_out, scale, nr_past, seqlen, head);
-        //! softmax
-        kernel->operator()<KernelID::SoftmaxFloat>(
-                (float*)qk_out, (float*)qk_out, head * seqlen, nr_past + seqlen);
-        //! compute v_out
-        float* out = outputs()[0]->ptr<float>();
-        float* p_totalv = static_cast<float*>(m_vstorage->ptr());
+                qk, p_totalk, q, seqlen, embd, head, nr_past);
+    }
+    //! scale and diag
+    kernel->operator()<KernelID::ScaleDiagMaskFloat>(
+            qk, qk, scale, nr_past, seqlen, head);
+    //! softmax
+    kernel->operator()<KernelID::SoftmaxFloat>(
+            qk, qk, head * seqlen, nr_past + seqlen);
+    //! compute v_out
+    if (head_major) {
+        kernel->operator()<KernelID::HeadBatchedMatmulKvStrideFloat>(
+                out, p_totalv, qk, seqlen, embd, head, nr_past, v_head_stride,
+                kv_row_stride);
+    } else {
         kernel->operator()<KernelID::HeadBatchedMatmulFloat>(
-                out, p_totalv, (float*)qk_out, seqlen, embd, head, nr_past);
+                out, p_totalv, qk, seqlen, embd, head, nr_past);
     }
 }
 
@@ -25,10 +25,10 @@ public:
     }
 
     virtual void pre_execute() {
-        for (auto weight : m_weights) {
+        for (auto& weight : m_weights) {
             weight->prepare_data();
         }
-        for (auto output : m_outputs) {
+        for (auto& output : m_outputs) {
             if (output->get_curr_user_count() == 0 && !output->shared()) {
                 output->resume_user_count();
                 output->prepare_data();
@@ -39,7 +39,7 @@ public:
     virtual void execute(WorkSpace* workspace, uint32_t nr_past) {}
 
     virtual void end_execute() {
-        for (auto input : m_inputs) {
+        for (auto& input : m_inputs) {
             input->decrease_curr_user_count();
         }
     };
@@ -73,9 +73,10 @@ public:
     }
     void set_name(std::string name) { m_name = name; }
 
-    OpIOs weights() { return m_weights; }
-    OpIOs inputs() { return m_inputs; }
-    OpIOs outputs() { return m_outputs; }
+    //! the accessors return the reference, so the execution does not copy them
+    const OpIOs& weights() const { return m_weights; }
+    const OpIOs& inputs() const { return m_inputs; }
+    const OpIOs& outputs() const { return m_outputs; }
     std::string name() { return m_name; }
 
     //! for better optimized the compute, some op need preprocess the weight, so that
@@ -87,11 +88,43 @@ public:
         return std::vector<size_t>();
     }
 
+    //! the weight is preprocessed by another process, such as the one which
+    //! prepares the shared weight segment
+    virtual void set_weight_preprocessed(Tensor*) {}
+
+    //! whether the op can read the Q8_0 blocks of its input shared with the
+    //! other readers, instead of quantizing the input itself
+    virtual bool support_quantized_input() { return false; }
+
+    //! the Q8_0 companion of inputs()[0], it is the last input so its memory is
+    //! recalled with the other inputs
+    void set_quantized_input(std::shared_ptr<Tensor> quantized) {
+        add_input(quantized);
+        m_quantized_input = quantized;
+    }
+    const std::shared_ptr<Tensor>& quantized_input() const { return m_quantized_input; }
+
+    //! quantize inputs()[0] to its companion, unless the producer or another
+    //! reader has done it since the input is written
+    void prepare_quantized_input();
+
+    //! the float weights which multiply the channels of inputs()[0] along their
+    //! second dim, a scale of the channels can be folded into them
+    virtual OpIOs input_scale_weights() { return {}; }
+
+    //! the extra input read by a fused computation, it is counted as a user
+    //! of the tensor like the inputs given to the constructor
+    void add_input(std::shared_ptr<Tensor> input) {
+        input->add_user();
+        m_inputs.push_back(input);
+    }
+
 private:
     Device* m_device;
     OpIOs m_weights;
     OpIOs m_inputs;
     OpIOs m_outputs;
+    std::shared_ptr<Tensor> m_quantized_input;
     std::string m_name;
 };
 
@@ -118,6 +151,27 @@ public:
         set_weights(weights);
     }
 
+    //! the second output of the norm is the quantized companion of its result,
+    //! the norm quantizes the rows when they are normed
+    std::shared_ptr<Tensor> quantized_output() {
+        if (outputs().size() == 1) {
+            add_outputs(outputs()[0]->quantized_companion());
+        }
+        return outputs()[1];
+    }
+
+    //! only multiply the weight after the norm, so it can be folded
+    bool weight_only() const { return m_mul && !m_bias; }
+
+    //! the weight is folded into the consumers, the norm does not multiply it
+    std::shared_ptr<Tensor> release_weight() {
+        INFER_ASSERT(weight_only(), "the norm weight can not be released.");
+        auto weight = weights()[0];
+        set_weights({});
+        m_mul = false;
+        return weight;
+    }
+
     void execute(WorkSpace* workspace, uint32_t nr_past) override;
 
 private:
@@ -176,12 +230,63 @@ public:
     virtual std::vector<size_t> preprocess_weight(
             Tensor* tensor, void* src, void* dst) override;
 
+    void set_weight_preprocessed(Tensor*) override { m_weight_packed = true; }
+
+    bool support_quantized_input() override {
+        auto dtype = weights()[0]->dtype();
+        return get_kernel()->m_kernel_type != KernelType::GPU &&
+               (dtype == DType::Int4 || dtype == DType::Int8);
+    }
+
     virtual void execute(WorkSpace* workspace, uint32_t nr_past) override;
 
     size_t get_workspace_in_byte() override;
 
+    OpIOs input_scale_weights() override { return {weights()[0]}; }
+
+    //! the activation applied to the output, fused into the matmul tasks
+    void set_activation(ElemMode mode) {
+        m_activate = true;
+        m_act_mode = mode;
+    }
+
+    //! add residual * scale to the output after the activation, fused into the
+    //! matmul tasks
+    void set_residual(std::shared_ptr<Tensor> residual, float scale = 1.0f) {
+        add_input(residual);
+        m_residual = residual;
+        m_residual_scale = scale;
+    }
+
     bool m_bias = false;
     bool m_weight_packed = false;
+
+private:
+    bool has_epilogue() const { return m_activate || m_residual; }
+    //! the gpu applies the epilogue by the elemwise kernels after the matmul
+    bool fuse_epilogue() {
+        return has_epilogue() && get_kernel()->m_kernel_type != KernelType::GPU;
+    }
+
+    template <KernelID Id, typename... Args>
+    void compute(const MatmulEpilogue& epilogue, Args... args) {
+        if (fuse_epilogue()) {
+            get_kernel()->matmul_with_epilogue<Id>(epilogue, args...);
+        } else {
+            get_kernel()->operator()<Id>(args...);
+        }
+    }
+
+    //! the matmul with the Q8_0 blocks of the input
+    void execute_quantized(
+            float* dst, const float* bias, uint32_t M, uint32_t N, uint32_t K,
+            const MatmulEpilogue& epilogue);
+    void execute_epilogue(const MatmulEpilogue& epilogue, WorkSpace* workspace);
+
+    bool m_activate = false;
+    ElemMode m_act_mode = ElemMode::Silu;
+    std::shared_ptr<Tensor> m_residual;
+    float m_residual_scale = 1.0f;
 };
 
 class MatMulLast : public MatMul {
@@ -190,9 +295,8 @@ public:
 
     void deduce_output_shape() override {
         auto weight_shape = weights()[0]->shape();
-        auto input_shape = inputs()[0]->shape();
-        //! only compute the last token
-        size_t M = 1;
+        //! only compute the last token, unless the rows are selected
+        size_t M = m_rows.empty() ? 1 : m_rows.size();
         size_t K = weight_shape[1];
         size_t N = weight_shape[0];
         if (m_weight_packed) {
@@ -202,8 +306,23 @@ public:
     }
     void execute(WorkSpace* workspace, uint32_t nr_past) override;
     virtual bool need_preprocess_weight(Tensor*) override { return false; }
+    //! only the last or the selected rows of the input are used
+    bool support_quantized_input() override { return false; }
+
+    //! the normed input of the head is the final hidden state of the graph
+    OpIOs input_scale_weights() override { return {}; }
 
     size_t get_workspace_in_byte() override;
+
+    //! compute the output of the selected input rows, such as every token to
+    //! score a sequence, the empty rows means the last one
+    void set_rows(const std::vector<uint32_t>& rows) { m_rows = rows; }
+
+private:
+    //! whether the selected rows are all the input rows in order
+    bool all_rows();
+
+    std::vector<uint32_t> m_rows;
 };
 
 class SoftMax : public OpBase {
@@ -246,8 +365,17 @@ public:
         outputs()[0]->set_shape(out_shape, inputs()[0]->dtype());
     }
 
+    //! the output shares the memory of the input instead of a copy
+    void set_view() {
+        m_view = true;
+        outputs()[0]->set_view_of(inputs()[0]);
+    }
+
+    void execute(WorkSpace* workspace, uint32_t nr_past) override;
+
 private:
     std::vector<int> m_target_shape;
+    bool m_view = false;
 };
 
 class Elemwise : public OpBase {
@@ -348,9 +476,17 @@ public:
         set_weights(weights);
     }
 
+    //! the q, k and v weights, the biases follow them
+    OpIOs input_scale_weights() override {
+        if (m_fused_weights) {
+            return {weights()[0]};
+        }
+        return {weights()[0], weights()[1], weights()[2]};
+    }
+
     void pre_execute() override {
         auto token_len = inputs()[0]->shape()[0];
-        for (auto weight : weights()) {
+        for (auto& weight : weights()) {
             weight->prepare_data();
         }
         auto output = outputs()[0];
@@ -358,6 +494,16 @@ public:
             output->prepare_data();
             output->resume_user_count();
         }
+        //! every sequence of the batch appends its rows
+        for (auto& run : batch_runs()) {
+            select_seq(run.first, true);
+            m_kstorage->prepare_data_with_length(run.second);
+            m_vstorage->prepare_data_with_length(run.second);
+        }
+        if (!m_batch_seqs.empty()) {
+            select_seq(0, false);
+            return;
+        }
         m_kstorage->prepare_data_with_length(token_len);
         m_vstorage->prepare_data_with_length(token_len);
     }
@@ -365,13 +511,22 @@ public:
     virtual void execute(WorkSpace* workspace, uint32_t nr_past) override = 0;
 
     void end_execute() override {
-        for (auto weight : weights()) {
+        for (auto& weight : weights()) {
             weight->recall_data();
         }
-        for (auto input : inputs()) {
+        for (auto& input : inputs()) {
             input->decrease_curr_user_count();
         }
         auto token_len = inputs()[0]->shape()[0];
+        for (auto& run : batch_runs()) {
+            select_seq(run.first, false);
+            m_kstorage->add_id(run.second);
+            m_vstorage->add_id(run.second);
+        }
+        if (!m_batch_seqs.empty()) {
+            select_seq(0, false);
+            return;
+        }
         m_kstorage->add_id(token_len);
         m_vstorage->add_id(token_len);
         m_kstorage->recall_data();
@@ -381,10 +536,46 @@ public:
     size_t get_workspace_in_byte() override;
 
     void reset_ctx() {
+        //! drop all the forked sequences, only the sequence 0 is kept
+        if (!m_seq_kstorage.empty()) {
+            m_kstorage = m_seq_kstorage[0];
+            m_vstorage = m_seq_vstorage[0];
+            m_seq_kstorage.clear();
+            m_seq_vstorage.clear();
+        }
         m_kstorage->reset_id();
         m_vstorage->reset_id();
     }
 
+    //! let the sequence dst share the kv cache of the sequence src, the cache
+    //! is copied when one of them appends to it
+    void fork_seq(uint32_t src, uint32_t dst);
+
+    //! row i of the next input is one token of the sequence seqs[i], the rows of
+    //! a sequence are consecutive, the empty seqs means the input is the tokens
+    //! of the sequence 0
+    void set_batch_seqs(const std::vector<uint32_t>& seqs);
+
+    //! drop the kv cache of the sequence, it restarts from an empty context
+    void reset_seq(uint32_t seq);
+
+    //! store the kv cache head major, so the attention of a head reads its
+    //! contiguous rows, it is called before the execution and ignored by the
+    //! attention without the kernels of the layout
+    void set_kv_head_major() {
+        if (!support_kv_head_major()) {
+            return;
+        }
+        m_kstorage = std::make_shared<KvStorage>(
+                std::vector<size_t>{m_ctx, m_embd}, m_kstorage->dtype(), device(),
+                m_head);
+        m_vstorage = std::make_shared<KvStorage>(
+                std::vector<size_t>{m_ctx, m_embd}, m_vstorage->dtype(), device(),
+                m_head);
+    }
+
+    virtual bool support_kv_head_major() { return false; }
+
     virtual bool need_preprocess_weight(Tensor* weight) override {
         auto kernel = get_kernel();
         bool int4 = weight->dtype() == DType::Int4;
@@ -406,6 +597,8 @@ public:
     virtual std::vector<size_t> preprocess_weight(
             Tensor* tensor, void* src, void* dst) override;
 
+    void set_weight_preprocessed(Tensor*) override { m_packed_weight = true; }
+
 protected:
     uint32_t m_embd;
     uint32_t m_head;
@@ -415,8 +608,28 @@ protected:
     bool m_bias;
     bool m_packed_weight = false;
 
-    std::unique_ptr<KvStorage> m_kstorage;
-    std::unique_ptr<KvStorage> m_vstorage;
+    //! make the kv cache of the sequence the current one, it is copied first if
+    //! it is shared with other sequences and will be written
+    void select_seq(uint32_t seq, bool write);
+
+    //! the consecutive rows of the batch, every run is {seq, number of rows}, they
+    //! are found once when the batch is set
+    const std::vector<std::pair<uint32_t, uint32_t>>& batch_runs() const {
+        return m_batch_runs;
+    }
+
+    //! the workspace of the attention scores of seqlen rows, it also holds the
+    //! partial results of the decode attention
+    size_t qk_workspace_in_byte(uint32_t seqlen);
+
+    //! the kv cache of the current sequence
+    std::shared_ptr<KvStorage> m_kstorage;
+    std::shared_ptr<KvStorage> m_vstorage;
+    //! the kv cache of all the sequences, empty when there is only sequence 0
+    std::vector<std::shared_ptr<KvStorage>> m_seq_kstorage;
+    std::vector<std::shared_ptr<KvStorage>> m_seq_vstorage;
+    std::vector<uint32_t> m_batch_seqs;
+    std::vector<std::pair<uint32_t, uint32_t>> m_batch_runs;
 };
 
 class LlamaAttention : public AttentionBase {
@@ -439,7 +652,24 @@ public:
 
     void execute(WorkSpace* workspace, uint32_t nr_past) override;
 
+    bool support_kv_head_major() override {
+        return get_kernel()->m_kernel_type != KernelType::GPU;
+    }
+
+    bool support_quantized_input() override {
+        auto dtype = weights()[0]->dtype();
+        return get_kernel()->m_kernel_type != KernelType::GPU &&
+               (dtype == DType::Int4 || dtype == DType::Int8);
+    }
+
 private:
+    //! rope the q and the new k, then compute the attention of q with the kv
+    //! cache of the current sequence, the new k and v are stored to the head
+    //! major kv cache here, and they are already in the kv cache of rows
+    void attention(
+            float* q, float* k, float* v, float* out, float* qk, uint32_t seqlen,
+            uint32_t nr_past);
+
     uint32_t m_rot;
     RotMode m_rotary_mode;
 };
@@ -0,0 +1,160 @@
+#include "pass.h"
+
+using namespace inferllm;
+
+std::vector<OpBase*> GraphPass::all_oprs(Graph* graph) {
+    //! the operators out of the layer range of a pipeline stage are not executed,
+    //! and their weights are not read
+    return graph->stage_oprs();
+}
+
+std::vector<std::pair<OpBase*, size_t>> GraphPass::consumers(
+        const std::vector<OpBase*>& oprs, const std::shared_ptr<Tensor>& tensor) {
+    std::vector<std::pair<OpBase*, size_t>> users;
+    for (auto opr : oprs) {
+        for (size_t i = 0; i < opr->inputs().size(); i++) {
+            if (opr->inputs()[i] == tensor) {
+                users.push_back({opr, i});
+            }
+        }
+    }
+    return users;
+}
+
+bool PassManager::run(Graph* graph) {
+    bool changed = false;
+    for (auto& pass : m_passes) {
+        changed = pass->apply(graph) || changed;
+    }
+    return changed;
+}
+
+bool EliminateReshapePass::apply(Graph* graph) {
+    bool changed = false;
+    for (auto opr : all_oprs(graph)) {
+        if (auto reshape = dynamic_cast<Reshape*>(opr)) {
+            reshape->set_view();
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool FoldNormWeightPass::apply(Graph* graph) {
+    //! the weights are scaled in place in the host memory
+    if (!graph->device()->unified_memory()) {
+        return false;
+    }
+    auto oprs = all_oprs(graph);
+    bool changed = false;
+    for (auto opr : oprs) {
+        auto norm = dynamic_cast<LayerNorm*>(opr);
+        if (!norm || !norm->weight_only()) {
+            continue;
+        }
+        size_t embd = norm->weights()[0]->length();
+        auto users = consumers(oprs, norm->outputs()[0]);
+        bool foldable = !users.empty();
+        OpIOs weights;
+        for (auto& user : users) {
+            auto scaled = user.first->input_scale_weights();
+            foldable = foldable && user.second == 0 && !scaled.empty();
+            for (auto& weight : scaled) {
+                foldable = foldable && weight->dtype() == DType::Float32 &&
+                           !weight->mapped() && weight->dims() == 2 &&
+                           weight->shape()[1] == embd;
+            }
+            weights.insert(weights.end(), scaled.begin(), scaled.end());
+        }
+        if (!foldable) {
+            continue;
+        }
+        auto gamma = norm->release_weight();
+        gamma->prepare_data();
+        const float* scale = gamma->ptr<float>();
+        for (auto& weight : weights) {
+            weight->prepare_data();
+            float* data = weight->ptr<float>();
+            size_t rows = weight->shape()[0];
+            for (size_t row = 0; row < rows; row++) {
+                for (size_t col = 0; col < embd; col++) {
+                    data[row * embd + col] *= scale[col];
+                }
+            }
+        }
+        gamma->recall_data();
+        changed = true;
+    }
+    return changed;
+}
+
+bool ShareQuantizedInputPass::apply(Graph* graph) {
+    auto oprs = all_oprs(graph);
+    bool changed = false;
+    for (auto opr : oprs) {
+        auto output = opr->outputs()[0];
+        std::vector<OpBase*> readers;
+        for (auto& user : consumers(oprs, output)) {
+            if (user.second == 0 && user.first->support_quantized_input() &&
+                !user.first->quantized_input()) {
+                readers.push_back(user.first);
+            }
+        }
+        if (readers.empty()) {
+            continue;
+        }
+        std::shared_ptr<Tensor> quantized;
+        if (auto norm = dynamic_cast<LayerNorm*>(opr)) {
+            quantized = norm->quantized_output();
+        } else if (readers.size() > 1 || !dynamic_cast<MatMul*>(readers[0])) {
+            quantized = output->quantized_companion();
+        } else {
+            //! the only matmul quantizes the input to its workspace once anyway
+            continue;
+        }
+        for (auto reader : readers) {
+            reader->set_quantized_input(quantized);
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+bool GroupSiblingPass::apply(Graph* graph) {
+    bool changed = false;
+    for (auto& module : graph->m_modules) {
+        auto& oprs = module->oprs();
+        for (size_t i = 0; i < oprs.size(); i++) {
+            if (oprs[i]->inputs().empty()) {
+                continue;
+            }
+            auto input = oprs[i]->inputs()[0];
+            size_t next = i + 1;
+            for (size_t j = i + 1; j < oprs.size(); j++) {
+                if (oprs[j]->inputs().empty() || oprs[j]->inputs()[0] != input) {
+                    continue;
+                }
+                //! it can not move before the producers of its inputs
+                bool depend = false;
+                for (size_t k = next; k < j && !depend; k++) {
+                    for (auto& output : oprs[k]->outputs()) {
+                        for (auto& in : oprs[j]->inputs()) {
+                            depend = depend || in == output;
+                        }
+                    }
+                }
+                if (depend) {
+                    continue;
+                }
+                if (j != next) {
+                    auto opr = oprs[j];
+                    oprs.erase(oprs.begin() + j);
+                    oprs.insert(oprs.begin() + next, opr);
+                    changed = true;
+                }
+                next++;
+            }
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "graph.h"
+
+namespace inferllm {
+
+//! a pass rewrites the ops of the constructed graph before its first execution,
+//! when the dtypes of the weights are loaded, the ops of the modules are kept in
+//! the execution order
+class GraphPass {
+public:
+    virtual ~GraphPass() = default;
+
+    virtual std::string name() const = 0;
+
+    //! return whether the graph is changed
+    virtual bool apply(Graph* graph) = 0;
+
+protected:
+    //! the ops of all the modules in the execution order, only the ones of the
+    //! layer range when the graph is a stage of the pipeline
+    static std::vector<OpBase*> all_oprs(Graph* graph);
+
+    //! the ops which read the tensor, with the index of the tensor in their inputs
+    static std::vector<std::pair<OpBase*, size_t>> consumers(
+            const std::vector<OpBase*>& oprs, const std::shared_ptr<Tensor>& tensor);
+};
+
+//! run the passes in the order they are added
+class PassManager {
+public:
+    template <typename Pass, typename... Args>
+    PassManager& add_pass(Args&&... args) {
+        m_passes.push_back(make_unique<Pass>(std::forward<Args>(args)...));
+        return *this;
+    }
+
+    //! return whether any pass changed the graph
+    bool run(Graph* graph);
+
+private:
+    std::vector<std::unique_ptr<GraphPass>> m_passes;
+};
+
+//! the output of the reshape shares the memory of its input instead of a copy
+class EliminateReshapePass : public GraphPass {
+public:
+    std::string name() const override { return "EliminateReshape"; }
+    bool apply(Graph* graph) override;
+};
+
+//! fold the weight of the norm into the float weights of all its consumers at
+//! load, W * (norm(x) * gamma) = (W * diag(gamma)) * norm(x), the quantized
+//! weights are not folded as it needs to quantize them again
+class FoldNormWeightPass : public GraphPass {
+public:
+    std::string name() const override { return "FoldNormWeight"; }
+    bool apply(Graph* graph) override;
+};
+
+//! the readers which quantize the same float tensor share its Q8_0 companion,
+//! such as q, k, v or w1, w3, so the tensor is quantized once per execution, by
+//! the norm producing it with the normed rows, or else by its first reader
+class ShareQuantizedInputPass : public GraphPass {
+public:
+    std::string name() const override { return "ShareQuantizedInput"; }
+    bool apply(Graph* graph) override;
+};
+
+//! move the ops of a module which read the same input next to the first of
+//! them, when they do not depend on the ops in between, so the input is read
+//! while it is still in the cache
+class GroupSiblingPass : public GraphPass {
+public:
+    std::string name() const override { return "GroupSibling"; }
+    bool apply(Graph* graph) override;
+};
+
+}  // namespace inferllm
@@ -0,0 +1,247 @@
+#include "pipeline.h"
+
+#include <algorithm>
+
+#include "graph.h"
+
+using namespace inferllm;
+
+namespace {
+//! a micro batch of the execution
+struct MicroBatch {
+    std::vector<int32_t> tokens;
+    std::vector<uint32_t> seqs;
+    uint32_t nr_past;
+    bool prefill;
+};
+}  // namespace
+
+PipelineStage::PipelineStage(
+        Graph* graph, uint32_t stage, uint32_t nr_stage,
+        std::unique_ptr<Transport> recv, std::unique_ptr<Transport> send,
+        uint32_t nr_micro_batch)
+        : m_graph(graph),
+          m_stage(stage),
+          m_nr_stage(nr_stage),
+          m_nr_micro_batch(std::max(nr_micro_batch, 1u)),
+          m_recv(std::move(recv)),
+          m_send(std::move(send)) {
+    INFER_ASSERT(
+            stage < nr_stage && nr_stage > 1, "the stage is out of the pipeline.");
+    uint32_t begin = 0, end = 0;
+    layer_range(stage, nr_stage, graph->get_nr_layer(), begin, end);
+    graph->set_layer_range(begin, end);
+    if (m_stage == 0) {
+        m_collector = std::thread([this]() {
+            while (true) {
+                PipelineMessage message;
+                std::vector<int32_t> tokens;
+                std::vector<uint32_t> seqs;
+                std::vector<float> data;
+                recv_message(message, tokens, seqs, data);
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_replies.emplace_back(message, std::move(data));
+                }
+                m_cv.notify_one();
+                if (message.kind == PipelineMessage::Stop) {
+                    break;
+                }
+            }
+        });
+    }
+}
+
+PipelineStage::~PipelineStage() {
+    if (m_stage == 0) {
+        PipelineMessage message;
+        message.kind = PipelineMessage::Stop;
+        control(message);
+        m_collector.join();
+    }
+}
+
+void PipelineStage::layer_range(
+        uint32_t stage, uint32_t nr_stage, uint32_t nr_layer, uint32_t& begin,
+        uint32_t& end) {
+    INFER_ASSERT(nr_stage <= nr_layer, "the pipeline has more stages than layers.");
+    begin = static_cast<uint64_t>(stage) * nr_layer / nr_stage;
+    end = static_cast<uint64_t>(stage + 1) * nr_layer / nr_stage;
+}
+
+void PipelineStage::send_message(
+        const PipelineMessage& message, const std::vector<int32_t>& tokens,
+        const std::vector<uint32_t>& seqs, const std::vector<float>& data) {
+    m_send->send(&message, sizeof(message));
+    m_send->send(tokens.data(), message.nr_token * sizeof(int32_t));
+    m_send->send(seqs.data(), message.nr_seq * sizeof(uint32_t));
+    m_send->send(data.data(), message.nr_data * sizeof(float));
+}
+
+void PipelineStage::recv_message(
+        PipelineMessage& message, std::vector<int32_t>& tokens,
+        std::vector<uint32_t>& seqs, std::vector<float>& data) {
+    m_recv->recv(&message, sizeof(message));
+    tokens.resize(message.nr_token);
+    seqs.resize(message.nr_seq);
+    data.resize(message.nr_data);
+    m_recv->recv(tokens.data(), tokens.size() * sizeof(int32_t));
+    m_recv->recv(seqs.data(), seqs.size() * sizeof(uint32_t));
+    m_recv->recv(data.data(), data.size() * sizeof(float));
+}
+
+PipelineMessage PipelineStage::wait_reply(std::vector<float>& data) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return !m_replies.empty(); });
+    auto message = m_replies.front().first;
+    data = std::move(m_replies.front().second);
+    m_replies.pop_front();
+    return message;
+}
+
+void PipelineStage::execute(
+        const std::vector<int32_t>& in_token, const std::vector<uint32_t>& seqs,
+        std::vector<float>& logist, uint32_t nr_past, bool prefill) {
+    INFER_ASSERT(m_stage == 0, "only the first stage executes the pipeline.");
+    std::vector<MicroBatch> batches;
+    if (!seqs.empty()) {
+        //! the batch is split by the sequences, every sequence has its kv cache
+        std::vector<size_t> starts;
+        for (size_t i = 0; i < seqs.size(); i++) {
+            if (i == 0 || seqs[i] != seqs[i - 1]) {
+                starts.push_back(i);
+            }
+        }
+        size_t nr_run = starts.size();
+        size_t nr_batch = std::min<size_t>(m_nr_micro_batch, nr_run);
+        starts.push_back(seqs.size());
+        for (size_t b = 0; b < nr_batch; b++) {
+            size_t first = starts[b * nr_run / nr_batch];
+            size_t last = starts[(b + 1) * nr_run / nr_batch];
+            batches.push_back(
+                    {{in_token.begin() + first, in_token.begin() + last},
+                     {seqs.begin() + first, seqs.begin() + last},
+                     0,
+                     false});
+        }
+    } else {
+        //! the prompt is split to chunks, only the last one outputs the logits
+        size_t nr_batch = 1;
+        if (m_graph->support_chunked_prefill()) {
+            nr_batch = std::min<size_t>(m_nr_micro_batch, in_token.size());
+        }
+        size_t chunk = (in_token.size() + nr_batch - 1) / nr_batch;
+        for (size_t start = 0; start < in_token.size(); start += chunk) {
+            size_t end = std::min(start + chunk, in_token.size());
+            batches.push_back(
+                    {{in_token.begin() + start, in_token.begin() + end},
+                     {},
+                     static_cast<uint32_t>(nr_past + start),
+                     prefill || end < in_token.size()});
+        }
+    }
+
+    std::vector<float> data;
+    for (auto& batch : batches) {
+        data.clear();
+        m_graph->execute_stage(
+                batch.tokens, batch.seqs, data, batch.nr_past, batch.prefill);
+        PipelineMessage message;
+        message.kind = PipelineMessage::Execute;
+        message.nr_token = batch.tokens.size();
+        message.nr_seq = batch.seqs.size();
+        message.nr_past = batch.nr_past;
+        message.prefill = batch.prefill;
+        message.nr_data = data.size();
+        send_message(message, batch.tokens, batch.seqs, data);
+    }
+    //! the logits of the micro batches are the rows of the logits in order
+    size_t offset = 0;
+    for (size_t i = 0; i < batches.size(); i++) {
+        wait_reply(data);
+        INFER_ASSERT(
+                offset + data.size() <= logist.size(),
+                "output length is not match with logist size");
+        std::copy(data.begin(), data.end(), logist.begin() + offset);
+        offset += data.size();
+    }
+    INFER_ASSERT(
+            prefill || offset == logist.size(),
+            "output length is not match with logist size");
+}
+
+void PipelineStage::control(const PipelineMessage& message) {
+    send_message(message, {}, {}, {});
+    std::vector<float> data;
+    wait_reply(data);
+}
+
+void PipelineStage::reset_ctx() {
+    PipelineMessage message;
+    message.kind = PipelineMessage::ResetCtx;
+    control(message);
+}
+
+void PipelineStage::reset_seq(uint32_t seq) {
+    PipelineMessage message;
+    message.kind = PipelineMessage::ResetSeq;
+    message.seq0 = seq;
+    control(message);
+}
+
+void PipelineStage::fork_seq(uint32_t src, uint32_t dst) {
+    PipelineMessage message;
+    message.kind = PipelineMessage::ForkSeq;
+    message.seq0 = src;
+    message.seq1 = dst;
+    control(message);
+}
+
+void PipelineStage::serve() {
+    INFER_ASSERT(m_stage > 0, "the first stage executes instead of serving.");
+    bool last = m_stage + 1 == m_nr_stage;
+    PipelineMessage message;
+    std::vector<int32_t> tokens;
+    std::vector<uint32_t> seqs;
+    std::vector<float> data;
+    while (true) {
+        recv_message(message, tokens, seqs, data);
+        switch (message.kind) {
+            case PipelineMessage::Execute:
+                m_graph->execute_stage(
+                        tokens, seqs, data, message.nr_past, message.prefill);
+                message.nr_data = data.size();
+                break;
+            case PipelineMessage::ResetCtx:
+                m_graph->reset_ctx();
+                break;
+            case PipelineMessage::ResetSeq:
+                m_graph->reset_seq(message.seq0);
+                break;
+            case PipelineMessage::ForkSeq:
+                m_graph->fork_seq(message.seq0, message.seq1);
+                break;
+            case PipelineMessage::Stop:
+                break;
+            default:
+                INFER_ASSERT(0, "unknown message of the pipeline.");
+        }
+        //! only the execution carries the data, the last stage replies the first
+        //! one with the logits
+        if (message.kind != PipelineMessage::Execute) {
+            data.clear();
+        }
+        message.nr_data = data.size();
+        if (last) {
+            if (message.kind != PipelineMessage::Stop) {
+                message.kind = PipelineMessage::Result;
+            }
+            message.nr_token = 0;
+            message.nr_seq = 0;
+        }
+        send_message(message, tokens, seqs, data);
+        if (message.kind == PipelineMessage::Stop) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "transport.h"
+
+namespace inferllm {
+
+class Graph;
+
+//! the header of the message between the stages, it is followed by the tokens,
+//! the sequences of the batched tokens and the float data
+struct PipelineMessage {
+    enum Kind : uint32_t {
+        Execute = 0,
+        //! the logits or the acknowledgement the last stage sends to the first one
+        Result,
+        ResetCtx,
+        ResetSeq,
+        ForkSeq,
+        Stop,
+    };
+    uint32_t kind = Execute;
+    uint32_t nr_token = 0;
+    uint32_t nr_seq = 0;
+    uint32_t nr_past = 0;
+    uint32_t prefill = 0;
+    //! the sequences of ResetSeq and ForkSeq
+    uint32_t seq0 = 0;
+    uint32_t seq1 = 0;
+    uint32_t reserved = 0;
+    uint64_t nr_data = 0;
+};
+
+//! a stage of the pipeline which splits the layers of the model to processes, the
+//! stages are connected as a ring, every stage receives from the previous one and
+//! sends to the next one, and the last stage sends the logits back to the first
+//! one. The first stage generates like the model without pipeline, the others
+//! serve the messages until the first stage is destroyed
+class PipelineStage {
+public:
+    //! the layers of the graph are split evenly to the stages, the input is split
+    //! to nr_micro_batch parts, so the stages compute different parts at the
+    //! same time
+    PipelineStage(
+            Graph* graph, uint32_t stage, uint32_t nr_stage,
+            std::unique_ptr<Transport> recv, std::unique_ptr<Transport> send,
+            uint32_t nr_micro_batch = 1);
+
+    ~PipelineStage();
+
+    //! the layers [begin, end) of the stage
+    static void layer_range(
+            uint32_t stage, uint32_t nr_stage, uint32_t nr_layer, uint32_t& begin,
+            uint32_t& end);
+
+    //! execute the tokens through all the stages and gather the logits like
+    //! Graph::execute, or Graph::execute_batch when the seqs are given. The
+    //! batch is split by sequences and the prompt of one sequence is split by
+    //! chunks, the first stage computes a part while the later stages compute
+    //! the parts before it
+    void execute(
+            const std::vector<int32_t>& in_token, const std::vector<uint32_t>& seqs,
+            std::vector<float>& logist, uint32_t nr_past, bool prefill);
+
+    //! pass the change of the kv cache to the other stages
+    void reset_ctx();
+    void reset_seq(uint32_t seq);
+    void fork_seq(uint32_t src, uint32_t dst);
+
+    //! serve the messages from the previous stage until the first stage stops,
+    //! only for the stages except the first one
+    void serve();
+
+    uint32_t stage() const { return m_stage; }
+
+private:
+    void send_message(
+            const PipelineMessage& message, const std::vector<int32_t>& tokens,
+            const std::vector<uint32_t>& seqs, const std::vector<float>& data);
+    void recv_message(
+            PipelineMessage& message, std::vector<int32_t>& tokens,
+            std::vector<uint32_t>& seqs, std::vector<float>& data);
+
+    //! send the control message through the stages and wait it back
+    void control(const PipelineMessage& message);
+
+    //! wait the reply of the earliest message the first stage sent
+    PipelineMessage wait_reply(std::vector<float>& data);
+
+    Graph* m_graph;
+    uint32_t m_stage;
+    uint32_t m_nr_stage;
+    uint32_t m_nr_micro_batch;
+    std::unique_ptr<Transport> m_recv;
+    std::unique_ptr<Transport> m_send;
+
+    //! the first stage receives the replies on the thread, so the last stage
+    //! never blocks on sending them while the first stage is sending
+    std::thread m_collector;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<PipelineMessage, std::vector<float>>> m_replies;
+};
+
+}  // namespace inferllm
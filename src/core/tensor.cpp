@@ -1,5 +1,8 @@
 #include "tensor.h"
+#include <cstring>
+#include <vector>
 #include "../kern/kernel_define.h"
+#include "../kern/naive/quantize.h"
 #include "memory.h"
 #include "utils.h"
 #include "op.h"
@@ -46,6 +49,11 @@ uint32_t inferllm::dtype_block_size(DType dtype) {
 }
 
 TensorState Tensor::prepare_data() {
+    if (m_view_base) {
+        m_data = m_view_base->ptr();
+        m_state = TensorState::Own;
+        return m_state;
+    }
     size_t length = length_in_byte();
     if (!m_data && m_state == TensorState::OutSide) {
         //! if m_file is not nullptr, the tensor is weights and should be read or map
@@ -66,6 +74,15 @@ TensorState Tensor::recall_data() {
     if (m_shared) {
         return m_state;
     }
+    //! release the user of the base memory
+    if (m_view_base) {
+        if (m_state == TensorState::Own) {
+            m_data = nullptr;
+            m_state = TensorState::OutSide;
+            m_view_base->decrease_curr_user_count();
+        }
+        return m_state;
+    }
     //! if the tensor data is from allocate by itself, we need free the memory
     if (!m_file && m_data != nullptr && m_state == TensorState::Own) {
         m_device->free_device(m_data);
@@ -77,13 +94,14 @@ TensorState Tensor::recall_data() {
 
 size_t Tensor::read_data_from_file() {
     size_t length = length_in_byte();
-    if (m_file->enable_mmap()) {
+    if (mapped()) {
         //! no unified memory, we need read data to host memory and copy to device
         if (!m_device->unified_memory()) {
             auto temp_ptr = m_file->get_mmap_data(length, m_file_offset);
             m_data = m_device->allocate(length);
             m_device->host2device_copy(m_data, temp_ptr, length);
         } else {
+            //! the pages of the file are not moved to the numa nodes
             m_data = m_file->get_mmap_data(length, m_file_offset);
         }
     } else if (m_data == nullptr) {
@@ -94,12 +112,13 @@ size_t Tensor::read_data_from_file() {
             auto opr = this->owner_op();
             if (opr->need_preprocess_weight(this)) {
                 auto host_ptr2 = m_device->allocate_host(length);
-                m_file->read_data(host_ptr2, length, m_file_offset);
+                read_file(host_ptr2, length);
                 auto shape = opr->preprocess_weight(this, host_ptr2, host_ptr);
                 set_shape(shape);
+                m_preprocessed = true;
                 m_device->free_host(host_ptr2);
             } else {
-                m_file->read_data(host_ptr, length, m_file_offset);
+                read_file(host_ptr, length);
             }
             m_device->host2device_copy(m_data, host_ptr, length);
             m_device->free_host(host_ptr);
@@ -108,18 +127,169 @@ size_t Tensor::read_data_from_file() {
             auto opr = this->owner_op();
             if (opr->need_preprocess_weight(this)) {
                 auto host_data = m_device->allocate_host(length);
-                m_file->read_data(host_data, length, m_file_offset);
+                read_file(host_data, length);
                 auto shape = opr->preprocess_weight(this, host_data, m_data);
                 set_shape(shape);
+                m_preprocessed = true;
                 m_device->free_host(host_data);
             } else {
-                m_file->read_data(m_data, length, m_file_offset);
+                read_file(m_data, length);
+            }
+            //! the rows of the weight are computed by the sub tasks in order
+            if (m_dims == 2) {
+                m_device->distribute(m_data, length, m_shape[0]);
             }
         }
     }
     return length;
 }
 
+namespace {
+float half_to_float(uint16_t h) {
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {
+        //! the subnormal half is normalized in float
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//! the super block of Q6_K in ggml, the element is the 4 low bits of ql and 2 high
+//! bits of qh minus 32, scaled by d and the scale of its 16 elements
+constexpr size_t QK_K = 256;
+struct GgmlBlockQ6K {
+    uint8_t ql[QK_K / 2];
+    uint8_t qh[QK_K / 4];
+    int8_t scales[QK_K / 16];
+    uint16_t d;
+};
+static_assert(sizeof(GgmlBlockQ6K) == 210, "GgmlBlockQ6K size error");
+
+void dequantize_q6k(const GgmlBlockQ6K& block, float* dst) {
+    float d = half_to_float(block.d);
+    const uint8_t* ql = block.ql;
+    const uint8_t* qh = block.qh;
+    const int8_t* sc = block.scales;
+    for (size_t n = 0; n < QK_K; n += 128) {
+        for (int l = 0; l < 32; l++) {
+            int is = l / 16;
+            int q1 = ((ql[l] & 0xf) | (((qh[l] >> 0) & 3) << 4)) - 32;
+            int q2 = ((ql[l + 32] & 0xf) | (((qh[l] >> 2) & 3) << 4)) - 32;
+            int q3 = ((ql[l] >> 4) | (((qh[l] >> 4) & 3) << 4)) - 32;
+            int q4 = ((ql[l + 32] >> 4) | (((qh[l] >> 6) & 3) << 4)) - 32;
+            dst[n + l] = d * sc[is] * q1;
+            dst[n + l + 32] = d * sc[is + 2] * q2;
+            dst[n + l + 64] = d * sc[is + 4] * q3;
+            dst[n + l + 96] = d * sc[is + 6] * q4;
+        }
+        ql += 64;
+        qh += 32;
+        sc += 8;
+    }
+}
+}  // namespace
+
+size_t Tensor::length_in_file() {
+    size_t length = length_in_byte();
+    if (m_file_layout == FileLayout::GgmlBlock) {
+        //! the float scale of every block is a half in the file
+        length -= length / dtype_in_byte(m_dtype) * (sizeof(float) - sizeof(uint16_t));
+    } else if (m_file_layout == FileLayout::Half) {
+        length = m_length * sizeof(uint16_t);
+    } else if (m_file_layout == FileLayout::GgmlQ6K) {
+        length = m_length / QK_K * sizeof(GgmlBlockQ6K);
+    }
+    return length;
+}
+
+void Tensor::read_file(void* dst, size_t length) {
+    if (m_file_layout == FileLayout::Native) {
+        m_file->read_data(dst, length, m_file_offset);
+        return;
+    }
+    INFER_ASSERT(
+            m_file_layout != FileLayout::Half || m_dtype == DType::Float32,
+            "only the Float32 tensor is converted from the halfs.");
+    INFER_ASSERT(
+            m_file_layout != FileLayout::GgmlQ6K ||
+                    (m_dtype == DType::Int8 && m_length % QK_K == 0),
+            "only the Int8 tensor of whole super blocks is converted from Q6_K.");
+    INFER_ASSERT(
+            m_file_layout != FileLayout::GgmlBlock || m_dtype == DType::Int4 ||
+                    m_dtype == DType::Int8,
+            "only the Int4 and Int8 blocks are converted from ggml.");
+    size_t file_length = length_in_file();
+    std::vector<uint8_t> buffer;
+    const uint8_t* src = nullptr;
+    if (m_file->enable_mmap()) {
+        src = static_cast<const uint8_t*>(
+                m_file->get_mmap_data(file_length, m_file_offset));
+    } else {
+        buffer.resize(file_length);
+        m_file->read_data(buffer.data(), file_length, m_file_offset);
+        src = buffer.data();
+    }
+    if (m_file_layout == FileLayout::Half) {
+        float* out = static_cast<float*>(dst);
+        for (size_t i = 0; i < m_length; i++) {
+            uint16_t half;
+            memcpy(&half, src + i * sizeof(half), sizeof(half));
+            out[i] = half_to_float(half);
+        }
+        return;
+    }
+    if (m_file_layout == FileLayout::GgmlQ6K) {
+        //! every super block is the 8 Int8 blocks of the same elements
+        float values[QK_K];
+        for (size_t i = 0; i < m_length / QK_K; i++) {
+            GgmlBlockQ6K block;
+            memcpy(&block, src + i * sizeof(block), sizeof(block));
+            dequantize_q6k(block, values);
+            naive::quantize_row_q8_0_reference(
+                    values, static_cast<BlockQ80*>(dst) + i * QK_K / QK80, QK_K);
+        }
+        return;
+    }
+    size_t nr_block = length / dtype_in_byte(m_dtype);
+    size_t src_block = file_length / nr_block;
+    for (size_t i = 0; i < nr_block; i++, src += src_block) {
+        uint16_t scale;
+        memcpy(&scale, src, sizeof(scale));
+        const uint8_t* qs = src + sizeof(scale);
+        if (m_dtype == DType::Int4) {
+            auto block = static_cast<BlockQ40*>(dst) + i;
+            block->d = half_to_float(scale);
+            //! the byte j of the tensor is the element 2j and 2j + 1
+            for (int j = 0; j < QK40 / 2; j++) {
+                uint8_t lo = j < QK40 / 4 ? qs[2 * j] & 0xf : qs[2 * j - QK40 / 2] >> 4;
+                uint8_t hi = j < QK40 / 4 ? qs[2 * j + 1] & 0xf
+                                          : qs[2 * j + 1 - QK40 / 2] >> 4;
+                block->qs[j] = lo | (hi << 4);
+            }
+        } else {
+            auto block = static_cast<BlockQ80*>(dst) + i;
+            block->d = half_to_float(scale);
+            memcpy(block->qs, qs, QK80);
+        }
+    }
+}
+
 void Tensor::preprocess_data() {
     size_t length = length_in_byte();
     INFER_ASSERT(m_data, "m_data should be not null when preprocess data.");
@@ -133,6 +303,7 @@ void Tensor::preprocess_data() {
             auto shape = opr->preprocess_weight(this, host_src, host_dst);
             m_device->host2device_copy(m_data, host_dst, length);
             set_shape(shape);
+            m_preprocessed = true;
             m_device->free_host(host_src);
             m_device->free_host(host_dst);
         }
@@ -141,6 +312,7 @@ void Tensor::preprocess_data() {
             void* new_data = m_device->allocate(length);
             auto shape = opr->preprocess_weight(this, m_data, new_data);
             set_shape(shape);
+            m_preprocessed = true;
             m_device->free_device(m_data);
             m_data = new_data;
         }
@@ -156,12 +328,26 @@ void Tensor::set_shared_memory(void* data, size_t size) {
     m_shared = true;
 }
 
+bool Tensor::mapped() const {
+    return m_segment || (m_file && m_file->enable_mmap() &&
+                         m_file_layout == FileLayout::Native);
+}
+
+void Tensor::set_segment_data(void* data) {
+    if (m_file && !mapped() && m_data) {
+        m_device->free_device(m_data);
+    }
+    m_file.reset();
+    m_segment = true;
+    set_shared_memory(data, length_in_byte());
+}
+
 Tensor::~Tensor() {
-    if (m_state == TensorState::Own) {
+    if (m_state == TensorState::Own && !m_view_base) {
         recall_data();
     }
     //! the data read from file by m_file->read_data
-    if (m_file && !m_file->enable_mmap() && m_data) {
+    if (m_file && !mapped() && m_data) {
         m_device->free_device(m_data);
     }
 }
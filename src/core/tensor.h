@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
 #include "device.h"
 #include "file.h"
 #include "utils.h"
@@ -29,8 +33,74 @@ enum class TensorState {
     OutSide = 1,
 };
 
+//! the layout of the weight data in the model file
+enum class FileLayout {
+    //! the same as the tensor, it is read or mapped directly
+    Native = 0,
+    //! the Int4 or Int8 blocks of ggml with a half scale, the Int4 block stores
+    //! the element i and i + 16 in the byte i, they are converted to the blocks
+    //! of the tensor when read
+    GgmlBlock = 1,
+    //! the halfs of a Float32 tensor, no operator computes the halfs, so they are
+    //! converted to the floats when read
+    Half = 2,
+    //! the Q6_K super blocks of ggml of 256 elements, they are requantized to the
+    //! Int8 blocks of the tensor when read
+    GgmlQ6K = 3,
+};
+
 class OpBase;
 
+//! the shape or the stride of a tensor, the dims are stored inline, so it is
+//! copied without heap allocation in the execution
+class Shape {
+public:
+    static constexpr uint32_t MAX_DIM = 4;
+
+    Shape() = default;
+    Shape(std::initializer_list<size_t> dims) {
+        for (auto dim : dims) {
+            push_back(dim);
+        }
+    }
+    Shape(const std::vector<size_t>& dims) {
+        for (auto dim : dims) {
+            push_back(dim);
+        }
+    }
+
+    operator std::vector<size_t>() const { return {begin(), end()}; }
+
+    size_t size() const { return m_size; }
+
+    void resize(size_t size) {
+        INFER_ASSERT(size <= MAX_DIM, "the dims of shape is out of range.");
+        m_size = size;
+    }
+
+    void push_back(size_t dim) {
+        INFER_ASSERT(m_size < MAX_DIM, "the dims of shape is out of range.");
+        m_dims[m_size++] = dim;
+    }
+
+    size_t& operator[](size_t i) { return m_dims[i]; }
+    size_t operator[](size_t i) const { return m_dims[i]; }
+
+    size_t* begin() { return m_dims; }
+    size_t* end() { return m_dims + m_size; }
+    const size_t* begin() const { return m_dims; }
+    const size_t* end() const { return m_dims + m_size; }
+
+    bool operator==(const Shape& other) const {
+        return m_size == other.m_size && std::equal(begin(), end(), other.begin());
+    }
+    bool operator!=(const Shape& other) const { return !(*this == other); }
+
+private:
+    size_t m_dims[MAX_DIM] = {0};
+    uint32_t m_size = 0;
+};
+
 //! the tensor memory is from three ways:
 //! 1. the tensor is own the memory, allocate by itself
 //! 2. the tensor memory is shared from outside, such as the input tensor,
@@ -42,7 +112,7 @@ public:
         m_state = TensorState::OutSide;
     }
 
-    Tensor(std::vector<size_t> shape, DType dtype, Device* device) {
+    Tensor(const Shape& shape, DType dtype, Device* device) {
         m_device = device;
         set_shape(shape);
         set_dtype(dtype);
@@ -51,14 +121,14 @@ public:
 
     ~Tensor();
 
-    std::vector<size_t> shape() const { return m_shape; }
+    const Shape& shape() const { return m_shape; }
 
-    void set_shape(std::vector<size_t> shape, DType dtype) {
+    void set_shape(const Shape& shape, DType dtype) {
         set_shape(shape);
         set_dtype(dtype);
     }
 
-    void set_shape(std::vector<size_t> shape) {
+    void set_shape(const Shape& shape) {
         m_dims = shape.size();
         m_shape = shape;
         //! init the tensor as continue tensor
@@ -68,12 +138,15 @@ public:
             m_stride[m_dims - 1 - i] = m_stride[m_dims - i] * m_shape[m_dims - i];
         }
         m_length = m_shape[0] * m_stride[0];
+        if (m_quantized) {
+            m_quantized->set_shape(shape, DType::Int8);
+        }
     }
 
     void set_dtype(DType dtype) { m_dtype = dtype; }
     DType dtype() const { return m_dtype; }
 
-    std::vector<size_t> stride() const { return m_stride; }
+    const Shape& stride() const { return m_stride; }
 
     OpBase* owner_op() { return m_owner_op; }
     void set_owner_op(OpBase* owner_op) { m_owner_op = owner_op; }
@@ -145,35 +218,84 @@ public:
 
     bool shared() const { return m_shared; }
 
-    void set_file(std::shared_ptr<InputFile> file, size_t offset) {
+    //! the tensor is a view of the memory of base, such as the output of a
+    //! reshape, it holds one user of base until its own users are finished
+    void set_view_of(std::shared_ptr<Tensor> base) {
+        base->add_user();
+        m_view_base = base;
+    }
+
+    //! the data is mapped read only from the model file or the weight segment
+    bool mapped() const;
+
+    //! the weight is in the shared weight segment, the memory read from the file
+    //! is freed and the data is never written again
+    void set_segment_data(void* data);
+
+    //! the weight is reordered by its op when it is read
+    bool preprocessed() const { return m_preprocessed; }
+
+    //! the Q8_0 blocks of the float data, shared by the readers which quantize
+    //! it, it is quantized once after the tensor is written, by the producer or
+    //! the first reader, and the readers skip it while it is ready
+    std::shared_ptr<Tensor> quantized_companion() {
+        if (!m_quantized) {
+            m_quantized = std::make_shared<Tensor>(m_device, m_name + "_q8");
+            if (m_dims > 0) {
+                m_quantized->set_shape(m_shape, DType::Int8);
+            }
+        }
+        return m_quantized;
+    }
+    bool quantized_ready() const { return m_quantized_ready; }
+    //! the tensor is written, so the companion is invalid
+    void set_quantized_ready(bool ready) { m_quantized_ready = ready; }
+
+    void set_file(
+            std::shared_ptr<InputFile> file, size_t offset,
+            FileLayout layout = FileLayout::Native) {
         m_state = TensorState::OutSide;
         m_file = file;
         m_file_offset = offset;
+        m_file_layout = layout;
     }
 
     size_t read_data_from_file();
 
+    //! the bytes of the weight in the model file
+    size_t length_in_file();
+
     void preprocess_data();
 
 private:
+    //! read the data of length bytes from the model file, the data in the other
+    //! layout is converted
+    void read_file(void* dst, size_t length);
+
     bool m_shared = false;
     int32_t m_usr_count = 0;
     int32_t m_cur_count = 0;
 
     Device* m_device;
-    OpBase* m_owner_op;
+    OpBase* m_owner_op = nullptr;
 
     //! backup the data of the tensor
     TensorState m_state;
     //! if m_file is not nullptr, the data is mmaped from the file
     std::shared_ptr<InputFile> m_file;
     size_t m_file_offset = 0;
+    FileLayout m_file_layout = FileLayout::Native;
+    bool m_segment = false;
+    bool m_preprocessed = false;
+    std::shared_ptr<Tensor> m_view_base;
+    std::shared_ptr<Tensor> m_quantized;
+    bool m_quantized_ready = false;
 
     uint32_t m_dims = 0;
     size_t m_length = 0;
     DType m_dtype;
-    std::vector<size_t> m_shape;
-    std::vector<size_t> m_stride;
+    Shape m_shape;
+    Shape m_stride;
     void* m_data = nullptr;
     std::string m_name;
 };
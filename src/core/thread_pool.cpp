@@ -1,12 +1,27 @@
 #include "thread_pool.h"
+#include "numa.h"
 
 using namespace inferllm;
 
-ThreadPool::ThreadPool(uint32_t threads_num)
+ThreadPool::ThreadPool(uint32_t threads_num, uint32_t nr_groups)
         : m_nr_threads(threads_num), m_stop{false}, m_active{false} {
     if (threads_num < 1) {
         m_nr_threads = 1;
     }
+    if (nr_groups > 1) {
+        auto& nodes = numa_nodes();
+        if (nodes.size() < nr_groups || m_nr_threads < nr_groups) {
+            INFER_LOG(
+                    "can't split %d threads to %d numa nodes, the system has %zu "
+                    "nodes, run them as one group.\n",
+                    m_nr_threads, nr_groups, nodes.size());
+        } else {
+            m_nr_groups = nr_groups;
+            for (uint32_t group = 0; group < nr_groups; group++) {
+                m_group_nodes.push_back(nodes[group].id);
+            }
+        }
+    }
     if (m_nr_threads > 1) {
         auto system_cpu_count = std::thread::hardware_concurrency();
         if (m_nr_threads > system_cpu_count) {
@@ -15,64 +30,137 @@ ThreadPool::ThreadPool(uint32_t threads_num)
                     "physical cpu cores, got: %d core_number: %d",
                     system_cpu_count, nr_threads());
         }
-        for (uint32_t i = 0; i < m_nr_threads - 1; i++) {
-            m_workers.push_back(new Worker([this, i]() {
-                while (!m_stop) {
-                    while (m_active) {
-                        //! if the thread should work
-                        if (m_workers[i]->work_flag.load(std::memory_order_acquire)) {
-                            m_task(TaskId{
-                                    i * m_task_per_thread,
-                                    std::min((i + 1) * m_task_per_thread, m_nr_task),
-                                    i});
-                            //! Flag worker is finished
-                            m_workers[i]->work_flag.store(
-                                    false, std::memory_order_release);
+    }
+    start();
+}
+
+void ThreadPool::start() {
+    if (m_nr_threads < 2 || !m_workers.empty()) {
+        return;
+    }
+    m_workers.reserve(m_nr_threads - 1);
+    for (uint32_t i = 0; i < m_nr_threads - 1; i++) {
+        m_workers.push_back(new Worker([this, i]() {
+            bind_thread(i);
+            while (!m_stop) {
+                while (m_active) {
+                    //! if the thread should work
+                    if (m_workers[i]->work_flag.load(std::memory_order_acquire)) {
+                        (*m_task)(TaskId{
+                                std::min(i * m_task_per_thread, m_nr_task),
+                                std::min((i + 1) * m_task_per_thread, m_nr_task),
+                                i});
+                        //! Flag worker is finished
+                        m_workers[i]->work_flag.store(
+                                false, std::memory_order_release);
+                    }
+                    //! Wait next task coming
+                    for (int it = 0; it < WORKER_ACTIVE_WAIT; it++) {
+                        if (m_workers[i]->work_flag.load(
+                                    std::memory_order_acquire)) {
+                            break;
                         }
-                        //! Wait next task coming
-                        for (int it = 0; it < WORKER_ACTIVE_WAIT; it++) {
-                            if (m_workers[i]->work_flag.load(
-                                        std::memory_order_acquire)) {
-                                break;
-                            }
-                            if (it < ACTIVE_WAIT_PAUSE_LIMIT || (it & 1)) {
-                                INFER_PAUSE(16);  // Spin lock's CPU-level yield
-                            } else {
-                                // Spin lock's OS-level yield
-                                std::this_thread::yield();
-                            }
+                        if (it < ACTIVE_WAIT_PAUSE_LIMIT || (it & 1)) {
+                            INFER_PAUSE(16);  // Spin lock's CPU-level yield
+                        } else {
+                            // Spin lock's OS-level yield
+                            std::this_thread::yield();
                         }
                     }
-                    {
-                        std::unique_lock<std::mutex> lock(m_mutex);
-                        if (!m_stop && !m_active) {
-                            m_cv.wait(lock, [this] { return m_stop || m_active; });
-                        }
+                }
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    if (!m_stop && !m_active) {
+                        m_cv.wait(lock, [this] { return m_stop || m_active; });
                     }
                 }
-            }));
+            }
+        }));
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_active = false;
+        m_cv.notify_all();
+    }
+    for (auto& worker : m_workers) {
+        delete worker;
+    }
+    m_workers.clear();
+    m_stop = false;
+}
+
+uint32_t ThreadPool::group_task_begin(
+        uint32_t group, uint32_t nr_task, uint32_t nr_threads, uint32_t nr_groups) {
+    //! the first thread of the group and the sub tasks of the threads before it
+    uint64_t thread = (static_cast<uint64_t>(group) * nr_threads + nr_groups - 1) /
+                      nr_groups;
+    uint64_t per_thread = (nr_task + nr_threads - 1) / nr_threads;
+    return static_cast<uint32_t>(std::min<uint64_t>(thread * per_thread, nr_task));
+}
+
+void ThreadPool::bind_thread(uint32_t thread) const {
+    if (m_nr_groups < 2) {
+        return;
+    }
+    uint32_t group = thread_group(thread, m_nr_threads, m_nr_groups);
+    for (auto& node : numa_nodes()) {
+        if (node.id == m_group_nodes[group]) {
+            if (!bind_thread_to_cpus(node.cpus)) {
+                INFER_LOG("failed to pin thread %d to numa node %d.\n", thread, node.id);
+            }
+            return;
         }
     }
 }
-void ThreadPool::add_task(const MultiThreadingTask& task, uint32_t nr_task) {
-    //! If only one thread or one task, execute directly
-    if (m_nr_threads == 1 || nr_task == 1) {
+
+uint32_t ThreadPool::nr_participants(
+        uint32_t nr_task, size_t cost, uint32_t nr_threads, uint32_t nr_groups) {
+    uint32_t nr_participants = std::min(nr_threads, nr_task);
+    if (cost > 0 && nr_participants > 1) {
+        size_t total = cost * nr_task;
+        size_t enough = (total + MIN_COST_PER_THREAD - 1) / MIN_COST_PER_THREAD;
+        nr_participants =
+                static_cast<uint32_t>(std::min<size_t>(nr_participants, enough));
+    }
+    //! the threads split the sub tasks like group_task_begin
+    if (nr_groups > 1 && nr_participants > 1) {
+        return nr_threads;
+    }
+    return std::max(nr_participants, 1u);
+}
+
+void ThreadPool::add_task(
+        const MultiThreadingTask& task, uint32_t nr_task, size_t cost) {
+    if (m_nr_groups > 1 && m_bound_main_thread != std::this_thread::get_id()) {
+        bind_thread(m_nr_threads - 1);
+        m_bound_main_thread = std::this_thread::get_id();
+    }
+    uint32_t nr_threads = nr_participants(nr_task, cost);
+    //! If only one thread has work, execute directly
+    if (nr_threads == 1) {
         task({0, nr_task, m_nr_threads - 1});
         return;
     } else {
+        //! the workers are stopped, such as in the process forked after stop
+        start();
         active();
         INFER_ASSERT(m_active, "thread pool is not actived.");
         m_nr_task = nr_task;
-        //! Set the task number, task iter and task
-        m_task_per_thread = (nr_task + m_nr_threads - 1) / m_nr_threads;
-        m_task = std::move(task);
-        for (uint32_t i = 0; i < m_nr_threads - 1; i++) {
+        //! Set the task number, task iter and task, only the first workers
+        //! and the main thread run the task
+        m_task_per_thread = (nr_task + nr_threads - 1) / nr_threads;
+        m_task = &task;
+        for (uint32_t i = 0; i < nr_threads - 1; i++) {
             m_workers[i]->work_flag.store(true, std::memory_order_release);
         }
         //! Main thread working
-        uint32_t start = (m_nr_threads - 1) * m_task_per_thread;
+        uint32_t start = std::min((nr_threads - 1) * m_task_per_thread, nr_task);
         // printf("main threads start\n");
-        m_task({start, nr_task, m_nr_threads - 1});
+        task({start, nr_task, m_nr_threads - 1});
         //! make sure all threads done
         sync();
     }
@@ -117,13 +205,5 @@ void ThreadPool::deactive() {
     m_active = false;
 }
 ThreadPool::~ThreadPool() {
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_stop = true;
-        m_active = false;
-        m_cv.notify_all();
-    }
-    for (auto& worker : m_workers) {
-        delete worker;
-    }
+    stop();
 }
@@ -58,11 +58,23 @@ public:
  */
 class ThreadPool {
 public:
-    //! Create thread-pool nr_threads thread_pool
-    ThreadPool(uint32_t nr_threads);
+    //! Create thread-pool nr_threads thread_pool, the threads are split in order to
+    //! nr_groups groups pinned to the numa nodes, so the sub tasks of a group run
+    //! on one socket, there is one group if the system has less numa nodes
+    ThreadPool(uint32_t nr_threads, uint32_t nr_groups = 1);
     //! The main thread set the task, parallelism and worker flag to
-    //! notify other thread.
-    void add_task(const MultiThreadingTask& task, uint32_t nr_task);
+    //! notify other thread. The cost is the estimated cost of one sub task, only
+    //! the threads which have enough work are notified, 0 means all the threads
+    void add_task(const MultiThreadingTask& task, uint32_t nr_task, size_t cost = 0);
+
+    //! the number of threads which run the task with the cost of its sub tasks,
+    //! the sub tasks of the groups are the ones bound to their nodes only when
+    //! all the threads run the task, so more than one group runs on all or one
+    uint32_t nr_participants(uint32_t nr_task, size_t cost) const {
+        return nr_participants(nr_task, cost, m_nr_threads, m_nr_groups);
+    }
+    static uint32_t nr_participants(
+            uint32_t nr_task, size_t cost, uint32_t nr_threads, uint32_t nr_groups);
 
     inline void sync();
     //! wake up all the threads from cv.wait(), when the thread pool is not
@@ -70,26 +82,63 @@ public:
     inline void active();
     //! all the threads go to sleep which will reduce CPU occupation
     void deactive();
+
+    //! join the worker threads, such as before the process forks, whose child
+    //! has no threads of the parent, the next task starts the workers again
+    void stop();
+    //! create the worker threads if they are stopped
+    void start();
+
     ~ThreadPool();
 
     uint32_t nr_threads() const { return m_nr_threads; }
 
+    uint32_t nr_groups() const { return m_nr_groups; }
+
+    //! the numa node of the group
+    uint32_t group_node(uint32_t group) const { return m_group_nodes[group]; }
+
+    //! the first sub task of the group when all the threads run the nr_task sub
+    //! tasks, the sub tasks of the group end at the first one of the next group
+    uint32_t group_task_begin(uint32_t group, uint32_t nr_task) const {
+        return group_task_begin(group, nr_task, m_nr_threads, m_nr_groups);
+    }
+    static uint32_t group_task_begin(
+            uint32_t group, uint32_t nr_task, uint32_t nr_threads,
+            uint32_t nr_groups);
+
+    //! the group of the thread, the main thread is the last one
+    static uint32_t thread_group(
+            uint32_t thread, uint32_t nr_threads, uint32_t nr_groups) {
+        return static_cast<uint64_t>(thread) * nr_groups / nr_threads;
+    }
+
     //! The number of iterations < main thread yeild resource>
     static constexpr int MAIN_THREAD_ACTIVE_WAIT = 10000;
     //! The number of iterations < worker thread yeild resource>
     static constexpr int WORKER_ACTIVE_WAIT = 2000;
+    //! The minimum cost a thread should run to pay off its wake up and the sync
+    static constexpr size_t MIN_COST_PER_THREAD = 16 * 1024;
     //! The number of iterations <pause>
     static constexpr int ACTIVE_WAIT_PAUSE_LIMIT = 16;
 
 private:
+    //! pin the calling thread to the numa node of the group of the thread
+    void bind_thread(uint32_t thread) const;
+
     uint32_t m_nr_threads = 1;
+    uint32_t m_nr_groups = 1;
+    std::vector<uint32_t> m_group_nodes;
+    //! the thread which calls add_task is pinned as the last thread
+    std::thread::id m_bound_main_thread;
     //! All the sub task number
     uint32_t m_nr_task = 0;
     uint32_t m_task_per_thread = 0;
     std::atomic_bool m_stop{false};
     std::atomic_bool m_active{false};
-    //! The executable funcition pointer
-    MultiThreadingTask m_task;
+    //! The executable task, it is owned by the caller of add_task which waits
+    //! until the task is finished
+    const MultiThreadingTask* m_task = nullptr;
 
     std::vector<Worker*> m_workers;
     //! The cv and mutex for threading activity
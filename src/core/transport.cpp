@@ -0,0 +1,425 @@
+#include "transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define INFER_SOCKET 1
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if INFER_SOCKET && !defined(__ANDROID__)
+#define INFER_SHM 1
+#endif
+
+using namespace inferllm;
+
+namespace {
+
+//! yield at first and then sleep, so the idle stage does not occupy the core
+void wait_step(uint32_t iter) {
+    if (iter < 1024) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+//! split "HOST:PORT" at the last colon
+void split_host_port(const std::string& address, std::string& host, std::string& port) {
+    auto pos = address.rfind(':');
+    INFER_ASSERT(pos != std::string::npos, "the tcp address should be HOST:PORT.");
+    host = address.substr(0, pos);
+    port = address.substr(pos + 1);
+}
+
+//! the queue of the loopback transports, the chunks are the sent buffers
+struct LoopbackQueue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<char>> chunks;
+    size_t offset = 0;
+};
+
+std::mutex g_loopback_mutex;
+std::map<std::string, std::shared_ptr<LoopbackQueue>> g_loopback_queues;
+
+std::shared_ptr<LoopbackQueue> loopback_queue(const std::string& name) {
+    std::lock_guard<std::mutex> lock(g_loopback_mutex);
+    auto& queue = g_loopback_queues[name];
+    if (!queue) {
+        queue = std::make_shared<LoopbackQueue>();
+    }
+    return queue;
+}
+
+class LoopbackTransport : public Transport {
+public:
+    LoopbackTransport(const std::string& name, bool receiver)
+            : m_name(name), m_receiver(receiver), m_queue(loopback_queue(name)) {}
+
+    ~LoopbackTransport() {
+        //! the name can be listened again, the sender keeps the queue it holds
+        if (m_receiver) {
+            std::lock_guard<std::mutex> lock(g_loopback_mutex);
+            auto it = g_loopback_queues.find(m_name);
+            if (it != g_loopback_queues.end() && it->second == m_queue) {
+                g_loopback_queues.erase(it);
+            }
+        }
+    }
+
+    void send(const void* data, size_t len) override {
+        auto ptr = static_cast<const char*>(data);
+        {
+            std::lock_guard<std::mutex> lock(m_queue->mutex);
+            m_queue->chunks.emplace_back(ptr, ptr + len);
+        }
+        m_queue->cv.notify_one();
+    }
+
+    void recv(void* data, size_t len) override {
+        auto ptr = static_cast<char*>(data);
+        std::unique_lock<std::mutex> lock(m_queue->mutex);
+        while (len > 0) {
+            m_queue->cv.wait(lock, [this] { return !m_queue->chunks.empty(); });
+            auto& chunk = m_queue->chunks.front();
+            size_t size = std::min(len, chunk.size() - m_queue->offset);
+            memcpy(ptr, chunk.data() + m_queue->offset, size);
+            ptr += size;
+            len -= size;
+            m_queue->offset += size;
+            if (m_queue->offset == chunk.size()) {
+                m_queue->chunks.pop_front();
+                m_queue->offset = 0;
+            }
+        }
+    }
+
+private:
+    std::string m_name;
+    bool m_receiver;
+    std::shared_ptr<LoopbackQueue> m_queue;
+};
+
+#if INFER_SHM
+//! whether the process exists, it may be one of another user
+bool alive(int32_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+//! the waiting end checks whether the other end exits once in these steps of
+//! sleep, so it fails instead of waiting for it forever
+constexpr uint32_t ALIVE_CHECK_STEPS = 256;
+
+//! the single producer single consumer ring at the start of the shared memory,
+//! the counters are the total bytes written and read
+struct ShmRing {
+    std::atomic<uint64_t> head;
+    char pad0[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> tail;
+    char pad1[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint32_t> ready;
+    //! the receiver process, the segment left by a dead receiver is not used
+    int32_t owner;
+    //! the sender process, 0 until the sender connects
+    std::atomic<int32_t> sender;
+    uint64_t capacity;
+
+    char* data() { return reinterpret_cast<char*>(this) + sizeof(ShmRing); }
+};
+
+class ShmTransport : public Transport {
+public:
+    //! the bytes buffered by the ring
+    static constexpr size_t CAPACITY = 64 * 1024 * 1024;
+
+    ShmTransport(const std::string& name, bool receiver)
+            : m_name("/inferllm_" + name), m_receiver(receiver) {
+        m_size = sizeof(ShmRing) + CAPACITY;
+        if (receiver) {
+            //! the segment left by a crashed process is dropped
+            shm_unlink(m_name.c_str());
+            int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            INFER_ASSERT(fd >= 0, "failed to create the shared memory of the transport.");
+            INFER_ASSERT(
+                    ftruncate(fd, m_size) == 0,
+                    "failed to resize the shared memory of the transport.");
+            map(fd);
+            new (m_ring) ShmRing();
+            m_ring->head.store(0);
+            m_ring->tail.store(0);
+            m_ring->capacity = CAPACITY;
+            m_ring->owner = getpid();
+            m_ring->sender.store(0);
+            m_ring->ready.store(1, std::memory_order_release);
+        } else {
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t iter = 0;; iter++) {
+                int fd = shm_open(m_name.c_str(), O_RDWR, 0600);
+                struct stat st;
+                if (fd >= 0 && fstat(fd, &st) == 0 &&
+                    static_cast<size_t>(st.st_size) >= m_size) {
+                    map(fd);
+                    if (m_ring->ready.load(std::memory_order_acquire) &&
+                        alive(m_ring->owner)) {
+                        m_ring->sender.store(getpid());
+                        break;
+                    }
+                    munmap(m_ring, m_size);
+                    m_ring = nullptr;
+                } else if (fd >= 0) {
+                    close(fd);
+                }
+                auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start);
+                INFER_ASSERT(
+                        waited.count() < CONNECT_TIMEOUT_MS,
+                        "timeout to connect the shared memory transport.");
+                wait_step(iter);
+            }
+        }
+    }
+
+    ~ShmTransport() {
+        munmap(m_ring, m_size);
+        if (m_receiver) {
+            shm_unlink(m_name.c_str());
+        }
+    }
+
+    void send(const void* data, size_t len) override {
+        auto ptr = static_cast<const char*>(data);
+        uint64_t capacity = m_ring->capacity;
+        uint64_t head = m_ring->head.load(std::memory_order_relaxed);
+        uint32_t iter = 0;
+        while (len > 0) {
+            uint64_t tail = m_ring->tail.load(std::memory_order_acquire);
+            size_t size = std::min<uint64_t>(len, capacity - (head - tail));
+            if (size == 0) {
+                wait_peer(m_ring->owner, iter++);
+                continue;
+            }
+            iter = 0;
+            //! the bytes may wrap to the start of the ring
+            size_t pos = head % capacity;
+            size_t first = std::min<size_t>(size, capacity - pos);
+            memcpy(m_ring->data() + pos, ptr, first);
+            memcpy(m_ring->data(), ptr + first, size - first);
+            head += size;
+            ptr += size;
+            len -= size;
+            m_ring->head.store(head, std::memory_order_release);
+        }
+    }
+
+    void recv(void* data, size_t len) override {
+        auto ptr = static_cast<char*>(data);
+        uint64_t capacity = m_ring->capacity;
+        uint64_t tail = m_ring->tail.load(std::memory_order_relaxed);
+        uint32_t iter = 0;
+        while (len > 0) {
+            uint64_t head = m_ring->head.load(std::memory_order_acquire);
+            size_t size = std::min<uint64_t>(len, head - tail);
+            if (size == 0) {
+                wait_peer(m_ring->sender.load(), iter++);
+                continue;
+            }
+            iter = 0;
+            size_t pos = tail % capacity;
+            size_t first = std::min<size_t>(size, capacity - pos);
+            memcpy(ptr, m_ring->data() + pos, first);
+            memcpy(ptr + first, m_ring->data(), size - first);
+            tail += size;
+            ptr += size;
+            len -= size;
+            m_ring->tail.store(tail, std::memory_order_release);
+        }
+    }
+
+private:
+    //! wait for the other end, the receiver waits for the sender which is not
+    //! connected yet without the check
+    void wait_peer(int32_t pid, uint32_t iter) {
+        if (iter >= 1024 && iter % ALIVE_CHECK_STEPS == 0 && pid > 0) {
+            INFER_ASSERT(
+                    alive(pid), "the other end of the shared memory transport exited.");
+        }
+        wait_step(iter);
+    }
+
+    void map(int fd) {
+        void* addr = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        INFER_ASSERT(addr != MAP_FAILED, "failed to map the shared memory transport.");
+        m_ring = static_cast<ShmRing*>(addr);
+    }
+
+    std::string m_name;
+    bool m_receiver;
+    size_t m_size;
+    ShmRing* m_ring = nullptr;
+};
+#endif
+
+#if INFER_SOCKET
+class TcpTransport : public Transport {
+public:
+    TcpTransport(const std::string& address, bool receiver) {
+        std::string host, port;
+        split_host_port(address, host, port);
+        if (receiver) {
+            m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            INFER_ASSERT(m_listen_fd >= 0, "failed to create the socket.");
+            int opt = 1;
+            setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            addr.sin_port = htons(std::stoi(port));
+            INFER_ASSERT(
+                    bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr),
+                         sizeof(addr)) == 0,
+                    "failed to bind the port of the transport.");
+            INFER_ASSERT(::listen(m_listen_fd, 1) == 0, "failed to listen the port.");
+        } else {
+            addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* info = nullptr;
+            INFER_ASSERT(
+                    getaddrinfo(host.c_str(), port.c_str(), &hints, &info) == 0,
+                    "failed to resolve the address of the transport.");
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t iter = 0;; iter++) {
+                m_fd = socket(AF_INET, SOCK_STREAM, 0);
+                INFER_ASSERT(m_fd >= 0, "failed to create the socket.");
+                if (::connect(m_fd, info->ai_addr, info->ai_addrlen) == 0) {
+                    break;
+                }
+                close(m_fd);
+                auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start);
+                INFER_ASSERT(
+                        waited.count() < CONNECT_TIMEOUT_MS,
+                        "timeout to connect the tcp transport.");
+                wait_step(iter);
+            }
+            freeaddrinfo(info);
+            set_no_delay();
+        }
+    }
+
+    ~TcpTransport() {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+        if (m_listen_fd >= 0) {
+            close(m_listen_fd);
+        }
+    }
+
+    void send(const void* data, size_t len) override {
+        auto ptr = static_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t size = ::send(m_fd, ptr, len, SEND_FLAGS);
+            //! interrupted by a signal before anything is sent
+            if (size < 0 && errno == EINTR) {
+                continue;
+            }
+            INFER_ASSERT(size > 0, "failed to send by the tcp transport.");
+            ptr += size;
+            len -= size;
+        }
+    }
+
+    void recv(void* data, size_t len) override {
+        //! the sender connects after every stage listens, so accept the first time
+        while (m_fd < 0) {
+            m_fd = accept(m_listen_fd, nullptr, nullptr);
+            if (m_fd < 0 && errno == EINTR) {
+                continue;
+            }
+            INFER_ASSERT(m_fd >= 0, "failed to accept the tcp transport.");
+            set_no_delay();
+        }
+        auto ptr = static_cast<char*>(data);
+        while (len > 0) {
+            ssize_t size = ::recv(m_fd, ptr, len, 0);
+            if (size < 0 && errno == EINTR) {
+                continue;
+            }
+            INFER_ASSERT(size > 0, "the tcp transport is closed.");
+            ptr += size;
+            len -= size;
+        }
+    }
+
+private:
+#ifdef MSG_NOSIGNAL
+    static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    static constexpr int SEND_FLAGS = 0;
+#endif
+
+    //! the small messages of the decode are sent at once
+    void set_no_delay() {
+        int opt = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+
+    int m_fd = -1;
+    int m_listen_fd = -1;
+};
+#endif
+
+std::unique_ptr<Transport> create_transport(const std::string& address, bool receiver) {
+    auto pos = address.find(':');
+    INFER_ASSERT(pos != std::string::npos, "the transport address has no scheme.");
+    std::string scheme = address.substr(0, pos);
+    std::string name = address.substr(pos + 1);
+    if (scheme == "loopback") {
+        return make_unique<LoopbackTransport>(name, receiver);
+    }
+#if INFER_SHM
+    if (scheme == "shm") {
+        return make_unique<ShmTransport>(name, receiver);
+    }
+#endif
+#if INFER_SOCKET
+    if (scheme == "tcp") {
+        return make_unique<TcpTransport>(name, receiver);
+    }
+#endif
+    INFER_ASSERT(0, "the transport is not supported on this platform.");
+    return nullptr;
+}
+}  // namespace
+
+std::unique_ptr<Transport> Transport::listen(const std::string& address) {
+    return create_transport(address, true);
+}
+
+std::unique_ptr<Transport> Transport::connect(const std::string& address) {
+    return create_transport(address, false);
+}
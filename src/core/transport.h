@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace inferllm {
+
+//! the one way channel which passes the bytes between the processes of the
+//! pipeline, the bytes arrive in the order they are sent, the address is
+//!     "loopback:NAME" the queue in this process, used to test the pipeline
+//!     "shm:NAME"      the ring buffer in the shared memory of this host
+//!     "tcp:HOST:PORT" the tcp connection, the receiver listens on the PORT
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    //! block until all the bytes are sent, or buffered by the channel, it fails
+    //! when the process of the other end exits
+    virtual void send(const void* data, size_t len) = 0;
+
+    //! block until len bytes are received, it fails when the process of the
+    //! other end exits after it connects
+    virtual void recv(void* data, size_t len) = 0;
+
+    //! create the receiving end, it does not block, so every process creates its
+    //! receiving end before it connects to the next one
+    static std::unique_ptr<Transport> listen(const std::string& address);
+
+    //! create the sending end, it waits until the receiving end is created
+    static std::unique_ptr<Transport> connect(const std::string& address);
+
+    //! the time to wait for the receiving end when connect
+    static constexpr int CONNECT_TIMEOUT_MS = 60000;
+};
+
+}  // namespace inferllm
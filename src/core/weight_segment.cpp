@@ -0,0 +1,146 @@
+#include "weight_segment.h"
+
+#include <chrono>
+#include <new>
+#include <thread>
+
+#include "utils.h"
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__ANDROID__)
+#define INFER_SHM 1
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace inferllm;
+
+struct WeightSegment::Header {
+    uint64_t magic;
+    std::atomic<uint32_t> ready;
+    //! the process which fills the segment
+    int32_t owner;
+    uint32_t nr_entry;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+namespace {
+constexpr uint64_t SEGMENT_MAGIC = 0x494e464552575347;
+
+std::string segment_path(const std::string& name) {
+    return "/inferllm_w_" + name;
+}
+}  // namespace
+
+std::unique_ptr<WeightSegment> WeightSegment::create_or_attach(
+        const std::string& name, uint32_t nr_entry, size_t data_size) {
+#if INFER_SHM
+    std::string path = segment_path(name);
+    size_t table = aligned(sizeof(Header) + nr_entry * sizeof(Entry));
+    size_t size = table + data_size;
+    std::unique_ptr<WeightSegment> segment(new WeightSegment());
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd >= 0) {
+            INFER_ASSERT(
+                    ftruncate(fd, size) == 0, "failed to resize the weight segment.");
+            void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            INFER_ASSERT(addr != MAP_FAILED, "failed to map the weight segment.");
+            auto header = new (addr) Header();
+            header->magic = SEGMENT_MAGIC;
+            header->owner = getpid();
+            header->nr_entry = nr_entry;
+            header->size = size;
+            header->ready.store(0, std::memory_order_release);
+            segment->m_header = header;
+            segment->m_size = size;
+            segment->m_creator = true;
+            return segment;
+        }
+        INFER_ASSERT(errno == EEXIST, "failed to create the weight segment.");
+        fd = shm_open(path.c_str(), O_RDONLY, 0644);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 &&
+            static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            INFER_ASSERT(addr != MAP_FAILED, "failed to map the weight segment.");
+            auto header = static_cast<Header*>(addr);
+            if (header->ready.load(std::memory_order_acquire)) {
+                INFER_ASSERT(
+                        header->magic == SEGMENT_MAGIC &&
+                                header->nr_entry == nr_entry && header->size == size,
+                        "the weight segment is of another model, remove it first.");
+                segment->m_header = header;
+                segment->m_size = st.st_size;
+                return segment;
+            }
+            //! the process which was filling the segment is dead
+            bool dead = header->owner > 0 && kill(header->owner, 0) != 0 &&
+                        errno == ESRCH;
+            munmap(addr, st.st_size);
+            if (dead) {
+                INFER_LOG(
+                        "remove the weight segment %s left unfinished.\n",
+                        path.c_str());
+                shm_unlink(path.c_str());
+                continue;
+            }
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+        INFER_ASSERT(
+                waited.count() < WAIT_TIMEOUT_MS,
+                "timeout to wait the weight segment filled by another process.");
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+#else
+    INFER_ASSERT(0, "the weight segment is not supported on this platform.");
+    return nullptr;
+#endif
+}
+
+void WeightSegment::remove(const std::string& name) {
+#if INFER_SHM
+    shm_unlink(segment_path(name).c_str());
+#endif
+}
+
+WeightSegment::~WeightSegment() {
+#if INFER_SHM
+    if (m_header) {
+        munmap(m_header, m_size);
+    }
+#endif
+}
+
+uint32_t WeightSegment::nr_entry() const {
+    return m_header->nr_entry;
+}
+
+WeightSegment::Entry& WeightSegment::entry(uint32_t id) {
+    INFER_ASSERT(id < m_header->nr_entry, "the entry is out of the weight segment.");
+    return reinterpret_cast<Entry*>(m_header + 1)[id];
+}
+
+void* WeightSegment::data(uint32_t id) {
+    size_t table = aligned(sizeof(Header) + m_header->nr_entry * sizeof(Entry));
+    return reinterpret_cast<char*>(m_header) + table + entry(id).offset;
+}
+
+void WeightSegment::publish() {
+#if INFER_SHM
+    INFER_ASSERT(m_creator, "only the creator publishes the weight segment.");
+    m_header->ready.store(1, std::memory_order_release);
+    //! the weights are read only in every process from now on
+    mprotect(m_header, m_size, PROT_READ);
+#endif
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace inferllm {
+
+//! the named shared memory which holds the prepared weights of a model, the first
+//! process creates and fills it, then publishes it, the later processes attach it
+//! read only, so the processes on a host share one copy of the weights. It lives
+//! until it is removed, so the later workers attach it after the first one exits
+class WeightSegment {
+public:
+    //! the table of the weights at the start of the segment
+    struct Entry {
+        char name[120];
+        uint64_t offset;
+        uint64_t length;
+        uint32_t dims;
+        uint32_t dtype;
+        uint64_t shape[4];
+        //! the weight is reordered by the op when prepared
+        uint32_t preprocessed;
+        uint32_t reserved;
+    };
+
+    //! create the segment with the room of the weights, or attach the published
+    //! one, it waits while another process is filling it
+    static std::unique_ptr<WeightSegment> create_or_attach(
+            const std::string& name, uint32_t nr_entry, size_t data_size);
+
+    //! remove the segment, the processes attached keep their mapping
+    static void remove(const std::string& name);
+
+    ~WeightSegment();
+
+    //! whether this process creates the segment and should fill it
+    bool creator() const { return m_creator; }
+
+    uint32_t nr_entry() const;
+    Entry& entry(uint32_t id);
+    //! the data of the entry, it is aligned to the cache line
+    void* data(uint32_t id);
+    //! the offset of the next data with the length
+    static size_t aligned(size_t length) {
+        return (length + ALIGN - 1) / ALIGN * ALIGN;
+    }
+
+    //! the filled segment can be attached by the other processes
+    void publish();
+
+    static constexpr size_t ALIGN = 64;
+    //! the time to wait for the process which is filling the segment
+    static constexpr int WAIT_TIMEOUT_MS = 30 * 60 * 1000;
+
+private:
+    struct Header;
+    WeightSegment() = default;
+
+    Header* m_header = nullptr;
+    size_t m_size = 0;
+    bool m_creator = false;
+};
+
+}  // namespace inferllm
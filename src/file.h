@@ -47,6 +47,8 @@ public:
 
     bool eof() { return tell() == m_size; }
 
+    size_t size() { return m_size; }
+
     void rewind() { std::rewind(m_file); }
 
     void skip(int64_t bytes);
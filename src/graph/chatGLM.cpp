@@ -85,11 +85,9 @@ void ChatGLMGraph::construct_llm() {
                 this, norm_out_attention, m_param.n_embd, m_param.n_head, m_param.n_rot,
                 m_param.n_ctx, model_config(), device(), name + ".attention", i,
                 true /*fused_weights*/, true /*bias*/);
-        //! add  norm_out_attention * scale + attention_output
-        auto add_output = add_one_opr_module<Elemwise>(
-                                  this, OpIOs{norm_out_attention, attention_output},
-                                  device(), name + ".attention.Elemwise")
-                                  ->add_opr(ElemMode::Add, scale);
+        //! add norm_out_attention * scale + attention_output, fused into the
+        //! matmul
+        auto add_output = add_residual(attention_output, norm_out_attention, scale);
 
         std::shared_ptr<Tensor> feed_forward_input = add_output;
         //! layer normal
@@ -103,11 +101,9 @@ void ChatGLMGraph::construct_llm() {
         auto ffn_output = add_module<GlmFFNModule>(
                 this, ffn_norm_out, m_param.n_embd, m_param.n_mult, model_config(),
                 device(), name);
-        //! add ffn_norm_out * scale + ffn_output
-        input = add_one_opr_module<Elemwise>(
-                        this, OpIOs{ffn_norm_out, ffn_output}, device(),
-                        name + ".ffn.Elemwise")
-                        ->add_opr(ElemMode::Add, scale);
+        //! add ffn_norm_out * scale + ffn_output, fused into the matmul
+        input = add_residual(ffn_output, ffn_norm_out, scale);
+        m_layer_outputs.push_back(input);
     }
     //! the last layer
     m_output = add_module<HeadModule>(
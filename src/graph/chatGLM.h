@@ -36,6 +36,8 @@ public:
             std::shared_ptr<InputFile> fin, LlmParams& param,
             std::shared_ptr<Vocab> vocab) override;
     void post_tokenize(std::vector<Vocab::Id>& input) override;
+    //! the gmask position is found in the whole prompt
+    bool support_chunked_prefill() override { return false; }
 };
 
 class ChatGLMGraph2 : public Graph {
@@ -82,11 +82,8 @@ void ChatGLMGraph3::construct_llm() {
                 name + ".attention", i, true /*fused_weights*/, true /*bias*/,
                 RotMode::Mode0, false /*proj_bias*/);
 
-        //! add  norm_out_attention * scale + attention_output
-        auto add_output = add_one_opr_module<Elemwise>(
-                                  this, OpIOs{attention_input, attention_output},
-                                  device(), name + ".attention.Elemwise")
-                                  ->add_opr(ElemMode::Add);
+        //! add attention_input + attention_output, fused into the matmul
+        auto add_output = add_residual(attention_output, attention_input);
 
         std::shared_ptr<Tensor> feed_forward_input = add_output;
         //! layer normal
@@ -100,11 +97,9 @@ void ChatGLMGraph3::construct_llm() {
         auto ffn_output = add_module<Glm2FFNModule>(
                 this, ffn_norm_out, m_param.n_embd, m_param.n_mult, model_config(),
                 device(), name);
-        //! add ffn_norm_out * scale + ffn_output
-        input = add_one_opr_module<Elemwise>(
-                        this, OpIOs{feed_forward_input, ffn_output}, device(),
-                        name + ".ffn.Elemwise")
-                        ->add_opr(ElemMode::Add);
+        //! add feed_forward_input + ffn_output, fused into the matmul
+        input = add_residual(ffn_output, feed_forward_input);
+        m_layer_outputs.push_back(input);
     }
     //! the last layer
     m_output = add_module<HeadModule>(
@@ -23,6 +23,10 @@ void GgmlLlamaGraph::load(
     uint32_t magic;
     uint32_t version = 0;
     fin->read_raw((char*)&magic, sizeof(magic));
+    if (magic == GgufReader::MAGIC) {
+        load_gguf(fin, param, vocab);
+        return;
+    }
     if (magic != 'ggml') {
         fin->read_raw((char*)&version, sizeof(version));
     }
@@ -119,6 +123,129 @@ void GgmlLlamaGraph::load(
     INFER_LOG("total weight length = %lu\n", weight_length);
 }
 
+void GgmlLlamaGraph::load_gguf(
+        std::shared_ptr<InputFile> fin, LlmParams& param,
+        std::shared_ptr<Vocab> vocab) {
+    GgufReader reader(fin);
+    INFER_ASSERT(
+            reader.get_string("general.architecture", "") == "llama",
+            "only the llama architecture of gguf is supported.");
+
+    //! the vocabulary is stored as the pieces of sentencepiece, they are
+    //! converted like the convert script of the legacy files
+    auto tokens = reader.get_strings("tokenizer.ggml.tokens");
+    auto types = reader.get_ints("tokenizer.ggml.token_type");
+    bool sentencepiece = reader.get_string("tokenizer.ggml.model", "llama") == "llama";
+    for (size_t i = 0; i < tokens.size() && sentencepiece; i++) {
+        auto& token = tokens[i];
+        int64_t type = i < types.size() ? types[i] : 1;
+        if (type == 2) {
+            //! the unknown token
+            token = " \u2047 ";
+        } else if (type == 3) {
+            //! the control tokens, such as <s> and </s>
+            token.clear();
+        } else if (type == 6 && token.size() == 6) {
+            //! the byte token <0xXX>
+            auto byte = std::stoi(token.substr(3, 2), nullptr, 16);
+            token = std::string(1, static_cast<char>(byte));
+        } else {
+            size_t pos = 0;
+            //! the U+2581 of sentencepiece is the space
+            while ((pos = token.find("\xe2\x96\x81", pos)) != std::string::npos) {
+                token.replace(pos, 3, " ");
+                pos++;
+            }
+        }
+    }
+    vocab->load_vocab(tokens, reader.get_floats("tokenizer.ggml.scores"));
+
+    param.n_vocab = reader.get_int("llama.vocab_size", tokens.size());
+    param.n_embd = reader.get_int("llama.embedding_length", 0);
+    param.n_head = reader.get_int("llama.attention.head_count", 0);
+    param.n_layer = reader.get_int("llama.block_count", 0);
+    param.n_ff = reader.get_int("llama.feed_forward_length", 0);
+    param.n_mult = 1;
+    INFER_ASSERT(
+            param.n_embd > 0 && param.n_head > 0 && param.n_layer > 0 &&
+                    param.n_ff > 0,
+            "the gguf file misses the hyper parameters of llama.");
+    param.n_rot =
+            reader.get_int("llama.rope.dimension_count", param.n_embd / param.n_head);
+    param.ftype = reader.get_int("general.file_type", 0);
+    auto nr_kv_head = reader.get_int("llama.attention.head_count_kv", param.n_head);
+    INFER_ASSERT(
+            nr_kv_head == param.n_head,
+            "the grouped query attention of gguf is not supported.");
+    //! the rope of the graph rotates with the base 10000
+    INFER_ASSERT(
+            reader.get_float("llama.rope.freq_base", 10000.f) == 10000.f,
+            "the rope base of the gguf file is not 10000, which is not supported.");
+    INFER_LOG("model is gguf, n_vocab = %d, n_embd = %d, n_head = %d, n_layer = %d, "
+              "n_ff = %d, n_rot = %d\n", param.n_vocab, param.n_embd, param.n_head,
+              param.n_layer, param.n_ff, param.n_rot);
+    m_param = param;
+
+    construct_llm();
+    collect_weights();
+
+    // clang-format off
+    m_weights_name_aliases = {
+            {"token_embd.weight", "tok_embeddings.weight"},
+            {"output_norm.weight", "head.norm.weight"},
+            {"output.weight", "head.output.weight"},
+            {"blk.x.attn_norm.weight", "layers.x.attention.norm.weight"},
+            {"blk.x.attn_q.weight", "layers.x.attention.wq.weight"},
+            {"blk.x.attn_k.weight", "layers.x.attention.wk.weight"},
+            {"blk.x.attn_v.weight", "layers.x.attention.wv.weight"},
+            {"blk.x.attn_output.weight", "layers.x.attention.wo.weight"},
+            {"blk.x.ffn_norm.weight", "layers.x.ffn.norm.weight"},
+            {"blk.x.ffn_gate.weight", "layers.x.ffn.w1.weight"},
+            {"blk.x.ffn_down.weight", "layers.x.ffn.w2.weight"},
+            {"blk.x.ffn_up.weight", "layers.x.ffn.w3.weight"},
+    };
+    // clang-format on
+    auto infos = reader.tensors();
+    bool has_output = false;
+    for (auto& info : infos) {
+        has_output = has_output || info.name == "output.weight";
+    }
+    //! the output shares the weight of the embedding if the file has no output
+    for (size_t i = 0; i < infos.size() && !has_output; i++) {
+        if (infos[i].name == "token_embd.weight") {
+            infos.push_back(infos[i]);
+            infos.back().name = "output.weight";
+            break;
+        }
+    }
+    size_t weight_length = 0;
+    for (auto& info : infos) {
+        auto alias_name = get_weight_alias(info.name);
+        if (m_weights_map.count(alias_name) == 0) {
+            INFER_LOG("skip weight %s\n", info.name.c_str());
+            continue;
+        }
+        DType dtype;
+        FileLayout layout;
+        if (!GgufReader::convert_type(info.type, dtype, layout)) {
+            INFER_LOG(
+                    "the ggml type %u of the gguf tensor %s is not supported.\n",
+                    info.type, info.name.c_str());
+            INFER_ASSERT(
+                    0, "use the gguf file of the f32, f16, q4_0, q8_0 or q6_k "
+                       "tensors.");
+        }
+        auto weight = m_weights_map[alias_name];
+        INFER_ASSERT(
+                weight->length() == info.nr_number(),
+                "Error length of weight is mismatch.");
+        weight->set_file(fin, info.offset, layout);
+        weight->set_dtype(dtype);
+        weight_length += weight->length_in_file();
+    }
+    INFER_LOG("total weight length = %lu\n", weight_length);
+}
+
 void GgmlLlamaGraph::construct_llm() {
     uint32_t embd = m_param.n_embd;
     uint32_t mult = m_param.n_mult;
@@ -127,7 +254,10 @@ void GgmlLlamaGraph::construct_llm() {
     uint32_t ctx = m_param.n_ctx;
     uint32_t n_vocab = m_param.n_vocab;
 
-    size_t nff = ((2 * (4 * embd) / 3 + mult - 1) / mult) * mult;
+    size_t nff = m_param.n_ff;
+    if (nff == 0) {
+        nff = ((2 * (4 * embd) / 3 + mult - 1) / mult) * mult;
+    }
     m_input = std::make_shared<Tensor>(device(), name() + ":input");
     std::shared_ptr<Tensor> input = m_input;
     //! embd
@@ -148,11 +278,8 @@ void GgmlLlamaGraph::construct_llm() {
         auto attention_output = add_module<AttentionModule<LlamaAttention>>(
                 this, norm_out_attention, embd, head, rot, ctx, model_config(),
                 device(), name + ".attention", i);
-        //! add
-        auto add_output = add_one_opr_module<Elemwise>(
-                                  this, OpIOs{attention_input, attention_output},
-                                  device(), name + ".attention_add")
-                                  ->add_opr(ElemMode::Add);
+        //! add, fused into the output matmul of the attention
+        auto add_output = add_residual(attention_output, attention_input);
 
         std::shared_ptr<Tensor> feed_forward_input = add_output;
         //! layer normal
@@ -163,11 +290,9 @@ void GgmlLlamaGraph::construct_llm() {
         //! feed forward
         auto ffn_output = add_module<LlamaFFNModule>(
                 this, ffn_norm_out, embd, nff, model_config(), device(), name);
-        //! add
-        input = add_one_opr_module<Elemwise>(
-                        this, OpIOs{feed_forward_input, ffn_output}, device(),
-                        name + ".ffn_add")
-                        ->add_opr(ElemMode::Add);
+        //! add, fused into the last matmul of the feed forward
+        input = add_residual(ffn_output, feed_forward_input);
+        m_layer_outputs.push_back(input);
     }
     //! the last layer
     m_output = add_module<HeadModule>(
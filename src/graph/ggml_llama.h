@@ -1,6 +1,7 @@
 #pragma once
 
 #include <unordered_map>
+#include "core/gguf.h"
 #include "core/graph.h"
 #include "core/kvstorage.h"
 #include "core/op.h"
@@ -25,5 +26,12 @@ public:
             std::shared_ptr<InputFile> fin, LlmParams& param,
             std::shared_ptr<Vocab> vocab) override;
 
+private:
+    //! load the llama of the gguf file whose magic is read, the weights whose
+    //! layout is the same as the tensor are mapped without copy when mmap is
+    //! enabled
+    void load_gguf(
+            std::shared_ptr<InputFile> fin, LlmParams& param,
+            std::shared_ptr<Vocab> vocab);
 };
 }  // namespace inferllm
\ No newline at end of file
@@ -80,11 +80,8 @@ void LlamaLikeGraph::construct_llm() {
         auto attention_output = add_module<AttentionModule<LlamaAttention>>(
                 this, norm_out_attention, embd, head, rot, ctx, model_config(),
                 device(), name + ".attention", i, false, false, RotMode::ModelRotHalf);
-        //! add
-        auto add_output = add_one_opr_module<Elemwise>(
-                                  this, OpIOs{attention_input, attention_output},
-                                  device(), name + ".attention_add")
-                                  ->add_opr(ElemMode::Add);
+        //! add, fused into the output matmul of the attention
+        auto add_output = add_residual(attention_output, attention_input);
 
         std::shared_ptr<Tensor> feed_forward_input = add_output;
         //! layer normal
@@ -97,11 +94,9 @@ void LlamaLikeGraph::construct_llm() {
         //! feed forward
         auto ffn_output = add_module<LlamaFFNModule>(
                 this, ffn_norm_out, embd, ffn_size, model_config(), device(), name);
-        //! add
-        input = add_one_opr_module<Elemwise>(
-                        this, OpIOs{feed_forward_input, ffn_output}, device(),
-                        name + ".ffn_add")
-                        ->add_opr(ElemMode::Add);
+        //! add, fused into the last matmul of the feed forward
+        input = add_residual(ffn_output, feed_forward_input);
+        m_layer_outputs.push_back(input);
     }
     //! the last layer
     m_output = add_module<HeadModule>(
@@ -80,11 +80,8 @@ void MistralGraph::construct_llm() {
         auto attention_output = add_module<AttentionModule<LlamaAttention>>(
                 this, norm_out_attention, embd, head, rot, ctx, model_config(),
                 device(), name + ".attention", i, false, false, RotMode::ModelRotHalf);
-        //! add
-        auto add_output = add_one_opr_module<Elemwise>(
-                                  this, OpIOs{attention_input, attention_output},
-                                  device(), name + ".attention_add")
-                                  ->add_opr(ElemMode::Add);
+        //! add, fused into the output matmul of the attention
+        auto add_output = add_residual(attention_output, attention_input);
 
         std::shared_ptr<Tensor> feed_forward_input = add_output;
         //! layer normal
@@ -106,6 +103,7 @@ void MistralGraph::construct_llm() {
                         this, OpIOs{feed_forward_input, ffn_output}, device(),
                         name + ".ffn_add")
                         ->add_opr(ElemMode::Add);
+        m_layer_outputs.push_back(input);
     }
     //! the last layer
     m_output = add_module<HeadModule>(
@@ -188,6 +188,16 @@ NOImplementKernel(MatmulInt4FloatPacked);
 NOImplementKernel(MatmulInt4WeightReorder);
 NOImplementKernel(MatmulInt8Float);
 NOImplementKernel(EmbeddingGetInt8Float);
+NOImplementKernel(FlashDecodeFloat);
+NOImplementKernel(MatmulWithKvStrideFloat);
+NOImplementKernel(HeadBatchedMatmulKvStrideFloat);
+NOImplementKernel(KvStoreFloat);
+NOImplementKernel(FusedNormFloat);
+NOImplementKernel(MatmulInt4Q8Float);
+NOImplementKernel(MatmulInt4Q8FloatPacked);
+NOImplementKernel(MatmulInt8Q8Float);
+NOImplementKernel(MatmulEpilogueFloat);
+NOImplementKernel(QuantizeQ8Float);
 
 #undef PartialImplementKernel
 #undef PartialImplementSpace
@@ -66,10 +66,44 @@ public:
             TaskSet task_set =
                     opt::Comp<Id, Args...>::get_all_task(std::forward<Args>(args)...);
             for (auto& task : task_set) {
-                m_thread_pool->add_task(task.first, task.second);
+                m_thread_pool->add_task(task.task, task.nr_task, task.cost);
             }
         }
     }
+    //! compute the matmul with the epilogue on its output, the last stage of the
+    //! matmul and the epilogue split the output columns alike, so every task
+    //! applies the epilogue to the columns it just computed while they are still
+    //! in the cache, instead of another pass over the output
+    template <KernelID Id, typename... Args>
+    void matmul_with_epilogue(const MatmulEpilogue& epilogue, Args... args) {
+        INFER_ASSERT(
+                m_kernel_type != KernelType::GPU,
+                "the matmul epilogue is not supported on GPU.");
+        TaskSet task_set =
+                opt::Comp<Id, Args...>::get_all_task(std::forward<Args>(args)...);
+        TaskSet epilogue_set =
+                opt::Comp<KernelID::MatmulEpilogueFloat, MatmulEpilogue>::get_all_task(
+                        epilogue);
+        INFER_ASSERT(
+                task_set.back().nr_task == epilogue_set[0].nr_task,
+                "the epilogue does not match the tasks of the matmul.");
+        //! the tasks are run before the function returns, so the wrapper only
+        //! refers to them
+        MultiThreadingTask compute = task_set.back().task;
+        const MultiThreadingTask* p_compute = &compute;
+        const MultiThreadingTask* p_apply = &epilogue_set[0].task;
+        task_set.back().task = [p_compute, p_apply](const TaskId& id) {
+            (*p_compute)(id);
+            (*p_apply)(id);
+        };
+        if (task_set.back().cost) {
+            task_set.back().cost += epilogue_set[0].cost;
+        }
+        for (auto& task : task_set) {
+            m_thread_pool->add_task(task.task, task.nr_task, task.cost);
+        }
+    }
+
     template <KernelID Id, typename... Args>
     size_t get_workspace(Args... args) {
         return opt::Space<Id, Args...>::get(std::forward<Args>(args)...);
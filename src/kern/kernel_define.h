@@ -3,16 +3,45 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
-#include <functional>
-#include <vector>
+#include <initializer_list>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "utils.h"
 
 #define PI                           (3.1415)
 #define PGELU                        (0.044715)
 #define INFER_ATTRIBUTE_TARGET(simd) __attribute__((target(simd)))
 namespace inferllm {
 
+//! the input pointers of a kernel, they are stored inline, so the tasks copy
+//! them without allocation
 template <class Dtype>
-using InData = std::vector<const Dtype*>;
+class InData {
+public:
+    static constexpr size_t MAX_INPUT = 4;
+
+    InData() = default;
+    InData(std::initializer_list<const Dtype*> datas) {
+        for (auto data : datas) {
+            push_back(data);
+        }
+    }
+
+    void push_back(const Dtype* data) {
+        INFER_ASSERT(m_size < MAX_INPUT, "too many inputs of the kernel.");
+        m_datas[m_size++] = data;
+    }
+
+    const Dtype*& operator[](size_t index) { return m_datas[index]; }
+    const Dtype* operator[](size_t index) const { return m_datas[index]; }
+    size_t size() const { return m_size; }
+
+private:
+    const Dtype* m_datas[MAX_INPUT] = {};
+    size_t m_size = 0;
+};
 
 enum class KernelID {
     EmbeddingGetInt4Float = 0,
@@ -41,6 +70,25 @@ enum class KernelID {
     GlmGmask,
     PermuteFloat,
     MatmulInt4WeightReorder,
+    //! attention of a single query row, fused q*kT, scale, softmax and v
+    FlashDecodeFloat,
+    //! q*kT and qk*v with the kv cache of any layout, given by the strides
+    MatmulWithKvStrideFloat,
+    HeadBatchedMatmulKvStrideFloat,
+    //! store the new kv rows to the kv cache of any layout
+    KvStoreFloat,
+    //! rms norm or layer norm with the weight and the bias, and it can quantize
+    //! the result to the Q8_0 blocks which are the input of the quantized matmul
+    FusedNormFloat,
+    //! the quantized matmul whose input is already quantized to Q8_0 blocks
+    MatmulInt4Q8Float,
+    MatmulInt4Q8FloatPacked,
+    MatmulInt8Q8Float,
+    //! the activation and the residual add of the matmul output, it is fused to
+    //! the last tasks of the matmul, see Kernel::matmul_with_epilogue
+    MatmulEpilogueFloat,
+    //! quantize the float rows to the Q8_0 blocks read by the Q8 matmuls
+    QuantizeQ8Float,
 };
 
 enum class KernelOptMethod {
@@ -65,19 +113,148 @@ enum class RotMode {
 
 enum class KernelType { Naive = 0, Arm = 1, X86 = 2, GPU = 3 };
 
+//! the element-wise tail of a matmul: dst = act(dst) + residual * residual_scale,
+//! the residual has the layout {M, N} of the dst, and one task item of the matmul
+//! computes pack columns of the dst
+struct MatmulEpilogue {
+    float* dst = nullptr;
+    uint32_t M = 0;
+    uint32_t N = 0;
+    uint32_t pack = 1;
+    bool activate = false;
+    ElemMode act_mode = ElemMode::Silu;
+    const float* residual = nullptr;
+    float residual_scale = 1.0f;
+};
+
 struct TaskId {
     uint32_t start;
     uint32_t end;
     uint32_t thread_id;
 };
 
-//! the task, the first parameter is the task start id, the second parameter is
-//! the task end if, the third parameter is the thread id
-using MultiThreadingTask = std::function<void(TaskId)>;
+//! the task, it is called with the task start id, the task end id and the thread
+//! id. The captures of the lambda are stored inline and copied as bytes, so the
+//! task is built, copied and submitted to the thread pool without allocation,
+//! the captures must be trivially copyable, such as the pointers and the sizes
+class MultiThreadingTask {
+public:
+    static constexpr size_t MAX_CAPTURE = 192;
+
+    MultiThreadingTask() = default;
+
+    template <
+            typename Fun, typename = typename std::enable_if<!std::is_same<
+                                  typename std::decay<Fun>::type,
+                                  MultiThreadingTask>::value>::type>
+    MultiThreadingTask(const Fun& fun) {
+        static_assert(
+                sizeof(Fun) <= MAX_CAPTURE, "the captures of the task are too big");
+        static_assert(
+                std::is_trivially_copyable<Fun>::value &&
+                        std::is_trivially_destructible<Fun>::value,
+                "the captures of the task must be trivially copyable");
+        static_assert(
+                alignof(Fun) <= alignof(max_align_t),
+                "the captures of the task are over aligned");
+        new (m_storage) Fun(fun);
+        m_invoke = &invoke<Fun>;
+    }
+
+    void operator()(const TaskId& id) const { m_invoke(m_storage, id); }
+
+    explicit operator bool() const { return m_invoke != nullptr; }
+
+private:
+    template <typename Fun>
+    static void invoke(const void* fun, const TaskId& id) {
+        (*static_cast<const Fun*>(fun))(id);
+    }
+
+    alignas(max_align_t) unsigned char m_storage[MAX_CAPTURE];
+    void (*m_invoke)(const void*, const TaskId&) = nullptr;
+};
+
+//! the task of a kernel with the number of its sub tasks, and the estimated cost
+//! of one sub task, in the number of the float elements it reads and writes,
+//! the thread pool uses the cost to decide how many threads run the task, a
+//! task without the cost runs on all the threads
+struct KernelTask {
+    KernelTask() = default;
+    KernelTask(const MultiThreadingTask& task, size_t nr_task, size_t cost = 0)
+            : task(task), nr_task(static_cast<uint32_t>(nr_task)), cost(cost) {}
+
+    MultiThreadingTask task;
+    uint32_t nr_task = 0;
+    size_t cost = 0;
+};
+
+//! the tasks of a kernel run one after another, some kernel may need to split
+//! the task into several, they are stored inline, so the kernel returns them
+//! without allocation
+class TaskSet {
+public:
+    using Task = KernelTask;
+    static constexpr size_t MAX_TASK = 4;
+
+    TaskSet() = default;
+    TaskSet(std::initializer_list<Task> tasks) {
+        for (auto& task : tasks) {
+            push_back(task);
+        }
+    }
+
+    void push_back(const Task& task) {
+        INFER_ASSERT(m_size < MAX_TASK, "too many tasks of the kernel.");
+        m_tasks[m_size++] = task;
+    }
+
+    Task* insert(Task* pos, const Task& task) {
+        INFER_ASSERT(m_size < MAX_TASK, "too many tasks of the kernel.");
+        for (Task* it = end(); it != pos; it--) {
+            *it = *(it - 1);
+        }
+        *pos = task;
+        m_size++;
+        return pos;
+    }
+
+    Task* begin() { return m_tasks; }
+    Task* end() { return m_tasks + m_size; }
+    const Task* begin() const { return m_tasks; }
+    const Task* end() const { return m_tasks + m_size; }
+    Task& operator[](size_t index) { return m_tasks[index]; }
+    Task& back() { return m_tasks[m_size - 1]; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+private:
+    Task m_tasks[MAX_TASK];
+    size_t m_size = 0;
+};
+
+//! the number of kv rows computed by one task of the decode attention, the
+//! partial results of the blocks are merged with their max scores
+#define FLASH_DECODE_BLOCK 64
+
+//! the number of columns the matmul epilogue activates at a time into its
+//! buffer, the activation can't write to its input
+#define EPILOGUE_BLOCK 64
+
+//! the int4 matmul prefetches the weights of the row this number of rows ahead
+//! while it computes a row, 0 disables the prefetch
+#ifndef INFER_PREFETCH_ROWS
+#define INFER_PREFETCH_ROWS 4
+#endif
 
-//! the task pair, the first parameter is the task, the second parameter is the
-//! number of sub task, some kernel may need to split the task into several
-using TaskSet = std::vector<std::pair<MultiThreadingTask, uint32_t>>;
+//! the weights are read once per token, so they are prefetched with the
+//! streaming hint, prefetchnta on x86 and prfm pldl1strm on arm, which does not
+//! evict the activations and the kv cache, otherwise they are kept in all levels
+#if INFER_WEIGHT_STREAM
+#define INFER_PREFETCH_WEIGHT(ptr) __builtin_prefetch((ptr), 0, 0)
+#else
+#define INFER_PREFETCH_WEIGHT(ptr) __builtin_prefetch((ptr), 0, 3)
+#endif
 
 #define QK40 32
 struct BlockQ40 {
@@ -21,7 +21,7 @@ TaskSet llm_embedding_get_int4_float(
                     dst + i * embd, embd);
         }
     };
-    return TaskSet{{task, len_seq}};
+    return TaskSet{{task, len_seq, embd}};
 }
 
 TaskSet llm_embedding_get_int8_float(
@@ -37,7 +37,7 @@ TaskSet llm_embedding_get_int8_float(
                     dst + i * embd, embd);
         }
     };
-    return TaskSet{{task, len_seq}};
+    return TaskSet{{task, len_seq, embd}};
 }
 
 TaskSet llm_embedding_get_float_float(
@@ -50,7 +50,7 @@ TaskSet llm_embedding_get_float_float(
             memcpy(dst + i * embd, weights + row * weight_stride, embd * sizeof(float));
         }
     };
-    return TaskSet{{task, len_seq}};
+    return TaskSet{{task, len_seq, embd}};
 }
 
 TaskSet llm_elemwise_compute_float(
@@ -104,7 +104,9 @@ TaskSet llm_elemwise_compute_float(
         default:
             INFER_ASSERT(0, "Not supported.");
     }
-    return TaskSet{{task, len}};
+    //! the exp and the tanh of the activations cost more than the add
+    size_t cost = mode == ElemMode::Add || mode == ElemMode::Mul ? 1 : 8;
+    return TaskSet{{task, len, cost}};
 }
 
 TaskSet llm_elemwise_compute_float_scale(
@@ -115,7 +117,7 @@ TaskSet llm_elemwise_compute_float_scale(
             dst[i] = src[i] * scale;
         }
     };
-    return TaskSet{{task, len}};
+    return TaskSet{{task, len, 1}};
 }
 
 TaskSet llm_elemwise_broadcast_dim0_src1_compute_float(
@@ -150,7 +152,7 @@ TaskSet llm_elemwise_broadcast_dim0_src1_compute_float(
         default:
             INFER_ASSERT(0, "Not supported.");
     }
-    return TaskSet{{task, len0}};
+    return TaskSet{{task, len0, len1}};
 }
 
 TaskSet llm_norm_compute_float(
@@ -180,7 +182,7 @@ TaskSet llm_norm_compute_float(
             }
         }
     };
-    return TaskSet{{task, seq_len}};
+    return TaskSet{{task, seq_len, 3 * embd}};
 }
 
 TaskSet llm_rms_norm_compute_float(
@@ -203,7 +205,53 @@ TaskSet llm_rms_norm_compute_float(
             }
         }
     };
-    return TaskSet{{task, seq_len}};
+    return TaskSet{{task, seq_len, 2 * embd}};
+}
+
+TaskSet llm_fused_norm_compute_float(
+        const float* src, float* dst, const float* weight, const float* bias,
+        void* q8_dst, uint32_t seq_len, uint32_t embd, float eps, bool rms) {
+    uint32_t q80_stride =
+            embd * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    auto task = [=](const TaskId& id) {
+        for (uint32_t i = id.start; i < id.end; i++) {
+            const float* row = src + i * embd;
+            float* out = dst + i * embd;
+
+            float mean = 0.0;
+            if (!rms) {
+                for (uint32_t j = 0; j < embd; j++) {
+                    mean += row[j];
+                }
+                mean /= embd;
+            }
+            float sum2 = 0.0;
+            for (uint32_t j = 0; j < embd; j++) {
+                float v = row[j] - mean;
+                sum2 += v * v;
+            }
+
+            const float scale = 1.0 / sqrt(sum2 / embd + eps);
+
+            for (uint32_t j = 0; j < embd; j++) {
+                float v = (row[j] - mean) * scale;
+                if (weight) {
+                    v *= weight[j];
+                }
+                if (bias) {
+                    v += bias[j];
+                }
+                out[j] = v;
+            }
+            //! the row is still in the cache
+            if (q8_dst) {
+                BlockQ80* q_out =
+                        (BlockQ80*)(static_cast<uint8_t*>(q8_dst) + i * q80_stride);
+                quantize_row_q8_0_reference(out, q_out, embd);
+            }
+        }
+    };
+    return TaskSet{{task, seq_len, 4 * embd}};
 }
 
 TaskSet llm_softmax_compute_float(
@@ -236,7 +284,7 @@ TaskSet llm_softmax_compute_float(
             }
         }
     };
-    return TaskSet{{task, len_row}};
+    return TaskSet{{task, len_row, 8 * col}};
 }
 
 // compute the softmax of the last dim of src, and store the result in dst
@@ -247,8 +295,6 @@ TaskSet llm_matmul_compute_int4_float(
     //! share the same scale, src1 is featureMap. src0 layout is {N,
     //! K}, src1 layout is {M, K}, the dst is {M, N}
     INFER_ASSERT(sizeof(float) * K <= size, "workspace is not enough.");
-    uint32_t weight_q40_stride =
-            K * dtype_in_byte(DType::Int4) / dtype_block_size(DType::Int4);
     uint32_t weight_q80_stride =
             K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
     //! dequantize input, and store in workspace
@@ -261,20 +307,33 @@ TaskSet llm_matmul_compute_int4_float(
             quantize_row_q8_0_reference(src1 + m * K, q_src1, K);
         }
     };
-    int8_t* q_src = static_cast<int8_t*>(workspace);
-    auto task2 = [=](const TaskId& id) {
+    TaskSet tasks =
+            llm_matmul_compute_int4_q8_float(dst, src0, bias, workspace, M, N, K);
+    tasks.insert(tasks.begin(), {task1, M, K});
+    return tasks;
+}
+
+TaskSet llm_matmul_compute_int4_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K) {
+    uint32_t weight_q40_stride =
+            K * dtype_in_byte(DType::Int4) / dtype_block_size(DType::Int4);
+    uint32_t weight_q80_stride =
+            K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    const int8_t* q_src = static_cast<const int8_t*>(q8_src1);
+    auto task = [=](const TaskId& id) {
         for (uint32_t n = id.start; n < id.end; n++) {
             const void* q_weight =
                     static_cast<const uint8_t*>(src0) + n * weight_q40_stride;
             float b = bias ? bias[n] : 0.0f;
             for (uint32_t m = 0; m < M; m++) {
-                int8_t* src = q_src + m * weight_q80_stride;
+                const int8_t* src = q_src + m * weight_q80_stride;
                 dst[m * N + n] =
                         vec_vec_dot_q40_with_q80_reference(K, q_weight, src) + b;
             }
         }
     };
-    return TaskSet{{task1, M}, {task2, N}};
+    return TaskSet{{task, N, M * K}};
 }
 
 TaskSet llm_matmul_compute_int4_float_packed(
@@ -284,8 +343,6 @@ TaskSet llm_matmul_compute_int4_float_packed(
     //! share the same scale, src1 is featureMap. src0 layout is {N,
     //! K}, src1 layout is {M, K}, the dst is {M, N}
     INFER_ASSERT(sizeof(float) * K <= size, "workspace is not enough.");
-    uint32_t weight_q40_stride =
-            K * dtype_in_byte(DType::Int4) / dtype_block_size(DType::Int4);
     uint32_t weight_q80_stride =
             K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
     //! dequantize input, and store in workspace
@@ -298,13 +355,26 @@ TaskSet llm_matmul_compute_int4_float_packed(
             quantize_row_q8_0_reference(src1 + m * K, q_src1, K);
         }
     };
-    int8_t* q_src = static_cast<int8_t*>(workspace);
-    auto task2 = [=](const TaskId& id) {
+    TaskSet tasks = llm_matmul_compute_int4_q8_float_packed(
+            dst, src0, bias, workspace, M, N, K);
+    tasks.insert(tasks.begin(), {task1, M, K});
+    return tasks;
+}
+
+TaskSet llm_matmul_compute_int4_q8_float_packed(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K) {
+    uint32_t weight_q40_stride =
+            K * dtype_in_byte(DType::Int4) / dtype_block_size(DType::Int4);
+    uint32_t weight_q80_stride =
+            K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    const int8_t* q_src = static_cast<const int8_t*>(q8_src1);
+    auto task = [=](const TaskId& id) {
         for (uint32_t n = id.start; n < id.end && n < N / 8; n++) {
             const void* q_weight =
                     static_cast<const uint8_t*>(src0) + n * 8 * weight_q40_stride;
             for (uint32_t m = 0; m < M; m++) {
-                int8_t* src = q_src + m * weight_q80_stride;
+                const int8_t* src = q_src + m * weight_q80_stride;
                 float* dst_ptr = dst + m * N + n * 8;
                 const float* bias_ptr = bias ? bias + n * 8 : nullptr;
                 vec_vec_dot_q40_with_q80_packed_reference(
@@ -312,7 +382,7 @@ TaskSet llm_matmul_compute_int4_float_packed(
             }
         }
     };
-    return TaskSet{{task1, M}, {task2, N / 8}};
+    return TaskSet{{task, N / 8, 8 * M * K}};
 }
 
 TaskSet llm_matmul_compute_int8_float(
@@ -334,20 +404,73 @@ TaskSet llm_matmul_compute_int8_float(
             quantize_row_q8_0_reference(src1 + m * K, q_src1, K);
         }
     };
-    int8_t* q_src = static_cast<int8_t*>(workspace);
-    auto task2 = [=](const TaskId& id) {
+    TaskSet tasks =
+            llm_matmul_compute_int8_q8_float(dst, src0, bias, workspace, M, N, K);
+    tasks.insert(tasks.begin(), {task1, M, K});
+    return tasks;
+}
+
+TaskSet llm_matmul_compute_int8_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K) {
+    uint32_t weight_q80_stride =
+            K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    const int8_t* q_src = static_cast<const int8_t*>(q8_src1);
+    auto task = [=](const TaskId& id) {
         for (uint32_t n = id.start; n < id.end; n++) {
             const void* q_weight =
                     static_cast<const uint8_t*>(src0) + n * weight_q80_stride;
             float b = bias ? bias[n] : 0.0f;
             for (uint32_t m = 0; m < M; m++) {
-                int8_t* src = q_src + m * weight_q80_stride;
+                const int8_t* src = q_src + m * weight_q80_stride;
                 dst[m * N + n] =
                         vec_vec_dot_q80_with_q80_reference(K, q_weight, src) + b;
             }
         }
     };
-    return TaskSet{{task1, M}, {task2, N}};
+    return TaskSet{{task, N, M * K}};
+}
+
+TaskSet llm_matmul_epilogue_float(MatmulEpilogue epilogue) {
+    MatmulEpilogue e = epilogue;
+    INFER_ASSERT(
+            !e.activate || e.act_mode == ElemMode::Silu || e.act_mode == ElemMode::Gelu,
+            "the activation of the matmul epilogue is not supported.");
+    auto task = [=](const TaskId& id) {
+        uint32_t begin = id.start * e.pack;
+        uint32_t end = std::min(id.end * e.pack, e.N);
+        for (uint32_t m = 0; m < e.M; m++) {
+            float* dst = e.dst + m * e.N;
+            const float* residual = e.residual ? e.residual + m * e.N : nullptr;
+            for (uint32_t n = begin; n < end; n++) {
+                float value = dst[n];
+                if (e.activate && e.act_mode == ElemMode::Silu) {
+                    value = value / (1.0 + exp(-value));
+                } else if (e.activate) {
+                    value = 0.5 * value *
+                            (1 + tanh(sqrt(2.0 / PI) *
+                                      (value + PGELU * value * value * value)));
+                }
+                if (residual) {
+                    value += residual[n] * e.residual_scale;
+                }
+                dst[n] = value;
+            }
+        }
+    };
+    return TaskSet{{task, (e.N + e.pack - 1) / e.pack, 8 * e.M * e.pack}};
+}
+
+TaskSet llm_quantize_q8_float(const float* src, void* dst, uint32_t M, uint32_t K) {
+    uint32_t q80_stride =
+            K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    auto task = [=](const TaskId& id) {
+        for (uint32_t m = id.start; m < id.end; m++) {
+            BlockQ80* q_dst = (BlockQ80*)(static_cast<int8_t*>(dst) + m * q80_stride);
+            quantize_row_q8_0_reference(src + m * K, q_dst, K);
+        }
+    };
+    return TaskSet{{task, M, 2 * K}};
 }
 
 size_t llm_matmul_get_workspace_float(uint32_t, uint32_t M, uint32_t N, uint32_t K) {
@@ -375,7 +498,7 @@ TaskSet llm_matmul_compute_float_float(
             }
         }
     };
-    return TaskSet{{task, N}};
+    return TaskSet{{task, N, M * K}};
 }
 
 TaskSet llm_rope_compute_float(
@@ -411,7 +534,7 @@ TaskSet llm_rope_compute_float(
                 }
             }
         };
-        return TaskSet{{task, ne1}};
+        return TaskSet{{task, head, 8 * N * n_rot}};
     } else {
         auto task = [=](const TaskId& id) {
             for (int i1 = id.start; i1 < id.end && i1 < ne1; i1++) {
@@ -436,7 +559,7 @@ TaskSet llm_rope_compute_float(
                 }
             }
         };
-        return TaskSet{{task, ne1}};
+        return TaskSet{{task, head, 8 * N * n_rot}};
     }
 }
 
@@ -488,14 +611,13 @@ TaskSet llm_glm_rope_compute_float(
             }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, 8 * seqlen * embd}};
 }
 
 TaskSet llm_diag_mask_inf_float(
         float* dst, const float* src0, uint32_t n_past, uint32_t N, uint32_t head) {
     const int nc = n_past + N;
     const int nr = N;
-    const int nz = head;
 
     auto task = [=](const TaskId& id) {
         for (int k = id.start; k < id.end && k < head; k++) {
@@ -510,7 +632,7 @@ TaskSet llm_diag_mask_inf_float(
             }
         }
     };
-    return TaskSet{{task, nz}};
+    return TaskSet{{task, head, N * nc}};
 }
 
 TaskSet llm_glm_gmask_inf_float(
@@ -525,7 +647,7 @@ TaskSet llm_glm_gmask_inf_float(
             }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen}};
 }
 
 TaskSet llm_scale_diag_mask_inf_float(
@@ -533,7 +655,6 @@ TaskSet llm_scale_diag_mask_inf_float(
         uint32_t head) {
     const int nc = n_past + seqlen;
     const int nr = seqlen;
-    const int nz = head;
 
     auto task = [=](const TaskId& id) {
         for (int k = id.start; k < id.end && k < head; k++) {
@@ -549,7 +670,7 @@ TaskSet llm_scale_diag_mask_inf_float(
             }
         }
     };
-    return TaskSet{{task, nz}};
+    return TaskSet{{task, head, seqlen * nc}};
 }
 
 TaskSet llm_permute_compute_float(
@@ -600,25 +721,33 @@ TaskSet llm_matmul_compute_with_head_strideq_broadcastk_float(
             }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
 }
 
 TaskSet llm_matmul_compute_with_head_stride_float(
         float* dst, const float* srck, const float* srcq, uint32_t seqlen,
         uint32_t embd, uint32_t head, uint32_t nr_past) {
+    return llm_matmul_compute_with_kv_stride_float(
+            dst, srck, srcq, seqlen, embd, head, nr_past, embd / head, embd);
+}
+
+TaskSet llm_matmul_compute_with_kv_stride_float(
+        float* dst, const float* srck, const float* srcq, uint32_t seqlen,
+        uint32_t embd, uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride) {
     uint32_t sub_embd = embd / head;
     uint32_t length = nr_past + seqlen;
     uint32_t line_stride = embd;
     auto task = [=](const TaskId& id) {
         for (uint32_t h = id.start; h < id.end && h < head; h++) {
             auto dst_head = dst + h * seqlen * (nr_past + seqlen);
-            auto srck_head = srck + h * sub_embd;
+            auto srck_head = srck + h * kv_head_stride;
             auto srcq_head = srcq + h * sub_embd;
             for (uint32_t row = 0; row < seqlen; row++) {
                 auto p_srcq = srcq_head + row * line_stride;
                 for (uint32_t len = 0; len < length; len++) {
                     auto p_dst = dst_head + row * length + len;
-                    auto p_srck = srck_head + len * line_stride;
+                    auto p_srck = srck_head + len * kv_row_stride;
                     float sum = 0;
                     for (uint32_t k = 0; k < sub_embd; k++) {
                         sum += p_srck[k] * p_srcq[k];
@@ -628,7 +757,7 @@ TaskSet llm_matmul_compute_with_head_stride_float(
             }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
 }
 
 TaskSet llm_head_batched_matmul_broadcastv_float(
@@ -658,12 +787,20 @@ TaskSet llm_head_batched_matmul_broadcastv_float(
             }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
 }
 
 TaskSet llm_head_batched_matmul_compute_float(
         float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
         uint32_t head, uint32_t nr_past) {
+    return llm_head_batched_matmul_kv_stride_float(
+            dst, v, qk, seqlen, embd, head, nr_past, embd / head, embd);
+}
+
+TaskSet llm_head_batched_matmul_kv_stride_float(
+        float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
+        uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride) {
     uint32_t sub_embd = embd / head;
     uint32_t length = nr_past + seqlen;
     uint32_t line_stride = embd;
@@ -671,7 +808,7 @@ TaskSet llm_head_batched_matmul_compute_float(
     auto task = [=](const TaskId& id) {
         for (uint32_t h = id.start; h < id.end && h < head; h++) {
             float* dst_head = dst + h * sub_embd;
-            const float* v_head = v + h * sub_embd;
+            const float* v_head = v + h * kv_head_stride;
             const float* qk_head = qk + h * seqlen * length;
             for (uint32_t row = 0; row < seqlen; row++) {
                 auto p_qk = qk_head + row * length;
@@ -680,14 +817,29 @@ TaskSet llm_head_batched_matmul_compute_float(
                     auto p_v = v_head + len;
                     float sum = 0;
                     for (uint32_t k = 0; k < length; k++) {
-                        sum += p_v[k * embd] * p_qk[k];
+                        sum += p_v[k * kv_row_stride] * p_qk[k];
                     }
                     *p_dst = sum;
                 }
             }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
+}
+
+TaskSet llm_kv_store_float(
+        float* dst, const float* src, uint32_t seqlen, uint32_t embd, uint32_t head,
+        uint32_t kv_head_stride, uint32_t kv_row_stride) {
+    uint32_t sub_embd = embd / head;
+    auto task = [=](const TaskId& id) {
+        for (uint32_t h = id.start; h < id.end && h < head; h++) {
+            for (uint32_t row = 0; row < seqlen; row++) {
+                memcpy(dst + h * kv_head_stride + row * kv_row_stride,
+                       src + row * embd + h * sub_embd, sub_embd * sizeof(float));
+            }
+        }
+    };
+    return TaskSet{{task, head, seqlen * sub_embd}};
 }
 
 TaskSet llm_int4_matmul_weight_reorder(
@@ -717,5 +869,87 @@ TaskSet llm_int4_matmul_weight_reorder(
     };
     return TaskSet{{task, block_m}};
 }
+
+size_t llm_flash_decode_get_workspace_float(
+        uint32_t embd, uint32_t head, uint32_t nr_ctx) {
+    uint32_t nr_block = (nr_ctx + FLASH_DECODE_BLOCK - 1) / FLASH_DECODE_BLOCK;
+    return head * nr_block * (embd / head + 2) * sizeof(float);
+}
+
+TaskSet llm_flash_decode_float(
+        float* dst, const float* q, const float* k, const float* v, float scale,
+        uint32_t embd, uint32_t head, uint32_t length, uint32_t k_head_stride,
+        uint32_t v_head_stride, uint32_t kv_row_stride, void* workspace,
+        uint32_t size) {
+    uint32_t sub_embd = embd / head;
+    uint32_t nr_block = (length + FLASH_DECODE_BLOCK - 1) / FLASH_DECODE_BLOCK;
+    //! every block keeps its max score, the sum of the exp of the scores and
+    //! the v accumulated with the exp of the scores
+    uint32_t partial_stride = sub_embd + 2;
+    INFER_ASSERT(
+            head * nr_block * partial_stride * sizeof(float) <= size,
+            "workspace is not enough.");
+    float* partial = static_cast<float*>(workspace);
+    auto block_task = [=](const TaskId& id) {
+        float score[FLASH_DECODE_BLOCK];
+        for (uint32_t i = id.start; i < id.end; i++) {
+            uint32_t h = i / nr_block;
+            uint32_t start = i % nr_block * FLASH_DECODE_BLOCK;
+            uint32_t len = std::min<uint32_t>(FLASH_DECODE_BLOCK, length - start);
+            const float* q_head = q + h * sub_embd;
+            const float* k_head = k + h * k_head_stride + start * kv_row_stride;
+            const float* v_head = v + h * v_head_stride + start * kv_row_stride;
+            float max = -INFINITY;
+            for (uint32_t j = 0; j < len; j++) {
+                float sum = 0;
+                for (uint32_t e = 0; e < sub_embd; e++) {
+                    sum += q_head[e] * k_head[j * kv_row_stride + e];
+                }
+                score[j] = sum * scale;
+                max = std::max(max, score[j]);
+            }
+            float* p_partial = partial + i * partial_stride;
+            float* acc = p_partial + 2;
+            memset(acc, 0, sub_embd * sizeof(float));
+            float sum = 0;
+            for (uint32_t j = 0; j < len; j++) {
+                float val = exp(score[j] - max);
+                sum += val;
+                for (uint32_t e = 0; e < sub_embd; e++) {
+                    acc[e] += val * v_head[j * kv_row_stride + e];
+                }
+            }
+            p_partial[0] = max;
+            p_partial[1] = sum;
+        }
+    };
+    auto reduce_task = [=](const TaskId& id) {
+        for (uint32_t h = id.start; h < id.end; h++) {
+            const float* p_head = partial + h * nr_block * partial_stride;
+            float max = -INFINITY;
+            for (uint32_t b = 0; b < nr_block; b++) {
+                max = std::max(max, p_head[b * partial_stride]);
+            }
+            float* p_dst = dst + h * sub_embd;
+            memset(p_dst, 0, sub_embd * sizeof(float));
+            float sum = 0;
+            for (uint32_t b = 0; b < nr_block; b++) {
+                const float* p_partial = p_head + b * partial_stride;
+                float rescale = exp(p_partial[0] - max);
+                sum += p_partial[1] * rescale;
+                for (uint32_t e = 0; e < sub_embd; e++) {
+                    p_dst[e] += p_partial[2 + e] * rescale;
+                }
+            }
+            sum = 1.0 / sum;
+            for (uint32_t e = 0; e < sub_embd; e++) {
+                p_dst[e] *= sum;
+            }
+        }
+    };
+    return TaskSet{
+            {block_task, head * nr_block, 2 * FLASH_DECODE_BLOCK * sub_embd},
+            {reduce_task, head, 2 * nr_block * sub_embd}};
+}
 }  // namespace naive
 }  // namespace inferllm
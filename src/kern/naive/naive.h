@@ -34,6 +34,12 @@ TaskSet llm_norm_compute_float(
 TaskSet llm_rms_norm_compute_float(
         const float* src, float* dst, uint32_t seq_len, uint32_t embd, float eps);
 
+//! the weight, the bias and the q8_dst can be null, the row m of the q8_dst is
+//! at m * embd * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8)
+TaskSet llm_fused_norm_compute_float(
+        const float* src, float* dst, const float* weight, const float* bias,
+        void* q8_dst, uint32_t seq_len, uint32_t embd, float eps, bool rms);
+
 TaskSet llm_softmax_compute_float(
         const float* src, float* dst, uint32_t len_row, uint32_t col);
 
@@ -49,6 +55,28 @@ TaskSet llm_matmul_compute_int4_float_packed(
 TaskSet llm_matmul_compute_int8_float(
         float* dst, const void* src0, const float* bias, const float* src1, uint32_t M,
         uint32_t N, uint32_t K, void* workspace, uint32_t size);
+
+//! the row m of q8_src1 is the Q8_0 blocks at m * K * dtype_in_byte(DType::Int8)
+//! / dtype_block_size(DType::Int8), which the above kernels quantize to the
+//! workspace
+TaskSet llm_matmul_compute_int4_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K);
+
+TaskSet llm_matmul_compute_int4_q8_float_packed(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K);
+
+TaskSet llm_matmul_compute_int8_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K);
+
+//! every task applies the epilogue to its columns of all the rows
+TaskSet llm_matmul_epilogue_float(MatmulEpilogue epilogue);
+
+//! the src layout is {M, K}, every row of the dst is K / QK80 Q8_0 blocks
+TaskSet llm_quantize_q8_float(const float* src, void* dst, uint32_t M, uint32_t K);
+
 TaskSet llm_matmul_compute_float_float(
         float* dst, const float* src0, const float* bias, const float* src1, uint32_t M,
         uint32_t N, uint32_t K, void* workspace, uint32_t size);
@@ -97,9 +125,39 @@ TaskSet llm_head_batched_matmul_compute_float(
         float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
         uint32_t head, uint32_t nr_past);
 
+//! the row r of the head h of the kv cache is at h * kv_head_stride + r *
+//! kv_row_stride, so the strides of the row layout are {embd / head, embd}, and
+//! the strides of the head major layout are {nr_ctx * embd / head, embd / head}
+TaskSet llm_matmul_compute_with_kv_stride_float(
+        float* dst, const float* srck, const float* srcq, uint32_t seqlen,
+        uint32_t embd, uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride);
+
+TaskSet llm_head_batched_matmul_kv_stride_float(
+        float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
+        uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride);
+
+TaskSet llm_kv_store_float(
+        float* dst, const float* src, uint32_t seqlen, uint32_t embd, uint32_t head,
+        uint32_t kv_head_stride, uint32_t kv_row_stride);
+
 TaskSet llm_int4_matmul_weight_reorder(
         size_t M, size_t N, void* dst, void* src, size_t PACK_SIZE);
 
+//! the attention of one query row with the length rows of the kv cache, the
+//! kv rows are split into blocks across the threads, and the blocks of a head
+//! are merged with the log-sum-exp of their scores, the strides of the kv cache
+//! are like llm_matmul_compute_with_kv_stride_float
+TaskSet llm_flash_decode_float(
+        float* dst, const float* q, const float* k, const float* v, float scale,
+        uint32_t embd, uint32_t head, uint32_t length, uint32_t k_head_stride,
+        uint32_t v_head_stride, uint32_t kv_row_stride, void* workspace,
+        uint32_t size);
+
+size_t llm_flash_decode_get_workspace_float(
+        uint32_t embd, uint32_t head, uint32_t nr_ctx);
+
 template <KernelID Id, typename... Args>
 struct Comp {
     static TaskSet get_all_task(Args... args);
@@ -116,6 +174,7 @@ PartialImplementKernel(
         ElemwiseBroadcastDim0Src1Float, llm_elemwise_broadcast_dim0_src1_compute_float);
 PartialImplementKernel(NormFloat, llm_norm_compute_float);
 PartialImplementKernel(RmsNormFloat, llm_rms_norm_compute_float);
+PartialImplementKernel(FusedNormFloat, llm_fused_norm_compute_float);
 PartialImplementKernel(EmbeddingGetInt4Float, llm_embedding_get_int4_float);
 PartialImplementKernel(EmbeddingGetInt8Float, llm_embedding_get_int8_float);
 PartialImplementKernel(EmbeddingGetFloatFloat, llm_embedding_get_float_float);
@@ -123,7 +182,13 @@ PartialImplementKernel(SoftmaxFloat, llm_softmax_compute_float);
 PartialImplementKernel(MatmulInt4Float, llm_matmul_compute_int4_float);
 PartialImplementKernel(MatmulInt4FloatPacked, llm_matmul_compute_int4_float_packed);
 PartialImplementKernel(MatmulInt8Float, llm_matmul_compute_int8_float);
+PartialImplementKernel(MatmulInt4Q8Float, llm_matmul_compute_int4_q8_float);
+PartialImplementKernel(
+        MatmulInt4Q8FloatPacked, llm_matmul_compute_int4_q8_float_packed);
+PartialImplementKernel(MatmulInt8Q8Float, llm_matmul_compute_int8_q8_float);
 PartialImplementKernel(MatmulFloatFloat, llm_matmul_compute_float_float);
+PartialImplementKernel(MatmulEpilogueFloat, llm_matmul_epilogue_float);
+PartialImplementKernel(QuantizeQ8Float, llm_quantize_q8_float);
 PartialImplementKernel(
         MatmulWithHeadStrideFloat, llm_matmul_compute_with_head_stride_float);
 PartialImplementKernel(HeadBatchedMatmulFloat, llm_head_batched_matmul_compute_float);
@@ -142,10 +207,17 @@ PartialImplementKernel(
         HeadBatchedMatmulBroadCastVFloat, llm_head_batched_matmul_broadcastv_float);
 
 PartialImplementKernel(MatmulInt4WeightReorder, llm_int4_matmul_weight_reorder);
+PartialImplementKernel(FlashDecodeFloat, llm_flash_decode_float);
+PartialImplementKernel(
+        MatmulWithKvStrideFloat, llm_matmul_compute_with_kv_stride_float);
+PartialImplementKernel(
+        HeadBatchedMatmulKvStrideFloat, llm_head_batched_matmul_kv_stride_float);
+PartialImplementKernel(KvStoreFloat, llm_kv_store_float);
 
 PartialImplementSpace(MatmulInt4Float, llm_matmul_get_workspace_float);
 PartialImplementSpace(MatmulInt8Float, llm_matmul_get_workspace_float);
 PartialImplementSpace(MatmulFloatFloat, llm_matmul_get_workspace_float_float);
+PartialImplementSpace(FlashDecodeFloat, llm_flash_decode_get_workspace_float);
 
 }  // namespace naive
 
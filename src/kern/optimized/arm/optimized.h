@@ -117,11 +117,48 @@ inline void compute_src_offset_embd_matmul(
     }
 }
 
+//! one row of the head batched matmul with the head dim known at compile time,
+//! the accumulators of 64 columns stay in the registers, so the rows of v are
+//! read continuously instead of a column at a time
+template <int SubEmbd>
+inline void comput_matmul_row_with_head_dim(
+        float* __restrict p_dst, const float* __restrict srcv, int offset_v,
+        const float* __restrict p_qk, int length) {
+    static_assert(SubEmbd % 64 == 0, "the head dim is not a multiple of 64.");
+    for (int col = 0; col < SubEmbd; col += 64) {
+        float32x4_t sum[16];
+        for (int j = 0; j < 16; j++) {
+            sum[j] = vdupq_n_f32(0.0f);
+        }
+        for (int k = 0; k < length; k++) {
+            auto p_v = srcv + k * offset_v + col;
+            float qk = p_qk[k];
+            for (int j = 0; j < 16; j++) {
+                sum[j] = vmlaq_n_f32(sum[j], vld1q_f32(p_v + j * 4), qk);
+            }
+        }
+        for (int j = 0; j < 16; j++) {
+            vst1q_f32(p_dst + col + j * 4, sum[j]);
+        }
+    }
+}
+
 inline void comput_matmul_with_dst_uncontinue(
         float* __restrict dst, int offset_dst, const float* __restrict srcv,
         int offset_v, const float* __restrict srcqk, int seqlen, int length, int K) {
     for (uint32_t row = 0; row < seqlen; row++) {
         auto p_qk = srcqk + row * length;
+        //! the common head dims
+        if (K == 64) {
+            comput_matmul_row_with_head_dim<64>(
+                    dst + row * offset_dst, srcv, offset_v, p_qk, length);
+            continue;
+        }
+        if (K == 128) {
+            comput_matmul_row_with_head_dim<128>(
+                    dst + row * offset_dst, srcv, offset_v, p_qk, length);
+            continue;
+        }
         for (uint32_t len = 0; len < K; len++) {
             auto p_dst = dst + row * offset_dst + len;
             auto p_v = srcv + len;
@@ -135,7 +172,8 @@ inline void comput_matmul_with_dst_uncontinue(
 }
 
 inline float vec_vec_dot_q40_with_q80(
-        const int n, const void* __restrict vx, const void* __restrict vy) {
+        const int n, const void* __restrict vx, const void* __restrict vy,
+        const void* __restrict ahead = nullptr) {
     const int nb = n / QK80;
 
     assert(n % QK80 == 0);
@@ -148,6 +186,9 @@ inline float vec_vec_dot_q40_with_q80(
     float32x4_t sumv1 = vdupq_n_f32(0.0f);
 
     for (int i = 0; i < nb; i += 2) {
+        if (ahead) {
+            INFER_PREFETCH_WEIGHT((const BlockQ40*)ahead + i);
+        }
         const BlockQ40* __restrict x0 = &x[i + 0];
         const BlockQ40* __restrict x1 = &x[i + 1];
         const BlockQ80* __restrict y0 = &y[i + 0];
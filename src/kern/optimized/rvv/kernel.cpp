@@ -55,7 +55,9 @@ TaskSet llm_elemwise_compute_float(
         default:
             INFER_ASSERT(0, "Not supported.");
     }
-    return TaskSet{{task, length}};
+    //! the exp and the tanh of the activations cost more than the add
+    size_t cost = mode == ElemMode::Add || mode == ElemMode::Mul ? 1 : 8;
+    return TaskSet{{task, length, cost}};
 }
 
 TaskSet llm_elemwise_broadcast_dim0_src1_compute_float(
@@ -86,7 +88,7 @@ TaskSet llm_elemwise_broadcast_dim0_src1_compute_float(
         default:
             INFER_ASSERT(0, "Not supported.");
     }
-    return TaskSet{{task, len0}};
+    return TaskSet{{task, len0, len1}};
 }
 
 TaskSet llm_rms_norm_compute_float(
@@ -100,7 +102,56 @@ TaskSet llm_rms_norm_compute_float(
             elemwise_vec_scale(embd, row, scale, out);
         }
     };
-    return TaskSet{{task, seq_len}};
+    return TaskSet{{task, seq_len, 2 * embd}};
+}
+
+TaskSet llm_fused_norm_compute_float(
+        const float* src, float* dst, const float* weight, const float* bias,
+        void* q8_dst, uint32_t seq_len, uint32_t embd, float eps, bool rms) {
+    uint32_t q80_stride =
+            embd * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    auto task = [=](const TaskId& id) {
+        for (uint32_t i = id.start; i < id.end; i++) {
+            const float* row = src + i * embd;
+            float* out = dst + i * embd;
+            if (rms) {
+                float mean = reduce_square_sum(embd, row) / embd;
+                const float scale = 1.0 / sqrt(mean + eps);
+                elemwise_vec_scale(embd, row, scale, out);
+            } else {
+                float mean = 0.0;
+                for (uint32_t j = 0; j < embd; j++) {
+                    mean += row[j];
+                }
+                mean /= embd;
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] = row[j] - mean;
+                }
+                float variance = reduce_square_sum(embd, out) / embd;
+                const float scale = 1.0 / sqrt(variance + eps);
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] *= scale;
+                }
+            }
+            //! in place on the row of dst, which the restrict helpers can't do
+            if (weight) {
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] *= weight[j];
+                }
+            }
+            if (bias) {
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] += bias[j];
+                }
+            }
+            //! the row is still in the cache
+            if (q8_dst) {
+                quantize_row_q8_0(
+                        out, static_cast<uint8_t*>(q8_dst) + i * q80_stride, embd);
+            }
+        }
+    };
+    return TaskSet{{task, seq_len, 4 * embd}};
 }
 
 TaskSet llm_softmax_compute_float(
@@ -116,7 +167,7 @@ TaskSet llm_softmax_compute_float(
             elemwise_vec_scale(col, pdst, sum, pdst);
         }
     };
-    return TaskSet{{task, len_row}};
+    return TaskSet{{task, len_row, 8 * col}};
 }
 
 // compute the softmax of the last dim of src, and store the result in dst
@@ -127,9 +178,7 @@ TaskSet llm_matmul_compute_int4_float(
     //! share the same scale, src1 is featureMap. src0 layout is {N,
     //! K}, src1 layout is {M, K}, the dst is {M, N}
     INFER_ASSERT(sizeof(float) * K <= size, "workspace is not enough.");
-    uint32_t q4off = K / dtype_block_size(DType::Int4);
     uint32_t q8off = K / dtype_block_size(DType::Int8);
-    const BlockQ40* x = static_cast<const BlockQ40*>(src0);
     BlockQ80* y = static_cast<BlockQ80*>(workspace);
 
     //! dequantize input, and store in workspace
@@ -139,7 +188,19 @@ TaskSet llm_matmul_compute_int4_float(
         for (uint32_t m = id.start; m < id.end; m++)
             quantize_row_q8_0(&src1[m * K], &y[m * q8off], K);
     };
-    auto task2 = [=](const TaskId& id) {
+    TaskSet tasks = llm_matmul_compute_int4_q8_float(dst, src0, bias, y, M, N, K);
+    tasks.insert(tasks.begin(), {task1, M, K});
+    return tasks;
+}
+
+TaskSet llm_matmul_compute_int4_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K) {
+    uint32_t q4off = K / dtype_block_size(DType::Int4);
+    uint32_t q8off = K / dtype_block_size(DType::Int8);
+    const BlockQ40* x = static_cast<const BlockQ40*>(src0);
+    const BlockQ80* y = static_cast<const BlockQ80*>(q8_src1);
+    auto task = [=](const TaskId& id) {
         size_t lmul = mk_lmul(E16, QK80);
         size_t vt16 = mk_vtype(E16, lmul), vt32 = mk_vtype(E32, lmul);
         for (uint32_t n = id.start; n < id.end; n++) {
@@ -189,7 +250,7 @@ TaskSet llm_matmul_compute_int4_float(
             }
         }
     };
-    return TaskSet{{task1, M}, {task2, N}};
+    return TaskSet{{task, N, M * K}};
 }
 
 TaskSet llm_matmul_compute_int8_float(
@@ -200,7 +261,6 @@ TaskSet llm_matmul_compute_int8_float(
     //! K}, src1 layout is {M, K}, the dst is {M, N}
     INFER_ASSERT(sizeof(float) * K <= size, "workspace is not enough.");
     uint32_t q8off = K / dtype_block_size(DType::Int8);
-    const BlockQ80* x = static_cast<const BlockQ80*>(src0);
     BlockQ80* y = static_cast<BlockQ80*>(workspace);
 
     //! dequantize input, and store in workspace
@@ -210,7 +270,18 @@ TaskSet llm_matmul_compute_int8_float(
         for (uint32_t m = id.start; m < id.end; m++)
             quantize_row_q8_0(&src1[m * K], &y[m * q8off], K);
     };
-    auto task2 = [=](const TaskId& id) {
+    TaskSet tasks = llm_matmul_compute_int8_q8_float(dst, src0, bias, y, M, N, K);
+    tasks.insert(tasks.begin(), {task1, M, K});
+    return tasks;
+}
+
+TaskSet llm_matmul_compute_int8_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K) {
+    uint32_t q8off = K / dtype_block_size(DType::Int8);
+    const BlockQ80* x = static_cast<const BlockQ80*>(src0);
+    const BlockQ80* y = static_cast<const BlockQ80*>(q8_src1);
+    auto task = [=](const TaskId& id) {
         size_t lmul = mk_lmul(E16, QK80);
         size_t vt16 = mk_vtype(E16, lmul);
         for (uint32_t n = id.start; n < id.end; n++) {
@@ -251,7 +322,50 @@ TaskSet llm_matmul_compute_int8_float(
             }
         }
     };
-    return TaskSet{{task1, M}, {task2, N}};
+    return TaskSet{{task, N, M * K}};
+}
+
+TaskSet llm_matmul_epilogue_float(MatmulEpilogue epilogue) {
+    MatmulEpilogue e = epilogue;
+    INFER_ASSERT(
+            !e.activate || e.act_mode == ElemMode::Silu || e.act_mode == ElemMode::Gelu,
+            "the activation of the matmul epilogue is not supported.");
+    auto task = [=](const TaskId& id) {
+        uint32_t begin = id.start * e.pack;
+        uint32_t len = std::min(id.end * e.pack, e.N) - begin;
+        for (uint32_t m = 0; m < e.M; m++) {
+            float* dst = e.dst + m * e.N + begin;
+            if (e.activate && e.act_mode == ElemMode::Silu) {
+                elemwise_vector_silu(len, dst, dst);
+            } else if (e.activate) {
+                elemwise_vector_gelu(len, dst, dst);
+            }
+            if (!e.residual) {
+                continue;
+            }
+            const float* residual = e.residual + m * e.N + begin;
+            if (e.residual_scale == 1.0f) {
+                elemwise_vector_add(len, dst, residual, dst);
+            } else {
+                for (uint32_t n = 0; n < len; n++) {
+                    dst[n] += residual[n] * e.residual_scale;
+                }
+            }
+        }
+    };
+    return TaskSet{{task, (e.N + e.pack - 1) / e.pack, 8 * e.M * e.pack}};
+}
+
+TaskSet llm_quantize_q8_float(const float* src, void* dst, uint32_t M, uint32_t K) {
+    uint32_t q80_stride =
+            K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    auto task = [=](const TaskId& id) {
+        for (uint32_t m = id.start; m < id.end; m++) {
+            void* q_dst = static_cast<int8_t*>(dst) + m * q80_stride;
+            quantize_row_q8_0(src + m * K, q_dst, K);
+        }
+    };
+    return TaskSet{{task, M, 2 * K}};
 }
 
 size_t llm_matmul_get_workspace_float(uint32_t, uint32_t M, uint32_t N, uint32_t K) {
@@ -261,46 +375,61 @@ size_t llm_matmul_get_workspace_float(uint32_t, uint32_t M, uint32_t N, uint32_t
 TaskSet llm_matmul_compute_with_head_stride_float(
         float* dst, const float* srck, const float* srcq, uint32_t seqlen,
         uint32_t embd, uint32_t head, uint32_t nr_past) {
+    return llm_matmul_compute_with_kv_stride_float(
+            dst, srck, srcq, seqlen, embd, head, nr_past, embd / head, embd);
+}
+
+TaskSet llm_matmul_compute_with_kv_stride_float(
+        float* dst, const float* srck, const float* srcq, uint32_t seqlen,
+        uint32_t embd, uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride) {
     uint32_t sub_embd = embd / head;
     uint32_t length = nr_past + seqlen;
-    uint32_t line_stride = embd;
 
     auto task = [=](const TaskId& id) {
         for (uint32_t h = id.start; h < id.end; h++) {
             auto dst_head = dst + h * seqlen * (nr_past + seqlen);
-            auto srck_head = srck + h * sub_embd;
+            auto srck_head = srck + h * kv_head_stride;
             auto srcq_head = srcq + h * sub_embd;
             for (uint32_t row = 0; row < seqlen; row++) {
                 auto p_srcq = srcq_head + row * embd;
                 uint32_t len = 0;
                 for (; len < length; len++) {
                     auto p_dst = dst_head + row * length + len;
-                    auto p_srck = srck_head + len * embd;
+                    auto p_srck = srck_head + len * kv_row_stride;
                     *p_dst = vmulsum(p_srck, p_srcq, sub_embd, 0);
                 }
             }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
 }
 
 TaskSet llm_head_batched_matmul_compute_float(
         float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
         uint32_t head, uint32_t nr_past) {
+    return llm_head_batched_matmul_kv_stride_float(
+            dst, v, qk, seqlen, embd, head, nr_past, embd / head, embd);
+}
+
+TaskSet llm_head_batched_matmul_kv_stride_float(
+        float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
+        uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride) {
     uint32_t sub_embd = embd / head;
     uint32_t length = nr_past + seqlen;
-    uint32_t line_stride = embd;
 
     auto task = [=](const TaskId& id) {
         for (uint32_t h = id.start; h < id.end; h++) {
             float* dst_head = dst + h * sub_embd;
-            const float* v_head = v + h * sub_embd;
+            const float* v_head = v + h * kv_head_stride;
             const float* qk_head = qk + h * seqlen * length;
             comput_matmul_with_dst_uncontinue(
-                    dst_head, embd, v_head, embd, qk_head, seqlen, length, sub_embd);
+                    dst_head, embd, v_head, kv_row_stride, qk_head, seqlen, length,
+                    sub_embd);
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
 }
 
 }  // namespace opt
@@ -26,7 +26,7 @@ TaskSet llm_embedding_get_int4_float(
                     dst + i * embd, embd);
         }
     };
-    return TaskSet{{task, len_seq}};
+    return TaskSet{{task, len_seq, embd}};
 }
 
 TaskSet llm_elemwise_compute_float(
@@ -70,7 +70,9 @@ TaskSet llm_elemwise_compute_float(
         default:
             INFER_ASSERT(0, "Not supported.");
     }
-    return TaskSet{{task, length}};
+    //! the exp and the tanh of the activations cost more than the add
+    size_t cost = mode == ElemMode::Add || mode == ElemMode::Mul ? 1 : 8;
+    return TaskSet{{task, length, cost}};
 }
 
 TaskSet llm_elemwise_broadcast_dim0_src1_compute_float(
@@ -101,7 +103,7 @@ TaskSet llm_elemwise_broadcast_dim0_src1_compute_float(
         default:
             INFER_ASSERT(0, "Not supported.");
     }
-    return TaskSet{{task, len0}};
+    return TaskSet{{task, len0, len1}};
 }
 
 TaskSet llm_rms_norm_compute_float(
@@ -115,7 +117,56 @@ TaskSet llm_rms_norm_compute_float(
             elemwise_vec_scale(embd, row, scale, out);
         }
     };
-    return TaskSet{{task, seq_len}};
+    return TaskSet{{task, seq_len, 2 * embd}};
+}
+
+TaskSet llm_fused_norm_compute_float(
+        const float* src, float* dst, const float* weight, const float* bias,
+        void* q8_dst, uint32_t seq_len, uint32_t embd, float eps, bool rms) {
+    uint32_t q80_stride =
+            embd * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    auto task = [=](const TaskId& id) {
+        for (uint32_t i = id.start; i < id.end; i++) {
+            const float* row = src + i * embd;
+            float* out = dst + i * embd;
+            if (rms) {
+                float mean = reduce_square_sum(embd, row) / embd;
+                const float scale = 1.0 / sqrt(mean + eps);
+                elemwise_vec_scale(embd, row, scale, out);
+            } else {
+                float mean = 0.0;
+                for (uint32_t j = 0; j < embd; j++) {
+                    mean += row[j];
+                }
+                mean /= embd;
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] = row[j] - mean;
+                }
+                float variance = reduce_square_sum(embd, out) / embd;
+                const float scale = 1.0 / sqrt(variance + eps);
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] *= scale;
+                }
+            }
+            //! in place on the row of dst, which the restrict helpers can't do
+            if (weight) {
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] *= weight[j];
+                }
+            }
+            if (bias) {
+                for (uint32_t j = 0; j < embd; j++) {
+                    out[j] += bias[j];
+                }
+            }
+            //! the row is still in the cache
+            if (q8_dst) {
+                quantize_row_q8_0(
+                        out, static_cast<uint8_t*>(q8_dst) + i * q80_stride, embd);
+            }
+        }
+    };
+    return TaskSet{{task, seq_len, 4 * embd}};
 }
 
 TaskSet llm_softmax_compute_float(
@@ -131,7 +182,7 @@ TaskSet llm_softmax_compute_float(
             elemwise_vec_scale(col, pdst, sum, pdst);
         }
     };
-    return TaskSet{{task, len_row}};
+    return TaskSet{{task, len_row, 8 * col}};
 }
 
 // compute the softmax of the last dim of src, and store the result in dst
@@ -142,8 +193,6 @@ TaskSet llm_matmul_compute_int4_float(
     //! share the same scale, src1 is featureMap. src0 layout is {N,
     //! K}, src1 layout is {M, K}, the dst is {M, N}
     INFER_ASSERT(sizeof(float) * K <= size, "workspace is not enough.");
-    uint32_t weight_q40_stride =
-            K * dtype_in_byte(DType::Int4) / dtype_block_size(DType::Int4);
     uint32_t weight_q80_stride =
             K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
     //! dequantize input, and store in workspace
@@ -156,8 +205,31 @@ TaskSet llm_matmul_compute_int4_float(
             quantize_row_q8_0(src1 + m * K, q_src1, K);
         }
     };
-    int8_t* q_src = static_cast<int8_t*>(workspace);
-    auto task2 = [=](const TaskId& id) {
+    TaskSet tasks =
+            llm_matmul_compute_int4_q8_float(dst, src0, bias, workspace, M, N, K);
+    tasks.insert(tasks.begin(), {task1, M, K});
+    return tasks;
+}
+
+//! the weights of the row ahead which are prefetched while the row is computed,
+//! the rows of other tasks are not prefetched as they run on other cores
+inline const void* weight_row_ahead(
+        const void* weights, uint32_t row, uint32_t end, uint32_t stride) {
+    if (INFER_PREFETCH_ROWS == 0 || row + INFER_PREFETCH_ROWS >= end) {
+        return nullptr;
+    }
+    return static_cast<const uint8_t*>(weights) + (row + INFER_PREFETCH_ROWS) * stride;
+}
+
+TaskSet llm_matmul_compute_int4_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K) {
+    uint32_t weight_q40_stride =
+            K * dtype_in_byte(DType::Int4) / dtype_block_size(DType::Int4);
+    uint32_t weight_q80_stride =
+            K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    const int8_t* q_src = static_cast<const int8_t*>(q8_src1);
+    auto task = [=](const TaskId& id) {
         uint32_t N_len = id.end - id.start;
         uint32_t n_block_4 = N_len / 4;
         uint32_t n_block_4_left = N_len - n_block_4 * 4;
@@ -178,12 +250,25 @@ TaskSet llm_matmul_compute_int4_float(
                     static_cast<const uint8_t*>(src0) + (n + 2) * weight_q40_stride;
             const void* q_weight3 =
                     static_cast<const uint8_t*>(src0) + (n + 3) * weight_q40_stride;
+            const void* ahead0 = weight_row_ahead(src0, n, id.end, weight_q40_stride);
+            const void* ahead1 =
+                    weight_row_ahead(src0, n + 1, id.end, weight_q40_stride);
+            const void* ahead2 =
+                    weight_row_ahead(src0, n + 2, id.end, weight_q40_stride);
+            const void* ahead3 =
+                    weight_row_ahead(src0, n + 3, id.end, weight_q40_stride);
             for (uint32_t m = 0; m < M; m++) {
-                int8_t* src = q_src + m * weight_q80_stride;
-                dst[m * N + n] = vec_vec_dot_q40_with_q80(K, q_weight0, src) + b0;
-                dst[m * N + n + 1] = vec_vec_dot_q40_with_q80(K, q_weight1, src) + b1;
-                dst[m * N + n + 2] = vec_vec_dot_q40_with_q80(K, q_weight2, src) + b2;
-                dst[m * N + n + 3] = vec_vec_dot_q40_with_q80(K, q_weight3, src) + b3;
+                const int8_t* src = q_src + m * weight_q80_stride;
+                dst[m * N + n] =
+                        vec_vec_dot_q40_with_q80(K, q_weight0, src, ahead0) + b0;
+                dst[m * N + n + 1] =
+                        vec_vec_dot_q40_with_q80(K, q_weight1, src, ahead1) + b1;
+                dst[m * N + n + 2] =
+                        vec_vec_dot_q40_with_q80(K, q_weight2, src, ahead2) + b2;
+                dst[m * N + n + 3] =
+                        vec_vec_dot_q40_with_q80(K, q_weight3, src, ahead3) + b3;
+                //! the weights are in the cache for the later rows of the input
+                ahead0 = ahead1 = ahead2 = ahead3 = nullptr;
             }
         }
 
@@ -195,13 +280,60 @@ TaskSet llm_matmul_compute_int4_float(
             }
             const void* q_weight =
                     static_cast<const uint8_t*>(src0) + n * weight_q40_stride;
+            const void* ahead = weight_row_ahead(src0, n, id.end, weight_q40_stride);
             for (uint32_t m = 0; m < M; m++) {
-                int8_t* src = q_src + m * weight_q80_stride;
-                dst[m * N + n] = vec_vec_dot_q40_with_q80(K, q_weight, src) + b0;
+                const int8_t* src = q_src + m * weight_q80_stride;
+                dst[m * N + n] = vec_vec_dot_q40_with_q80(K, q_weight, src, ahead) + b0;
+                ahead = nullptr;
             }
         }
     };
-    return TaskSet{{task1, M}, {task2, N}};
+    return TaskSet{{task, N, M * K}};
+}
+
+TaskSet llm_matmul_epilogue_float(MatmulEpilogue epilogue) {
+    MatmulEpilogue e = epilogue;
+    INFER_ASSERT(
+            !e.activate || e.act_mode == ElemMode::Silu || e.act_mode == ElemMode::Gelu,
+            "the activation of the matmul epilogue is not supported.");
+    auto task = [=](const TaskId& id) {
+        uint32_t begin = id.start * e.pack;
+        uint32_t len = std::min(id.end * e.pack, e.N) - begin;
+        float act[EPILOGUE_BLOCK];
+        for (uint32_t m = 0; m < e.M; m++) {
+            float* dst = e.dst + m * e.N + begin;
+            for (uint32_t c = 0; e.activate && c < len; c += EPILOGUE_BLOCK) {
+                uint32_t nr = std::min<uint32_t>(EPILOGUE_BLOCK, len - c);
+                if (e.act_mode == ElemMode::Silu) {
+                    elemwise_vector_silu(nr, dst + c, act);
+                } else {
+                    elemwise_vector_gelu(nr, dst + c, act);
+                }
+                memcpy(dst + c, act, nr * sizeof(float));
+            }
+            if (!e.residual) {
+                continue;
+            }
+            //! in place on the dst, which the restrict helpers can't do
+            const float* residual = e.residual + m * e.N + begin;
+            for (uint32_t n = 0; n < len; n++) {
+                dst[n] += residual[n] * e.residual_scale;
+            }
+        }
+    };
+    return TaskSet{{task, (e.N + e.pack - 1) / e.pack, 8 * e.M * e.pack}};
+}
+
+TaskSet llm_quantize_q8_float(const float* src, void* dst, uint32_t M, uint32_t K) {
+    uint32_t q80_stride =
+            K * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    auto task = [=](const TaskId& id) {
+        for (uint32_t m = id.start; m < id.end; m++) {
+            void* q_dst = static_cast<int8_t*>(dst) + m * q80_stride;
+            quantize_row_q8_0(src + m * K, q_dst, K);
+        }
+    };
+    return TaskSet{{task, M, 2 * K}};
 }
 
 size_t llm_matmul_get_workspace_float(uint32_t, uint32_t M, uint32_t N, uint32_t K) {
@@ -211,40 +343,124 @@ size_t llm_matmul_get_workspace_float(uint32_t, uint32_t M, uint32_t N, uint32_t
 TaskSet llm_matmul_compute_with_head_stride_float(
         float* dst, const float* srck, const float* srcq, uint32_t seqlen,
         uint32_t embd, uint32_t head, uint32_t nr_past) {
+    return llm_matmul_compute_with_kv_stride_float(
+            dst, srck, srcq, seqlen, embd, head, nr_past, embd / head, embd);
+}
+
+TaskSet llm_matmul_compute_with_kv_stride_float(
+        float* dst, const float* srck, const float* srcq, uint32_t seqlen,
+        uint32_t embd, uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride) {
     uint32_t sub_embd = embd / head;
     uint32_t length = nr_past + seqlen;
-    uint32_t line_stride = embd;
 
     auto task = [=](const TaskId& id) {
         for (uint32_t h = id.start; h < id.end; h++) {
             auto dst_head = dst + h * seqlen * (nr_past + seqlen);
-            auto srck_head = srck + h * sub_embd;
+            auto srck_head = srck + h * kv_head_stride;
             auto srcq_head = srcq + h * sub_embd;
             compute_src_offset_embd_matmul(
-                    srcq_head, embd, srck_head, embd, dst_head, seqlen, length,
-                    sub_embd);
+                    srcq_head, embd, srck_head, kv_row_stride, dst_head, seqlen,
+                    length, sub_embd);
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
 }
 
 TaskSet llm_head_batched_matmul_compute_float(
         float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
         uint32_t head, uint32_t nr_past) {
+    return llm_head_batched_matmul_kv_stride_float(
+            dst, v, qk, seqlen, embd, head, nr_past, embd / head, embd);
+}
+
+TaskSet llm_head_batched_matmul_kv_stride_float(
+        float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
+        uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride) {
     uint32_t sub_embd = embd / head;
     uint32_t length = nr_past + seqlen;
-    uint32_t line_stride = embd;
 
     auto task = [=](const TaskId& id) {
         for (uint32_t h = id.start; h < id.end; h++) {
             float* dst_head = dst + h * sub_embd;
-            const float* v_head = v + h * sub_embd;
+            const float* v_head = v + h * kv_head_stride;
             const float* qk_head = qk + h * seqlen * length;
             comput_matmul_with_dst_uncontinue(
-                    dst_head, embd, v_head, embd, qk_head, seqlen, length, sub_embd);
+                    dst_head, embd, v_head, kv_row_stride, qk_head, seqlen, length,
+                    sub_embd);
+        }
+    };
+    return TaskSet{{task, head, seqlen * length * sub_embd}};
+}
+
+TaskSet llm_flash_decode_float(
+        float* dst, const float* q, const float* k, const float* v, float scale,
+        uint32_t embd, uint32_t head, uint32_t length, uint32_t k_head_stride,
+        uint32_t v_head_stride, uint32_t kv_row_stride, void* workspace,
+        uint32_t size) {
+    uint32_t sub_embd = embd / head;
+    uint32_t nr_block = (length + FLASH_DECODE_BLOCK - 1) / FLASH_DECODE_BLOCK;
+    //! every block keeps its max score, the sum of the exp of the scores and
+    //! the v accumulated with the exp of the scores
+    uint32_t partial_stride = sub_embd + 2;
+    INFER_ASSERT(
+            head * nr_block * partial_stride * sizeof(float) <= size,
+            "workspace is not enough.");
+    float* partial = static_cast<float*>(workspace);
+    auto block_task = [=](const TaskId& id) {
+        //! the helpers take restrict pointers, so the qk and the scaled score
+        //! are in two buffers
+        float qk[FLASH_DECODE_BLOCK];
+        float score[FLASH_DECODE_BLOCK];
+        for (uint32_t i = id.start; i < id.end; i++) {
+            uint32_t h = i / nr_block;
+            uint32_t start = i % nr_block * FLASH_DECODE_BLOCK;
+            uint32_t len = std::min<uint32_t>(FLASH_DECODE_BLOCK, length - start);
+            const float* k_head = k + h * k_head_stride + start * kv_row_stride;
+            const float* v_head = v + h * v_head_stride + start * kv_row_stride;
+            compute_src_offset_embd_matmul(
+                    q + h * sub_embd, embd, k_head, kv_row_stride, qk, 1, len,
+                    sub_embd);
+            elemwise_vec_scale(len, qk, scale, score);
+            float* p_partial = partial + i * partial_stride;
+            p_partial[0] = reduce_max(len, score);
+            p_partial[1] = select_sub_max_and_reduce_sum(len, score, qk, p_partial[0]);
+            comput_matmul_with_dst_uncontinue(
+                    p_partial + 2, sub_embd, v_head, kv_row_stride, qk, 1, len,
+                    sub_embd);
+        }
+    };
+    auto reduce_task = [=](const TaskId& id) {
+        for (uint32_t h = id.start; h < id.end; h++) {
+            float* p_head = partial + h * nr_block * partial_stride;
+            float max = -INFINITY;
+            for (uint32_t b = 0; b < nr_block; b++) {
+                max = std::max(max, p_head[b * partial_stride]);
+            }
+            float sum = 0;
+            for (uint32_t b = 0; b < nr_block; b++) {
+                float* p_partial = p_head + b * partial_stride;
+                sum += p_partial[1] * exp(p_partial[0] - max);
+            }
+            //! rescale the v of every block to the global max and normalize it
+            float* p_dst = dst + h * sub_embd;
+            for (uint32_t b = 0; b < nr_block; b++) {
+                float* p_partial = p_head + b * partial_stride;
+                float rescale = exp(p_partial[0] - max) / sum;
+                if (b == 0) {
+                    elemwise_vec_scale(sub_embd, p_partial + 2, rescale, p_dst);
+                } else {
+                    for (uint32_t j = 0; j < sub_embd; j++) {
+                        p_dst[j] += p_partial[2 + j] * rescale;
+                    }
+                }
+            }
         }
     };
-    return TaskSet{{task, head}};
+    return TaskSet{
+            {block_task, head * nr_block, 2 * FLASH_DECODE_BLOCK * sub_embd},
+            {reduce_task, head, 2 * nr_block * sub_embd}};
 }
 
 }  // namespace opt
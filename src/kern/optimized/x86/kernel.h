@@ -21,6 +21,10 @@ TaskSet llm_elemwise_broadcast_dim0_src1_compute_float(
 TaskSet llm_rms_norm_compute_float(
         const float* src, float* dst, uint32_t seq_len, uint32_t embd, float eps);
 
+TaskSet llm_fused_norm_compute_float(
+        const float* src, float* dst, const float* weight, const float* bias,
+        void* q8_dst, uint32_t seq_len, uint32_t embd, float eps, bool rms);
+
 TaskSet llm_softmax_compute_float(
         const float* src, float* dst, uint32_t len_row, uint32_t col);
 
@@ -29,6 +33,14 @@ TaskSet llm_matmul_compute_int4_float(
         float* dst, const void* src0, const float* bias, const float* src1, uint32_t M,
         uint32_t N, uint32_t K, void* workspace, uint32_t size);
 
+TaskSet llm_matmul_compute_int4_q8_float(
+        float* dst, const void* src0, const float* bias, const void* q8_src1,
+        uint32_t M, uint32_t N, uint32_t K);
+
+TaskSet llm_matmul_epilogue_float(MatmulEpilogue epilogue);
+
+TaskSet llm_quantize_q8_float(const float* src, void* dst, uint32_t M, uint32_t K);
+
 size_t llm_matmul_get_workspace_float(
         uint32_t nr_thread, uint32_t M, uint32_t N, uint32_t K);
 
@@ -40,15 +52,40 @@ TaskSet llm_head_batched_matmul_compute_float(
         float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
         uint32_t head, uint32_t nr_past);
 
+TaskSet llm_matmul_compute_with_kv_stride_float(
+        float* dst, const float* srck, const float* srcq, uint32_t seqlen,
+        uint32_t embd, uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride);
+
+TaskSet llm_head_batched_matmul_kv_stride_float(
+        float* dst, const float* v, const float* qk, uint32_t seqlen, uint32_t embd,
+        uint32_t head, uint32_t nr_past, uint32_t kv_head_stride,
+        uint32_t kv_row_stride);
+
+TaskSet llm_flash_decode_float(
+        float* dst, const float* q, const float* k, const float* v, float scale,
+        uint32_t embd, uint32_t head, uint32_t length, uint32_t k_head_stride,
+        uint32_t v_head_stride, uint32_t kv_row_stride, void* workspace,
+        uint32_t size);
+
 PartialImplementKernel(ElemwiseFloat, llm_elemwise_compute_float);
 PartialImplementKernel(
         ElemwiseBroadcastDim0Src1Float, llm_elemwise_broadcast_dim0_src1_compute_float);
 PartialImplementKernel(RmsNormFloat, llm_rms_norm_compute_float);
+PartialImplementKernel(FusedNormFloat, llm_fused_norm_compute_float);
 PartialImplementKernel(EmbeddingGetInt4Float, llm_embedding_get_int4_float);
 PartialImplementKernel(MatmulInt4Float, llm_matmul_compute_int4_float);
+PartialImplementKernel(MatmulInt4Q8Float, llm_matmul_compute_int4_q8_float);
 PartialImplementKernel(
         MatmulWithHeadStrideFloat, llm_matmul_compute_with_head_stride_float);
 PartialImplementKernel(HeadBatchedMatmulFloat, llm_head_batched_matmul_compute_float);
+PartialImplementKernel(
+        MatmulWithKvStrideFloat, llm_matmul_compute_with_kv_stride_float);
+PartialImplementKernel(
+        HeadBatchedMatmulKvStrideFloat, llm_head_batched_matmul_kv_stride_float);
+PartialImplementKernel(FlashDecodeFloat, llm_flash_decode_float);
+PartialImplementKernel(MatmulEpilogueFloat, llm_matmul_epilogue_float);
+PartialImplementKernel(QuantizeQ8Float, llm_quantize_q8_float);
 PartialImplementSpace(MatmulInt4Float, llm_matmul_get_workspace_float);
 
 }  // namespace opt
@@ -132,7 +132,8 @@ inline float vec_vec_dot_q4_0(
 #if defined(__AVX2__)
 INFER_ATTRIBUTE_TARGET("avx2")
 inline float vec_vec_dot_q40_with_q80(
-        const int n, const void* __restrict vx, const void* __restrict vy) {
+        const int n, const void* __restrict vx, const void* __restrict vy,
+        const void* __restrict ahead = nullptr) {
     const int nb = n / QK80;
 
     assert(n % QK80 == 0);
@@ -146,6 +147,9 @@ inline float vec_vec_dot_q40_with_q80(
 
     // Main loop
     for (int i = 0; i < nb; ++i) {
+        if (ahead) {
+            INFER_PREFETCH_WEIGHT((const BlockQ40*)ahead + i);
+        }
         /* Compute combined scale for the block */
         const __m256 d = _mm256_mul_ps(
                 _mm256_broadcast_ss(&x[i].d), _mm256_broadcast_ss(&y[i].d));
@@ -176,7 +180,8 @@ inline float vec_vec_dot_q40_with_q80(
 #elif defined(__AVX__)
 INFER_ATTRIBUTE_TARGET("avx")
 inline float vec_vec_dot_q40_with_q80(
-        const int n, const void* __restrict vx, const void* __restrict vy) {
+        const int n, const void* __restrict vx, const void* __restrict vy,
+        const void* __restrict ahead = nullptr) {
     const int nb = n / QK80;
 
     assert(n % QK80 == 0);
@@ -189,6 +194,9 @@ inline float vec_vec_dot_q40_with_q80(
 
     // Main loop
     for (int i = 0; i < nb; ++i) {
+        if (ahead) {
+            INFER_PREFETCH_WEIGHT((const BlockQ40*)ahead + i);
+        }
         // Compute combined scale for the block
         const __m256 d = _mm256_mul_ps(
                 _mm256_broadcast_ss(&x[i].d), _mm256_broadcast_ss(&y[i].d));
@@ -233,7 +241,8 @@ inline float vec_vec_dot_q40_with_q80(
 #else
 INFER_ATTRIBUTE_TARGET("default")
 inline float vec_vec_dot_q40_with_q80(
-        const int n, const void* __restrict vx, const void* __restrict vy) {
+        const int n, const void* __restrict vx, const void* __restrict vy,
+        const void* __restrict ahead = nullptr) {
     const int nb = n / QK80;
     assert(n % QK80 == 0);
     assert(nb % 2 == 0);
@@ -243,6 +252,9 @@ inline float vec_vec_dot_q40_with_q80(
     // scalar
     float sumf = 0.0;
     for (int i = 0; i < nb; i++) {
+        if (ahead) {
+            INFER_PREFETCH_WEIGHT((const BlockQ40*)ahead + i);
+        }
         const float d0 = x[i].d;
         const float d1 = y[i].d;
 
@@ -814,6 +826,34 @@ inline void compute_src_offset_embd_matmul(
     }
 }
 
+//! one row of the head batched matmul with the head dim known at compile time,
+//! the accumulators of 64 columns stay in the registers, so every row of v is
+//! read once for 64 columns instead of once for 16 columns
+template <int SubEmbd>
+INFER_ATTRIBUTE_TARGET("avx2")
+inline void comput_matmul_row_with_head_dim(
+        float* __restrict p_dst, const float* __restrict srcv, int offset_v,
+        const float* __restrict p_qk, int length) {
+    static_assert(SubEmbd % 64 == 0, "the head dim is not a multiple of 64.");
+    for (int col = 0; col < SubEmbd; col += 64) {
+        __m256 sum[8];
+        for (int j = 0; j < 8; j++) {
+            sum[j] = _mm256_setzero_ps();
+        }
+        for (int k = 0; k < length; k++) {
+            auto p_v = srcv + k * offset_v + col;
+            __m256 qk = _mm256_set1_ps(p_qk[k]);
+            for (int j = 0; j < 8; j++) {
+                __m256 v = _mm256_loadu_ps(p_v + j * 8);
+                sum[j] = _mm256_add_ps(_mm256_mul_ps(v, qk), sum[j]);
+            }
+        }
+        for (int j = 0; j < 8; j++) {
+            _mm256_storeu_ps(p_dst + col + j * 8, sum[j]);
+        }
+    }
+}
+
 //! because most case, the seqlen is 1, so we don't pack the srcv data to get
 //! the best memory access. this optimize is only reuse the srcqk data and the
 //! srcv data to compute the near dst data.
@@ -886,6 +926,15 @@ inline void comput_matmul_with_dst_uncontinue(
     for (; row < seqlen; row++) {
         auto p_qk = srcqk + row * length;
         auto p_dst = dst + row * offset_dst;
+        //! the common head dims
+        if (sub_embd == 64) {
+            comput_matmul_row_with_head_dim<64>(p_dst, srcv, offset_v, p_qk, length);
+            continue;
+        }
+        if (sub_embd == 128) {
+            comput_matmul_row_with_head_dim<128>(p_dst, srcv, offset_v, p_qk, length);
+            continue;
+        }
         uint32_t len = 0;
         for (; len + 15 < sub_embd; len += 16) {
             auto p_v = srcv + len;
@@ -67,6 +67,17 @@ public:
         }
     }
 
+    //! the tokens and the scores read from the metadata of the model file
+    void load_vocab(
+            const std::vector<Token>& tokens, const std::vector<float>& scores) {
+        id_to_token.resize(tokens.size());
+        for (size_t i = 0; i < tokens.size(); i++) {
+            token_to_id[tokens[i]] = i;
+            id_to_token[i].tok = tokens[i];
+            id_to_token[i].score = i < scores.size() ? scores[i] : 0;
+        }
+    }
+
     Id map_to_id(const Token& str) { return token_to_id[str]; }
 
     Token unmap_to_token(Id id) { return id_to_token[id].tok; }
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "fixture.h"
+
+using namespace inferllm;
+using namespace test;
+
+namespace {
+std::atomic<bool> g_count_alloc{false};
+std::atomic<size_t> g_nr_alloc{0};
+}  // namespace
+
+void* operator new(size_t size) {
+    if (g_count_alloc) {
+        g_nr_alloc++;
+    }
+    void* ptr = malloc(size);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+//! the ops for one token, such as the shape deduce, the accessors, the memory of
+//! the activations and the dispatch of the kernels, should not allocate
+TEST_F(CPU, TestNoAllocationPerToken) {
+    auto input = std::make_shared<Tensor>(device(), "input");
+    input->set_shape({1, 64}, DType::Float32);
+    Elemwise silu(device(), "silu", OpIOs{input}, ElemMode::Silu);
+    Elemwise gelu(device(), "gelu", OpIOs{silu.outputs()[0]}, ElemMode::Gelu);
+    std::vector<OpBase*> oprs = {&silu, &gelu};
+    //! the output is used by the next token
+    gelu.outputs()[0]->add_user();
+
+    auto token = [&]() {
+        input->resume_user_count();
+        input->prepare_data();
+        size_t nr_elem = 0;
+        for (auto opr : oprs) {
+            opr->deduce_output_shape();
+            opr->pre_execute();
+            opr->execute(nullptr, 0);
+            for (auto& in : opr->inputs()) {
+                nr_elem += in->shape()[0] * in->stride()[0];
+            }
+            for (auto& out : opr->outputs()) {
+                nr_elem += out->shape()[1];
+            }
+            opr->end_execute();
+        }
+        gelu.outputs()[0]->decrease_curr_user_count();
+        return nr_elem;
+    };
+    //! the first token fills the memory pool
+    token();
+    g_nr_alloc = 0;
+    g_count_alloc = true;
+    size_t nr_elem = 0;
+    for (int i = 0; i < 10; i++) {
+        nr_elem += token();
+    }
+    g_count_alloc = false;
+    ASSERT_EQ(nr_elem, 10u * 256u);
+    ASSERT_EQ(g_nr_alloc, 0u);
+
+    //! the norm, the matmul and the attention of a layer, the decode of one
+    //! sequence and the batched decode of two sequences
+    uint32_t embd = 64, head = 4, ctx = 32;
+    auto hidden = std::make_shared<Tensor>(device(), "hidden");
+    LayerNorm norm(device(), "norm", OpIOs{hidden}, embd);
+    MatMul matmul(device(), "matmul", OpIOs{norm.outputs()[0]}, {embd, embd});
+    LlamaAttention attention(
+            device(), "attention", OpIOs{matmul.outputs()[0]}, embd, embd / head, ctx,
+            head, 0, DType::Float32);
+    std::vector<OpBase*> layer = {&norm, &matmul, &attention};
+    for (auto opr : layer) {
+        for (auto& weight : opr->weights()) {
+            weight->set_dtype(DType::Float32);
+            weight->prepare_data();
+            std::fill_n(weight->ptr<float>(), weight->length(), 0.01f);
+        }
+    }
+    attention.outputs()[0]->add_user();
+    std::vector<uint8_t> workspace_data;
+    WorkSpace workspace;
+    //! the tokens in the kv cache of the sequence 0
+    uint32_t nr_past = 0;
+
+    auto decode = [&](const std::vector<uint32_t>& seqs) {
+        size_t nr_row = std::max<size_t>(seqs.size(), 1);
+        hidden->set_shape({nr_row, embd}, DType::Float32);
+        hidden->resume_user_count();
+        hidden->prepare_data();
+        std::fill_n(hidden->ptr<float>(), hidden->length(), 1.f);
+        attention.set_batch_seqs(seqs);
+        for (auto opr : layer) {
+            opr->deduce_output_shape();
+            size_t size = opr->get_workspace_in_byte();
+            if (size > workspace_data.size()) {
+                workspace_data.resize(size);
+            }
+            workspace.set_memory(workspace_data.data(), workspace_data.size());
+            opr->pre_execute();
+            opr->execute(&workspace, nr_past);
+            opr->end_execute();
+        }
+        attention.outputs()[0]->decrease_curr_user_count();
+        nr_past++;
+    };
+    //! the first tokens fill the memory pool and the kv caches
+    std::vector<uint32_t> single, batch = {0, 1};
+    attention.reset_seq(1);
+    decode(single);
+    decode(batch);
+    g_nr_alloc = 0;
+    g_count_alloc = true;
+    for (int i = 0; i < 10; i++) {
+        decode(single);
+        decode(batch);
+    }
+    g_count_alloc = false;
+    ASSERT_EQ(g_nr_alloc, 0u);
+}
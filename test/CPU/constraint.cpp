@@ -0,0 +1,151 @@
+#include <cmath>
+
+#include "core/constraint.h"
+#include "fixture.h"
+
+using namespace inferllm;
+using namespace test;
+
+namespace {
+//! feed the text to the matcher, return false at the first rejected byte
+bool feed(Matcher& matcher, const std::string& text) {
+    for (char c : text) {
+        if (!matcher.advance(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! 0: the text is rejected, 1: it is a prefix of the grammar, 2: it is complete
+template <typename MakeMatcher>
+int match(MakeMatcher make, const std::string& text) {
+    auto matcher = make();
+    if (!feed(*matcher, text)) {
+        return 0;
+    }
+    return matcher->accepted() ? 2 : 1;
+}
+
+Vocab make_vocab(const std::vector<std::string>& tokens) {
+    Vocab vocab;
+    vocab.id_to_token.resize(tokens.size());
+    for (size_t i = 0; i < tokens.size(); i++) {
+        vocab.token_to_id[tokens[i]] = i;
+        vocab.id_to_token[i].tok = tokens[i];
+        vocab.id_to_token[i].score = 0;
+    }
+    return vocab;
+}
+}  // namespace
+
+TEST_F(CPU, TestRegexMatcher) {
+    auto regex = [](const std::string& pattern) {
+        auto compiled = std::make_shared<Regex>(pattern);
+        return [compiled]() { return make_unique<RegexMatcher>(compiled); };
+    };
+    auto date = regex("\\d{4}-\\d\\d-\\d\\d");
+    ASSERT_EQ(match(date, ""), 1);
+    ASSERT_EQ(match(date, "2024-0"), 1);
+    ASSERT_EQ(match(date, "2024-01-31"), 2);
+    ASSERT_EQ(match(date, "2024-01-311"), 0);
+    ASSERT_EQ(match(date, "202a"), 0);
+
+    auto words = regex("(yes|no)( [a-c]+)*\\.?");
+    ASSERT_EQ(match(words, "y"), 1);
+    ASSERT_EQ(match(words, "yes"), 2);
+    ASSERT_EQ(match(words, "yes ab"), 2);
+    ASSERT_EQ(match(words, "no "), 1);
+    ASSERT_EQ(match(words, "no cab."), 2);
+    ASSERT_EQ(match(words, "no d"), 0);
+    ASSERT_EQ(match(words, "yes."), 2);
+    ASSERT_EQ(match(words, "yes.."), 0);
+
+    auto repeat = regex("[^x]{2,3}x+");
+    ASSERT_EQ(match(repeat, "ax"), 0);
+    ASSERT_EQ(match(repeat, "abx"), 2);
+    ASSERT_EQ(match(repeat, "abcxx"), 2);
+    ASSERT_EQ(match(repeat, "abcd"), 0);
+}
+
+TEST_F(CPU, TestJsonMatcher) {
+    auto json = []() { return make_unique<JsonMatcher>(); };
+    ASSERT_EQ(match(json, ""), 1);
+    ASSERT_EQ(match(json, " {"), 1);
+    ASSERT_EQ(match(json, "{}"), 2);
+    ASSERT_EQ(match(json, "[1]"), 0);
+    ASSERT_EQ(match(json, "{\"a\": [1, -2.5e+3, {\"b\": [true, null]}], \"c\": {}}"), 2);
+    ASSERT_EQ(match(json, "{\"a\": [1, {\"b\": 0}"), 1);
+    ASSERT_EQ(match(json, "{\"a\": [1}"), 0);
+    ASSERT_EQ(match(json, "{\"a\": {]"), 0);
+    ASSERT_EQ(match(json, "{\"a\" 1}"), 0);
+    ASSERT_EQ(match(json, "{\"a\": 01}"), 0);
+    ASSERT_EQ(match(json, "{\"a\": tru"), 1);
+    ASSERT_EQ(match(json, "{\"a\": trux"), 0);
+    //! nothing follows the root object
+    ASSERT_EQ(match(json, "{} "), 0);
+
+    //! the strings with the escapes, the braces in a string are not nested
+    ASSERT_EQ(match(json, "{\"k\\\"}\": \"\\\\ \\n \\u00e9 {[\"}"), 2);
+    ASSERT_EQ(match(json, "{\"a\": \"\\u00g"), 0);
+    ASSERT_EQ(match(json, "{\"a\": \"\\q\"}"), 0);
+    ASSERT_EQ(match(json, "{\"a\": \"\n\"}"), 0);
+}
+
+//! the end token is only sampled when the text is complete, and the mask of
+//! every state is the same as checking every token of the vocab
+TEST_F(CPU, TestTokenConstraint) {
+    auto vocab = make_vocab(
+            {"<unk>", "<s>", "</s>", "", "{", "}", "{\"", "\"", "a", "ab", "\":",
+             " ", ": ", "1", "12", "true", "tr", "\"}", ",", "[", "]", "x"});
+    Vocab::Id end = 2;
+    auto constraint = make_constraint("json", "", vocab);
+    auto matcher = make_unique<JsonMatcher>();
+    std::vector<std::string> text = {"{\"", "ab", "\":", " ", "[",  "12", ",",
+                                     "true", "]", ",",  "\"", "a", "\":", "1", "}"};
+    std::vector<float> logits(vocab.id_to_token.size());
+    for (size_t step = 0; step <= text.size(); step++) {
+        std::fill(logits.begin(), logits.end(), 1.f);
+        constraint->apply(logits.data(), end);
+        for (size_t id = 0; id < logits.size(); id++) {
+            if (static_cast<Vocab::Id>(id) == end) {
+                ASSERT_EQ(std::isinf(logits[id]), !matcher->accepted());
+                continue;
+            }
+            auto& token = vocab.id_to_token[id].tok;
+            auto next = matcher->clone();
+            bool valid = !token.empty() && feed(*next, token);
+            ASSERT_EQ(!std::isinf(logits[id]), valid) << token << " at " << step;
+        }
+        if (step < text.size()) {
+            constraint->accept(vocab.token_to_id[text[step]]);
+            ASSERT_TRUE(feed(*matcher, text[step]));
+        }
+    }
+    ASSERT_TRUE(matcher->accepted());
+
+    //! the reset and the cloned constraints restart from the empty text
+    auto clone = constraint->clone();
+    clone->reset();
+    constraint->reset();
+    for (auto c : {constraint.get(), clone.get()}) {
+        std::fill(logits.begin(), logits.end(), 1.f);
+        c->apply(logits.data(), end);
+        ASSERT_TRUE(std::isinf(logits[end]));
+        ASSERT_FALSE(std::isinf(logits[vocab.token_to_id["{"]]));
+        ASSERT_TRUE(std::isinf(logits[vocab.token_to_id["}"]]));
+    }
+
+    //! the regex allows the end token after "ab" and "abab" only
+    auto regex = make_constraint("regex", "(ab){1,2}", vocab);
+    for (int step = 0; step < 3; step++) {
+        std::fill(logits.begin(), logits.end(), 1.f);
+        regex->apply(logits.data(), end);
+        ASSERT_EQ(std::isinf(logits[end]), step == 0);
+        ASSERT_EQ(std::isinf(logits[vocab.token_to_id["ab"]]), step == 2);
+        ASSERT_EQ(std::isinf(logits[vocab.token_to_id["a"]]), step == 2);
+        if (step < 2) {
+            regex->accept(vocab.token_to_id["ab"]);
+        }
+    }
+}
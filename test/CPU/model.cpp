@@ -0,0 +1,373 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <random>
+
+#include "core/model_imp.h"
+#include "fixture.h"
+#include "model.h"
+
+using namespace inferllm;
+using namespace test;
+
+namespace {
+//! write a llama2 model of random float weights to a temporary file, the vocab
+//! is the letters, the space and some words, so any lowercase text tokenizes
+std::string write_tiny_model() {
+    int32_t embd = 64, head = 4, layer = 2, mult = 32;
+    std::vector<std::string> words = {"<unk>", "<s>", "</s>"};
+    for (char c = 'a'; c <= 'z'; c++) {
+        words.push_back(std::string(1, c));
+    }
+    for (auto word : {" ", "ab", "cd", "the", "he"}) {
+        words.push_back(word);
+    }
+    int32_t nr_vocab = words.size();
+    int32_t nff = ((2 * (4 * embd) / 3 + mult - 1) / mult) * mult;
+
+    std::string data;
+    auto put = [&data](const void* ptr, size_t len) {
+        data.append(static_cast<const char*>(ptr), len);
+    };
+    auto put_i32 = [&put](int32_t value) { put(&value, sizeof(value)); };
+    std::string vocab;
+    for (auto& word : words) {
+        uint32_t len = word.size();
+        vocab.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        vocab += word;
+    }
+    int32_t param_offset = 6 * sizeof(int32_t), param_length = 5 * sizeof(int32_t);
+    int32_t vocab_offset = param_offset + param_length;
+    put_i32(0x123456);
+    for (int32_t value :
+         {param_offset, param_length, vocab_offset, int32_t(vocab.size()),
+          vocab_offset + int32_t(vocab.size())}) {
+        put_i32(value);
+    }
+    for (int32_t value : {embd, head, layer, mult, nr_vocab}) {
+        put_i32(value);
+    }
+    data += vocab;
+
+    std::mt19937 gen(0);
+    auto tensor = [&](const std::string& name, std::vector<int32_t> shape,
+                      float scale) {
+        put_i32(shape.size());
+        put_i32(name.size());
+        put_i32(0);
+        size_t nr = 1;
+        for (auto dim : shape) {
+            put_i32(dim);
+            nr *= dim;
+        }
+        data += name;
+        //! the norm weights are around one
+        bool norm = name.find("norm") != std::string::npos;
+        std::normal_distribution<float> dist(norm ? 1.f : 0.f, scale);
+        for (size_t i = 0; i < nr; i++) {
+            float value = dist(gen);
+            put(&value, sizeof(value));
+        }
+    };
+    tensor("model.embed_tokens.weight", {nr_vocab, embd}, 1.f);
+    for (int32_t l = 0; l < layer; l++) {
+        std::string prefix = "model.layers." + std::to_string(l) + ".";
+        tensor(prefix + "input_layernorm.weight", {embd}, 0.05f);
+        for (auto w : {"q", "k", "v", "o"}) {
+            tensor(prefix + "self_attn." + w + "_proj.weight", {embd, embd}, 0.1f);
+        }
+        tensor(prefix + "post_attention_layernorm.weight", {embd}, 0.05f);
+        tensor(prefix + "mlp.up_proj.weight", {nff, embd}, 0.1f);
+        tensor(prefix + "mlp.gate_proj.weight", {nff, embd}, 0.1f);
+        tensor(prefix + "mlp.down_proj.weight", {embd, nff}, 0.1f);
+    }
+    tensor("model.norm.weight", {embd}, 0.05f);
+    tensor("lm_head.weight", {nr_vocab, embd}, 0.5f);
+
+    std::string path = "/tmp/inferllm_tiny_" + std::to_string(getpid()) + ".bin";
+    FILE* file = fopen(path.c_str(), "wb");
+    INFER_ASSERT(file, "failed to write the tiny model.");
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+    return path;
+}
+
+std::unique_ptr<Model> load_tiny_model(const std::string& path, ModelConfig config) {
+    config.device_type = "CPU";
+    config.nr_thread = 2;
+    config.enable_mmap = false;
+    config.nr_ctx = 128;
+    std::unique_ptr<Model> model(new Model(config, "llama2"));
+    model->load(path);
+    //! greedy decode with the end token "</s>"
+    model->init(1, 1.f, 1.f, 1.f, 8, 0, 2);
+    return model;
+}
+
+class TinyModel : public CPU {
+public:
+    void SetUp() override {
+        CPU::SetUp();
+        m_path = write_tiny_model();
+    }
+    void TearDown() override {
+        remove(m_path.c_str());
+        CPU::TearDown();
+    }
+
+protected:
+    std::string m_path;
+};
+}  // namespace
+
+//! the execution of a longer text after a short one allocates the tensors with
+//! the longer shape, so the embedding is the same as the one of a new model
+TEST_F(TinyModel, TestEmbeddingLength) {
+    std::string text = "the cat sat on the mat and he ate the cd by the door";
+    auto model = load_tiny_model(m_path, ModelConfig());
+    for (int32_t layer : {0, -1}) {
+        model->embedding({"ab"}, "mean", layer);
+        auto embd = model->embedding({text}, "mean", layer)[0];
+        auto expect = load_tiny_model(m_path, ModelConfig())
+                              ->embedding({text}, "mean", layer)[0];
+        ASSERT_EQ(embd.size(), expect.size());
+        for (size_t i = 0; i < embd.size(); i++) {
+            ASSERT_NEAR(embd[i], expect[i], 1e-4);
+        }
+    }
+    //! the generation after the embedding reads the whole graph again
+    int token;
+    auto text0 = model->decode(text, token);
+    auto expect = load_tiny_model(m_path, ModelConfig());
+    ASSERT_EQ(text0, expect->decode(text, token));
+}
+
+//! the log-probabilities of score are the ones of the logits of decode and
+//! decode_iter for the same tokens, and scoring doesn't change the next decode
+TEST_F(TinyModel, TestScoreMatchDecode) {
+    ModelConfig config;
+    config.device_type = "CPU";
+    config.nr_thread = 2;
+    config.enable_mmap = false;
+    config.nr_ctx = 128;
+    ModelImp model(config, "llama2");
+    model.load(m_path);
+    model.init(1, 1.f, 1.f, 1.f, 8, 0, 2);
+    auto log_softmax = [](const std::vector<float>& logits, int32_t token) {
+        float max = *std::max_element(logits.begin(), logits.end());
+        double sum = 0;
+        for (float logit : logits) {
+            sum += exp(logit - max);
+        }
+        return logits[token] - max - log(sum);
+    };
+
+    //! "<s>the cd" in the vocab of the tiny model
+    std::vector<Vocab::Id> tokens = {1, 32, 29, 31};
+    std::vector<float> expect;
+    int token;
+    model.prefill("");
+    model.decode("the cd", token);
+    expect.push_back(log_softmax(model.logits(), token));
+    tokens.push_back(token);
+    for (int i = 0; i < 8; i++) {
+        model.decode_iter(token);
+        expect.push_back(log_softmax(model.logits(), token));
+        tokens.push_back(token);
+    }
+
+    size_t nr_prompt = 4;
+    for (uint32_t chunk : {1u, 3u, 512u}) {
+        auto scores = model.score(tokens, chunk);
+        ASSERT_EQ(scores.size(), tokens.size() - 1);
+        for (size_t i = 0; i < expect.size(); i++) {
+            ASSERT_NEAR(scores[nr_prompt - 1 + i], expect[i], 1e-4)
+                    << "chunk " << chunk;
+        }
+    }
+
+    auto answer = model.decode("he ate", token);
+    ModelImp fresh(config, "llama2");
+    fresh.load(m_path);
+    fresh.init(1, 1.f, 1.f, 1.f, 8, 0, 2);
+    int expect_token;
+    ASSERT_EQ(answer, fresh.decode("he ate", expect_token));
+    ASSERT_EQ(token, expect_token);
+}
+
+//! every generation restarts the grammar, on the serial, the batched and the
+//! n-best paths
+TEST_F(TinyModel, TestConstraintGeneration) {
+    auto model = load_tiny_model(m_path, ModelConfig());
+    model->set_constraint("regex", "the (cat|dog)");
+    auto generate = [&model](const std::string& prompt) {
+        int token;
+        std::string text = model->decode(prompt, token);
+        for (int i = 0; i < 20 && token != 2; i++) {
+            text += model->decode_iter(token);
+        }
+        return token == 2 ? text.substr(0, text.size() - 4) : text;
+    };
+    for (auto prompt : {"a b", "he ate"}) {
+        model->reset_token();
+        auto text = generate(prompt);
+        ASSERT_TRUE(text == "the cat" || text == "the dog") << text;
+    }
+    std::vector<std::string> texts(3);
+    for (size_t i = 0; i < texts.size(); i++) {
+        model->submit("cd ab", 20, [&texts, i](int32_t, const std::string& text, bool) {
+            texts[i] += text;
+        });
+    }
+    model->wait_all();
+    for (auto& text : texts) {
+        ASSERT_TRUE(text == "the cat" || text == "the dog") << text;
+    }
+    for (auto& candidate : model->beam_search("the", 3, 20)) {
+        ASSERT_TRUE(candidate.text == "the cat" || candidate.text == "the dog")
+                << candidate.text;
+    }
+    for (auto& candidate : model->sample_n("the", 3, 20)) {
+        ASSERT_TRUE(candidate.text == "the cat" || candidate.text == "the dog")
+                << candidate.text;
+    }
+
+    //! the submitted requests keep their constraint when it is changed
+    for (size_t i = 0; i < texts.size(); i++) {
+        texts[i].clear();
+        model->submit("cd ab", 20, [&texts, i](int32_t, const std::string& text, bool) {
+            texts[i] += text;
+        });
+    }
+    model->set_constraint("");
+    model->wait_all();
+    for (auto& text : texts) {
+        ASSERT_TRUE(text == "the cat" || text == "the dog") << text;
+    }
+}
+
+//! the prompt prefilled by chunks and the prompts decoded together in the batched
+//! steps give the same logits as the whole prompt of the serial decode
+TEST_F(TinyModel, TestChunkedAndBatched) {
+    std::vector<std::string> prompts = {
+            "the cat sat on the mat", "he ate", "ab cd ab cd the cat and the dog"};
+    auto serial = load_tiny_model(m_path, ModelConfig());
+    auto generate = [](Model* model, const std::string& prompt) {
+        int token;
+        model->reset_token();
+        std::string text = model->decode(prompt, token);
+        for (int i = 1; i < 12 && token != 2; i++) {
+            text += model->decode_iter(token);
+        }
+        return token == 2 ? text.substr(0, text.size() - 4) : text;
+    };
+    std::vector<std::string> expects;
+    for (auto& prompt : prompts) {
+        expects.push_back(generate(serial.get(), prompt));
+    }
+
+    ModelConfig config;
+    config.prefill_chunk = 3;
+    auto chunked = load_tiny_model(m_path, config);
+    std::string text = "the cat sat on the mat and he ate the cd by the door";
+    auto expect = serial->score(text);
+    for (uint32_t chunk : {1u, 4u, 7u}) {
+        auto scores = serial->score(text, chunk);
+        ASSERT_EQ(scores.size(), expect.size());
+        for (size_t i = 0; i < scores.size(); i++) {
+            ASSERT_NEAR(scores[i], expect[i], 1e-4) << "chunk " << chunk;
+        }
+    }
+    for (size_t i = 0; i < prompts.size(); i++) {
+        ASSERT_EQ(generate(chunked.get(), prompts[i]), expects[i]);
+    }
+
+    //! the prompts are prefilled by chunks while the others are decoding
+    std::vector<std::string> texts(prompts.size());
+    for (size_t i = 0; i < prompts.size(); i++) {
+        chunked->submit(
+                prompts[i], 12, [&texts, i](int32_t, const std::string& text, bool) {
+                    texts[i] += text;
+                });
+    }
+    chunked->wait_all();
+    for (size_t i = 0; i < prompts.size(); i++) {
+        ASSERT_EQ(texts[i], expects[i]) << prompts[i];
+    }
+}
+
+//! the prompt which doesn't fit the context is rejected with the reason, on the
+//! batched and the serial paths
+TEST_F(TinyModel, TestRejectedPrompt) {
+    auto model = load_tiny_model(m_path, ModelConfig());
+    std::string prompt;
+    for (int i = 0; i < 64; i++) {
+        prompt += "a ";
+    }
+    for (bool reset : {true, false}) {
+        std::vector<int32_t> tokens;
+        std::string error;
+        model->submit(
+                prompt, 8,
+                [&](int32_t token, const std::string& text, bool finished) {
+                    tokens.push_back(token);
+                    if (finished) {
+                        error = text;
+                    }
+                },
+                reset);
+        model->wait_all();
+        ASSERT_EQ(tokens, std::vector<int32_t>{REJECTED_TOKEN});
+        ASSERT_NE(error.find("exceeds"), std::string::npos) << error;
+    }
+    auto stream = model->submit_stream(prompt, 8);
+    model->wait_all();
+    std::string text;
+    ASSERT_FALSE(stream->pop(text));
+    ASSERT_TRUE(stream->finished());
+    ASSERT_FALSE(stream->error().empty());
+
+    //! the model still generates after the rejection
+    int token;
+    model->reset_token();
+    ASSERT_FALSE(model->decode("the cat", token).empty());
+}
+
+//! the worker forked from the prepared model starts its threads again and
+//! generates the same tokens as the parent
+TEST_F(TinyModel, TestForkWorker) {
+    auto model = load_tiny_model(m_path, ModelConfig());
+    auto generate = [&model]() {
+        int token;
+        model->reset_token();
+        std::string text = model->decode("the cat sat on the mat", token);
+        for (int i = 1; i < 12 && token != 2; i++) {
+            text += model->decode_iter(token);
+        }
+        return text;
+    };
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    int32_t pid = model->fork_worker();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        close(fds[0]);
+        std::string text = generate();
+        bool written = write(fds[1], text.data(), text.size()) ==
+                       static_cast<ssize_t>(text.size());
+        close(fds[1]);
+        _exit(written ? 0 : 1);
+    }
+    close(fds[1]);
+    std::string child;
+    char buf[256];
+    for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0;) {
+        child.append(buf, n);
+    }
+    close(fds[0]);
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    ASSERT_FALSE(child.empty());
+    ASSERT_EQ(generate(), child);
+}
@@ -1,5 +1,19 @@
 
+#include <numeric>
+#include <thread>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include "checker.h"
+#include "core/gguf.h"
+#include "core/numa.h"
+#include "core/pass.h"
+#include "core/pipeline.h"
+#include "core/weight_segment.h"
 #include "fixture.h"
 
 using namespace std;
@@ -112,3 +126,643 @@ TEST_F(CPU, TestGlm2MultiQueryAttention) {
         }
     }
 }
+
+//! the split decode attention of both the kv layouts should be the same as the
+//! attention computed by q*kT, scale, softmax and v
+TEST_F(CPU, TestFlashDecode) {
+    std::mt19937 gen(0);
+    std::normal_distribution<float> dist(0.f, 1.f);
+    for (uint32_t head : {4, 8, 16}) {
+        for (uint32_t length : {1, 64, 200}) {
+            uint32_t embd = 512;
+            uint32_t nr_past = length - 1;
+            std::vector<float> q(embd), k(length * embd), v(length * embd);
+            for (auto& data : {&q, &k, &v}) {
+                for (auto& value : *data) {
+                    value = dist(gen);
+                }
+            }
+            float scale = 1.0f / sqrt(float(embd) / head);
+            std::vector<float> qk(head * length), expect(embd);
+            auto naive = naive_device()->kernel();
+            naive->operator()<KernelID::MatmulWithHeadStrideFloat>(
+                    qk.data(), k.data(), q.data(), 1u, embd, head, nr_past);
+            naive->operator()<KernelID::ScaleDiagMaskFloat>(
+                    qk.data(), qk.data(), scale, nr_past, 1u, head);
+            naive->operator()<KernelID::SoftmaxFloat>(
+                    qk.data(), qk.data(), head, length);
+            naive->operator()<KernelID::HeadBatchedMatmulFloat>(
+                    expect.data(), v.data(), qk.data(), 1u, embd, head, nr_past);
+            //! all the cpu devices run the optimized kernels, check the product
+            //! of the scores and v with the plain loops
+            for (uint32_t i = 0; i < embd; i++) {
+                uint32_t h = i / (embd / head);
+                float sum = 0;
+                for (uint32_t j = 0; j < length; j++) {
+                    sum += qk[h * length + j] * v[j * embd + i];
+                }
+                ASSERT_NEAR(expect[i], sum, 1e-4);
+            }
+
+            auto kernel = device()->kernel();
+            std::vector<float> workspace(
+                    kernel->get_workspace<KernelID::FlashDecodeFloat>(
+                            embd, head, length) /
+                    sizeof(float));
+            //! the row layout, and the head major layout with the different
+            //! capacity of k and v
+            uint32_t sub_embd = embd / head;
+            std::vector<float> hk(head * (length + 3) * sub_embd),
+                    hv(head * (length + 5) * sub_embd);
+            kernel->operator()<KernelID::KvStoreFloat>(
+                    hk.data(), k.data(), length, embd, head, (length + 3) * sub_embd,
+                    sub_embd);
+            kernel->operator()<KernelID::KvStoreFloat>(
+                    hv.data(), v.data(), length, embd, head, (length + 5) * sub_embd,
+                    sub_embd);
+            for (bool head_major : {false, true}) {
+                std::vector<float> out(embd);
+                kernel->operator()<KernelID::FlashDecodeFloat>(
+                        out.data(), q.data(), head_major ? hk.data() : k.data(),
+                        head_major ? hv.data() : v.data(), scale, embd, head, length,
+                        head_major ? (length + 3) * sub_embd : sub_embd,
+                        head_major ? (length + 5) * sub_embd : sub_embd,
+                        head_major ? sub_embd : embd,
+                        static_cast<void*>(workspace.data()),
+                        workspace.size() * sizeof(float));
+                for (uint32_t i = 0; i < embd; i++) {
+                    ASSERT_NEAR(out[i], expect[i], 1e-4);
+                }
+            }
+        }
+    }
+}
+
+TEST_F(CPU, TestFusedNorm) {
+    std::mt19937 gen(0);
+    std::normal_distribution<float> dist(0.f, 1.f);
+    uint32_t seqlen = 3, embd = 256;
+    std::vector<float> src(seqlen * embd), weight(embd), bias(embd);
+    for (auto& data : {&src, &weight, &bias}) {
+        for (auto& value : *data) {
+            value = dist(gen);
+        }
+    }
+    uint32_t q8_stride =
+            embd * dtype_in_byte(DType::Int8) / dtype_block_size(DType::Int8);
+    for (bool rms : {true, false}) {
+        std::vector<float> expect(seqlen * embd);
+        auto naive = naive_device()->kernel();
+        if (rms) {
+            naive->operator()<KernelID::RmsNormFloat>(
+                    src.data(), expect.data(), seqlen, embd, 1e-5f);
+        } else {
+            naive->operator()<KernelID::NormFloat>(
+                    src.data(), expect.data(), seqlen, embd, 1e-5f);
+        }
+        naive->operator()<KernelID::ElemwiseBroadcastDim0Src1Float>(
+                expect.data(), weight.data(), expect.data(), seqlen, embd,
+                ElemMode::Mul);
+        naive->operator()<KernelID::ElemwiseBroadcastDim0Src1Float>(
+                expect.data(), bias.data(), expect.data(), seqlen, embd,
+                ElemMode::Add);
+
+        std::vector<float> out(seqlen * embd);
+        std::vector<uint8_t> q8(seqlen * q8_stride);
+        device()->kernel()->operator()<KernelID::FusedNormFloat>(
+                src.data(), out.data(), weight.data(), bias.data(),
+                static_cast<void*>(q8.data()), seqlen, embd, 1e-5f, rms);
+        for (uint32_t m = 0; m < seqlen; m++) {
+            auto blocks = reinterpret_cast<BlockQ80*>(q8.data() + m * q8_stride);
+            for (uint32_t i = 0; i < embd; i++) {
+                uint32_t index = m * embd + i;
+                ASSERT_NEAR(out[index], expect[index], 1e-4);
+                auto& block = blocks[i / QK80];
+                ASSERT_NEAR(block.qs[i % QK80] * block.d, out[index], block.d);
+            }
+        }
+    }
+}
+
+TEST_F(CPU, TestMatmulEpilogue) {
+    std::mt19937 gen(0);
+    std::normal_distribution<float> dist(0.f, 1.f);
+    uint32_t M = 3, N = 96, K = 64;
+    std::vector<float> src(M * K), weight(N * K), bias(N), residual(M * N);
+    for (auto& data : {&src, &weight, &bias, &residual}) {
+        for (auto& value : *data) {
+            value = dist(gen);
+        }
+    }
+    for (ElemMode mode : {ElemMode::Silu, ElemMode::Gelu}) {
+        std::vector<float> expect(M * N);
+        auto naive = naive_device()->kernel();
+        naive->operator()<KernelID::MatmulFloatFloat>(
+                expect.data(), weight.data(), bias.data(), src.data(), M, N, K,
+                static_cast<void*>(nullptr), 0u);
+        naive->operator()<KernelID::ElemwiseFloat>(
+                InData<float>{expect.data()}, expect.data(), expect.size(), mode);
+        for (size_t i = 0; i < expect.size(); i++) {
+            expect[i] += residual[i] * 2.f;
+        }
+
+        std::vector<float> out(M * N);
+        MatmulEpilogue epilogue;
+        epilogue.dst = out.data();
+        epilogue.M = M;
+        epilogue.N = N;
+        epilogue.activate = true;
+        epilogue.act_mode = mode;
+        epilogue.residual = residual.data();
+        epilogue.residual_scale = 2.f;
+        device()->kernel()->matmul_with_epilogue<KernelID::MatmulFloatFloat>(
+                epilogue, out.data(), weight.data(), bias.data(), src.data(), M, N, K,
+                static_cast<void*>(nullptr), 0u);
+        for (size_t i = 0; i < out.size(); i++) {
+            ASSERT_NEAR(out[i], expect[i], 1e-3);
+        }
+    }
+}
+
+TEST_F(CPU, TestReshapeView) {
+    std::mt19937 gen(0);
+    std::normal_distribution<float> dist(0.f, 1.f);
+    std::vector<float> src(2 * 32);
+    for (auto& value : src) {
+        value = dist(gen);
+    }
+    auto input = std::make_shared<Tensor>(device(), "input");
+    input->set_shape({2, 32}, DType::Float32);
+    input->set_shared_memory(src.data(), src.size() * sizeof(float));
+    Elemwise silu(device(), "silu", OpIOs{input}, ElemMode::Silu);
+    Reshape reshape(device(), "reshape", OpIOs{silu.outputs()[0]}, {-1});
+    reshape.set_view();
+    Elemwise gelu(device(), "gelu", OpIOs{reshape.outputs()[0]}, ElemMode::Gelu);
+    gelu.outputs()[0]->add_user();
+    for (OpBase* opr : std::vector<OpBase*>{&silu, &reshape, &gelu}) {
+        opr->deduce_output_shape();
+        opr->pre_execute();
+        opr->execute(nullptr, 0);
+        if (opr == &reshape) {
+            ASSERT_EQ(reshape.outputs()[0]->ptr(), silu.outputs()[0]->ptr());
+        }
+        opr->end_execute();
+    }
+    //! the memory of the silu is recalled after the users of the view
+    ASSERT_EQ(silu.outputs()[0]->get_curr_user_count(), 0);
+    ASSERT_EQ(reshape.outputs()[0]->shape()[0], 64u);
+
+    std::vector<float> expect(src.size());
+    auto naive = naive_device()->kernel();
+    naive->operator()<KernelID::ElemwiseFloat>(
+            InData<float>{src.data()}, expect.data(), expect.size(), ElemMode::Silu);
+    naive->operator()<KernelID::ElemwiseFloat>(
+            InData<float>{expect.data()}, expect.data(), expect.size(), ElemMode::Gelu);
+    const float* out = gelu.outputs()[0]->ptr<float>();
+    for (size_t i = 0; i < expect.size(); i++) {
+        ASSERT_NEAR(out[i], expect[i], 1e-5);
+    }
+    gelu.outputs()[0]->decrease_curr_user_count();
+}
+
+namespace {
+//! the graph of the modules added by the test
+class ModuleGraph : public Graph {
+public:
+    using Graph::Graph;
+    void construct_llm() override {}
+};
+}  // namespace
+
+//! the passes rewrite a norm and the q, k, v of it, with an op reading q in
+//! between, and the outputs are not changed
+TEST_F(CPU, TestGraphPassOutputs) {
+    std::mt19937 gen(0);
+    std::normal_distribution<float> dist(0.f, 1.f);
+    size_t seqlen = 3, embd = 64;
+    auto random = [&](size_t len) {
+        std::vector<float> data(len);
+        for (auto& value : data) {
+            value = dist(gen);
+        }
+        return data;
+    };
+    auto src = random(seqlen * embd);
+    std::vector<std::vector<float>> weights;
+    for (size_t i = 0; i < 4; i++) {
+        weights.push_back(random(i == 0 ? embd : embd * embd));
+    }
+
+    ModuleGraph graph(UserConfig(), device(), "passes");
+    auto input = std::make_shared<Tensor>(device(), "input");
+    input->set_shape({seqlen, embd}, DType::Float32);
+    input->set_shared_memory(src.data(), src.size() * sizeof(float));
+    auto module = std::make_shared<OprModuleBase>(input, device(), "layer");
+    auto normed = module->add_opr<LayerNorm>(device(), "norm", OpIOs{input}, embd)[0];
+    auto q = module->add_opr<MatMul>(
+            device(), "q", OpIOs{normed}, std::vector<size_t>{embd, embd})[0];
+    auto silu =
+            module->add_opr<Elemwise>(device(), "silu", OpIOs{q}, ElemMode::Silu)[0];
+    auto k = module->add_opr<MatMul>(
+            device(), "k", OpIOs{normed}, std::vector<size_t>{embd, embd})[0];
+    auto v = module->add_opr<MatMul>(
+            device(), "v", OpIOs{normed}, std::vector<size_t>{embd, embd})[0];
+    graph.m_modules.push_back(module);
+    size_t index = 0;
+    for (auto& opr : module->oprs()) {
+        for (auto& weight : opr->weights()) {
+            weight->set_dtype(DType::Float32);
+            weight->set_shared_memory(
+                    weights[index].data(), weights[index].size() * sizeof(float));
+            index++;
+        }
+    }
+    std::vector<std::shared_ptr<Tensor>> outputs = {silu, k, v};
+
+    std::vector<uint8_t> workspace_data;
+    WorkSpace workspace;
+    auto execute = [&]() {
+        for (auto& output : outputs) {
+            output->add_user();
+        }
+        input->resume_user_count();
+        for (auto& opr : module->oprs()) {
+            opr->deduce_output_shape();
+            workspace_data.resize(
+                    std::max(workspace_data.size(), opr->get_workspace_in_byte()));
+            workspace.set_memory(workspace_data.data(), workspace_data.size());
+            opr->pre_execute();
+            opr->execute(&workspace, 0);
+            opr->end_execute();
+        }
+        std::vector<std::vector<float>> result;
+        for (auto& output : outputs) {
+            const float* data = output->ptr<float>();
+            result.emplace_back(data, data + output->length());
+            output->decrease_curr_user_count();
+        }
+        return result;
+    };
+    auto check = [&](const std::vector<std::vector<float>>& expect) {
+        auto result = execute();
+        for (size_t i = 0; i < expect.size(); i++) {
+            for (size_t j = 0; j < expect[i].size(); j++) {
+                ASSERT_NEAR(result[i][j], expect[i][j], 1e-4) << outputs[i]->name();
+            }
+        }
+    };
+    auto expect = execute();
+
+    FoldNormWeightPass fold;
+    ASSERT_TRUE(fold.apply(&graph));
+    ASSERT_TRUE(module->oprs()[0]->weights().empty());
+    check(expect);
+
+    GroupSiblingPass group;
+    ASSERT_TRUE(group.apply(&graph));
+    std::vector<std::string> order;
+    for (auto& opr : module->oprs()) {
+        order.push_back(opr->name());
+    }
+    ASSERT_EQ(order, std::vector<std::string>({"norm", "q", "k", "v", "silu"}));
+    check(expect);
+}
+
+TEST_F(CPU, TestQuantizedCompanion) {
+    std::mt19937 gen(0);
+    std::normal_distribution<float> dist(0.f, 1.f);
+    uint32_t M = 2, K = 64;
+    std::vector<float> src(M * K);
+    for (auto& value : src) {
+        value = dist(gen);
+    }
+    auto input = std::make_shared<Tensor>(device(), "input");
+    input->set_shape({M, K}, DType::Float32);
+    input->set_shared_memory(src.data(), src.size() * sizeof(float));
+    auto quantized = input->quantized_companion();
+    ASSERT_EQ(quantized->dtype(), DType::Int8);
+    ASSERT_EQ(quantized->length(), input->length());
+    Elemwise reader0(device(), "reader0", OpIOs{input}, ElemMode::Silu);
+    Elemwise reader1(device(), "reader1", OpIOs{input}, ElemMode::Silu);
+    reader0.set_quantized_input(quantized);
+    reader1.set_quantized_input(quantized);
+
+    auto check = [&](const std::vector<float>& expect) {
+        auto blocks = static_cast<BlockQ80*>(quantized->ptr());
+        for (uint32_t i = 0; i < M * K; i++) {
+            auto& block = blocks[i / QK80];
+            ASSERT_NEAR(block.qs[i % QK80] * block.d, expect[i], block.d);
+        }
+    };
+    reader0.prepare_quantized_input();
+    ASSERT_TRUE(input->quantized_ready());
+    check(src);
+    //! the second reader reuses the blocks
+    auto old = src;
+    for (auto& value : src) {
+        value = -value;
+    }
+    reader1.prepare_quantized_input();
+    check(old);
+    //! the input is written again
+    input->set_quantized_ready(false);
+    reader1.prepare_quantized_input();
+    check(src);
+    reader0.end_execute();
+    reader1.end_execute();
+    ASSERT_EQ(quantized->get_curr_user_count(), 0);
+}
+
+TEST_F(CPU, TestTaskCost) {
+    ThreadPool pool(4);
+    uint32_t nr_threads = pool.nr_threads();
+    //! the cheap task runs on the caller only
+    ASSERT_EQ(pool.nr_participants(4096, 1), 1u);
+    ASSERT_EQ(pool.nr_participants(4096, 0), std::min(nr_threads, 4096u));
+    ASSERT_EQ(pool.nr_participants(2, 1 << 20), std::min(nr_threads, 2u));
+    ASSERT_EQ(
+            pool.nr_participants(4, ThreadPool::MIN_COST_PER_THREAD),
+            std::min(nr_threads, 4u));
+
+    //! every sub task runs once whatever the number of the threads
+    for (size_t cost : {size_t(0), size_t(1), size_t(100), size_t(1) << 20}) {
+        std::vector<int> counts(1000, 0);
+        int* p_counts = counts.data();
+        MultiThreadingTask task = [p_counts](const TaskId& id) {
+            for (uint32_t i = id.start; i < id.end; i++) {
+                p_counts[i]++;
+            }
+        };
+        pool.add_task(task, counts.size(), cost);
+        for (auto count : counts) {
+            ASSERT_EQ(count, 1);
+        }
+    }
+}
+
+TEST_F(CPU, TestNumaGroup) {
+    std::vector<uint32_t> cpus = parse_cpu_list("0-3,8,10-11\n");
+    ASSERT_EQ(cpus, (std::vector<uint32_t>{0, 1, 2, 3, 8, 10, 11}));
+
+    //! the sub tasks of a group are the ones the threads of the group run
+    for (uint32_t nr_threads : {2u, 5u, 8u}) {
+        for (uint32_t nr_groups : {1u, 2u}) {
+            for (uint32_t nr_task : {1u, 7u, 37u, 4096u}) {
+                uint32_t per = (nr_task + nr_threads - 1) / nr_threads;
+                ASSERT_EQ(
+                        ThreadPool::group_task_begin(0, nr_task, nr_threads, nr_groups),
+                        0u);
+                ASSERT_EQ(
+                        ThreadPool::group_task_begin(
+                                nr_groups, nr_task, nr_threads, nr_groups),
+                        nr_task);
+                for (uint32_t t = 0; t < nr_threads; t++) {
+                    uint32_t start = std::min(t * per, nr_task);
+                    uint32_t group = ThreadPool::thread_group(t, nr_threads, nr_groups);
+                    ASSERT_GE(
+                            start, ThreadPool::group_task_begin(
+                                           group, nr_task, nr_threads, nr_groups));
+                    ASSERT_LE(
+                            std::min(start + per, nr_task),
+                            ThreadPool::group_task_begin(
+                                    group + 1, nr_task, nr_threads, nr_groups));
+                }
+            }
+        }
+    }
+
+    //! the cost which needs fewer threads of one group runs on all the threads of
+    //! several groups, whose sub tasks are the ones checked above, or on one
+    size_t cost = ThreadPool::MIN_COST_PER_THREAD * 3 / 64;
+    ASSERT_EQ(ThreadPool::nr_participants(64, cost, 8, 1), 3u);
+    ASSERT_EQ(ThreadPool::nr_participants(64, cost, 8, 2), 8u);
+    ASSERT_EQ(ThreadPool::nr_participants(5, 0, 8, 2), 8u);
+    ASSERT_EQ(ThreadPool::nr_participants(64, 1, 8, 2), 1u);
+    ASSERT_EQ(ThreadPool::nr_participants(1, 0, 8, 2), 1u);
+}
+
+TEST_F(CPU, TestPipelineTransport) {
+    //! the layers are split to the stages without gap
+    uint32_t last_end = 0;
+    for (uint32_t stage = 0; stage < 3; stage++) {
+        uint32_t begin = 0, end = 0;
+        PipelineStage::layer_range(stage, 3, 32, begin, end);
+        ASSERT_EQ(begin, last_end);
+        ASSERT_GE(end - begin, 10u);
+        last_end = end;
+    }
+    ASSERT_EQ(last_end, 32u);
+
+    //! the bytes arrive in order whatever the size of the sends and the receives
+    std::vector<std::string> addresses = {"loopback:test"};
+#if defined(__linux__)
+    addresses.push_back("shm:test_" + std::to_string(getpid()));
+#endif
+    for (auto& address : addresses) {
+        auto recv = Transport::listen(address);
+        auto send = Transport::connect(address);
+        std::vector<int32_t> data(100000);
+        std::iota(data.begin(), data.end(), 0);
+        std::thread sender([&]() {
+            for (size_t start = 0; start < data.size(); start += 777) {
+                size_t len = std::min<size_t>(777, data.size() - start);
+                send->send(data.data() + start, len * sizeof(int32_t));
+            }
+        });
+        std::vector<int32_t> received(data.size());
+        for (size_t start = 0; start < data.size(); start += 1000) {
+            recv->recv(received.data() + start, 1000 * sizeof(int32_t));
+        }
+        sender.join();
+        ASSERT_EQ(received, data);
+    }
+}
+
+#if defined(__linux__)
+TEST_F(CPU, TestPipelineTransportPeerExit) {
+    //! the receiver fails instead of waiting forever after the sender exits
+    std::string address = "shm:test_exit_" + std::to_string(getpid());
+    EXPECT_DEATH(
+            {
+                auto recv = Transport::listen(address);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    Transport::connect(address);
+                    _exit(0);
+                }
+                waitpid(pid, nullptr, 0);
+                int32_t value;
+                recv->recv(&value, sizeof(value));
+            },
+            "exited");
+    //! the receiver aborts before it removes the shared memory
+    shm_unlink(("/inferllm_test_exit_" + std::to_string(getpid())).c_str());
+}
+#endif
+
+#if defined(__linux__)
+TEST_F(CPU, TestWeightSegment) {
+    //! the later process attaches the weights the first one publishes
+    std::string name = "test_" + std::to_string(getpid());
+    WeightSegment::remove(name);
+    std::vector<float> data(1000);
+    std::iota(data.begin(), data.end(), 0.f);
+    size_t length = data.size() * sizeof(float);
+    size_t size = WeightSegment::aligned(length) * 2;
+    auto creator = WeightSegment::create_or_attach(name, 2, size);
+    ASSERT_TRUE(creator->creator());
+    for (uint32_t id = 0; id < 2; id++) {
+        creator->entry(id).offset = id * WeightSegment::aligned(length);
+        creator->entry(id).length = length;
+        memcpy(creator->data(id), data.data(), length);
+    }
+    creator->publish();
+    auto attacher = WeightSegment::create_or_attach(name, 2, size);
+    ASSERT_FALSE(attacher->creator());
+    for (uint32_t id = 0; id < 2; id++) {
+        ASSERT_EQ(attacher->entry(id).length, length);
+        ASSERT_EQ(reinterpret_cast<size_t>(attacher->data(id)) % 64, 0u);
+        ASSERT_EQ(memcmp(attacher->data(id), data.data(), length), 0);
+    }
+    WeightSegment::remove(name);
+}
+#endif
+
+TEST_F(CPU, TestGgufReader) {
+    //! the header of a gguf file with the metadata and the infos of two tensors
+    std::string data;
+    auto put = [&data](const void* ptr, size_t len) {
+        data.append(static_cast<const char*>(ptr), len);
+    };
+    auto put_u32 = [&put](uint32_t value) { put(&value, sizeof(value)); };
+    auto put_u64 = [&put](uint64_t value) { put(&value, sizeof(value)); };
+    auto put_str = [&](const std::string& str) {
+        put_u64(str.size());
+        put(str.data(), str.size());
+    };
+    put_u32(GgufReader::MAGIC);
+    put_u32(3);
+    put_u64(2);
+    put_u64(3);
+    put_str("general.architecture");
+    put_u32(8);
+    put_str("llama");
+    put_str("llama.block_count");
+    put_u32(4);
+    put_u32(32);
+    put_str("tokenizer.ggml.scores");
+    put_u32(9);
+    put_u32(6);
+    put_u64(2);
+    float scores[2] = {-1.5f, 2.f};
+    put(scores, sizeof(scores));
+    put_str("token_embd.weight");
+    put_u32(2);
+    put_u64(64);
+    put_u64(10);
+    put_u32(2);
+    put_u64(0);
+    put_str("output_norm.weight");
+    put_u32(1);
+    put_u64(64);
+    put_u32(0);
+    put_u64(384);
+    size_t header = data.size();
+
+    std::string path = "/tmp/inferllm_test_" + std::to_string(getpid()) + ".gguf";
+    FILE* file = fopen(path.c_str(), "wb");
+    ASSERT_TRUE(file);
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+    auto fin = std::make_shared<InputFile>(path);
+    ASSERT_EQ(fin->read_u32(), GgufReader::MAGIC);
+    GgufReader reader(fin);
+    remove(path.c_str());
+
+    ASSERT_EQ(reader.get_string("general.architecture", ""), "llama");
+    ASSERT_EQ(reader.get_int("llama.block_count", 0), 32);
+    ASSERT_EQ(reader.get_int("llama.context_length", 4096), 4096);
+    ASSERT_EQ(
+            reader.get_floats("tokenizer.ggml.scores"),
+            (std::vector<float>{-1.5f, 2.f}));
+    auto& tensors = reader.tensors();
+    ASSERT_EQ(tensors.size(), 2u);
+    //! the data starts at the default alignment after the header
+    size_t start = (header + 31) / 32 * 32;
+    ASSERT_EQ(tensors[0].offset, start);
+    ASSERT_EQ(tensors[0].nr_number(), 640u);
+    ASSERT_EQ(tensors[1].offset, start + 384);
+
+    DType dtype;
+    FileLayout layout;
+    ASSERT_TRUE(GgufReader::convert_type(tensors[0].type, dtype, layout));
+    ASSERT_EQ(dtype, DType::Int4);
+    ASSERT_EQ(layout, FileLayout::GgmlBlock);
+    ASSERT_TRUE(GgufReader::convert_type(tensors[1].type, dtype, layout));
+    ASSERT_EQ(dtype, DType::Float32);
+    ASSERT_EQ(layout, FileLayout::Native);
+    //! the halfs are read as floats and the Q6_K of the output as Int8, the other
+    //! k quants have no dtype
+    ASSERT_TRUE(GgufReader::convert_type(1, dtype, layout));
+    ASSERT_EQ(dtype, DType::Float32);
+    ASSERT_EQ(layout, FileLayout::Half);
+    ASSERT_TRUE(GgufReader::convert_type(14, dtype, layout));
+    ASSERT_EQ(dtype, DType::Int8);
+    ASSERT_EQ(layout, FileLayout::GgmlQ6K);
+    ASSERT_FALSE(GgufReader::convert_type(12, dtype, layout));
+
+    //! the Q4_0 blocks of 18 bytes in the file are the blocks of 20 bytes
+    Tensor weight(device(), "weight");
+    weight.set_shape({10, 64}, DType::Int4);
+    weight.set_file(fin, tensors[0].offset, FileLayout::GgmlBlock);
+    ASSERT_EQ(weight.length_in_file(), 20u * 18);
+    ASSERT_EQ(weight.length_in_byte(), 20u * 20);
+    weight.set_shape({10, 64}, DType::Float32);
+    weight.set_file(fin, tensors[0].offset, FileLayout::Half);
+    ASSERT_EQ(weight.length_in_file(), 640u * 2);
+    //! the super block of 210 bytes is the 8 blocks of 36 bytes
+    weight.set_shape({2, 256}, DType::Int8);
+    weight.set_file(fin, tensors[0].offset, FileLayout::GgmlQ6K);
+    ASSERT_EQ(weight.length_in_file(), 2u * 210);
+    ASSERT_EQ(weight.length_in_byte(), 16u * 36);
+}
+
+TEST_F(CPU, TestGgufReaderBrokenCount) {
+    //! the huge counts of the values, the tensors, a string or an array fail
+    //! before they allocate
+    auto header = [](uint64_t nr_tensor, uint64_t nr_kv, uint64_t len, uint64_t nr) {
+        std::string data;
+        auto put = [&data](const void* ptr, size_t len) {
+            data.append(static_cast<const char*>(ptr), len);
+        };
+        auto put_u32 = [&put](uint32_t value) { put(&value, sizeof(value)); };
+        auto put_u64 = [&put](uint64_t value) { put(&value, sizeof(value)); };
+        put_u32(GgufReader::MAGIC);
+        put_u32(3);
+        put_u64(nr_tensor);
+        put_u64(nr_kv);
+        put_u64(len);
+        put("tokens", 6);
+        put_u32(9);
+        put_u32(8);
+        put_u64(nr);
+        return data;
+    };
+    std::string path = "/tmp/inferllm_test_" + std::to_string(getpid()) + ".gguf";
+    auto read = [&path](const std::string& data) {
+        FILE* file = fopen(path.c_str(), "wb");
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+        auto fin = std::make_shared<InputFile>(path);
+        fin->read_u32();
+        GgufReader reader(fin);
+    };
+    uint64_t huge = 1ull << 60;
+    EXPECT_DEATH(read(header(0, huge, 6, 0)), "exceeds the file");
+    EXPECT_DEATH(read(header(huge, 1, 6, 0)), "exceeds the file");
+    EXPECT_DEATH(read(header(0, 1, huge, 0)), "exceeds the file");
+    EXPECT_DEATH(read(header(0, 1, 6, huge)), "exceeds the file");
+    //! the counts fit the file
+    read(header(0, 1, 6, 0));
+    remove(path.c_str());
+}
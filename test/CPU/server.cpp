@@ -0,0 +1,72 @@
+#include "fixture.h"
+#include "model.h"
+#include "server.h"
+
+using namespace inferllm;
+using namespace test;
+
+TEST_F(CPU, TestServerParseHttpHead) {
+    HttpRequest request;
+    size_t length;
+    std::string error;
+    ASSERT_TRUE(parse_http_head(
+            "POST /v1/completions HTTP/1.1\r\nHost: x\r\nCONTENT-Length:  12 ", request,
+            length, error));
+    ASSERT_EQ(request.method, "POST");
+    ASSERT_EQ(request.path, "/v1/completions");
+    ASSERT_EQ(length, 12u);
+
+    ASSERT_TRUE(parse_http_head("GET /health HTTP/1.1", request, length, error));
+    ASSERT_EQ(request.path, "/health");
+    ASSERT_EQ(length, 0u);
+
+    for (auto head :
+         {"GET", "GET /health", "POST / HTTP/1.1\r\nContent-Length: -1",
+          "POST / HTTP/1.1\r\nContent-Length: 1x",
+          "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999"}) {
+        error.clear();
+        ASSERT_FALSE(parse_http_head(head, request, length, error)) << head;
+        ASSERT_FALSE(error.empty()) << head;
+    }
+}
+
+TEST_F(CPU, TestServerParseJson) {
+    JsonValue value;
+    ASSERT_TRUE(JsonParser(" {\"prompt\": \"a\\n\\u00e9\", \"max_tokens\": 8, "
+                           "\"stream\": true, \"stop\": [null, false]} ")
+                        .parse(value));
+    ASSERT_EQ(value.get("prompt")->str, "a\n\xc3\xa9");
+    ASSERT_EQ(value.get("max_tokens")->number, 8);
+    ASSERT_TRUE(value.get("stream")->boolean);
+    ASSERT_EQ(value.get("stop")->array.size(), 2u);
+    ASSERT_EQ(value.get("none"), nullptr);
+
+    for (auto text :
+         {"", "{", "{\"a\":}", "{\"a\":1,}", "[1 2]", "{} {}", "\"\\u12\""}) {
+        JsonValue invalid;
+        ASSERT_FALSE(JsonParser(text).parse(invalid)) << text;
+    }
+}
+
+//! every piece is one event of one line whatever characters it has
+TEST_F(CPU, TestServerSseEvent) {
+    for (std::string piece : {"a", "\n\n", "data: x\r\n\r\n", "\"\\\t\x01"}) {
+        auto event = sse_event("{\"text\":" + json_escape(piece) + "}");
+        ASSERT_EQ(event.compare(0, 6, "data: "), 0);
+        ASSERT_EQ(event.find('\n'), event.size() - 2);
+        ASSERT_EQ(event.find('\r'), std::string::npos);
+        JsonValue value;
+        ASSERT_TRUE(JsonParser(event.substr(6, event.size() - 8)).parse(value));
+        ASSERT_EQ(value.get("text")->str, piece);
+    }
+    ASSERT_EQ(sse_event("[DONE]"), "data: [DONE]\n\n");
+}
+
+TEST_F(CPU, TestTokenToText) {
+    ASSERT_EQ(token_to_text("<n>"), "\n");
+    ASSERT_EQ(token_to_text("<|tab|>"), "\t");
+    ASSERT_EQ(token_to_text("<|blank_3|>"), "   ");
+    ASSERT_EQ(token_to_text("▁the▁cat"), " the cat");
+    ASSERT_EQ(token_to_text("<0x0A>"), "\n");
+    ASSERT_EQ(token_to_text("cat"), "cat");
+}